@@ -0,0 +1,172 @@
+#include "bench.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Timing loop and statistics of the benchmark harness.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "errstack.h"
+
+static uint64_t _now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int _cmp_u64(const void *a, const void *b)
+{
+	const uint64_t ua = *(const uint64_t *) a, ub = *(const uint64_t *) b;
+	return (ua > ub) - (ua < ub);
+}
+
+/* One repetition, returns the time op took */
+static int _once(const bn_case_t *bench, uint64_t *ns)
+{
+	uint64_t start;
+	if (bench->setup) {
+		ES_FWD_INT(bench->setup(bench->arg), "Setup");
+	}
+	start = _now_ns();
+	ES_FWD_INT_NM(bench->op(bench->arg));
+	*ns = (_now_ns() - start) / MAX(bench->ops_per_call, (size_t) 1);
+	if (bench->teardown) {
+		ES_FWD_INT(bench->teardown(bench->arg), "Teardown");
+	}
+	return 0;
+}
+
+int bn_run(bn_result_t *dst, const bn_case_t *bench, const bn_opts_t *opts)
+{
+	uint64_t ns;
+	size_t i;
+	ES_NEW_ASRT_NM(dst && bench && bench->op && opts);
+	ES_NEW_ASRT(opts->reps > 0, "%s needs at least one repetition", bench->name);
+	memset(dst, 0, sizeof(*dst));
+	for (i = 0; i < opts->warmup; i++) {
+		ES_FWD_INT(_once(bench, &ns), "%s warmup %zu", bench->name, i);
+	}
+	ES_NEW_ASRT_NM(dst->samples = malloc(opts->reps * sizeof(*dst->samples)));
+	for (i = 0; i < opts->reps; i++) {
+		if (_once(bench, &dst->samples[i]) < 0) {
+			bn_result_cleanup(dst);
+			ES_FWD_INT(-1, "%s repetition %zu", bench->name, i);
+		}
+	}
+	qsort(dst->samples, opts->reps, sizeof(*dst->samples), _cmp_u64);
+	STRLCPY(dst->name, bench->name);
+	dst->bytes = bench->bytes;
+	dst->n     = opts->reps;
+	return 0;
+}
+
+void bn_result_cleanup(bn_result_t *result)
+{
+	free(result->samples);
+	memset(result, 0, sizeof(*result));
+}
+
+void bn_results_free(bn_result_t *results, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		bn_result_cleanup(&results[i]);
+	}
+	free(results);
+}
+
+uint64_t bn_percentile(const bn_result_t *result, double p)
+{
+	size_t rank = (size_t) ceil(p / 100.0 * result->n);
+	return result->samples[MIN(MAX(rank, (size_t) 1), result->n) - 1];
+}
+
+double bn_mean(const bn_result_t *result)
+{
+	double sum = 0;
+	size_t i;
+	for (i = 0; i < result->n; i++) {
+		sum += result->samples[i];
+	}
+	return sum / result->n;
+}
+
+double bn_mbps(const bn_result_t *result, double ns)
+{
+	/* bytes per ns is 10^3 MB/s */
+	return result->bytes && ns > 0 ? result->bytes / ns * 1e3 : 0;
+}
+
+double bn_mann_whitney(const bn_result_t *a, const bn_result_t *b)
+{
+	const double na = a->n, nb = b->n, n = na + nb;
+	double rank_sum_b = 0, ties = 0, u, mean, var;
+	size_t i = 0, j = 0;
+	/* Both are sorted, so the ranks come from merging them. Equal values share their mean rank */
+	while (i < a->n || j < b->n) {
+		const bool from_a    = j == b->n || (i < a->n && a->samples[i] < b->samples[j]);
+		const uint64_t value = from_a ? a->samples[i] : b->samples[j];
+		const size_t rank    = i + j + 1;
+		size_t in_a = 0, in_b = 0;
+		double t;
+		while (i < a->n && a->samples[i] == value) {
+			i++;
+			in_a++;
+		}
+		while (j < b->n && b->samples[j] == value) {
+			j++;
+			in_b++;
+		}
+		t = in_a + in_b;
+		rank_sum_b += in_b * (rank + (t - 1) / 2);
+		ties += t * t * t - t;
+	}
+	u    = rank_sum_b - nb * (nb + 1) / 2;
+	mean = na * nb / 2;
+	var  = na * nb / 12 * ((n + 1) - ties / (n * (n - 1)));
+	if (var <= 0) {
+		return 1;
+	}
+	/* Continuity correction towards the mean */
+	return 0.5 * erfc((u - mean - 0.5) / sqrt(var) / sqrt(2));
+}
+
+void bn_print_header(FILE *f)
+{
+	fprintf(f,
+	        "%-32s %10s %10s %10s %10s %10s %10s %10s\n",
+	        "case",
+	        "min ns",
+	        "p50 ns",
+	        "p90 ns",
+	        "p99 ns",
+	        "max ns",
+	        "mean ns",
+	        "p50 MB/s");
+}
+
+void bn_print(const bn_result_t *result, FILE *f)
+{
+	const uint64_t p50 = bn_percentile(result, 50);
+	fprintf(f,
+	        "%-32s %10llu %10llu %10llu %10llu %10llu %10.0f",
+	        result->name,
+	        (unsigned long long) result->samples[0],
+	        (unsigned long long) p50,
+	        (unsigned long long) bn_percentile(result, 90),
+	        (unsigned long long) bn_percentile(result, 99),
+	        (unsigned long long) result->samples[result->n - 1],
+	        bn_mean(result));
+	if (result->bytes) {
+		fprintf(f, " %10.2f", bn_mbps(result, p50));
+	}
+	fputc('\n', f);
+}
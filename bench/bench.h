@@ -0,0 +1,117 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Minimal benchmark harness. A case is an operation timed with CLOCK_MONOTONIC, optionally
+ * surrounded by untimed setup and teardown (e.g. to refill or drain the device FIFOs). Every case
+ * runs its warmup repetitions first, then keeps one sample per timed repetition so that
+ * percentiles, not just a mean, are reported.
+ *
+ * Results are written as JSON or CSV along with the build and host they were measured on, and two
+ * result files are compared case by case with a Mann-Whitney U test (see compare.c).
+ *
+ * How to:
+ * 1. Describe each measurement with a bn_case_t
+ * 2. bn_run it into a bn_result_t
+ * 3. bn_print the result, or collect them and bn_write_json/bn_write_csv with a bn_config_host
+ * 4. bn_result_cleanup
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "util.h"
+
+typedef struct bn_case_s
+{
+	const char *name;
+	/* Bytes moved by one op, for MB/s. 0 to only report ns/op */
+	size_t bytes;
+	/* Ops done by one call of op, the samples are per op. 0 is treated as 1 */
+	size_t ops_per_call;
+	/* Untimed, before every op. May be NULL */
+	int (*setup)(void *arg);
+	int (*op)(void *arg);
+	/* Untimed, after every op. May be NULL */
+	int (*teardown)(void *arg);
+	void *arg;
+} bn_case_t;
+
+typedef struct bn_opts_s
+{
+	size_t warmup;
+	size_t reps;
+} bn_opts_t;
+
+typedef struct bn_result_s
+{
+	char name[64];
+	size_t bytes;
+	/* ns per op, ascending, owned */
+	uint64_t *samples;
+	size_t n;
+} bn_result_t;
+
+int bn_run(bn_result_t *dst, const bn_case_t *bench, const bn_opts_t *opts);
+void bn_result_cleanup(bn_result_t *result);
+/* Cleans up and frees an array of n results */
+void bn_results_free(bn_result_t *results, size_t n);
+
+#define BN_RESULT_CLEANUP CLEANUP(bn_result_cleanup)
+
+/**
+ * @brief Nearest-rank percentile of the samples.
+ *
+ * @param p In [0, 100]
+ */
+uint64_t bn_percentile(const bn_result_t *result, double p);
+double bn_mean(const bn_result_t *result);
+/* MB/s (10^6 bytes per second) of an op taking ns, 0 for cases without bytes */
+double bn_mbps(const bn_result_t *result, double ns);
+
+/**
+ * @brief One-sided Mann-Whitney U test, normal approximation with tie correction.
+ *
+ * @returns The p-value of the samples of b not tending to be larger than those of a, small when b
+ * is slower
+ */
+double bn_mann_whitney(const bn_result_t *a, const bn_result_t *b);
+
+void bn_print_header(FILE *f);
+/* One line: ns/op at min, p50, p90, p99 and max, the mean, and MB/s at the median */
+void bn_print(const bn_result_t *result, FILE *f);
+
+/* What the results were measured with. -1 or "" where unknown */
+typedef struct bn_config_s
+{
+	/* The makefile's settings */
+	int release;
+	int debug;
+	int error_stack_disable;
+	int error_stack_buffer_backed;
+	int neon;
+	int trace;
+	char compiler[128];
+	char cpu[128];
+	char machine[32];
+	int cpus;
+	/* Name of the device ops the device cases ran against, "emu" or "hw" */
+	char device[32];
+	int warmup;
+	int reps;
+} bn_config_t;
+
+void bn_config_host(bn_config_t *config, const char *device, const bn_opts_t *opts);
+/* Prints the settings that differ between a and b, returns how many do */
+size_t bn_config_diff(const bn_config_t *a, const bn_config_t *b, FILE *f);
+
+/* The configuration, then per case the statistics of bn_print and every sample */
+int bn_write_json(FILE *f, const bn_config_t *config, const bn_result_t *results, size_t n);
+/* The configuration as "# key=value" lines, then one "case,bytes,ns" row per sample */
+int bn_write_csv(FILE *f, const bn_config_t *config, const bn_result_t *results, size_t n);
+/* Reads a file of bn_write_csv, free the results with bn_results_free */
+int bn_read_csv(const char *path, bn_config_t *config, bn_result_t **results, size_t *n);
@@ -0,0 +1,279 @@
+#include "bench_ds.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Data structure cases. Building the structure for a lookup case and freeing it are untimed. The
+ * hashtable cases run against both the chained ht and the flat fht with the same keys.
+ *
+ * avl has no cases: avl_add dereferences NULL on its first rotation, so it cannot be timed yet.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "data-structures/flat_hashtable.h"
+#include "data-structures/hashtable.h"
+#include "data-structures/vec.h"
+#include "errstack.h"
+#include "util.h"
+
+typedef struct _ds_s
+{
+	/* A permutation of 1 to BN_DS_KEYS, 0 is not a valid key of the int hashtable */
+	uint32_t keys[BN_DS_KEYS];
+	/* The same keys printed in decimal */
+	char str_keys[BN_DS_KEYS][12];
+	ht_st *ht;
+	fht_int_st *fht;
+	fht_str_st *fht_str;
+	vec_t *vec;
+	/* Keeps the lookups from being optimized out */
+	volatile uintptr_t sink;
+} _ds_t;
+
+static _ds_t _ds;
+
+/* Same keys on every run so that results of two builds are comparable */
+static void _keys(_ds_t *ds)
+{
+	uint32_t seed = 18;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ds->keys[i] = i + 1;
+	}
+	for (i = BN_DS_KEYS - 1; i > 0; i--) {
+		uint32_t tmp;
+		size_t j;
+		seed        = seed * 1664525 + 1013904223;
+		j           = seed % (i + 1);
+		tmp         = ds->keys[i];
+		ds->keys[i] = ds->keys[j];
+		ds->keys[j] = tmp;
+	}
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		snprintf(ds->str_keys[i], sizeof(ds->str_keys[i]), "%u", ds->keys[i]);
+	}
+}
+
+static int _ht_setup(void *arg)
+{
+	_ds_t *ds = arg;
+	_keys(ds);
+	ES_FWD_INT_NM(ht_int_alloc(&ds->ht, 0, NULL, NULL));
+	return 0;
+}
+
+static int _ht_set(void *arg)
+{
+	_ds_t *ds = arg;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ES_FWD_INT_NM(ht_int_set(ds->ht, ds->keys[i], i));
+	}
+	return 0;
+}
+
+static int _ht_filled(void *arg)
+{
+	ES_FWD_INT_NM(_ht_setup(arg));
+	ES_FWD_INT_NM(_ht_set(arg));
+	return 0;
+}
+
+static int _ht_get(void *arg)
+{
+	_ds_t *ds = arg;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ds->sink = (uintptr_t) ht_int_get(ds->ht, ds->keys[BN_DS_KEYS - 1 - i]);
+	}
+	return 0;
+}
+
+static int _ht_teardown(void *arg)
+{
+	ht_free(&((_ds_t *) arg)->ht);
+	return 0;
+}
+
+static int _ht_str_setup(void *arg)
+{
+	_ds_t *ds = arg;
+	_keys(ds);
+	ES_FWD_INT_NM(ht_str_alloc(&ds->ht, 0, NULL, NULL));
+	return 0;
+}
+
+static int _ht_str_set(void *arg)
+{
+	_ds_t *ds = arg;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ES_FWD_INT_NM(ht_str_set(ds->ht, ds->str_keys[i], i));
+	}
+	return 0;
+}
+
+static int _ht_str_filled(void *arg)
+{
+	ES_FWD_INT_NM(_ht_str_setup(arg));
+	ES_FWD_INT_NM(_ht_str_set(arg));
+	return 0;
+}
+
+static int _ht_str_get(void *arg)
+{
+	_ds_t *ds = arg;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ds->sink = (uintptr_t) ht_str_get(ds->ht, ds->str_keys[BN_DS_KEYS - 1 - i]);
+	}
+	return 0;
+}
+
+static int _fht_setup(void *arg)
+{
+	_ds_t *ds = arg;
+	_keys(ds);
+	ES_FWD_INT_NM(fht_int_alloc(&ds->fht, 0, NULL, NULL));
+	return 0;
+}
+
+static int _fht_set(void *arg)
+{
+	_ds_t *ds = arg;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ES_FWD_INT_NM(fht_int_set(ds->fht, ds->keys[i], (void *) i));
+	}
+	return 0;
+}
+
+static int _fht_filled(void *arg)
+{
+	ES_FWD_INT_NM(_fht_setup(arg));
+	ES_FWD_INT_NM(_fht_set(arg));
+	return 0;
+}
+
+static int _fht_get(void *arg)
+{
+	_ds_t *ds = arg;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ds->sink = (uintptr_t) fht_int_get(ds->fht, ds->keys[BN_DS_KEYS - 1 - i]);
+	}
+	return 0;
+}
+
+static int _fht_teardown(void *arg)
+{
+	fht_int_free(&((_ds_t *) arg)->fht);
+	return 0;
+}
+
+static int _fht_str_setup(void *arg)
+{
+	_ds_t *ds = arg;
+	_keys(ds);
+	ES_FWD_INT_NM(fht_str_alloc(&ds->fht_str, 0, NULL, NULL));
+	return 0;
+}
+
+static int _fht_str_set(void *arg)
+{
+	_ds_t *ds = arg;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ES_FWD_INT_NM(fht_str_set(ds->fht_str, ds->str_keys[i], (void *) i));
+	}
+	return 0;
+}
+
+static int _fht_str_filled(void *arg)
+{
+	ES_FWD_INT_NM(_fht_str_setup(arg));
+	ES_FWD_INT_NM(_fht_str_set(arg));
+	return 0;
+}
+
+static int _fht_str_get(void *arg)
+{
+	_ds_t *ds = arg;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ds->sink = (uintptr_t) fht_str_get(ds->fht_str, ds->str_keys[BN_DS_KEYS - 1 - i]);
+	}
+	return 0;
+}
+
+static int _fht_str_teardown(void *arg)
+{
+	fht_str_free(&((_ds_t *) arg)->fht_str);
+	return 0;
+}
+
+static int _vec_setup(void *arg)
+{
+	_ds_t *ds = arg;
+	_keys(ds);
+	ES_FWD_INT_NM(vec_alloc(&ds->vec, sizeof(uint32_t)));
+	return 0;
+}
+
+static int _vec_push_back(void *arg)
+{
+	_ds_t *ds = arg;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ES_FWD_INT_NM(vec_push_back(ds->vec, &ds->keys[i]));
+	}
+	return 0;
+}
+
+static int _vec_filled(void *arg)
+{
+	ES_FWD_INT_NM(_vec_setup(arg));
+	ES_FWD_INT_NM(_vec_push_back(arg));
+	return 0;
+}
+
+/* Random access, the keys are the indices shifted by one */
+static int _vec_at(void *arg)
+{
+	_ds_t *ds = arg;
+	size_t i;
+	for (i = 0; i < BN_DS_KEYS; i++) {
+		ds->sink = *(uint32_t *) vec_at(ds->vec, ds->keys[i] - 1);
+	}
+	return 0;
+}
+
+static int _vec_teardown(void *arg)
+{
+	vec_cleanup(&((_ds_t *) arg)->vec);
+	return 0;
+}
+
+static const bn_case_t _cases[] = {
+    {"ht_int_set/1024", 0, BN_DS_KEYS, _ht_setup, _ht_set, _ht_teardown, &_ds},
+    {"ht_int_get/1024", 0, BN_DS_KEYS, _ht_filled, _ht_get, _ht_teardown, &_ds},
+    {"ht_str_set/1024", 0, BN_DS_KEYS, _ht_str_setup, _ht_str_set, _ht_teardown, &_ds},
+    {"ht_str_get/1024", 0, BN_DS_KEYS, _ht_str_filled, _ht_str_get, _ht_teardown, &_ds},
+    {"fht_int_set/1024", 0, BN_DS_KEYS, _fht_setup, _fht_set, _fht_teardown, &_ds},
+    {"fht_int_get/1024", 0, BN_DS_KEYS, _fht_filled, _fht_get, _fht_teardown, &_ds},
+    {"fht_str_set/1024", 0, BN_DS_KEYS, _fht_str_setup, _fht_str_set, _fht_str_teardown, &_ds},
+    {"fht_str_get/1024", 0, BN_DS_KEYS, _fht_str_filled, _fht_str_get, _fht_str_teardown, &_ds},
+    {"vec_push_back/1024", 0, BN_DS_KEYS, _vec_setup, _vec_push_back, _vec_teardown, &_ds},
+    {"vec_at/1024", 0, BN_DS_KEYS, _vec_filled, _vec_at, _vec_teardown, &_ds},
+};
+
+const bn_case_t *bn_ds_cases(size_t *n)
+{
+	*n = ARRAY_SIZE(_cases);
+	return _cases;
+}
@@ -0,0 +1,19 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Benchmark cases of the host data structures hashtable, flat_hashtable and vec. Each case inserts
+ * or looks up BN_DS_KEYS keys in shuffled order and reports ns per key.
+ */
+
+#include <stddef.h>
+
+#include "bench.h"
+
+#define BN_DS_KEYS (1024)
+
+/* The cases, static and independent of any device */
+const bn_case_t *bn_ds_cases(size_t *n);
@@ -0,0 +1,156 @@
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Compares two CSV result files of bench case by case. A case is slower when a one-sided
+ * Mann-Whitney U test over all samples is significant at alpha and its median also grew by more
+ * than the threshold, so neither noise between runs nor a significant but negligible shift fails
+ * the comparison. Settings that differ between the two runs are printed first, since a different
+ * compiler or device explains a difference better than the change under test.
+ *
+ * Usage: bench_compare [-a alpha] [-t threshold] [-m] base.csv new.csv
+ *    -a significance level, 0.01 by default
+ *    -t relative change of the median that matters, 0.05 by default
+ *    -m allow cases of base.csv to be missing from new.csv, e.g. when bench ran with -f
+ *
+ * Exits with 1 when a case got slower or is missing from new.csv, -1 on errors, 0 otherwise. A
+ * case that was deleted or crashed bench is a failure just like a slower one.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "errstack.h"
+#include "util.h"
+
+typedef struct _run_s
+{
+	bn_config_t config;
+	bn_result_t *results;
+	size_t n;
+} _run_t;
+
+static void _cleanup_run(_run_t *run)
+{
+	bn_results_free(run->results, run->n);
+}
+
+static const bn_result_t *_find(const _run_t *run, const char *name)
+{
+	size_t i;
+	for (i = 0; i < run->n; i++) {
+		if (strcmp(run->results[i].name, name) == 0) {
+			return &run->results[i];
+		}
+	}
+	return NULL;
+}
+
+/* Prints one case, returns whether it got slower */
+static bool _compare(const bn_result_t *base,
+                     const bn_result_t *cur,
+                     double alpha,
+                     double threshold)
+{
+	const double base_p50 = bn_percentile(base, 50), cur_p50 = bn_percentile(cur, 50);
+	const double change   = base_p50 > 0 ? cur_p50 / base_p50 - 1 : 0;
+	const double p_slower = bn_mann_whitney(base, cur);
+	const double p_faster = bn_mann_whitney(cur, base);
+	const bool slower     = p_slower < alpha && change > threshold;
+	const bool faster     = p_faster < alpha && change < -threshold;
+	printf("%-32s %12.0f %12.0f %+9.1f%% %10.2g  %s\n",
+	       cur->name,
+	       base_p50,
+	       cur_p50,
+	       change * 100,
+	       slower ? p_slower : p_faster,
+	       slower ? "SLOWER" : (faster ? "faster" : "-"));
+	return slower;
+}
+
+static int _compare_files(const char *base_path,
+                          const char *cur_path,
+                          double alpha,
+                          double threshold,
+                          size_t *n_slower,
+                          size_t *n_missing)
+{
+	CLEANUP(_cleanup_run) _run_t base = {0};
+	CLEANUP(_cleanup_run) _run_t cur  = {0};
+	size_t i;
+	ES_FWD_INT_NM(bn_read_csv(base_path, &base.config, &base.results, &base.n));
+	ES_FWD_INT_NM(bn_read_csv(cur_path, &cur.config, &cur.results, &cur.n));
+	if (bn_config_diff(&base.config, &cur.config, stdout)) {
+		printf("\n");
+	}
+	printf("%-32s %12s %12s %10s %10s  %s\n", "case", "base p50 ns", "p50 ns", "change", "p", "");
+	*n_slower  = 0;
+	*n_missing = 0;
+	for (i = 0; i < cur.n; i++) {
+		const bn_result_t *old = _find(&base, cur.results[i].name);
+		if (!old) {
+			printf("%-32s %12s\n", cur.results[i].name, "new");
+			continue;
+		}
+		*n_slower += _compare(old, &cur.results[i], alpha, threshold);
+	}
+	for (i = 0; i < base.n; i++) {
+		if (!_find(&cur, base.results[i].name)) {
+			printf("%-32s %12s\n", base.results[i].name, "missing");
+			(*n_missing)++;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	double alpha = 0.01, threshold = 0.05;
+	bool allow_missing = false;
+	size_t n_slower, n_missing;
+	int opt;
+	while ((opt = getopt(argc, argv, "a:t:m")) != -1) {
+		switch (opt) {
+		case 'a':
+			alpha = strtod(optarg, NULL);
+			break;
+		case 't':
+			threshold = strtod(optarg, NULL);
+			break;
+		case 'm':
+			allow_missing = true;
+			break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (optind != argc - 2) {
+		fprintf(
+		    stderr, "Usage: %s [-a alpha] [-t threshold] [-m] base.csv new.csv\n", argv[0]);
+		return -1;
+	}
+	if (_compare_files(
+	        argv[optind], argv[optind + 1], alpha, threshold, &n_slower, &n_missing) < 0) {
+		printf("Comparison failed: [ ");
+		ES_PRINT();
+		printf("\n ]\n");
+		return -1;
+	}
+	if (allow_missing) {
+		n_missing = 0;
+	}
+	if (n_slower) {
+		printf("\n%zu case%s slower\n", n_slower, n_slower == 1 ? "" : "s");
+	}
+	if (n_missing) {
+		printf("\n%zu case%s missing\n", n_missing, n_missing == 1 ? "" : "s");
+	}
+	return n_slower || n_missing ? 1 : 0;
+}
@@ -0,0 +1,409 @@
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Interface benchmarks of the systolic array: read and write DMA throughput, single tile latency,
+ * instruction FIFO push rate and the cost of cache maintenance on device memory. Runs against the
+ * FPGA through udmabuf0, or against the emulator with SYSTOLIC_EMU set (only useful to check the
+ * host side and the benchmark itself, the emulator's timing is not the board's).
+ *
+ * Completion is detected by spinning on the status registers, not through the device's waiter, so
+ * that the numbers are the interface's and not the wait policy's.
+ *
+ * The data structure cases of bench_ds.h run after the device ones. Without a board the device
+ * cases fall back to the emulator, the device field of the results tells which one ran.
+ *
+ * Usage: bench [-w warmup] [-r repetitions] [-f filter] [-j json] [-c csv]
+ *    -f only runs the cases whose name contains filter
+ *    -j and -c also write the results with the build configuration to a JSON or CSV file
+ */
+
+#include <getopt.h>
+#include <hps.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_ds.h"
+#include "device.h"
+#include "dma_arena.h"
+#include "errstack.h"
+#include "systolic.h"
+#include "util.h"
+
+/* Bytes of device memory when running against the emulator */
+#define EMU_MEM_SIZE (1 << 20)
+/* Tiles whose operands fit into one read descriptor per channel */
+#define MAX_TILES (MSGDMA_READ_CSR_MAX_BYTE / sizeof(matrix_t))
+/* Largest range synced by the cache maintenance cases */
+#define MAX_SYNC (256 * 1024)
+/* msgdma status register */
+#define MSGDMA_STATUS_BUSY (1u << 0)
+
+typedef struct _ctx_s
+{
+	dev_st *dev;
+	da_span_t left;
+	da_span_t right;
+	/* MAX_TILES results */
+	da_span_t dst;
+	da_span_t sync;
+	/* Per case: bytes per read channel or synced, tiles per op */
+	uint32_t n_bytes;
+	size_t n_tiles;
+} _ctx_t;
+
+/* One case and the parameters it runs with */
+typedef struct _entry_s
+{
+	char name[64];
+	bn_case_t bench;
+	_ctx_t ctx;
+} _entry_t;
+
+static bool _reads_done(dev_st *dev)
+{
+	return !(dev_read_reg(dev, DEV_REG_RD_STATUS) & MSGDMA_STATUS_BUSY) &&
+	       (dev_read_reg(dev, DEV_REG_RD_FILL) & 0xFFFF) == 0;
+}
+
+static int _spin_reads(dev_st *dev)
+{
+	while (!_reads_done(dev)) {
+	}
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_SYS_STATE) == 0, "Device error state");
+	return 0;
+}
+
+static int _spin_writes(dev_st *dev)
+{
+	while (dev_writes_outstanding(dev)) {
+	}
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_SYS_STATE) == 0, "Device error state");
+	return 0;
+}
+
+static void _send_operands(_ctx_t *ctx, size_t n_tiles)
+{
+	dev_send_read(ctx->dev, ctx->left.phys, n_tiles * sizeof(matrix_t), DEV_CHANNEL_LEFT);
+	dev_send_read(ctx->dev, ctx->right.phys, n_tiles * sizeof(matrix_t), DEV_CHANNEL_RIGHT);
+}
+
+static void _send_results(_ctx_t *ctx, size_t n_tiles)
+{
+	size_t i;
+	for (i = 0; i < n_tiles; i++) {
+		dev_send_write(ctx->dev, ctx->dst.phys + i * sizeof(matrix_t));
+	}
+	for (i = 0; i < n_tiles; i++) {
+		dev_send_instr(ctx->dev, SA_INSTR(SA_DIM, SA_DIM));
+	}
+}
+
+/* Read DMA: both channels stream n_bytes into the array's input FIFOs, which hold them all */
+static int _read_op(void *arg)
+{
+	_ctx_t *ctx = arg;
+	_send_operands(ctx, ctx->n_tiles);
+	ES_FWD_INT_NM(_spin_reads(ctx->dev));
+	return 0;
+}
+
+/* Let the array consume what a read case left in the FIFOs */
+static int _drain(void *arg)
+{
+	_ctx_t *ctx = arg;
+	_send_results(ctx, ctx->n_tiles);
+	ES_FWD_INT_NM(_spin_writes(ctx->dev));
+	return 0;
+}
+
+/* Write DMA: the operands are already buffered, so the results are the only traffic */
+static int _write_setup(void *arg)
+{
+	_ctx_t *ctx = arg;
+	_send_operands(ctx, ctx->n_tiles);
+	ES_FWD_INT_NM(_spin_reads(ctx->dev));
+	return 0;
+}
+
+static int _write_op(void *arg)
+{
+	_ctx_t *ctx = arg;
+	_send_results(ctx, ctx->n_tiles);
+	ES_FWD_INT_NM(_spin_writes(ctx->dev));
+	return 0;
+}
+
+/* One matrix_mult16 call, from the first descriptor to the result being written */
+static int _mult16_op(void *arg)
+{
+	_ctx_t *ctx = arg;
+	ES_FWD_INT_NM(matrix_mult16(ctx->dev, ctx->dst.phys, ctx->left.phys, ctx->right.phys));
+	return 0;
+}
+
+/* n_tiles instructions into an empty FIFO without checking the fill level */
+static int _push_op(void *arg)
+{
+	_ctx_t *ctx = arg;
+	size_t i;
+	for (i = 0; i < ctx->n_tiles; i++) {
+		dev_send_instr(ctx->dev, SA_INSTR(SA_DIM, SA_DIM));
+	}
+	return 0;
+}
+
+/* The same with the fill level read before every push */
+static int _try_push_op(void *arg)
+{
+	_ctx_t *ctx = arg;
+	size_t i;
+	for (i = 0; i < ctx->n_tiles; i++) {
+		ES_NEW_ASRT(dev_try_send_instr(ctx->dev, SA_INSTR(SA_DIM, SA_DIM)) == 1,
+		            "Instruction FIFO full");
+	}
+	return 0;
+}
+
+/* Give the pushed instructions their operands and results so the FIFO is empty again */
+static int _push_drain(void *arg)
+{
+	_ctx_t *ctx = arg;
+	size_t i;
+	_send_operands(ctx, ctx->n_tiles);
+	for (i = 0; i < ctx->n_tiles; i++) {
+		dev_send_write(ctx->dev, ctx->dst.phys + i * sizeof(matrix_t));
+	}
+	ES_FWD_INT_NM(_spin_writes(ctx->dev));
+	return 0;
+}
+
+static int _sync_device_op(void *arg)
+{
+	_ctx_t *ctx = arg;
+	ES_FWD_INT_NM(dev_sync_for_device(ctx->dev, ctx->sync.offset, ctx->n_bytes));
+	return 0;
+}
+
+static int _sync_cpu_op(void *arg)
+{
+	_ctx_t *ctx = arg;
+	ES_FWD_INT_NM(dev_sync_for_cpu(ctx->dev, ctx->sync.offset, ctx->n_bytes));
+	return 0;
+}
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+static int _add(_entry_t **entries,
+                size_t *n,
+                const _ctx_t *ctx,
+                const bn_case_t *bench,
+                const char *name)
+{
+	_entry_t *tmp;
+	ES_NEW_ASRT_NM(tmp = realloc(*entries, (*n + 1) * sizeof(**entries)));
+	*entries = tmp;
+	tmp      = &(*entries)[(*n)++];
+	STRLCPY(tmp->name, name);
+	tmp->bench = *bench;
+	tmp->ctx   = *ctx;
+	return 0;
+}
+
+/* Every case with its own copy of the context. bench.name and .arg are set later, realloc moves
+ * the cases */
+static int _cases(_entry_t **entries, size_t *n, const _ctx_t *base)
+{
+	char name[64];
+	_ctx_t ctx = *base;
+	size_t tiles;
+	uint32_t size;
+	for (tiles = 1; tiles <= MAX_TILES; tiles *= 2) {
+		const bn_case_t read = {
+		    .bytes    = 2 * tiles * sizeof(matrix_t),
+		    .op       = _read_op,
+		    .teardown = _drain,
+		};
+		ctx.n_tiles = tiles;
+		snprintf(name, sizeof(name), "read_dma/%zu", tiles * sizeof(matrix_t));
+		ES_FWD_INT_NM(_add(entries, n, &ctx, &read, name));
+	}
+	for (tiles = 1; tiles <= MAX_TILES; tiles *= 2) {
+		const bn_case_t write = {
+		    .bytes = tiles * sizeof(matrix_t),
+		    .setup = _write_setup,
+		    .op    = _write_op,
+		};
+		ctx.n_tiles = tiles;
+		snprintf(name, sizeof(name), "write_dma/%zu", write.bytes);
+		ES_FWD_INT_NM(_add(entries, n, &ctx, &write, name));
+	}
+	{
+		const bn_case_t mult16 = {.op = _mult16_op};
+		const bn_case_t push = {
+		    .ops_per_call = MAX_TILES,
+		    .op           = _push_op,
+		    .teardown     = _push_drain,
+		};
+		const bn_case_t try_push = {
+		    .ops_per_call = MAX_TILES,
+		    .op           = _try_push_op,
+		    .teardown     = _push_drain,
+		};
+		ctx.n_tiles = MAX_TILES;
+		ES_FWD_INT_NM(_add(entries, n, &ctx, &mult16, "matrix_mult16"));
+		ES_FWD_INT_NM(_add(entries, n, &ctx, &push, "instr_push"));
+		ES_FWD_INT_NM(_add(entries, n, &ctx, &try_push, "instr_try_push"));
+	}
+	for (size = 4096; size <= ctx.sync.size; size *= 4) {
+		const bn_case_t to_device = {.bytes = size, .op = _sync_device_op};
+		const bn_case_t to_cpu    = {.bytes = size, .op = _sync_cpu_op};
+		ctx.n_bytes               = size;
+		snprintf(name, sizeof(name), "sync_for_device/%u", size);
+		ES_FWD_INT_NM(_add(entries, n, &ctx, &to_device, name));
+		snprintf(name, sizeof(name), "sync_for_cpu/%u", size);
+		ES_FWD_INT_NM(_add(entries, n, &ctx, &to_cpu, name));
+	}
+	return 0;
+}
+
+/* Results of the cases that ran */
+typedef struct _results_s
+{
+	bn_result_t *results;
+	size_t n;
+} _results_t;
+
+static void _cleanup_results(_results_t *results)
+{
+	bn_results_free(results->results, results->n);
+}
+
+/* Runs bench unless filtered out, prints and keeps its result */
+static int _run(_results_t *dst, const bn_case_t *bench, const bn_opts_t *opts, const char *filter)
+{
+	bn_result_t *tmp;
+	if (filter && !strstr(bench->name, filter)) {
+		return 0;
+	}
+	ES_NEW_ASRT_NM(tmp = realloc(dst->results, (dst->n + 1) * sizeof(*tmp)));
+	dst->results = tmp;
+	ES_FWD_INT_NM(bn_run(&tmp[dst->n], bench, opts));
+	bn_print(&tmp[dst->n++], stdout);
+	return 0;
+}
+
+/* The FPGA, or the emulator when asked for with SYSTOLIC_EMU or when there is no board */
+static int _open(dev_st **dev)
+{
+	if (!getenv("SYSTOLIC_EMU")) {
+		if (dev_hw_open(dev, 0) >= 0) {
+			return 0;
+		}
+		fprintf(stderr, "No FPGA with udmabuf0, the device cases run on the emulator\n");
+	}
+	ES_FWD_INT(dev_emu_open(dev, EMU_MEM_SIZE, 0), "Failed to open emulator");
+	return 0;
+}
+
+static int _write(const char *path,
+                  int (*write)(FILE *, const bn_config_t *, const bn_result_t *, size_t),
+                  const bn_config_t *config,
+                  const _results_t *results)
+{
+	CLEAN_FILE FILE *f = NULL;
+	if (!path) {
+		return 0;
+	}
+	ES_NEW_ASRT(f = fopen(path, "w"), "Failed to open %s", path);
+	ES_FWD_INT(write(f, config, results->results, results->n), "Failed to write %s", path);
+	return 0;
+}
+
+static int _bench(const bn_opts_t *opts,
+                  const char *filter,
+                  const char *json_path,
+                  const char *csv_path)
+{
+	DEV_CLEANUP dev_st *dev                      = NULL;
+	DA_CLEANUP da_st *da                         = NULL;
+	CLEANUP(_cleanup_free) _entry_t *cases       = NULL;
+	CLEANUP(_cleanup_results) _results_t results = {0};
+	_ctx_t ctx                                   = {0};
+	const bn_case_t *ds_cases;
+	bn_config_t config;
+	da_span_t whole;
+	size_t n = 0, n_ds, i;
+	ES_FWD_INT_NM(_open(&dev));
+	whole   = da_span_of_dev(dev);
+	ctx.dev = dev;
+	ES_FWD_INT_NM(da_alloc(&da, &whole, DA_MODE_BUMP));
+	ES_FWD_INT_NM(da_get(da, &ctx.left, MAX_TILES * sizeof(matrix_t)));
+	ES_FWD_INT_NM(da_get(da, &ctx.right, MAX_TILES * sizeof(matrix_t)));
+	ES_FWD_INT_NM(da_get(da, &ctx.dst, MAX_TILES * sizeof(matrix_t)));
+	ES_FWD_INT(da_get(da, &ctx.sync, MIN(whole.size - da_used(da), (uint32_t) MAX_SYNC)),
+	           "No device memory left to sync");
+	ES_FWD_INT_NM(_cases(&cases, &n, &ctx));
+	bn_config_host(&config, dev->ops->name, opts);
+	printf("device: %s, %zu warmup, %zu repetitions\n", dev->ops->name, opts->warmup, opts->reps);
+	bn_print_header(stdout);
+	for (i = 0; i < n; i++) {
+		cases[i].bench.name = cases[i].name;
+		cases[i].bench.arg  = &cases[i].ctx;
+		ES_FWD_INT_NM(_run(&results, &cases[i].bench, opts, filter));
+	}
+	ds_cases = bn_ds_cases(&n_ds);
+	for (i = 0; i < n_ds; i++) {
+		ES_FWD_INT_NM(_run(&results, &ds_cases[i], opts, filter));
+	}
+	ES_FWD_INT_NM(_write(json_path, bn_write_json, &config, &results));
+	ES_FWD_INT_NM(_write(csv_path, bn_write_csv, &config, &results));
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	bn_opts_t opts        = {.warmup = 10, .reps = 200};
+	const char *filter    = NULL;
+	const char *json_path = NULL;
+	const char *csv_path  = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "w:r:f:j:c:")) != -1) {
+		switch (opt) {
+		case 'w':
+			opts.warmup = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opts.reps = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'j':
+			json_path = optarg;
+			break;
+		case 'c':
+			csv_path = optarg;
+			break;
+		default:
+			fprintf(stderr,
+			        "Usage: %s [-w warmup] [-r repetitions] [-f filter] [-j json] [-c csv]\n",
+			        argv[0]);
+			return -1;
+		}
+	}
+	if (_bench(&opts, filter, json_path, csv_path) < 0) {
+		printf("Benchmark failed: [ ");
+		ES_PRINT();
+		printf("\n ]\n");
+		return -1;
+	}
+	return 0;
+}
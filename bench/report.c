@@ -0,0 +1,332 @@
+#include "bench.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Build and host configuration of a benchmark run, and reading and writing results as JSON and CSV.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "errstack.h"
+
+/* Set by the makefile from its settings of the same name */
+#ifndef BN_RELEASE
+#	define BN_RELEASE -1
+#endif
+#ifndef BN_DEBUG
+#	define BN_DEBUG -1
+#endif
+#ifndef BN_ERROR_STACK_DISABLE
+#	define BN_ERROR_STACK_DISABLE -1
+#endif
+#ifndef BN_ERROR_STACK_BUFFER_BACKED
+#	define BN_ERROR_STACK_BUFFER_BACKED -1
+#endif
+#ifndef BN_NEON
+#	define BN_NEON -1
+#endif
+#ifndef BN_TRACE
+#	define BN_TRACE -1
+#endif
+#ifndef BN_CC
+#	define BN_CC "cc"
+#endif
+
+#define _LINE_MAX (512)
+
+typedef struct _field_s
+{
+	const char *key;
+	size_t offset;
+	/* 0 for an int, else the size of the string */
+	size_t str_size;
+} _field_t;
+
+#define _INT(name) {#name, offsetof(bn_config_t, name), 0}
+#define _STR(name) {#name, offsetof(bn_config_t, name), sizeof(((bn_config_t *) 0)->name)}
+
+static const _field_t _fields[] = {
+    _INT(release),
+    _INT(debug),
+    _INT(error_stack_disable),
+    _INT(error_stack_buffer_backed),
+    _INT(neon),
+    _INT(trace),
+    _STR(compiler),
+    _STR(cpu),
+    _STR(machine),
+    _INT(cpus),
+    _STR(device),
+    _INT(warmup),
+    _INT(reps),
+};
+
+static int _cmp_u64(const void *a, const void *b)
+{
+	const uint64_t ua = *(const uint64_t *) a, ub = *(const uint64_t *) b;
+	return (ua > ub) - (ua < ub);
+}
+
+static int *_int_of(const bn_config_t *config, const _field_t *field)
+{
+	return (int *) ((const char *) config + field->offset);
+}
+
+static char *_str_of(const bn_config_t *config, const _field_t *field)
+{
+	return (char *) config + field->offset;
+}
+
+/* /proc/cpuinfo names the CPU "model name" on x86 and "Processor" or "Hardware" on older ARM */
+static void _cpu_name(char *dst, size_t size)
+{
+	static const char *const keys[] = {"model name", "Processor", "Hardware"};
+	CLEAN_FILE FILE *f              = fopen("/proc/cpuinfo", "r");
+	char line[_LINE_MAX];
+	size_t i;
+	dst[0] = '\0';
+	while (f && !dst[0] && fgets(line, sizeof(line), f)) {
+		char *colon = strchr(line, ':');
+		for (i = 0; colon && i < ARRAY_SIZE(keys); i++) {
+			if (strncmp(line, keys[i], strlen(keys[i])) == 0) {
+				strlcpy(dst, colon + 1 + strspn(colon + 1, " \t"), size);
+				dst[strcspn(dst, "\n")] = '\0';
+				break;
+			}
+		}
+	}
+}
+
+void bn_config_host(bn_config_t *config, const char *device, const bn_opts_t *opts)
+{
+	struct utsname name;
+	memset(config, 0, sizeof(*config));
+	config->release                   = BN_RELEASE;
+	config->debug                     = BN_DEBUG;
+	config->error_stack_disable       = BN_ERROR_STACK_DISABLE;
+	config->error_stack_buffer_backed = BN_ERROR_STACK_BUFFER_BACKED;
+	config->neon                      = BN_NEON;
+	config->trace                     = BN_TRACE;
+	config->cpus                      = sysconf(_SC_NPROCESSORS_ONLN);
+	config->warmup                    = opts->warmup;
+	config->reps                      = opts->reps;
+	snprintf(config->compiler, sizeof(config->compiler), "%s %s", BN_CC, __VERSION__);
+	_cpu_name(config->cpu, sizeof(config->cpu));
+	if (uname(&name) == 0) {
+		STRLCPY(config->machine, name.machine);
+	}
+	STRLCPY(config->device, device);
+}
+
+size_t bn_config_diff(const bn_config_t *a, const bn_config_t *b, FILE *f)
+{
+	size_t i, n = 0;
+	for (i = 0; i < ARRAY_SIZE(_fields); i++) {
+		const _field_t *field = &_fields[i];
+		if (field->str_size) {
+			if (strcmp(_str_of(a, field), _str_of(b, field)) != 0) {
+				fprintf(f,
+				        "%s: \"%s\" -> \"%s\"\n",
+				        field->key,
+				        _str_of(a, field),
+				        _str_of(b, field));
+				n++;
+			}
+		} else if (*_int_of(a, field) != *_int_of(b, field)) {
+			fprintf(f, "%s: %d -> %d\n", field->key, *_int_of(a, field), *_int_of(b, field));
+			n++;
+		}
+	}
+	return n;
+}
+
+static void _json_str(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			fprintf(f, "\\%c", *str);
+		} else if ((unsigned char) *str < 0x20) {
+			fprintf(f, "\\u%04x", *str);
+		} else {
+			fputc(*str, f);
+		}
+	}
+	fputc('"', f);
+}
+
+int bn_write_json(FILE *f, const bn_config_t *config, const bn_result_t *results, size_t n)
+{
+	size_t i, j;
+	fprintf(f, "{\n  \"config\": {");
+	for (i = 0; i < ARRAY_SIZE(_fields); i++) {
+		fprintf(f, "%s\n    \"%s\": ", i ? "," : "", _fields[i].key);
+		if (_fields[i].str_size) {
+			_json_str(f, _str_of(config, &_fields[i]));
+		} else if (*_int_of(config, &_fields[i]) < 0) {
+			fprintf(f, "null");
+		} else {
+			fprintf(f, "%d", *_int_of(config, &_fields[i]));
+		}
+	}
+	fprintf(f, "\n  },\n  \"results\": [");
+	for (i = 0; i < n; i++) {
+		const bn_result_t *result = &results[i];
+		const uint64_t p50        = bn_percentile(result, 50);
+		fprintf(f, "%s\n    {\"name\": ", i ? "," : "");
+		_json_str(f, result->name);
+		fprintf(f,
+		        ", \"bytes\": %zu, \"n\": %zu, \"min_ns\": %llu, \"p50_ns\": %llu, "
+		        "\"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, \"mean_ns\": %.1f, "
+		        "\"p50_mbps\": %.2f,\n"
+		        "     \"samples_ns\": [",
+		        result->bytes,
+		        result->n,
+		        (unsigned long long) result->samples[0],
+		        (unsigned long long) p50,
+		        (unsigned long long) bn_percentile(result, 90),
+		        (unsigned long long) bn_percentile(result, 99),
+		        (unsigned long long) result->samples[result->n - 1],
+		        bn_mean(result),
+		        bn_mbps(result, p50));
+		for (j = 0; j < result->n; j++) {
+			fprintf(f, "%s%llu", j ? ", " : "", (unsigned long long) result->samples[j]);
+		}
+		fprintf(f, "]}");
+	}
+	fprintf(f, "\n  ]\n}\n");
+	ES_NEW_ASRT(!ferror(f), "Failed to write JSON");
+	return 0;
+}
+
+int bn_write_csv(FILE *f, const bn_config_t *config, const bn_result_t *results, size_t n)
+{
+	size_t i, j;
+	for (i = 0; i < ARRAY_SIZE(_fields); i++) {
+		if (_fields[i].str_size) {
+			fprintf(f, "# %s=%s\n", _fields[i].key, _str_of(config, &_fields[i]));
+		} else {
+			fprintf(f, "# %s=%d\n", _fields[i].key, *_int_of(config, &_fields[i]));
+		}
+	}
+	fprintf(f, "case,bytes,ns\n");
+	for (i = 0; i < n; i++) {
+		ES_NEW_ASRT(!strpbrk(results[i].name, ",\"\n"), "Case %s needs quoting", results[i].name);
+		for (j = 0; j < results[i].n; j++) {
+			fprintf(f,
+			        "%s,%zu,%llu\n",
+			        results[i].name,
+			        results[i].bytes,
+			        (unsigned long long) results[i].samples[j]);
+		}
+	}
+	ES_NEW_ASRT(!ferror(f), "Failed to write CSV");
+	return 0;
+}
+
+static void _read_setting(bn_config_t *config, char *line)
+{
+	char *value = strchr(line, '=');
+	size_t i;
+	if (!value) {
+		return;
+	}
+	*value++ = '\0';
+	for (i = 0; i < ARRAY_SIZE(_fields); i++) {
+		if (strcmp(line, _fields[i].key) != 0) {
+			continue;
+		}
+		if (_fields[i].str_size) {
+			strlcpy(_str_of(config, &_fields[i]), value, _fields[i].str_size);
+		} else {
+			*_int_of(config, &_fields[i]) = strtol(value, NULL, 0);
+		}
+	}
+}
+
+/* Appends a sample to the last result, or starts a new one when the case changes */
+static int _read_sample(bn_result_t **results,
+                        size_t *n,
+                        const char *name,
+                        size_t bytes,
+                        uint64_t ns)
+{
+	bn_result_t *result = *n ? &(*results)[*n - 1] : NULL;
+	uint64_t *samples;
+	if (!result || strcmp(result->name, name) != 0) {
+		ES_NEW_ASRT_NM(result = realloc(*results, (*n + 1) * sizeof(**results)));
+		*results = result;
+		result   = &result[(*n)++];
+		memset(result, 0, sizeof(*result));
+		STRLCPY(result->name, name);
+		result->bytes = bytes;
+	}
+	ES_NEW_ASRT_NM(samples = realloc(result->samples, (result->n + 1) * sizeof(*samples)));
+	result->samples              = samples;
+	result->samples[result->n++] = ns;
+	return 0;
+}
+
+static int _read_lines(FILE *f, bn_config_t *config, bn_result_t **results, size_t *n)
+{
+	char line[_LINE_MAX];
+	size_t line_no = 0, i;
+	while (fgets(line, sizeof(line), f)) {
+		char *bytes, *ns;
+		line_no++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '#') {
+			_read_setting(config, line + 1 + strspn(line + 1, " "));
+			continue;
+		}
+		if (line[0] == '\0' || strcmp(line, "case,bytes,ns") == 0) {
+			continue;
+		}
+		ns = strrchr(line, ',');
+		ES_NEW_ASRT(ns, "Line %zu is no case,bytes,ns row", line_no);
+		*ns++ = '\0';
+		bytes = strrchr(line, ',');
+		ES_NEW_ASRT(bytes, "Line %zu is no case,bytes,ns row", line_no);
+		*bytes++ = '\0';
+		ES_FWD_INT(_read_sample(results, n, line, strtoul(bytes, NULL, 0), strtoull(ns, NULL, 0)),
+		           "Line %zu",
+		           line_no);
+	}
+	ES_NEW_ASRT(!ferror(f), "Failed to read");
+	/* Samples are written sorted, but the file may have been edited or concatenated */
+	for (i = 0; i < *n; i++) {
+		qsort((*results)[i].samples, (*results)[i].n, sizeof(uint64_t), _cmp_u64);
+	}
+	return 0;
+}
+
+int bn_read_csv(const char *path, bn_config_t *config, bn_result_t **results, size_t *n)
+{
+	CLEAN_FILE FILE *f = fopen(path, "r");
+	size_t i;
+	ES_NEW_ASRT(f, "Failed to open %s", path);
+	/* Settings missing from the file stay unknown */
+	memset(config, 0, sizeof(*config));
+	for (i = 0; i < ARRAY_SIZE(_fields); i++) {
+		if (!_fields[i].str_size) {
+			*_int_of(config, &_fields[i]) = -1;
+		}
+	}
+	*results = NULL;
+	*n       = 0;
+	if (_read_lines(f, config, results, n) < 0) {
+		bn_results_free(*results, *n);
+		*results = NULL;
+		*n       = 0;
+		ES_FWD_INT(-1, "Failed to read %s", path);
+	}
+	return 0;
+}
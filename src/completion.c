@@ -0,0 +1,240 @@
+#include "completion.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * File descriptor based job completion.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "errstack.h"
+#include "util.h"
+
+/* Events handled per eh_ctx_wait while waiting on a handle */
+#define _WAIT_EVENTS (8)
+
+struct cs_s
+{
+	cs_kind_et kind;
+	int fd;
+	jq_st *jq;
+	uint32_t period_us;
+	bool armed;
+	uint64_t wakeups;
+
+	eh_ctx_st *ctx;
+	cs_done_ft on_done;
+	void *arg;
+};
+
+static int _cs_alloc(cs_st **dst, cs_kind_et kind, jq_st *jq, int fd)
+{
+	cs_st *tmp;
+	ES_NEW_ASRT_NM(dst && jq);
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	tmp->kind = kind;
+	tmp->fd   = fd;
+	tmp->jq   = jq;
+	*dst      = tmp;
+	return 0;
+}
+
+int cs_uio_open(cs_st **dst, jq_st *jq, int uio_id)
+{
+	char file_name[64];
+	CLEAN_FD int fd   = -1;
+	const uint32_t on = 1;
+	ES_NEW_INT(snprintf(file_name, sizeof(file_name), "/dev/uio%d", uio_id),
+	           "failed to make file name");
+	ES_NEW_INT_ERRNO(fd = open(file_name, O_RDWR | O_CLOEXEC));
+	/* uio_pdrv_genirq leaves the line masked until the first write */
+	ES_NEW_INT_ERRNO(write(fd, &on, sizeof(on)));
+	ES_FWD_INT_NM(_cs_alloc(dst, CS_KIND_UIO, jq, fd));
+	fd = -1;
+	return 0;
+}
+
+int cs_eventfd_open(cs_st **dst, jq_st *jq)
+{
+	CLEAN_FD int fd = -1;
+	ES_NEW_INT_ERRNO(fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+	ES_FWD_INT_NM(_cs_alloc(dst, CS_KIND_EVENTFD, jq, fd));
+	fd = -1;
+	return 0;
+}
+
+int cs_timer_open(cs_st **dst, jq_st *jq, uint32_t period_us)
+{
+	CLEAN_FD int fd = -1;
+	ES_NEW_ASRT(period_us > 0, "Timer period must be positive");
+	ES_NEW_INT_ERRNO(fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK));
+	ES_FWD_INT_NM(_cs_alloc(dst, CS_KIND_TIMER, jq, fd));
+	(*dst)->period_us = period_us;
+	fd                = -1;
+	return 0;
+}
+
+void cs_cleanup(cs_st **cs)
+{
+	if (!*cs) {
+		return;
+	}
+	cs_detach(*cs);
+	cleanup_fd(&(*cs)->fd);
+	free(*cs);
+	*cs = NULL;
+}
+
+static int _set_timer(cs_st *cs, bool armed)
+{
+	const uint64_t period_ns     = armed ? (uint64_t) cs->period_us * 1000 : 0;
+	const struct timespec tick   = {.tv_sec  = period_ns / 1000000000,
+	                                .tv_nsec = period_ns % 1000000000};
+	const struct itimerspec spec = {.it_interval = tick, .it_value = tick};
+	if (cs->kind != CS_KIND_TIMER || cs->armed == armed) {
+		return 0;
+	}
+	ES_NEW_INT_ERRNO(timerfd_settime(cs->fd, 0, &spec, NULL));
+	cs->armed = armed;
+	return 0;
+}
+
+/* Consume whatever made the fd readable, and re-enable the interrupt for uio */
+static int _drain(cs_st *cs)
+{
+	if (cs->kind == CS_KIND_UIO) {
+		uint32_t n_irq;
+		const uint32_t on = 1;
+		ES_NEW_INT_ERRNO(read(cs->fd, &n_irq, sizeof(n_irq)));
+		ES_NEW_INT_ERRNO(write(cs->fd, &on, sizeof(on)));
+	} else {
+		uint64_t count;
+		if (read(cs->fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+			ES_NEW_ERRNO();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int _on_readable(UNUSED eh_ctx_st *ctx, eh_hook_st *hook, UNUSED bool ops[EH_OPS_MAX])
+{
+	cs_st *cs = eh_hook_get_data(hook);
+	int n_completed;
+	cs->wakeups++;
+	ES_FWD_INT_NM(_drain(cs));
+	ES_FWD_INT_NM(n_completed = jq_poll(cs->jq));
+	if (!jq_in_flight(cs->jq)) {
+		ES_FWD_INT_NM(_set_timer(cs, false));
+	}
+	if (n_completed && cs->on_done) {
+		cs->on_done(cs->arg, n_completed);
+	}
+	return 1;
+}
+
+/* Blocking phase of the device's waits: sleep until the fd fires, _on_readable polls the queue */
+static int _block(void *arg, int ms)
+{
+	cs_st *cs = arg;
+	ES_FWD_INT_NM(_set_timer(cs, true));
+	ES_FWD_INT_NM(eh_ctx_wait(cs->ctx, _WAIT_EVENTS, ms));
+	return 0;
+}
+
+int cs_attach(cs_st *cs, eh_ctx_st *ctx, cs_done_ft on_done, void *arg)
+{
+	const eh_hook_ft ops[EH_OPS_MAX] = {[EH_OPS_IN] = _on_readable};
+	dev_st *dev;
+	ES_NEW_ASRT_NM(cs && ctx);
+	ES_NEW_ASRT(!cs->ctx, "Source already attached");
+	dev = jq_dev(cs->jq);
+	ES_NEW_ASRT(!dev->block, "Device already blocks on another source");
+	ES_FWD_INT_NM(eh_ctx_hook_alloc(ctx, cs->fd, cs, &ops));
+	dev_set_block(dev, _block, cs);
+	cs->ctx     = ctx;
+	cs->on_done = on_done;
+	cs->arg     = arg;
+	return 0;
+}
+
+void cs_detach(cs_st *cs)
+{
+	eh_hook_st *hook;
+	if (!cs || !cs->ctx) {
+		return;
+	}
+	hook = eh_ctx_get_hook_by_fd(cs->ctx, cs->fd);
+	eh_hook_cleanup(&hook);
+	dev_set_block(jq_dev(cs->jq), NULL, NULL);
+	cs->ctx = NULL;
+}
+
+int cs_signal(cs_st *cs)
+{
+	const uint64_t one = 1;
+	ES_NEW_ASRT_NM(cs);
+	if (cs->kind != CS_KIND_EVENTFD) {
+		return 0;
+	}
+	ES_NEW_INT_ERRNO(write(cs->fd, &one, sizeof(one)));
+	return 0;
+}
+
+static int64_t _now_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int cs_wait(cs_st *cs, jq_handle_t handle, int ms)
+{
+	const int64_t deadline = _now_ms() + ms;
+	ES_NEW_ASRT_NM(cs);
+	ES_NEW_ASRT(cs->ctx, "Source is not attached");
+	ES_NEW_ASRT(handle < jq_submitted(cs->jq),
+	            "Handle %llu was never submitted",
+	            (unsigned long long) handle);
+	if (jq_is_done(cs->jq, handle)) {
+		return 1;
+	}
+	/* The device is only looked at when the fd fires, a pending interrupt is latched in the fd */
+	ES_FWD_INT_NM(_set_timer(cs, true));
+	while (!jq_is_done(cs->jq, handle)) {
+		int remaining = -1;
+		if (ms >= 0) {
+			remaining = MAX(deadline - _now_ms(), (int64_t) 0);
+		}
+		if (ES_FWD_INT_NM(eh_ctx_wait(cs->ctx, _WAIT_EVENTS, remaining)) == 0 && remaining == 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int cs_fd(const cs_st *cs)
+{
+	return cs->fd;
+}
+
+cs_kind_et cs_kind(const cs_st *cs)
+{
+	return cs->kind;
+}
+
+uint64_t cs_wakeups(const cs_st *cs)
+{
+	return cs->wakeups;
+}
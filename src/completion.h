@@ -0,0 +1,75 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Job completion as a file descriptor, so a host thread can sleep in epoll instead of spinning on
+ * the write DMA status. A source wakes an epoll_hook context and polls its job queue. Three kinds:
+ *    - uio: /dev/uioN bound to the write DMA interrupt. Needs the FIFOs built with USE_IRQ 1
+ *    - eventfd: signalled by whoever knows a job finished, e.g. a stand-in for the interrupt
+ *    - timer: a timerfd that polls the CSRs at a fixed period while jobs are in flight
+ *
+ * How to:
+ * 1. cs_*_open a source for a job queue
+ * 2. cs_attach it to an eh_ctx_st, optionally with a callback per completion batch
+ * 3. cs_wait on a handle, or run eh_ctx_wait from the host's own event loop
+ */
+
+#include <stdint.h>
+
+#include "epoll_hook.h"
+#include "job_queue.h"
+
+typedef enum cs_kind_e
+{
+	CS_KIND_UIO,
+	CS_KIND_EVENTFD,
+	CS_KIND_TIMER,
+} cs_kind_et;
+
+/* Called from eh_ctx_wait with the number of jobs that completed since the last call */
+typedef void (*cs_done_ft)(void *arg, uint32_t n_completed);
+
+struct cs_s;
+typedef struct cs_s cs_st;
+
+int cs_uio_open(cs_st **dst, jq_st *jq, int uio_id);
+int cs_eventfd_open(cs_st **dst, jq_st *jq);
+/**
+ * @brief Fallback for builds without an interrupt: check the device every period_us while armed.
+ */
+int cs_timer_open(cs_st **dst, jq_st *jq, uint32_t period_us);
+/* Detaches first, so call it before the context is freed */
+void cs_cleanup(cs_st **cs);
+
+#define CS_CLEANUP CLEANUP(cs_cleanup)
+
+/**
+ * @brief Hook the fd into ctx. While attached, the waits of the job queue's device (jq_wait,
+ * dev_wait_idle) block in eh_ctx_wait on ctx once they stop sleeping, so they must not be called
+ * from on_done. A device blocks on one source at a time.
+ */
+int cs_attach(cs_st *cs, eh_ctx_st *ctx, cs_done_ft on_done, void *arg);
+void cs_detach(cs_st *cs);
+
+/**
+ * @brief Raise the source by hand. For an eventfd this is the stand-in for the interrupt; a uio or
+ * timer source ignores it.
+ */
+int cs_signal(cs_st *cs);
+
+/**
+ * @brief Sleep in eh_ctx_wait until handle completes. The source must be attached.
+ *
+ * @param ms Overall timeout, < 0 waits forever
+ * @return 1 if the job completed, 0 on timeout, < 0 on failure or if the handle was never
+ * submitted
+ */
+int cs_wait(cs_st *cs, jq_handle_t handle, int ms);
+
+int cs_fd(const cs_st *cs);
+cs_kind_et cs_kind(const cs_st *cs);
+/* Number of times the fd woke the context */
+uint64_t cs_wakeups(const cs_st *cs);
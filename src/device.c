@@ -0,0 +1,259 @@
+#include "device.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Backend independent part of the device interface.
+ */
+
+#include <hps.h>
+#include <stdio.h>
+
+#include "errstack.h"
+#include "trace.h"
+
+void dev_cleanup(dev_st **dev)
+{
+	if (!*dev) {
+		return;
+	}
+	(*dev)->ops->cleanup(*dev);
+	*dev = NULL;
+}
+
+uint32_t dev_read_reg(dev_st *dev, dev_reg_et reg)
+{
+	dev->stats.reg_reads++;
+	return dev->ops->read_reg(dev, reg);
+}
+
+uint32_t dev_peek_reg(dev_st *dev, dev_reg_et reg)
+{
+	return dev->ops->read_reg(dev, reg);
+}
+
+int dev_sync_for_cpu(dev_st *dev, uint32_t offset, uint32_t size)
+{
+	int ret;
+	TR_BEGIN("sync_for_cpu");
+	ret = dev->ops->sync_for_cpu(dev, offset, size);
+	TR_END("sync_for_cpu");
+	return ret;
+}
+
+int dev_sync_for_device(dev_st *dev, uint32_t offset, uint32_t size)
+{
+	int ret;
+	TR_BEGIN("sync_for_device");
+	ret = dev->ops->sync_for_device(dev, offset, size);
+	TR_END("sync_for_device");
+	return ret;
+}
+
+int dev_sync_ranges_for_cpu(dev_st *dev, mu_sync_range_t *ranges, size_t n)
+{
+	size_t i;
+	int ret = 0;
+	n       = mu_sync_ranges_merge(ranges, n);
+	TR_BEGIN("sync_for_cpu");
+	for (i = 0; i < n && ret >= 0; i++) {
+		ret = dev->ops->sync_for_cpu(dev, ranges[i].offset, ranges[i].size);
+	}
+	TR_END("sync_for_cpu");
+	ES_FWD_INT_NM(ret);
+	return 0;
+}
+
+int dev_sync_ranges_for_device(dev_st *dev, mu_sync_range_t *ranges, size_t n)
+{
+	size_t i;
+	int ret = 0;
+	n       = mu_sync_ranges_merge(ranges, n);
+	TR_BEGIN("sync_for_device");
+	for (i = 0; i < n && ret >= 0; i++) {
+		ret = dev->ops->sync_for_device(dev, ranges[i].offset, ranges[i].size);
+	}
+	TR_END("sync_for_device");
+	ES_FWD_INT_NM(ret);
+	return 0;
+}
+
+uint32_t dev_virt_to_phys(const dev_st *dev, const void *virt)
+{
+	const uint8_t *base = dev->virtual_base;
+	return dev->phys_addr + (uint32_t) ((const uint8_t *) virt - base);
+}
+
+void *dev_phys_to_virt(const dev_st *dev, uint32_t phys)
+{
+	return (uint8_t *) dev->virtual_base + (phys - dev->phys_addr);
+}
+
+int dev_try_send_instr(dev_st *dev, uint64_t instr)
+{
+	int n = FIFO_INSTR_IN_CSR_FIFO_DEPTH - (int) dev_read_reg(dev, DEV_REG_INSTR_FILL);
+	if (n <= 0) {
+		return 0;
+	}
+	dev_send_instr(dev, instr);
+	return 1;
+}
+
+void dev_send_instr(dev_st *dev, uint64_t instr)
+{
+	dev->ops->send_instr(dev, instr);
+	dev->send_count += 1;
+	dev->stats.reg_writes++;
+}
+
+void dev_send_read(dev_st *dev, uint32_t phys_addr, uint32_t n_bytes, uint32_t channel)
+{
+	// ES_NEW_ASRT((phys_addr & 0x1F) == 0, "physical address must be 32 byte aligned");
+	// ES_NEW_ASRT((n_bytes & 0x1F) == 0, "length must be in 32 byte increments");
+	dev->ops->send_read(dev, phys_addr, n_bytes, channel);
+	/* Address, length and control words */
+	dev->stats.reg_writes += 3;
+}
+
+/* Length of the transfer starting at descs[0] after merging, and how many entries it covers */
+static dev_read_desc_t _merge_next(const dev_read_desc_t *descs, size_t n, size_t *n_used)
+{
+	dev_read_desc_t merged = descs[0];
+	size_t i;
+	for (i = 1; i < n; i++) {
+		const dev_read_desc_t *next = &descs[i];
+		if (next->channel != merged.channel ||
+		    next->phys_addr != merged.phys_addr + merged.n_bytes ||
+		    merged.n_bytes + next->n_bytes > MSGDMA_READ_CSR_MAX_BYTE) {
+			break;
+		}
+		merged.n_bytes += next->n_bytes;
+	}
+	*n_used = i;
+	return merged;
+}
+
+size_t dev_coalesce_reads(dev_read_desc_t *descs, size_t n)
+{
+	size_t i = 0, n_out = 0;
+	while (i < n) {
+		size_t n_used;
+		descs[n_out++] = _merge_next(&descs[i], n - i, &n_used);
+		i += n_used;
+	}
+	return n_out;
+}
+
+size_t dev_count_reads(const dev_read_desc_t *descs, size_t n)
+{
+	size_t i = 0, n_out = 0;
+	while (i < n) {
+		size_t n_used;
+		_merge_next(&descs[i], n - i, &n_used);
+		n_out++;
+		i += n_used;
+	}
+	return n_out;
+}
+
+size_t dev_send_reads_in(dev_st *dev, const dev_read_desc_t *descs, size_t n, int32_t *space)
+{
+	size_t i = 0;
+	while (i < n && *space > 0) {
+		size_t n_used;
+		dev_read_desc_t merged = _merge_next(&descs[i], n - i, &n_used);
+		dev_send_read(dev, merged.phys_addr, merged.n_bytes, merged.channel);
+		(*space)--;
+		i += n_used;
+	}
+	return i;
+}
+
+size_t dev_send_reads(dev_st *dev, const dev_read_desc_t *descs, size_t n)
+{
+	int32_t space = MSGDMA_READ_CSR_DESCRIPTOR_FIFO_DEPTH -
+	                (int32_t) (dev_read_reg(dev, DEV_REG_RD_FILL) & 0xFFFF);
+	return dev_send_reads_in(dev, descs, n, &space);
+}
+
+void dev_send_write(dev_st *dev, uint32_t phys_addr)
+{
+	// ES_NEW_ASRT((phys_addr & 0x1F) == 0, "physical address must be 32 byte aligned");
+	dev->ops->send_write(dev, phys_addr);
+	dev->stats.reg_writes++;
+}
+
+bool dev_is_busy(dev_st *dev)
+{
+	return dev_read_reg(dev, DEV_REG_WR_STATUS) != 0;
+}
+
+static bool _is_idle(void *dev)
+{
+	return !dev_is_busy(dev);
+}
+
+void dev_set_block(dev_st *dev, wt_block_ft block, void *arg)
+{
+	dev->block     = block;
+	dev->block_arg = arg;
+}
+
+int dev_block(dev_st *dev, int ms)
+{
+	return dev->block(dev->block_arg, ms);
+}
+
+static int _block(void *dev, int ms)
+{
+	return dev_block(dev, ms);
+}
+
+int dev_wait_idle(dev_st *dev)
+{
+	ES_FWD_INT_NM(wt_wait(&dev->waiter, _is_idle, dev->block ? _block : NULL, dev));
+	return 0;
+}
+
+uint32_t dev_writes_outstanding(dev_st *dev)
+{
+	/* Fill level first: a descriptor moving from the FIFO into the DMA in between is then counted
+	 * twice rather than not at all, so completions are never reported early. */
+	uint32_t fill = dev_read_reg(dev, DEV_REG_WR_FIFO_FILL);
+	return fill + (dev_is_busy(dev) ? 1 : 0);
+}
+
+void dev_print_state(dev_st *dev)
+{
+	static const char *names[DEV_REG_MAX] = {
+	    [DEV_REG_SYS_STATE]    = "sys_state",
+	    [DEV_REG_SYS_N_COL]    = "sys_n_col",
+	    [DEV_REG_SYS_N_ROW]    = "sys_n_row",
+	    [DEV_REG_SYS_CYCLE]    = "sys_cycle",
+	    [DEV_REG_SYS_STREAM]   = "sys_stream",
+	    [DEV_REG_SYS_C0]       = "sys_c0",
+	    [DEV_REG_SYS_C1]       = "sys_c1",
+	    [DEV_REG_SYS_C2]       = "sys_c2",
+	    [DEV_REG_SYS_C3]       = "sys_c3",
+	    [DEV_REG_SYS_C4]       = "sys_c4",
+	    [DEV_REG_SYS_C5]       = "sys_c5",
+	    [DEV_REG_SYS_C6]       = "sys_c6",
+	    [DEV_REG_SYS_C7]       = "sys_c7",
+	    [DEV_REG_WR_STATUS]    = "wr_status",
+	    [DEV_REG_WR_CSR1]      = "wr_csr1",
+	    [DEV_REG_WR_FILL]      = "wr_fill",
+	    [DEV_REG_WR_CSR3]      = "wr_csr3",
+	    [DEV_REG_WR_FIFO_FILL] = "wr_fifo_fill",
+	    [DEV_REG_RD_STATUS]    = "rd_status",
+	    [DEV_REG_RD_FILL]      = "rd_fill",
+	    [DEV_REG_INSTR_FILL]   = "instr_fill",
+	};
+	int i;
+	printf("device: %s\n", dev->ops->name);
+	for (i = 0; i < DEV_REG_MAX; i++) {
+		printf("%s: 0x%08x\n", names[i], dev_read_reg(dev, i));
+	}
+	printf("\n");
+}
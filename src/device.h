@@ -0,0 +1,208 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Hardware abstraction for the systolic array. A device is a set of register/FIFO operations plus a
+ * region of DMA-able memory. Two backends exist:
+ *    - hw: /dev/mem mapped HPS-to-FPGA bridge and a udmabuf
+ *    - emu: an in-process model of the FIFOs in hps.h that computes the products itself
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory_utils.h"
+#include "util.h"
+#include "waiter.h"
+
+/* Registers visible to the host. The hw backend maps these onto the CSR spans in hps.h. */
+typedef enum dev_reg_e
+{
+	DEV_REG_SYS_STATE,
+	DEV_REG_SYS_N_COL,
+	DEV_REG_SYS_N_ROW,
+	DEV_REG_SYS_CYCLE,
+	DEV_REG_SYS_STREAM,
+	DEV_REG_SYS_C0,
+	DEV_REG_SYS_C1,
+	DEV_REG_SYS_C2,
+	DEV_REG_SYS_C3,
+	DEV_REG_SYS_C4,
+	DEV_REG_SYS_C5,
+	DEV_REG_SYS_C6,
+	DEV_REG_SYS_C7,
+	/* Non zero while the write DMA has work */
+	DEV_REG_WR_STATUS,
+	DEV_REG_WR_CSR1,
+	DEV_REG_WR_FILL,
+	DEV_REG_WR_CSR3,
+	/* Number of write descriptors waiting in the write DMA FIFO */
+	DEV_REG_WR_FIFO_FILL,
+	DEV_REG_RD_STATUS,
+	/* msgdma fill levels, read descriptors in [15:0] */
+	DEV_REG_RD_FILL,
+	/* Number of instructions waiting in the instruction FIFO */
+	DEV_REG_INSTR_FILL,
+	DEV_REG_MAX,
+} dev_reg_et;
+
+/* Bits of DEV_REG_SYS_STATE driven by the emulator */
+#define DEV_SYS_STATE_BAD_INSTR (1u << 31)
+#define DEV_SYS_STATE_OVERFLOW  (1u << 30)
+#define DEV_SYS_STATE_BAD_ADDR  (1u << 29)
+
+/* Read DMA channels feeding the array */
+#define DEV_CHANNEL_RIGHT (0)
+#define DEV_CHANNEL_LEFT  (1)
+
+struct dev_s;
+typedef struct dev_s dev_st;
+
+struct dev_ops_s
+{
+	const char *name;
+	/* Must be safe to call from a second thread, see dev_peek_reg */
+	uint32_t (*read_reg)(dev_st *dev, dev_reg_et reg);
+	void (*send_instr)(dev_st *dev, uint64_t instr);
+	void (*send_read)(dev_st *dev, uint32_t phys_addr, uint32_t n_bytes, uint32_t channel);
+	void (*send_write)(dev_st *dev, uint32_t phys_addr);
+	int (*sync_for_cpu)(dev_st *dev, uint32_t offset, uint32_t size);
+	int (*sync_for_device)(dev_st *dev, uint32_t offset, uint32_t size);
+	void (*cleanup)(dev_st *dev);
+};
+
+struct dev_s
+{
+	const struct dev_ops_s *ops;
+	/* DMA-able memory shared with the FPGA */
+	void *virtual_base;
+	uint32_t phys_addr;
+	uint32_t size;
+
+	/* Bytes one read channel may be streamed ahead of the other without stalling the read DMA */
+	uint32_t read_lead_bytes;
+
+	/* Instructions sent since the device was opened, wraps */
+	uint32_t send_count;
+	/* Policy and wait-time histogram of every wait on this device */
+	wt_st waiter;
+	/* Blocking phase of those waits, installed by a completion source. NULL keeps sleeping */
+	wt_block_ft block;
+	void *block_arg;
+	/* Bridge accesses issued through this interface */
+	struct
+	{
+		uint64_t reg_reads;
+		uint64_t reg_writes;
+	} stats;
+};
+
+typedef struct dev_read_desc_s
+{
+	uint32_t phys_addr;
+	uint32_t n_bytes;
+	uint32_t channel;
+} dev_read_desc_t;
+
+/**
+ * @brief Map the FPGA bridge through /dev/mem and open udmabuf<udmabuf_id> as device memory.
+ *
+ * @param dst Where to store the new device
+ * @param udmabuf_id Index of /dev/udmabufN
+ * @return >= 0 on success, < 0 on failure
+ */
+int dev_hw_open(dev_st **dst, int udmabuf_id);
+
+/**
+ * @brief Create a software model of the FPGA design.
+ *
+ * @param dst Where to store the new device
+ * @param mem_size Bytes of emulated DMA memory
+ * @param latency_ns Minimum time an instruction spends in the array before its result is written
+ * @return >= 0 on success, < 0 on failure
+ */
+int dev_emu_open(dev_st **dst, uint32_t mem_size, uint32_t latency_ns);
+
+/**
+ * @brief Release a device of any backend. __attribute__((cleanup())) safe, including NULL.
+ */
+void dev_cleanup(dev_st **dev);
+
+#define DEV_CLEANUP CLEANUP(dev_cleanup)
+
+uint32_t dev_read_reg(dev_st *dev, dev_reg_et reg);
+/**
+ * @brief Read a register without counting it in dev->stats. Unlike the rest of the interface it may
+ * be called from another thread while the owner of the device submits, e.g. by a sampler.
+ */
+uint32_t dev_peek_reg(dev_st *dev, dev_reg_et reg);
+int dev_sync_for_cpu(dev_st *dev, uint32_t offset, uint32_t size);
+int dev_sync_for_device(dev_st *dev, uint32_t offset, uint32_t size);
+/* Sort and merge the ranges in place, then sync each merged range once */
+int dev_sync_ranges_for_cpu(dev_st *dev, mu_sync_range_t *ranges, size_t n);
+int dev_sync_ranges_for_device(dev_st *dev, mu_sync_range_t *ranges, size_t n);
+
+/* Translate between the two views of device memory */
+uint32_t dev_virt_to_phys(const dev_st *dev, const void *virt);
+void *dev_phys_to_virt(const dev_st *dev, uint32_t phys);
+
+/**
+ * @brief Try to push an instruction into the instruction FIFO.
+ *
+ * @return 1 if sent, 0 if the FIFO is full
+ */
+int dev_try_send_instr(dev_st *dev, uint64_t instr);
+/* Push without checking the fill level, the caller must know there is space */
+void dev_send_instr(dev_st *dev, uint64_t instr);
+void dev_send_read(dev_st *dev, uint32_t phys_addr, uint32_t n_bytes, uint32_t channel);
+/**
+ * @brief Merge neighbouring descriptors on the same channel that are contiguous in memory, up to
+ * MSGDMA_READ_CSR_MAX_BYTE per descriptor. Order is preserved.
+ *
+ * @param descs Descriptors to merge in place
+ * @param n Number of descriptors
+ * @return Number of descriptors left
+ */
+size_t dev_coalesce_reads(dev_read_desc_t *descs, size_t n);
+/* Number of descriptors dev_coalesce_reads would leave, without touching descs */
+size_t dev_count_reads(const dev_read_desc_t *descs, size_t n);
+/**
+ * @brief Push as many read descriptors as the FIFO has room for, merging them on the way like
+ * dev_coalesce_reads. The fill level is read once per call.
+ *
+ * @param descs Descriptors to send
+ * @param n Number of descriptors
+ * @return Number of entries of descs that were sent, the caller resubmits the rest
+ */
+size_t dev_send_reads(dev_st *dev, const dev_read_desc_t *descs, size_t n);
+/**
+ * @brief dev_send_reads against a known number of free descriptor slots, without reading the fill
+ * level. *space is decreased by the descriptors sent.
+ */
+size_t dev_send_reads_in(dev_st *dev, const dev_read_desc_t *descs, size_t n, int32_t *space);
+void dev_send_write(dev_st *dev, uint32_t phys_addr);
+bool dev_is_busy(dev_st *dev);
+/**
+ * @brief Set the blocking phase of the waits on this device, e.g. cs_attach. NULL to remove it.
+ */
+void dev_set_block(dev_st *dev, wt_block_ft block, void *arg);
+/**
+ * @brief Block through dev->block for at most ms. Only valid while one is set.
+ */
+int dev_block(dev_st *dev, int ms);
+/**
+ * @brief Wait through dev->waiter until the write DMA is idle.
+ *
+ * @return >= 0 on success, < 0 if the blocking phase failed
+ */
+int dev_wait_idle(dev_st *dev);
+/**
+ * @brief Count write descriptors that have not completed, the one in flight plus those in the FIFO.
+ * Results are written in submission order, so this also counts unfinished instructions.
+ */
+uint32_t dev_writes_outstanding(dev_st *dev);
+
+void dev_print_state(dev_st *dev);
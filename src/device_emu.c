@@ -0,0 +1,329 @@
+#include "device.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Device backend that models the FPGA design in process. The FIFOs have the depths given in hps.h,
+ * the read DMA streams descriptors in order into one data FIFO per channel, and the array pops one
+ * instruction at a time once both operands and a write descriptor are available. The model only
+ * advances when the host reads a register, the same way the host only learns about progress on the
+ * real board by polling.
+ */
+
+#include <hps.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "errstack.h"
+#include "systolic.h"
+
+/* Pretend physical address of the emulated DMA memory */
+#define _EMU_PHYS_BASE (0x30000000u)
+/* Bytes buffered per read channel between the read DMA and the array */
+#define _EMU_STREAM_BYTES (MSGDMA_READ_CSR_DATA_FIFO_DEPTH * MSGDMA_READ_CSR_DATA_WIDTH / 8)
+#define _EMU_N_CHANNELS   (2)
+
+#define _RING_PUSH(ring, depth, value)                                                             \
+	({                                                                                             \
+		(ring).data[((ring).head + (ring).count) % (depth)] = (value);                             \
+		(ring).count++;                                                                            \
+	})
+#define _RING_FRONT(ring, depth) (&(ring).data[(ring).head % (depth)])
+#define _RING_POP(ring, depth)                                                                     \
+	({                                                                                             \
+		(ring).head = ((ring).head + 1) % (depth);                                                 \
+		(ring).count--;                                                                            \
+	})
+
+struct _emu_read_s
+{
+	uint32_t phys_addr;
+	uint32_t n_bytes;
+	uint32_t channel;
+	/* Bytes already moved into the channel stream */
+	uint32_t done;
+};
+
+struct _emu_stream_s
+{
+	uint8_t data[_EMU_STREAM_BYTES];
+	size_t head;
+	size_t count;
+};
+
+struct _dev_emu_s
+{
+	dev_st dev;
+	/* Serialises the model, registers may be read from a second thread (dev_peek_reg) */
+	pthread_mutex_t lock;
+	uint32_t latency_ns;
+	/* Time the head instruction had everything it needs, 0 if it is still waiting */
+	uint64_t ready_ns;
+
+	struct
+	{
+		uint64_t data[FIFO_INSTR_IN_FIFO_DEPTH];
+		size_t head;
+		size_t count;
+	} instr;
+
+	struct
+	{
+		struct _emu_read_s data[MSGDMA_READ_CSR_DESCRIPTOR_FIFO_DEPTH];
+		size_t head;
+		size_t count;
+	} reads;
+
+	/* The head entry is the descriptor the write DMA is working on, the rest are in its FIFO */
+	struct
+	{
+		uint32_t data[DMA_WRITE_FIFO_IN_FIFO_DEPTH + 1];
+		size_t head;
+		size_t count;
+	} writes;
+
+	struct _emu_stream_s streams[_EMU_N_CHANNELS];
+
+	uint32_t sys_state;
+	uint32_t sys_cycle;
+	uint32_t sys_stream;
+};
+
+static uint64_t _now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool _in_memory(const struct _dev_emu_s *emu, uint32_t phys_addr, uint32_t n_bytes)
+{
+	return phys_addr >= emu->dev.phys_addr && n_bytes <= emu->dev.size &&
+	       phys_addr - emu->dev.phys_addr <= emu->dev.size - n_bytes;
+}
+
+/* Move as much of the queued read descriptors as fits into the channel streams */
+static void _step_read_dma(struct _dev_emu_s *emu)
+{
+	while (emu->reads.count) {
+		struct _emu_read_s *rd    = _RING_FRONT(emu->reads, ARRAY_SIZE(emu->reads.data));
+		struct _emu_stream_s *str = &emu->streams[rd->channel % _EMU_N_CHANNELS];
+		const uint8_t *src        = dev_phys_to_virt(&emu->dev, rd->phys_addr);
+		size_t n = MIN((size_t) (rd->n_bytes - rd->done), _EMU_STREAM_BYTES - str->count);
+		size_t i;
+		if (!_in_memory(emu, rd->phys_addr, rd->n_bytes)) {
+			emu->sys_state |= DEV_SYS_STATE_BAD_ADDR;
+			_RING_POP(emu->reads, ARRAY_SIZE(emu->reads.data));
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			str->data[(str->head + str->count + i) % _EMU_STREAM_BYTES] = src[rd->done + i];
+		}
+		str->count += n;
+		rd->done += n;
+		emu->sys_stream += n;
+		if (rd->done < rd->n_bytes) {
+			/* Head of line blocked until the array drains this channel */
+			return;
+		}
+		_RING_POP(emu->reads, ARRAY_SIZE(emu->reads.data));
+	}
+}
+
+static void _stream_pop(struct _emu_stream_s *str, void *dst, size_t n)
+{
+	uint8_t *out = dst;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		out[i] = str->data[(str->head + i) % _EMU_STREAM_BYTES];
+	}
+	str->head = (str->head + n) % _EMU_STREAM_BYTES;
+	str->count -= n;
+}
+
+/* Retire at most one instruction, returns true if something retired */
+static bool _step_array(struct _dev_emu_s *emu)
+{
+	uint64_t instr;
+	uint32_t n_cols, n_rows, dst_addr;
+	matrix_t left, right, dst;
+	if (!emu->instr.count) {
+		return false;
+	}
+	instr  = *_RING_FRONT(emu->instr, ARRAY_SIZE(emu->instr.data));
+	n_cols = instr & 0b111111;
+	n_rows = (instr >> 6) & 0b111111;
+	if (n_cols != SA_DIM || n_rows != SA_DIM) {
+		emu->sys_state |= DEV_SYS_STATE_BAD_INSTR;
+		_RING_POP(emu->instr, ARRAY_SIZE(emu->instr.data));
+		return true;
+	}
+	if (!emu->writes.count || emu->streams[DEV_CHANNEL_LEFT].count < sizeof(matrix_t) ||
+	    emu->streams[DEV_CHANNEL_RIGHT].count < sizeof(matrix_t)) {
+		emu->ready_ns = 0;
+		return false;
+	}
+	if (emu->latency_ns) {
+		uint64_t now = _now_ns();
+		if (!emu->ready_ns) {
+			emu->ready_ns = now;
+		}
+		if (now - emu->ready_ns < emu->latency_ns) {
+			return false;
+		}
+	}
+	emu->ready_ns = 0;
+	_stream_pop(&emu->streams[DEV_CHANNEL_LEFT], &left, sizeof(left));
+	_stream_pop(&emu->streams[DEV_CHANNEL_RIGHT], &right, sizeof(right));
+	dst_addr = *_RING_FRONT(emu->writes, ARRAY_SIZE(emu->writes.data));
+	_RING_POP(emu->writes, ARRAY_SIZE(emu->writes.data));
+	_RING_POP(emu->instr, ARRAY_SIZE(emu->instr.data));
+	matrix_mult16_ref(&dst, &left, &right);
+	if (_in_memory(emu, dst_addr, sizeof(dst))) {
+		memcpy(dev_phys_to_virt(&emu->dev, dst_addr), &dst, sizeof(dst));
+	} else {
+		emu->sys_state |= DEV_SYS_STATE_BAD_ADDR;
+	}
+	/* Fill, stream and drain of the array */
+	emu->sys_cycle += 3 * SA_DIM;
+	return true;
+}
+
+static void _step(struct _dev_emu_s *emu)
+{
+	do {
+		_step_read_dma(emu);
+	} while (_step_array(emu));
+}
+
+static uint32_t _read_locked(struct _dev_emu_s *emu, dev_reg_et reg)
+{
+	_step(emu);
+	switch (reg) {
+	case DEV_REG_SYS_STATE:
+		return emu->sys_state;
+	case DEV_REG_SYS_N_COL:
+	case DEV_REG_SYS_N_ROW:
+		return SA_DIM;
+	case DEV_REG_SYS_CYCLE:
+		return emu->sys_cycle;
+	case DEV_REG_SYS_STREAM:
+		return emu->sys_stream;
+	case DEV_REG_WR_STATUS:
+		return emu->writes.count != 0;
+	case DEV_REG_WR_FILL:
+	case DEV_REG_WR_FIFO_FILL:
+		return emu->writes.count ? emu->writes.count - 1 : 0;
+	case DEV_REG_RD_STATUS:
+		return emu->reads.count != 0;
+	case DEV_REG_RD_FILL:
+		return emu->reads.count & 0xFFFF;
+	case DEV_REG_INSTR_FILL:
+		return emu->instr.count;
+	default:
+		return 0;
+	}
+}
+
+static uint32_t _read_reg(dev_st *dev, dev_reg_et reg)
+{
+	struct _dev_emu_s *emu = (struct _dev_emu_s *) dev;
+	uint32_t value;
+	pthread_mutex_lock(&emu->lock);
+	value = _read_locked(emu, reg);
+	pthread_mutex_unlock(&emu->lock);
+	return value;
+}
+
+static void _send_instr(dev_st *dev, uint64_t instr)
+{
+	struct _dev_emu_s *emu = (struct _dev_emu_s *) dev;
+	pthread_mutex_lock(&emu->lock);
+	if (emu->instr.count == ARRAY_SIZE(emu->instr.data)) {
+		emu->sys_state |= DEV_SYS_STATE_OVERFLOW;
+	} else {
+		_RING_PUSH(emu->instr, ARRAY_SIZE(emu->instr.data), instr);
+	}
+	pthread_mutex_unlock(&emu->lock);
+}
+
+static void _send_read(dev_st *dev, uint32_t phys_addr, uint32_t n_bytes, uint32_t channel)
+{
+	struct _dev_emu_s *emu = (struct _dev_emu_s *) dev;
+	struct _emu_read_s rd  = {.phys_addr = phys_addr, .n_bytes = n_bytes, .channel = channel};
+	pthread_mutex_lock(&emu->lock);
+	if (emu->reads.count == ARRAY_SIZE(emu->reads.data)) {
+		emu->sys_state |= DEV_SYS_STATE_OVERFLOW;
+	} else if (n_bytes > MSGDMA_READ_CSR_MAX_BYTE) {
+		emu->sys_state |= DEV_SYS_STATE_BAD_ADDR;
+	} else {
+		_RING_PUSH(emu->reads, ARRAY_SIZE(emu->reads.data), rd);
+	}
+	pthread_mutex_unlock(&emu->lock);
+}
+
+static void _send_write(dev_st *dev, uint32_t phys_addr)
+{
+	struct _dev_emu_s *emu = (struct _dev_emu_s *) dev;
+	pthread_mutex_lock(&emu->lock);
+	if (emu->writes.count == ARRAY_SIZE(emu->writes.data)) {
+		emu->sys_state |= DEV_SYS_STATE_OVERFLOW;
+	} else {
+		_RING_PUSH(emu->writes, ARRAY_SIZE(emu->writes.data), phys_addr);
+	}
+	pthread_mutex_unlock(&emu->lock);
+}
+
+/* Emulated memory is coherent, syncing only validates the range */
+static int _sync(dev_st *dev, uint32_t offset, uint32_t size)
+{
+	ES_NEW_ASRT(offset <= dev->size && size <= dev->size - offset,
+	            "Sync [0x%x, +0x%x) outside of 0x%x bytes",
+	            offset,
+	            size,
+	            dev->size);
+	return 0;
+}
+
+static void _cleanup(dev_st *dev)
+{
+	pthread_mutex_destroy(&((struct _dev_emu_s *) dev)->lock);
+	free(dev->virtual_base);
+	free(dev);
+}
+
+static const struct dev_ops_s _ops = {
+    .name            = "emu",
+    .read_reg        = _read_reg,
+    .send_instr      = _send_instr,
+    .send_read       = _send_read,
+    .send_write      = _send_write,
+    .sync_for_cpu    = _sync,
+    .sync_for_device = _sync,
+    .cleanup         = _cleanup,
+};
+
+int dev_emu_open(dev_st **dst, uint32_t mem_size, uint32_t latency_ns)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	struct _dev_emu_s *emu;
+	ES_NEW_ASRT_NM(dst);
+	ES_NEW_ASRT_NM(emu = calloc(1, sizeof(*emu)));
+	emu->dev.ops    = &_ops;
+	pthread_mutex_init(&emu->lock, NULL);
+	wt_init(&emu->dev.waiter, NULL);
+	emu->latency_ns = latency_ns;
+	dev             = &emu->dev;
+	ES_NEW_ASRT_NM(posix_memalign(&emu->dev.virtual_base, sysconf(_SC_PAGE_SIZE), mem_size) == 0);
+	memset(emu->dev.virtual_base, 0, mem_size);
+	emu->dev.phys_addr       = _EMU_PHYS_BASE;
+	emu->dev.size            = mem_size;
+	emu->dev.read_lead_bytes = _EMU_STREAM_BYTES;
+	*dst                     = MOVE_PZ(dev);
+	return 0;
+}
@@ -0,0 +1,186 @@
+#include "device.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Device backend for the real FPGA. Registers are reached through the HPS-to-FPGA bridge mapped out
+ * of /dev/mem, DMA memory is a udmabuf.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <hps.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "errstack.h"
+#include "memory_utils.h"
+
+// Cyclone V Hard Processor System Technical Reference Manual, Table 2-2
+#define HPS2FPGA_BASE (0xC0000000)
+// Size of 2 MiB, can be as much as 960 MiB
+#define HPS2FPGA_SPAN (0x00200000)
+// Operand buffering in front of systolic_array_buffered. Both channels share the one data FIFO of
+// the read msgdma, which drains in order, so a channel running ahead puts the operands of the
+// other behind its own. One tile is all the board has been shown to run.
+#define HW_READ_LEAD_BYTES (256)
+
+struct _dev_hw_s
+{
+	dev_st dev;
+	int fd_dev_mem;
+	void *virtual_base;
+
+	udmabuf_t udmabuf;
+
+	volatile uint64_t *fifo_instr;
+	volatile uint32_t *fifo_instr_csr;
+	volatile uint32_t *pio_status;
+	volatile uint32_t *systolic_csr;
+
+	struct
+	{
+		volatile uint32_t *csr;
+		volatile uint32_t *descriptor;
+	} read_dma;
+
+	struct
+	{
+		volatile uint32_t *csr;
+		volatile uint64_t *descriptor;
+		volatile uint32_t *fifo_csr;
+	} write_dma;
+};
+
+static uint32_t _read_reg(dev_st *dev, dev_reg_et reg)
+{
+	struct _dev_hw_s *hw = (struct _dev_hw_s *) dev;
+	if (reg <= DEV_REG_SYS_C7) {
+		return *(hw->systolic_csr + (reg - DEV_REG_SYS_STATE));
+	}
+	if (reg <= DEV_REG_WR_CSR3) {
+		return *(hw->write_dma.csr + (reg - DEV_REG_WR_STATUS));
+	}
+	switch (reg) {
+	case DEV_REG_WR_FIFO_FILL:
+		return *(hw->write_dma.fifo_csr);
+	case DEV_REG_RD_STATUS:
+		return *(hw->read_dma.csr);
+	case DEV_REG_RD_FILL:
+		return *(hw->read_dma.csr + 2);
+	case DEV_REG_INSTR_FILL:
+		return *(hw->fifo_instr_csr);
+	default:
+		return 0;
+	}
+}
+
+static void _send_instr(dev_st *dev, uint64_t instr)
+{
+	struct _dev_hw_s *hw = (struct _dev_hw_s *) dev;
+	*(hw->fifo_instr)    = instr;
+}
+
+static void _send_read(dev_st *dev, uint32_t phys_addr, uint32_t n_bytes, uint32_t channel)
+{
+	struct _dev_hw_s *hw           = (struct _dev_hw_s *) dev;
+	*hw->read_dma.descriptor       = phys_addr;
+	*(hw->read_dma.descriptor + 2) = n_bytes;
+	// Go bit and early done enable
+	*(hw->read_dma.descriptor + 3) = (1u << 31) | (1u << 24) | (channel & 0xFF);
+}
+
+static void _send_write(dev_st *dev, uint32_t phys_addr)
+{
+	struct _dev_hw_s *hw        = (struct _dev_hw_s *) dev;
+	*(hw->write_dma.descriptor) = phys_addr;
+}
+
+static int _sync_for_cpu(dev_st *dev, uint32_t offset, uint32_t size)
+{
+	struct _dev_hw_s *hw = (struct _dev_hw_s *) dev;
+	ES_FWD_INT_NM(mu_udmabuf_sync_for_cpu(&hw->udmabuf, offset, size));
+	return 0;
+}
+
+static int _sync_for_device(dev_st *dev, uint32_t offset, uint32_t size)
+{
+	struct _dev_hw_s *hw = (struct _dev_hw_s *) dev;
+	ES_FWD_INT_NM(mu_udmabuf_sync_for_device(&hw->udmabuf, offset, size));
+	return 0;
+}
+
+static void _cleanup(dev_st *dev)
+{
+	struct _dev_hw_s *hw = (struct _dev_hw_s *) dev;
+	if (hw->virtual_base) {
+		munmap(hw->virtual_base, HPS2FPGA_SPAN);
+		hw->virtual_base = NULL;
+	}
+	if (hw->fd_dev_mem >= 0) {
+		int res;
+again:
+		res = close(hw->fd_dev_mem);
+		if (res < 0 && errno == EINTR) {
+			goto again;
+		}
+		hw->fd_dev_mem = -1;
+	}
+	cleanup_udmabuf(&hw->udmabuf);
+	free(hw);
+}
+
+static const struct dev_ops_s _ops = {
+    .name            = "hw",
+    .read_reg        = _read_reg,
+    .send_instr      = _send_instr,
+    .send_read       = _send_read,
+    .send_write      = _send_write,
+    .sync_for_cpu    = _sync_for_cpu,
+    .sync_for_device = _sync_for_device,
+    .cleanup         = _cleanup,
+};
+
+int dev_hw_open(dev_st **dst, int udmabuf_id)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	struct _dev_hw_s *hw;
+	ES_NEW_ASRT_NM(dst);
+	ES_NEW_ASRT_NM(hw = calloc(1, sizeof(*hw)));
+	hw->dev.ops    = &_ops;
+	wt_init(&hw->dev.waiter, NULL);
+	hw->fd_dev_mem = -1;
+	hw->udmabuf    = MU_UDMABUF_EMPTY;
+	dev            = &hw->dev;
+
+	ES_NEW_INT_ERRNO(hw->fd_dev_mem = open("/dev/mem", (O_RDWR | O_SYNC)));
+	hw->virtual_base = mmap(
+	    NULL, HPS2FPGA_SPAN, PROT_READ | PROT_WRITE, MAP_SHARED, hw->fd_dev_mem, HPS2FPGA_BASE);
+	if (hw->virtual_base == MAP_FAILED) {
+		hw->virtual_base = NULL;
+		ES_NEW_ERRNO();
+		return -1;
+	}
+	ES_FWD_INT(mu_get_udmabuf(&hw->udmabuf, udmabuf_id), "Failed to get udmabuf%d", udmabuf_id);
+
+	hw->fifo_instr           = (void *) (hw->virtual_base + FIFO_INSTR_IN_BASE);
+	hw->fifo_instr_csr       = (void *) (hw->virtual_base + FIFO_INSTR_IN_CSR_BASE);
+	hw->pio_status           = (void *) (hw->virtual_base + PIO_0_BASE);
+	hw->systolic_csr         = (void *) (hw->virtual_base + SYSTOLIC_CORE_BASE);
+	hw->read_dma.csr         = (void *) (hw->virtual_base + MSGDMA_READ_CSR_BASE);
+	hw->read_dma.descriptor  = (void *) (hw->virtual_base + MSGDMA_READ_DESCRIPTOR_SLAVE_BASE);
+	hw->write_dma.csr        = (void *) (hw->virtual_base + DMA_WRITE_BASE);
+	hw->write_dma.descriptor = (void *) (hw->virtual_base + DMA_WRITE_FIFO_IN_BASE);
+	hw->write_dma.fifo_csr   = (void *) (hw->virtual_base + DMA_WRITE_FIFO_IN_CSR_BASE);
+
+	hw->dev.virtual_base    = hw->udmabuf.virtual_base;
+	hw->dev.phys_addr       = hw->udmabuf.phys_addr;
+	hw->dev.size            = hw->udmabuf.size;
+	hw->dev.read_lead_bytes = HW_READ_LEAD_BYTES;
+	*dst                    = MOVE_PZ(dev);
+	return 0;
+}
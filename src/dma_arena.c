@@ -0,0 +1,234 @@
+#include "dma_arena.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Region allocator for DMA-able memory.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "errstack.h"
+
+#define _ALIGN_UP(x) (((x) + (DA_ALIGN - 1)) & ~(uint32_t) (DA_ALIGN - 1))
+
+/* A free range, as an offset from the aligned base of the arena */
+typedef struct _da_block_s
+{
+	uint32_t start;
+	uint32_t size;
+} _da_block_t;
+
+struct da_s
+{
+	da_mode_et mode;
+	/* Parent span moved up to the first aligned physical address */
+	da_span_t base;
+	uint32_t used;
+
+	/* Bump mode */
+	uint32_t top;
+
+	/* Free list mode, sorted by start and never adjacent */
+	_da_block_t *blocks;
+	size_t n_blocks;
+	size_t cap_blocks;
+};
+
+da_span_t da_span_of_dev(const dev_st *dev)
+{
+	return (da_span_t){
+	    .virt = dev->virtual_base, .phys = dev->phys_addr, .offset = 0, .size = dev->size};
+}
+
+da_span_t da_span_of_udmabuf(const udmabuf_t *udmabuf)
+{
+	return (da_span_t){.virt   = udmabuf->virtual_base,
+	                   .phys   = udmabuf->phys_addr,
+	                   .offset = 0,
+	                   .size   = udmabuf->size};
+}
+
+static da_span_t _span_at(const da_st *da, uint32_t start, uint32_t size)
+{
+	return (da_span_t){.virt   = (uint8_t *) da->base.virt + start,
+	                   .phys   = da->base.phys + start,
+	                   .offset = da->base.offset + start,
+	                   .size   = size};
+}
+
+static int _insert_block(da_st *da, size_t idx, uint32_t start, uint32_t size)
+{
+	if (da->n_blocks == da->cap_blocks) {
+		const size_t cap = da->cap_blocks ? 2 * da->cap_blocks : 8;
+		_da_block_t *tmp;
+		ES_NEW_ASRT_NM(tmp = realloc(da->blocks, cap * sizeof(*tmp)));
+		da->blocks     = tmp;
+		da->cap_blocks = cap;
+	}
+	memmove(&da->blocks[idx + 1], &da->blocks[idx], (da->n_blocks - idx) * sizeof(*da->blocks));
+	da->blocks[idx] = (_da_block_t){.start = start, .size = size};
+	da->n_blocks++;
+	return 0;
+}
+
+static void _remove_block(da_st *da, size_t idx)
+{
+	memmove(&da->blocks[idx],
+	        &da->blocks[idx + 1],
+	        (da->n_blocks - idx - 1) * sizeof(*da->blocks));
+	da->n_blocks--;
+}
+
+int da_alloc(da_st **dst, const da_span_t *parent, da_mode_et mode)
+{
+	DA_CLEANUP da_st *tmp = NULL;
+	uint32_t skip;
+	ES_NEW_ASRT_NM(dst && parent && parent->virt);
+	ES_NEW_ASRT(mode == DA_MODE_BUMP || mode == DA_MODE_FREE_LIST, "Bad arena mode %d", mode);
+	skip = _ALIGN_UP(parent->phys) - parent->phys;
+	ES_NEW_ASRT(parent->size >= skip + DA_ALIGN,
+	            "Span of %u bytes has no aligned room",
+	            parent->size);
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	tmp->mode = mode;
+	tmp->base = (da_span_t){.virt   = (uint8_t *) parent->virt + skip,
+	                        .phys   = parent->phys + skip,
+	                        .offset = parent->offset + skip,
+	                        .size   = (parent->size - skip) & ~(uint32_t) (DA_ALIGN - 1)};
+	if (mode == DA_MODE_FREE_LIST) {
+		ES_FWD_INT_NM(_insert_block(tmp, 0, 0, tmp->base.size));
+	}
+	*dst = MOVE_PZ(tmp);
+	return 0;
+}
+
+void da_cleanup(da_st **da)
+{
+	if (!*da) {
+		return;
+	}
+	free((*da)->blocks);
+	free(*da);
+	*da = NULL;
+}
+
+void da_reset(da_st *da)
+{
+	da->used     = 0;
+	da->top      = 0;
+	da->n_blocks = 0;
+	if (da->mode == DA_MODE_FREE_LIST) {
+		/* da_alloc reserved room for at least one block */
+		da->blocks[0] = (_da_block_t){.start = 0, .size = da->base.size};
+		da->n_blocks  = 1;
+	}
+}
+
+static int _get_bump(da_st *da, da_span_t *dst, uint32_t size)
+{
+	ES_NEW_ASRT(size <= da->base.size - da->top,
+	            "Arena exhausted: %u bytes requested, %u left",
+	            size,
+	            da->base.size - da->top);
+	*dst = _span_at(da, da->top, size);
+	da->top += size;
+	return 0;
+}
+
+static int _get_free_list(da_st *da, da_span_t *dst, uint32_t size)
+{
+	size_t i;
+	/* First fit keeps long-lived regions packed at the bottom of the buffer */
+	for (i = 0; i < da->n_blocks; i++) {
+		_da_block_t *block = &da->blocks[i];
+		if (block->size < size) {
+			continue;
+		}
+		*dst = _span_at(da, block->start, size);
+		block->start += size;
+		block->size -= size;
+		if (block->size == 0) {
+			_remove_block(da, i);
+		}
+		return 0;
+	}
+	ES_NEW("No free range of %u bytes, largest is %u, %zu fragments",
+	       size,
+	       da_largest_free(da),
+	       da->n_blocks);
+	return -1;
+}
+
+int da_get(da_st *da, da_span_t *dst, uint32_t size)
+{
+	ES_NEW_ASRT_NM(da && dst);
+	ES_NEW_ASRT(size > 0 && size <= da->base.size, "Bad region size %u", size);
+	size = _ALIGN_UP(size);
+	if (da->mode == DA_MODE_BUMP) {
+		ES_FWD_INT_NM(_get_bump(da, dst, size));
+	} else {
+		ES_FWD_INT_NM(_get_free_list(da, dst, size));
+	}
+	da->used += size;
+	return 0;
+}
+
+int da_put(da_st *da, const da_span_t *region)
+{
+	uint32_t start, end;
+	size_t idx;
+	_da_block_t *prev, *next;
+	ES_NEW_ASRT_NM(da && region);
+	ES_NEW_ASRT(da->mode == DA_MODE_FREE_LIST, "da_put needs a free list arena, use da_reset");
+	ES_NEW_ASRT(region->phys >= da->base.phys &&
+	                region->phys - da->base.phys + (uint64_t) region->size <= da->base.size,
+	            "Region 0x%08X is not part of this arena",
+	            region->phys);
+	start = region->phys - da->base.phys;
+	end   = start + region->size;
+	ES_NEW_ASRT(start % DA_ALIGN == 0 && region->size % DA_ALIGN == 0, "Misaligned region");
+
+	for (idx = 0; idx < da->n_blocks && da->blocks[idx].start < start; idx++) {
+	}
+	prev = idx > 0 ? &da->blocks[idx - 1] : NULL;
+	next = idx < da->n_blocks ? &da->blocks[idx] : NULL;
+	ES_NEW_ASRT(!prev || prev->start + prev->size <= start, "Double put at 0x%08X", region->phys);
+	ES_NEW_ASRT(!next || end <= next->start, "Double put at 0x%08X", region->phys);
+
+	if (prev && prev->start + prev->size == start) {
+		prev->size += region->size;
+		if (next && end == next->start) {
+			prev->size += next->size;
+			_remove_block(da, idx);
+		}
+	} else if (next && end == next->start) {
+		next->start = start;
+		next->size += region->size;
+	} else {
+		ES_FWD_INT_NM(_insert_block(da, idx, start, region->size));
+	}
+	da->used -= region->size;
+	return 0;
+}
+
+uint32_t da_used(const da_st *da)
+{
+	return da->used;
+}
+
+uint32_t da_largest_free(const da_st *da)
+{
+	uint32_t largest = 0;
+	size_t i;
+	if (da->mode == DA_MODE_BUMP) {
+		return da->base.size - da->top;
+	}
+	for (i = 0; i < da->n_blocks; i++) {
+		largest = MAX(largest, da->blocks[i].size);
+	}
+	return largest;
+}
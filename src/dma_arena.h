@@ -0,0 +1,90 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Carves regions out of DMA-able memory (a udmabuf or a whole device). Every region knows its
+ * virtual address, its physical address and its offset into the buffer, which is what the sync
+ * calls take. Two modes:
+ *    - bump: O(1) allocation, everything is released at once by da_reset. For per-inference
+ *      scratch.
+ *    - free list: regions are returned one by one with da_put and neighbours coalesce. For
+ *      long-lived data such as weights.
+ *
+ * How to:
+ * 1. Describe the parent memory with da_span_of_dev or da_span_of_udmabuf
+ * 2. da_alloc an arena over it
+ * 3. da_get regions, then da_reset or da_put them
+ */
+
+#include <stdint.h>
+
+#include "device.h"
+#include "memory_utils.h"
+
+/* The msgdma moves 256-bit words, so regions start on a 32 byte boundary */
+#define DA_ALIGN (32)
+
+typedef enum da_mode_e
+{
+	DA_MODE_BUMP,
+	DA_MODE_FREE_LIST,
+} da_mode_et;
+
+/* A contiguous piece of DMA-able memory */
+typedef struct da_span_s
+{
+	void *virt;
+	uint32_t phys;
+	/* Offset into the owning buffer, as taken by dev_sync_* and mu_udmabuf_sync_* */
+	uint32_t offset;
+	uint32_t size;
+} da_span_t;
+
+struct da_s;
+typedef struct da_s da_st;
+
+da_span_t da_span_of_dev(const dev_st *dev);
+da_span_t da_span_of_udmabuf(const udmabuf_t *udmabuf);
+
+/**
+ * @brief Create an arena over parent. The start of parent is aligned up to DA_ALIGN.
+ *
+ * @param dst Where to store the arena
+ * @param parent The memory to hand out, the arena does not own it
+ * @param mode DA_MODE_BUMP or DA_MODE_FREE_LIST
+ * @return 0 on success, < 0 on failure
+ */
+int da_alloc(da_st **dst, const da_span_t *parent, da_mode_et mode);
+void da_cleanup(da_st **da);
+
+#define DA_CLEANUP CLEANUP(da_cleanup)
+
+/**
+ * @brief Take size bytes (rounded up to DA_ALIGN) from the arena.
+ *
+ * @param da Working arena
+ * @param dst The region, dst->size is the rounded size
+ * @param size Requested size in bytes
+ * @return 0 on success, < 0 if there is no free range large enough
+ */
+int da_get(da_st *da, da_span_t *dst, uint32_t size);
+
+/**
+ * @brief Give a region back. Only valid in DA_MODE_FREE_LIST.
+ *
+ * @param da Working arena
+ * @param region A region returned by da_get on this arena
+ * @return 0 on success, < 0 if the region does not belong to the arena or overlaps a free range
+ */
+int da_put(da_st *da, const da_span_t *region);
+
+/* Release every region at once. Valid in both modes. */
+void da_reset(da_st *da);
+
+/* Bytes handed out and not yet returned */
+uint32_t da_used(const da_st *da);
+/* Largest single region da_get could return right now */
+uint32_t da_largest_free(const da_st *da);
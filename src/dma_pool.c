@@ -0,0 +1,227 @@
+#include "dma_pool.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Placement of tensors over several DMA-able regions.
+ */
+
+#include <stdlib.h>
+
+#include "errstack.h"
+
+typedef struct _dp_region_s
+{
+	da_span_t span;
+	uint32_t uses;
+	da_st *arena;
+	/* Exactly one of these backs the region */
+	udmabuf_t udmabuf;
+	dev_st *dev;
+} _dp_region_t;
+
+struct dp_s
+{
+	_dp_region_t regions[DP_MAX_REGIONS];
+	size_t n_regions;
+};
+
+int dp_alloc(dp_st **dst)
+{
+	dp_st *tmp;
+	ES_NEW_ASRT_NM(dst);
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	*dst = tmp;
+	return 0;
+}
+
+void dp_cleanup(dp_st **pool)
+{
+	size_t i;
+	if (!*pool) {
+		return;
+	}
+	for (i = 0; i < (*pool)->n_regions; i++) {
+		da_cleanup(&(*pool)->regions[i].arena);
+		cleanup_udmabuf(&(*pool)->regions[i].udmabuf);
+	}
+	free(*pool);
+	*pool = NULL;
+}
+
+static int _add_region(dp_st *pool, const da_span_t *span, uint32_t uses, _dp_region_t **dst)
+{
+	_dp_region_t *region;
+	ES_NEW_ASRT(pool->n_regions < DP_MAX_REGIONS, "Pool is full");
+	ES_NEW_ASRT(uses && (uses & ~DP_USE_ANY) == 0, "Bad uses mask 0x%x", uses);
+	region  = &pool->regions[pool->n_regions];
+	*region = (_dp_region_t){.span = *span, .uses = uses, .udmabuf = MU_UDMABUF_EMPTY};
+	ES_FWD_INT_NM(da_alloc(&region->arena, span, DA_MODE_FREE_LIST));
+	pool->n_regions++;
+	*dst = region;
+	return 0;
+}
+
+int dp_add_udmabufs(dp_st *pool, uint32_t id_mask, uint32_t uses)
+{
+	int id, n_added = 0;
+	ES_NEW_ASRT_NM(pool);
+	for (id = 0; id < MU_UDMABUF_MAX; id++) {
+		CLEANUP(cleanup_udmabuf) udmabuf_t udmabuf = MU_UDMABUF_EMPTY;
+		_dp_region_t *region;
+		da_span_t span;
+		if (!(id_mask & (1u << id)) || !mu_udmabuf_exists(id)) {
+			continue;
+		}
+		ES_FWD_INT(mu_get_udmabuf(&udmabuf, id), "Could not open udmabuf%d", id);
+		span = da_span_of_udmabuf(&udmabuf);
+		ES_FWD_INT(_add_region(pool, &span, uses, &region), "udmabuf%d", id);
+		region->udmabuf = udmabuf;
+		udmabuf         = MU_UDMABUF_EMPTY;
+		n_added++;
+	}
+	return n_added;
+}
+
+int dp_add_dev_span(dp_st *pool, dev_st *dev, const da_span_t *span, uint32_t uses)
+{
+	_dp_region_t *region;
+	ES_NEW_ASRT_NM(pool && dev && span);
+	ES_NEW_ASRT(span->phys >= dev->phys_addr &&
+	                span->phys - dev->phys_addr + (uint64_t) span->size <= dev->size,
+	            "Span is not part of the device memory");
+	ES_FWD_INT_NM(_add_region(pool, span, uses, &region));
+	region->dev = dev;
+	return pool->n_regions - 1;
+}
+
+/* Region with the largest free range among those matching mask, -1 if none has size bytes */
+static int _pick_region(const dp_st *pool, uint32_t size, uint32_t mask)
+{
+	uint32_t best_free = 0;
+	int best           = -1;
+	size_t i;
+	for (i = 0; i < pool->n_regions; i++) {
+		const uint32_t free_bytes = da_largest_free(pool->regions[i].arena);
+		if (!(pool->regions[i].uses & mask) || free_bytes < size || free_bytes <= best_free) {
+			continue;
+		}
+		best_free = free_bytes;
+		best      = i;
+	}
+	return best;
+}
+
+int dp_get(dp_st *pool, dp_buf_t *dst, uint32_t size, dp_use_et use)
+{
+	const uint32_t rounded = (size + DA_ALIGN - 1) & ~(uint32_t) (DA_ALIGN - 1);
+	int region;
+	ES_NEW_ASRT_NM(pool && dst);
+	ES_NEW_ASRT(pool->n_regions, "Pool has no regions");
+	region = _pick_region(pool, rounded, use);
+	if (region < 0) {
+		/* Spill into whatever has room */
+		region = _pick_region(pool, rounded, DP_USE_ANY);
+	}
+	ES_NEW_ASRT(region >= 0, "No region has %u free bytes", rounded);
+	ES_FWD_INT_NM(da_get(pool->regions[region].arena, &dst->span, size));
+	dst->region = region;
+	return 0;
+}
+
+int dp_put(dp_st *pool, const dp_buf_t *buf)
+{
+	ES_NEW_ASRT_NM(pool && buf);
+	ES_NEW_ASRT(buf->region >= 0 && (size_t) buf->region < pool->n_regions,
+	            "Bad region %d",
+	            buf->region);
+	ES_FWD_INT_NM(da_put(pool->regions[buf->region].arena, &buf->span));
+	return 0;
+}
+
+static _dp_region_t *_region_of_buf(dp_st *pool, const dp_buf_t *buf)
+{
+	if (!pool || !buf || buf->region < 0 || (size_t) buf->region >= pool->n_regions) {
+		return NULL;
+	}
+	return &pool->regions[buf->region];
+}
+
+int dp_sync_for_cpu(dp_st *pool, const dp_buf_t *buf)
+{
+	_dp_region_t *region = _region_of_buf(pool, buf);
+	ES_NEW_ASRT(region, "Buffer does not belong to the pool");
+	if (region->dev) {
+		ES_FWD_INT_NM(dev_sync_for_cpu(region->dev, buf->span.offset, buf->span.size));
+	} else {
+		ES_FWD_INT_NM(
+		    mu_udmabuf_sync_for_cpu(&region->udmabuf, buf->span.offset, buf->span.size));
+	}
+	return 0;
+}
+
+int dp_sync_for_device(dp_st *pool, const dp_buf_t *buf)
+{
+	_dp_region_t *region = _region_of_buf(pool, buf);
+	ES_NEW_ASRT(region, "Buffer does not belong to the pool");
+	if (region->dev) {
+		ES_FWD_INT_NM(dev_sync_for_device(region->dev, buf->span.offset, buf->span.size));
+	} else {
+		ES_FWD_INT_NM(
+		    mu_udmabuf_sync_for_device(&region->udmabuf, buf->span.offset, buf->span.size));
+	}
+	return 0;
+}
+
+int dp_region_of_phys(const dp_st *pool, uint32_t phys)
+{
+	size_t i;
+	for (i = 0; i < pool->n_regions; i++) {
+		const da_span_t *span = &pool->regions[i].span;
+		if (phys >= span->phys && phys - span->phys < span->size) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int dp_region_of_virt(const dp_st *pool, const void *virt)
+{
+	size_t i;
+	for (i = 0; i < pool->n_regions; i++) {
+		const da_span_t *span = &pool->regions[i].span;
+		if ((const uint8_t *) virt >= (uint8_t *) span->virt &&
+		    (size_t) ((const uint8_t *) virt - (uint8_t *) span->virt) < span->size) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void *dp_phys_to_virt(const dp_st *pool, uint32_t phys)
+{
+	const int region = dp_region_of_phys(pool, phys);
+	const da_span_t *span;
+	if (region < 0) {
+		return NULL;
+	}
+	span = &pool->regions[region].span;
+	return (uint8_t *) span->virt + (phys - span->phys);
+}
+
+size_t dp_n_regions(const dp_st *pool)
+{
+	return pool->n_regions;
+}
+
+da_span_t dp_region_span(const dp_st *pool, size_t region)
+{
+	return pool->regions[region].span;
+}
+
+uint32_t dp_region_used(const dp_st *pool, size_t region)
+{
+	return da_used(pool->regions[region].arena);
+}
@@ -0,0 +1,92 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * A pool of DMA-able regions, each one physically contiguous but not contiguous with the others.
+ * The regions are normally the udmabuf devices the kernel module was loaded with, plus optionally
+ * part of the memory of an open device. Every region is managed by a free list arena and tagged
+ * with the kinds of tensors it should hold, so weights and activations can live in different
+ * buffers (and therefore reach SDRAM over different ports). When the preferred regions are full,
+ * allocations spill into any region with room.
+ *
+ * How to:
+ * 1. dp_alloc an empty pool
+ * 2. dp_add_udmabufs and/or dp_add_dev_span to give it memory
+ * 3. dp_get / dp_put buffers, dp_sync_* them around device accesses
+ */
+
+#include <stdint.h>
+
+#include "device.h"
+#include "dma_arena.h"
+
+#define DP_MAX_REGIONS (MU_UDMABUF_MAX)
+
+/* What a region is meant to hold, as a bit mask */
+typedef enum dp_use_e
+{
+	DP_USE_ACTIVATIONS = 1 << 0,
+	DP_USE_WEIGHTS     = 1 << 1,
+	DP_USE_ANY         = DP_USE_ACTIVATIONS | DP_USE_WEIGHTS,
+} dp_use_et;
+
+typedef struct dp_buf_s
+{
+	da_span_t span;
+	/* Index of the owning region */
+	int region;
+} dp_buf_t;
+
+struct dp_s;
+typedef struct dp_s dp_st;
+
+int dp_alloc(dp_st **dst);
+void dp_cleanup(dp_st **pool);
+
+#define DP_CLEANUP CLEANUP(dp_cleanup)
+
+/**
+ * @brief Open every udmabuf in id_mask that exists and add it as a region.
+ *
+ * @param pool Working pool
+ * @param id_mask Bit i selects udmabuf<i>
+ * @param uses dp_use_et mask for the new regions
+ * @return Number of regions added, < 0 on failure
+ */
+int dp_add_udmabufs(dp_st *pool, uint32_t id_mask, uint32_t uses);
+
+/**
+ * @brief Add part of a device's memory as a region. Syncs go through the device.
+ *
+ * @param pool Working pool
+ * @param dev The device, must outlive the pool
+ * @param span A span of the device memory, e.g. what is left after the device's own staging
+ * @param uses dp_use_et mask for the new region
+ * @return Index of the region, < 0 on failure
+ */
+int dp_add_dev_span(dp_st *pool, dev_st *dev, const da_span_t *span, uint32_t uses);
+
+/**
+ * @brief Take size bytes, preferring regions tagged with use. Among candidates the one with the
+ * largest free range wins, which spreads tensors over the regions.
+ *
+ * @return 0 on success, < 0 if no region has room
+ */
+int dp_get(dp_st *pool, dp_buf_t *dst, uint32_t size, dp_use_et use);
+int dp_put(dp_st *pool, const dp_buf_t *buf);
+
+int dp_sync_for_cpu(dp_st *pool, const dp_buf_t *buf);
+int dp_sync_for_device(dp_st *pool, const dp_buf_t *buf);
+
+/* Translate through every region, NULL / -1 if the address is not in the pool */
+void *dp_phys_to_virt(const dp_st *pool, uint32_t phys);
+int dp_region_of_phys(const dp_st *pool, uint32_t phys);
+int dp_region_of_virt(const dp_st *pool, const void *virt);
+
+size_t dp_n_regions(const dp_st *pool);
+/* The whole span of a region */
+da_span_t dp_region_span(const dp_st *pool, size_t region);
+uint32_t dp_region_used(const dp_st *pool, size_t region);
@@ -0,0 +1,210 @@
+#include "flatbuffer.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Bounds checked FlatBuffers reader.
+ */
+
+#include <string.h>
+
+#include "errstack.h"
+#include "util.h"
+
+/* size bytes at pos are inside the buffer */
+static bool _in(const fb_t *fb, uint64_t pos, uint64_t size)
+{
+	return pos <= fb->size && size <= fb->size - pos;
+}
+
+static uint16_t _read_u16(const fb_t *fb, uint32_t pos)
+{
+	uint16_t v;
+	memcpy(&v, &fb->buf[pos], sizeof(v));
+	return v;
+}
+
+static uint32_t _read_u32(const fb_t *fb, uint32_t pos)
+{
+	uint32_t v;
+	memcpy(&v, &fb->buf[pos], sizeof(v));
+	return v;
+}
+
+/* Position of the table at pos, with its vtable checked */
+static int _table_at(fb_table_t *dst, const fb_t *fb, uint32_t pos)
+{
+	int64_t vtable;
+	memset(dst, 0, sizeof(*dst));
+	dst->fb = fb;
+	ES_NEW_ASRT(_in(fb, pos, 4) && pos % 4 == 0, "Table at 0x%x is out of bounds", pos);
+	vtable = (int64_t) pos - (int32_t) _read_u32(fb, pos);
+	ES_NEW_ASRT(vtable >= 0 && _in(fb, vtable, 4) && vtable % 2 == 0,
+	            "Table at 0x%x has a bad vtable",
+	            pos);
+	dst->pos         = pos;
+	dst->vtable      = (uint32_t) vtable;
+	dst->vtable_size = _read_u16(fb, dst->vtable);
+	dst->table_size  = _read_u16(fb, dst->vtable + 2);
+	ES_NEW_ASRT(dst->vtable_size >= 4 && dst->vtable_size % 2 == 0 &&
+	                _in(fb, dst->vtable, dst->vtable_size) && dst->table_size >= 4 &&
+	                _in(fb, pos, dst->table_size),
+	            "Table at 0x%x is truncated",
+	            pos);
+	return 0;
+}
+
+/* Offset of a field inside its table, 0 when missing */
+static uint16_t _field(const fb_table_t *table, unsigned field)
+{
+	const uint32_t entry = 4 + 2 * field;
+	if (entry + 2 > table->vtable_size) {
+		return 0;
+	}
+	return _read_u16(table->fb, table->vtable + entry);
+}
+
+/* Position of a scalar field of size bytes, 0 when missing or not inside its table */
+static uint32_t _scalar(const fb_table_t *table, unsigned field, size_t size)
+{
+	const uint16_t off = _field(table, field);
+	if (off == 0 || off < 4 || (size_t) off + size > table->table_size) {
+		return 0;
+	}
+	return table->pos + off;
+}
+
+/* Follow the uoffset stored at pos */
+static int _follow(uint32_t *dst, const fb_t *fb, uint32_t pos)
+{
+	uint64_t target;
+	ES_NEW_ASRT(_in(fb, pos, 4), "Offset at 0x%x is out of bounds", pos);
+	target = (uint64_t) pos + _read_u32(fb, pos);
+	ES_NEW_ASRT(_in(fb, target, 4), "Offset at 0x%x points out of the buffer", pos);
+	*dst = (uint32_t) target;
+	return 0;
+}
+
+int fb_root(fb_table_t *dst, const fb_t *fb, const char *identifier)
+{
+	uint32_t pos;
+	ES_NEW_ASRT_NM(dst && fb && fb->buf);
+	ES_NEW_ASRT(fb->size >= 8 && fb->size < UINT32_MAX, "Buffer of %zu bytes", fb->size);
+	if (identifier) {
+		ES_NEW_ASRT(memcmp(&fb->buf[4], identifier, 4) == 0,
+		            "File identifier is not %.4s",
+		            identifier);
+	}
+	ES_FWD_INT_NM(_follow(&pos, fb, 0));
+	ES_FWD_INT_NM(_table_at(dst, fb, pos));
+	return 0;
+}
+
+bool fb_has(const fb_table_t *table, unsigned field)
+{
+	return _field(table, field) != 0;
+}
+
+int fb_table(fb_table_t *dst, const fb_table_t *table, unsigned field)
+{
+	const uint32_t at = _scalar(table, field, 4);
+	uint32_t pos;
+	if (!at) {
+		memset(dst, 0, sizeof(*dst));
+		dst->fb = table->fb;
+		return 0;
+	}
+	ES_FWD_INT_NM(_follow(&pos, table->fb, at));
+	ES_FWD_INT_NM(_table_at(dst, table->fb, pos));
+	return 1;
+}
+
+int fb_vector(fb_vector_t *dst, const fb_table_t *table, unsigned field, size_t elem_size)
+{
+	const uint32_t at = _scalar(table, field, 4);
+	uint32_t pos;
+	memset(dst, 0, sizeof(*dst));
+	dst->fb        = table->fb;
+	dst->elem_size = elem_size;
+	if (!at) {
+		return 0;
+	}
+	ES_FWD_INT_NM(_follow(&pos, table->fb, at));
+	dst->len = _read_u32(table->fb, pos);
+	dst->pos = pos + 4;
+	ES_NEW_ASRT(_in(table->fb, dst->pos, (uint64_t) dst->len * elem_size),
+	            "Vector of %u elements at 0x%x is truncated",
+	            dst->len,
+	            pos);
+	return 1;
+}
+
+int fb_string(const char **str, size_t *len, const fb_table_t *table, unsigned field)
+{
+	fb_vector_t chars;
+	int present;
+	ES_FWD_INT_NM(present = fb_vector(&chars, table, field, 1));
+	*str = "";
+	*len = 0;
+	if (!present) {
+		return 0;
+	}
+	ES_NEW_ASRT(_in(table->fb, chars.pos, (uint64_t) chars.len + 1) &&
+	                table->fb->buf[chars.pos + chars.len] == 0,
+	            "String at 0x%x is not terminated",
+	            chars.pos);
+	*str = (const char *) &table->fb->buf[chars.pos];
+	*len = chars.len;
+	return 1;
+}
+
+#define _SCALAR_GETTER(name, type)                                                                 \
+	type name(const fb_table_t *table, unsigned field, type def)                                   \
+	{                                                                                              \
+		const uint32_t at = _scalar(table, field, sizeof(type));                                   \
+		type v;                                                                                    \
+		if (!at) {                                                                                 \
+			return def;                                                                            \
+		}                                                                                          \
+		memcpy(&v, &table->fb->buf[at], sizeof(v));                                                \
+		return v;                                                                                  \
+	}
+
+_SCALAR_GETTER(fb_u8, uint8_t)
+_SCALAR_GETTER(fb_i8, int8_t)
+_SCALAR_GETTER(fb_u32, uint32_t)
+_SCALAR_GETTER(fb_i32, int32_t)
+_SCALAR_GETTER(fb_u64, uint64_t)
+_SCALAR_GETTER(fb_f32, float)
+
+#define _ELEMENT_GETTER(name, type)                                                                \
+	type name(const fb_vector_t *vector, size_t i)                                                 \
+	{                                                                                              \
+		type v;                                                                                    \
+		memcpy(&v, &vector->fb->buf[vector->pos + i * sizeof(type)], sizeof(v));                   \
+		return v;                                                                                  \
+	}
+
+_ELEMENT_GETTER(fb_vector_u8, uint8_t)
+_ELEMENT_GETTER(fb_vector_i32, int32_t)
+_ELEMENT_GETTER(fb_vector_i64, int64_t)
+_ELEMENT_GETTER(fb_vector_f32, float)
+
+const void *fb_vector_data(const fb_vector_t *vector)
+{
+	return &vector->fb->buf[vector->pos];
+}
+
+int fb_vector_table(fb_table_t *dst, const fb_vector_t *vector, size_t i)
+{
+	uint32_t pos;
+	ES_NEW_ASRT(i < vector->len && vector->elem_size == 4,
+	            "Element %zu of a vector of %u",
+	            i,
+	            vector->len);
+	ES_FWD_INT_NM(_follow(&pos, vector->fb, vector->pos + i * 4));
+	ES_FWD_INT_NM(_table_at(dst, vector->fb, pos));
+	return 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Read-only access to FlatBuffers, enough to walk a schema by hand without generated code. Every
+ * offset is checked against the buffer before it is followed, so a truncated or hostile file makes
+ * the accessors fail instead of reading out of bounds.
+ *
+ * Fields are addressed by their id in the schema (declaration order, a union takes two ids: the
+ * type and the value). A missing field reads as its default, a missing table as a table whose
+ * fields are all missing and a missing vector as an empty one, which is also what the format means
+ * by leaving them out.
+ *
+ * Scalars are read as little endian in host order, which both the HPS and x86 hosts are.
+ *
+ * How to:
+ * 1. fb_root on the whole file
+ * 2. fb_table / fb_vector / fb_string to follow fields, fb_vector_table for vectors of tables
+ * 3. fb_u8 ... fb_f32 for scalar fields, fb_vector_i32 ... for vector elements
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct fb_s
+{
+	const uint8_t *buf;
+	size_t size;
+} fb_t;
+
+typedef struct fb_table_s
+{
+	const fb_t *fb;
+	/* Position of the table, its fields are at pos + vtable entry */
+	uint32_t pos;
+	uint32_t vtable;
+	/* Bytes of vtable, 0 for a missing table */
+	uint16_t vtable_size;
+	/* Bytes of inline table data starting at pos */
+	uint16_t table_size;
+} fb_table_t;
+
+typedef struct fb_vector_s
+{
+	const fb_t *fb;
+	/* Position of the first element */
+	uint32_t pos;
+	uint32_t len;
+	size_t elem_size;
+} fb_vector_t;
+
+/**
+ * @brief Open the root table of a buffer.
+ *
+ * @param identifier 4 character file identifier to check, NULL to skip
+ */
+int fb_root(fb_table_t *dst, const fb_t *fb, const char *identifier);
+
+bool fb_has(const fb_table_t *table, unsigned field);
+
+/**
+ * @return 1 if the field was present, 0 if dst is the missing table, < 0 on a malformed buffer
+ */
+int fb_table(fb_table_t *dst, const fb_table_t *table, unsigned field);
+/**
+ * @param elem_size Size of an element: the scalar size, or 4 for vectors of tables and strings
+ * @return 1 if the field was present, 0 if dst is empty, < 0 on a malformed buffer
+ */
+int fb_vector(fb_vector_t *dst, const fb_table_t *table, unsigned field, size_t elem_size);
+/**
+ * @param str Set to the NUL terminated string, "" when missing
+ */
+int fb_string(const char **str, size_t *len, const fb_table_t *table, unsigned field);
+
+/* Scalar fields, def when the field is missing */
+uint8_t fb_u8(const fb_table_t *table, unsigned field, uint8_t def);
+int8_t fb_i8(const fb_table_t *table, unsigned field, int8_t def);
+uint32_t fb_u32(const fb_table_t *table, unsigned field, uint32_t def);
+int32_t fb_i32(const fb_table_t *table, unsigned field, int32_t def);
+uint64_t fb_u64(const fb_table_t *table, unsigned field, uint64_t def);
+float fb_f32(const fb_table_t *table, unsigned field, float def);
+
+/* Elements of scalar vectors, i < len */
+uint8_t fb_vector_u8(const fb_vector_t *vector, size_t i);
+int32_t fb_vector_i32(const fb_vector_t *vector, size_t i);
+int64_t fb_vector_i64(const fb_vector_t *vector, size_t i);
+float fb_vector_f32(const fb_vector_t *vector, size_t i);
+/* The elements of a vector of scalars as they sit in the buffer */
+const void *fb_vector_data(const fb_vector_t *vector);
+
+int fb_vector_table(fb_table_t *dst, const fb_vector_t *vector, size_t i);
@@ -0,0 +1,424 @@
+#include "gemm.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * General int8 matrix multiplication built out of SA_DIM x SA_DIM systolic array tiles.
+ */
+
+#include <sched.h>
+#include <string.h>
+
+#include "dma_arena.h"
+#include "errstack.h"
+#include "job_queue.h"
+#include "pack.h"
+#include "util.h"
+
+/* Array instructions per tile of C and K: every left digit times every right digit */
+#define _N_PRODUCTS (PK_N_DIGITS * PK_N_DIGITS)
+
+/* Tiles of a staging slot: the digit products, then the left digits, then the right digits */
+enum _stage_slot_e
+{
+	_STAGE_DST   = 0,
+	_STAGE_LEFT  = _STAGE_DST + _N_PRODUCTS,
+	_STAGE_RIGHT = _STAGE_LEFT + PK_N_DIGITS,
+	_STAGE_MAX   = _STAGE_RIGHT + PK_N_DIGITS,
+};
+
+/*
+ * The right digits carry an offset of PK_DIGIT_OFFSET, so the tiles add up to
+ * A x (B + PK_DIGIT_OFFSET). C starts out at the correction, -PK_DIGIT_OFFSET times the row sums of
+ * A, which needs neither B nor its column sums.
+ */
+static void _init_offset(int32_t *c, const int8_t *a, size_t m, size_t k, size_t n)
+{
+	size_t i, j, l;
+	for (i = 0; i < m; i++) {
+		int32_t sum = 0;
+		for (l = 0; l < k; l++) {
+			sum += a[i * k + l];
+		}
+		for (j = 0; j < n; j++) {
+			c[i * n + j] = -PK_DIGIT_OFFSET * sum;
+		}
+	}
+}
+
+/* Add the digit products of one tile into its rows x cols block of C */
+static void _accumulate_products(int32_t *block,
+                                 size_t ld,
+                                 const matrix_t *products,
+                                 size_t rows,
+                                 size_t cols)
+{
+	matrix32_t sum;
+	pk_digits_combine(&sum, products);
+	pk_accumulate32_col_major(block, ld, &sum, rows, cols);
+}
+
+/* Multiply the digits in stage[_STAGE_LEFT] and stage[_STAGE_RIGHT] into stage[_STAGE_DST] */
+typedef int (*_tile_mult_ft)(void *ctx, matrix_t *stage);
+
+static int _gemm_tiled(_tile_mult_ft mult,
+                       void *ctx,
+                       matrix_t *stage,
+                       int32_t *c,
+                       const int8_t *a,
+                       const int8_t *b,
+                       size_t m,
+                       size_t k,
+                       size_t n)
+{
+	matrix_t tile;
+	size_t mi, ni, ki;
+	ES_NEW_ASRT_NM(c && a && b);
+	ES_NEW_ASRT(k <= GEMM_MAX_K, "K %zu is too deep", k);
+	_init_offset(c, a, m, k, n);
+	for (mi = 0; mi < PK_N_TILES(m); mi++) {
+		const size_t rows = MIN(m - mi * SA_DIM, (size_t) SA_DIM);
+		for (ni = 0; ni < PK_N_TILES(n); ni++) {
+			const size_t cols = MIN(n - ni * SA_DIM, (size_t) SA_DIM);
+			for (ki = 0; ki < PK_N_TILES(k); ki++) {
+				const size_t depth = MIN(k - ki * SA_DIM, (size_t) SA_DIM);
+				pk_tile_col_major(&tile, &a[mi * SA_DIM * k + ki * SA_DIM], k, rows, depth);
+				pk_digits_signed(&stage[_STAGE_LEFT], &tile);
+				pk_tile_row_major(&tile, &b[ki * SA_DIM * n + ni * SA_DIM], n, depth, cols);
+				pk_digits_offset(&stage[_STAGE_RIGHT], &tile);
+				ES_FWD_INT(mult(ctx, stage), "Tile (%zu, %zu, %zu) failed", mi, ni, ki);
+				_accumulate_products(
+				    &c[mi * SA_DIM * n + ni * SA_DIM], n, &stage[_STAGE_DST], rows, cols);
+			}
+		}
+	}
+	return 0;
+}
+
+static int _tile_mult_ref(UNUSED void *ctx, matrix_t *stage)
+{
+	size_t i, j;
+	for (i = 0; i < PK_N_DIGITS; i++) {
+		for (j = 0; j < PK_N_DIGITS; j++) {
+			matrix_mult16_ref(&stage[_STAGE_DST + i * PK_N_DIGITS + j],
+			                  &stage[_STAGE_LEFT + i],
+			                  &stage[_STAGE_RIGHT + j]);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Position and extent of the t-th tile product, in (ni, ki, mi) order with mi innermost: each
+ * tile of B meets every row tile of A (every sample of a batch) before the next, so its packed copy
+ * in the staging slots is reused by all of them. b_tile is the index of the B tile, (ni, ki) in the
+ * same order.
+ */
+typedef struct _tile_s
+{
+	size_t mi, ni, ki;
+	size_t rows, cols, depth;
+	size_t b_tile;
+} _tile_t;
+
+static _tile_t _tile_at(size_t t, size_t m, size_t k, size_t n)
+{
+	_tile_t tile;
+	tile.mi     = t % PK_N_TILES(m);
+	tile.b_tile = t / PK_N_TILES(m);
+	tile.ki     = tile.b_tile % PK_N_TILES(k);
+	tile.ni     = tile.b_tile / PK_N_TILES(k);
+	tile.rows   = MIN(m - tile.mi * SA_DIM, (size_t) SA_DIM);
+	tile.cols   = MIN(n - tile.ni * SA_DIM, (size_t) SA_DIM);
+	tile.depth  = MIN(k - tile.ki * SA_DIM, (size_t) SA_DIM);
+	return tile;
+}
+
+typedef struct _pipeline_s
+{
+	dev_st *dev;
+	jq_st *jq;
+	/* depth slots of _STAGE_MAX tiles */
+	da_span_t span;
+	size_t depth;
+	/* Last job of the tile in each slot */
+	jq_handle_t handles[GEMM_PIPELINE_MAX_DEPTH];
+	/* Run on a block of C after its last K tile, may be NULL */
+	gemm_epilogue_ft epilogue;
+	void *arg;
+	size_t k_tiles;
+	/* B is already tiled in device memory at b_tiles_phys, only A is packed */
+	bool pretiled;
+	uint32_t b_tiles_phys;
+} _pipeline_t;
+
+/* Index of a stage in the span, in matrix_t */
+static size_t _slot_index(size_t slot, int stage)
+{
+	return slot * _STAGE_MAX + stage;
+}
+
+static matrix_t *_slot_virt(const _pipeline_t *pl, size_t slot, int stage)
+{
+	return (matrix_t *) pl->span.virt + _slot_index(slot, stage);
+}
+
+static uint32_t _slot_phys(const _pipeline_t *pl, size_t slot, int stage)
+{
+	return pl->span.phys + _slot_index(slot, stage) * sizeof(matrix_t);
+}
+
+static uint32_t _slot_offset(const _pipeline_t *pl, size_t slot, int stage)
+{
+	return pl->span.offset + _slot_index(slot, stage) * sizeof(matrix_t);
+}
+
+/* Digits of tile (ki, ni) of a B laid out by pk_matrix_row_major_digits */
+static uint32_t _pretiled_phys(const _pipeline_t *pl, const _tile_t *tile, size_t n)
+{
+	const size_t index = (tile->ki * PK_N_TILES(n) + tile->ni) * PK_N_DIGITS;
+	return pl->b_tiles_phys + index * sizeof(matrix_t);
+}
+
+/*
+ * Host side, stage 1: pack and split tile t into its slot, hand the digits to the device and queue
+ * the _N_PRODUCTS jobs of the tile.
+ *
+ * The right stage of slot b_tile % depth caches the packed B tile, which is only packed and synced
+ * by the first tile that uses it. The jobs that last used that stage belong to b_tile - depth, and
+ * at least depth - 1 tiles of the B tiles in between separate them from tile t, so they have been
+ * retired before t is issued.
+ *
+ * The jobs run with the right digit outermost, so the left digits of consecutive jobs are
+ * contiguous and share a read descriptor.
+ */
+static int _pipeline_issue(_pipeline_t *pl,
+                           size_t t,
+                           const _tile_t *tile,
+                           const int8_t *a,
+                           const int8_t *b,
+                           size_t k,
+                           size_t n)
+{
+	const size_t slot        = t % pl->depth;
+	const size_t b_slot      = tile->b_tile % pl->depth;
+	const bool new_b         = !pl->pretiled && tile->mi == 0;
+	const uint32_t right     = pl->pretiled ? _pretiled_phys(pl, tile, n)
+	                                        : _slot_phys(pl, b_slot, _STAGE_RIGHT);
+	mu_sync_range_t ranges[2] = {
+	    {_slot_offset(pl, slot, _STAGE_LEFT), PK_N_DIGITS * sizeof(matrix_t)},
+	    {_slot_offset(pl, b_slot, _STAGE_RIGHT), PK_N_DIGITS * sizeof(matrix_t)},
+	};
+	jq_job_t jobs[_N_PRODUCTS];
+	matrix_t packed;
+	size_t i, j, done;
+	int ret = 0;
+	pk_tile_col_major(
+	    &packed, &a[tile->mi * SA_DIM * k + tile->ki * SA_DIM], k, tile->rows, tile->depth);
+	pk_digits_signed(_slot_virt(pl, slot, _STAGE_LEFT), &packed);
+	if (new_b) {
+		pk_tile_row_major(
+		    &packed, &b[tile->ki * SA_DIM * n + tile->ni * SA_DIM], n, tile->depth, tile->cols);
+		pk_digits_offset(_slot_virt(pl, b_slot, _STAGE_RIGHT), &packed);
+	}
+	/* Only what was packed, the other stages are owned by the device or still being read */
+	ES_FWD_INT_NM(dev_sync_ranges_for_device(pl->dev, ranges, new_b ? 2 : 1));
+	for (j = 0; j < PK_N_DIGITS; j++) {
+		for (i = 0; i < PK_N_DIGITS; i++) {
+			jobs[j * PK_N_DIGITS + i] = (jq_job_t){
+			    .dst_phys   = _slot_phys(pl, slot, _STAGE_DST + i * PK_N_DIGITS + j),
+			    .left_phys  = _slot_phys(pl, slot, _STAGE_LEFT + i),
+			    .right_phys = right + j * sizeof(matrix_t),
+			};
+		}
+	}
+	for (done = 0; done < _N_PRODUCTS; done += ret) {
+		jq_handle_t first;
+		while (!(ret = jq_submit_batch(pl->jq, &jobs[done], _N_PRODUCTS - done, &first))) {
+			sched_yield();
+		}
+		ES_FWD_INT_NM(ret);
+		pl->handles[slot] = first + ret - 1;
+	}
+	return 0;
+}
+
+/* Host side, stage 3: wait for tile t and add its partial sums into C */
+static int _pipeline_retire(_pipeline_t *pl, size_t t, const _tile_t *tile, int32_t *c, size_t n)
+{
+	const size_t slot = t % pl->depth;
+	int32_t *block    = &c[tile->mi * SA_DIM * n + tile->ni * SA_DIM];
+	ES_FWD_INT_NM(jq_wait(pl->jq, pl->handles[slot]));
+	ES_FWD_INT_NM(dev_sync_for_cpu(
+	    pl->dev, _slot_offset(pl, slot, _STAGE_DST), _N_PRODUCTS * sizeof(matrix_t)));
+	_accumulate_products(block, n, _slot_virt(pl, slot, _STAGE_DST), tile->rows, tile->cols);
+	if (pl->epilogue && tile->ki == pl->k_tiles - 1) {
+		pl->epilogue(
+		    pl->arg, block, n, tile->mi * SA_DIM, tile->ni * SA_DIM, tile->rows, tile->cols);
+	}
+	return 0;
+}
+
+static void _pipeline_init(_pipeline_t *pl, dev_st *dev, size_t depth)
+{
+	memset(pl, 0, sizeof(*pl));
+	pl->dev   = dev;
+	pl->depth = depth;
+}
+
+size_t gemm_staging_size(UNUSED const dev_st *dev, size_t depth)
+{
+	/* da_alloc aligns the start of the device up to DA_ALIGN */
+	return DA_ALIGN + depth * _STAGE_MAX * sizeof(matrix_t);
+}
+
+/* Run a pipeline set up by _pipeline_init, plus its epilogue and B operand */
+static int _gemm_pipelined(_pipeline_t *pl,
+                           int32_t *c,
+                           const int8_t *a,
+                           const int8_t *b,
+                           size_t m,
+                           size_t k,
+                           size_t n)
+{
+	DA_CLEANUP da_st *scratch = NULL;
+	JQ_CLEANUP jq_st *jq      = NULL;
+	const size_t depth        = pl->depth;
+	size_t t, n_tiles;
+	da_span_t whole;
+	ES_NEW_ASRT_NM(c && a && (b || pl->pretiled));
+	ES_NEW_ASRT(depth >= 1 && depth <= GEMM_PIPELINE_MAX_DEPTH, "Bad pipeline depth %zu", depth);
+	ES_NEW_ASRT(k <= GEMM_MAX_K, "K %zu is too deep", k);
+	whole = da_span_of_dev(pl->dev);
+	ES_FWD_INT_NM(da_alloc(&scratch, &whole, DA_MODE_BUMP));
+	ES_FWD_INT(da_get(scratch, &pl->span, depth * _STAGE_MAX * sizeof(matrix_t)),
+	           "Device memory too small for %zu staging slots",
+	           depth);
+	ES_FWD_INT_NM(jq_alloc(&jq, pl->dev));
+	pl->jq      = jq;
+	pl->k_tiles = PK_N_TILES(k);
+
+	_init_offset(c, a, m, k, n);
+	n_tiles = PK_N_TILES(m) * PK_N_TILES(n) * PK_N_TILES(k);
+	for (t = 0; t < n_tiles + depth; t++) {
+		/* Tile t - depth used the slot tile t is about to take: read it back first */
+		if (t >= depth) {
+			const _tile_t done = _tile_at(t - depth, m, k, n);
+			ES_FWD_INT(_pipeline_retire(pl, t - depth, &done, c, n), "Tile %zu", t - depth);
+		}
+		if (t < n_tiles) {
+			const _tile_t next = _tile_at(t, m, k, n);
+			ES_FWD_INT(_pipeline_issue(pl, t, &next, a, b, k, n), "Tile %zu", t);
+		}
+	}
+	return 0;
+}
+
+int gemm_s8_pipelined(dev_st *dev,
+                      size_t depth,
+                      int32_t *c,
+                      const int8_t *a,
+                      const int8_t *b,
+                      size_t m,
+                      size_t k,
+                      size_t n)
+{
+	_pipeline_t pl;
+	ES_NEW_ASRT_NM(dev);
+	_pipeline_init(&pl, dev, depth);
+	ES_FWD_INT_NM(_gemm_pipelined(&pl, c, a, b, m, k, n));
+	return 0;
+}
+
+int gemm_s8_fused(dev_st *dev,
+                  int32_t *c,
+                  const int8_t *a,
+                  const int8_t *b,
+                  size_t m,
+                  size_t k,
+                  size_t n,
+                  gemm_epilogue_ft epilogue,
+                  void *arg)
+{
+	_pipeline_t pl;
+	size_t mi, ni;
+	ES_NEW_ASRT_NM(epilogue);
+	if (dev) {
+		_pipeline_init(&pl, dev, GEMM_PIPELINE_DEPTH);
+		pl.epilogue = epilogue;
+		pl.arg      = arg;
+		ES_FWD_INT_NM(_gemm_pipelined(&pl, c, a, b, m, k, n));
+		return 0;
+	}
+	ES_NEW_ASRT_NM(c && a && b);
+	gemm_s8_ref(c, a, b, m, k, n);
+	for (mi = 0; mi < m; mi += SA_DIM) {
+		for (ni = 0; ni < n; ni += SA_DIM) {
+			epilogue(arg,
+			         &c[mi * n + ni],
+			         n,
+			         mi,
+			         ni,
+			         MIN(m - mi, (size_t) SA_DIM),
+			         MIN(n - ni, (size_t) SA_DIM));
+		}
+	}
+	return 0;
+}
+
+int gemm_s8_pretiled(dev_st *dev,
+                     int32_t *c,
+                     const int8_t *a,
+                     uint32_t b_tiles_phys,
+                     size_t m,
+                     size_t k,
+                     size_t n,
+                     gemm_epilogue_ft epilogue,
+                     void *arg)
+{
+	_pipeline_t pl;
+	ES_NEW_ASRT_NM(dev);
+	ES_NEW_ASRT(b_tiles_phys % DA_ALIGN == 0, "B tiles at 0x%x are not aligned", b_tiles_phys);
+	_pipeline_init(&pl, dev, GEMM_PIPELINE_DEPTH);
+	pl.epilogue     = epilogue;
+	pl.arg          = arg;
+	pl.pretiled     = true;
+	pl.b_tiles_phys = b_tiles_phys;
+	ES_FWD_INT_NM(_gemm_pipelined(&pl, c, a, NULL, m, k, n));
+	return 0;
+}
+
+int gemm_s8(dev_st *dev,
+            int32_t *c,
+            const int8_t *a,
+            const int8_t *b,
+            size_t m,
+            size_t k,
+            size_t n)
+{
+	ES_FWD_INT_NM(gemm_s8_pipelined(dev, GEMM_PIPELINE_DEPTH, c, a, b, m, k, n));
+	return 0;
+}
+
+int gemm_s8_tiled_ref(int32_t *c, const int8_t *a, const int8_t *b, size_t m, size_t k, size_t n)
+{
+	matrix_t stage[_STAGE_MAX];
+	ES_FWD_INT_NM(_gemm_tiled(_tile_mult_ref, NULL, stage, c, a, b, m, k, n));
+	return 0;
+}
+
+void gemm_s8_ref(int32_t *c, const int8_t *a, const int8_t *b, size_t m, size_t k, size_t n)
+{
+	size_t i, j, l;
+	for (i = 0; i < m; i++) {
+		for (j = 0; j < n; j++) {
+			int32_t acc = 0;
+			for (l = 0; l < k; l++) {
+				acc += a[i * k + l] * b[l * n + j];
+			}
+			c[i * n + j] = acc;
+		}
+	}
+}
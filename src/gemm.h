@@ -0,0 +1,146 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * General int8 matrix multiplication built out of SA_DIM x SA_DIM systolic array tiles.
+ *
+ * All user facing matrices are dense row-major. A is M x K, B is K x N and C is M x N. Ragged edges
+ * are zero padded when packed into tiles, so any M, K and N are accepted.
+ *
+ * The array only returns the low byte of each 16 element dot product. To keep C exact, every tile
+ * of A and B is split into PK_N_DIGITS digit tiles (see pack.h) and each tile product takes
+ * PK_N_DIGITS * PK_N_DIGITS instructions, one per pair of digits, whose byte results cannot wrap.
+ * The host reassembles them in int32 and reduces the partial sums over K. B is split with an offset
+ * of PK_DIGIT_OFFSET, which C starts out corrected for.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "systolic.h"
+
+/* Staging slots used by gemm_s8: one tile is packed while the other computes */
+#define GEMM_PIPELINE_DEPTH (2)
+/* Bounded by the jobs the device FIFOs accept: 16 per tile against 64 write descriptors */
+#define GEMM_PIPELINE_MAX_DEPTH (4)
+/* Deepest K for which no int32 partial sum of C can overflow */
+#define GEMM_MAX_K (32768)
+
+/**
+ * @brief Called once per SA_DIM x SA_DIM block of C as soon as its reduction over K is complete,
+ * while the block is still in cache. Used to fuse requantization into the readback.
+ *
+ * @param arg User pointer given to gemm_s8_fused
+ * @param c Top left element of the finished block
+ * @param ld Row stride of c in elements
+ * @param row Row of C the block starts at
+ * @param col Column of C the block starts at
+ */
+typedef void (*gemm_epilogue_ft)(void *arg,
+                                 const int32_t *c,
+                                 size_t ld,
+                                 size_t row,
+                                 size_t col,
+                                 size_t rows,
+                                 size_t cols);
+
+/**
+ * @brief Multiply two int8 matrices on the FPGA, accumulating the K tiles on the host.
+ *
+ * Same as gemm_s8_pipelined with GEMM_PIPELINE_DEPTH slots. C is exact for any K up to GEMM_MAX_K,
+ * the same as gemm_s8_ref.
+ *
+ * @param dev device handle
+ * @param c M x N row-major output
+ * @param a M x K row-major input
+ * @param b K x N row-major input
+ * @returns 0 on success, negative on failure
+ */
+int gemm_s8(dev_st *dev,
+            int32_t *c,
+            const int8_t *a,
+            const int8_t *b,
+            size_t m,
+            size_t k,
+            size_t n);
+
+/**
+ * @brief Multiply with host packing, device compute and host accumulation overlapped.
+ *
+ * The start of the device memory is split into depth slots of the digit products of one tile, and
+ * the digits of its left and right operand tiles.
+ * Tile t uses slot t % depth: while it computes, tile t + 1 is packed into the next slot and the
+ * oldest tile in flight is read back. Every sync covers only the slot being handed over.
+ *
+ * The staging slots double as a host side cache of packed B: each SA_DIM x SA_DIM tile of B is
+ * multiplied by all row tiles of A (all samples of a batch) before the next one, so it is packed,
+ * split and synced once instead of once per row tile. This only saves host work. The array keeps
+ * no operand between instructions, so both operands are still read from memory for every job.
+ *
+ * @param dev device handle
+ * @param depth Number of slots, in [1, GEMM_PIPELINE_MAX_DEPTH]. 1 is fully serial
+ * @returns 0 on success, negative on failure
+ */
+int gemm_s8_pipelined(dev_st *dev,
+                      size_t depth,
+                      int32_t *c,
+                      const int8_t *a,
+                      const int8_t *b,
+                      size_t m,
+                      size_t k,
+                      size_t n);
+
+/**
+ * @brief gemm_s8 that hands every finished block of C to epilogue(arg, ...).
+ *
+ * @param dev device handle, NULL to multiply with gemm_s8_ref on the CPU (the epilogue then sees C
+ * in blocks of the same size)
+ * @param c M x N row-major int32 scratch, holds the raw sums afterwards
+ */
+int gemm_s8_fused(dev_st *dev,
+                  int32_t *c,
+                  const int8_t *a,
+                  const int8_t *b,
+                  size_t m,
+                  size_t k,
+                  size_t n,
+                  gemm_epilogue_ft epilogue,
+                  void *arg);
+
+/**
+ * @brief gemm_s8_fused with B already packed and resident in device memory, so only A is packed
+ * per tile. The right operand of tile (ki, ni) is read straight from b_tiles_phys.
+ *
+ * @param b_tiles_phys Physical address of B packed by pk_matrix_row_major_digits (k x n), DA_ALIGN
+ * aligned and outside of the first gemm_staging_size bytes of device memory
+ * @param epilogue May be NULL
+ */
+int gemm_s8_pretiled(dev_st *dev,
+                     int32_t *c,
+                     const int8_t *a,
+                     uint32_t b_tiles_phys,
+                     size_t m,
+                     size_t k,
+                     size_t n,
+                     gemm_epilogue_ft epilogue,
+                     void *arg);
+
+/**
+ * @brief Bytes at the start of device memory used for staging by a pipeline of this depth. Data
+ * that has to survive a GEMM, e.g. resident weights, goes after them.
+ */
+size_t gemm_staging_size(const dev_st *dev, size_t depth);
+
+/**
+ * @brief Same tiling, digit split and accumulation as gemm_s8, but every digit product is computed
+ * by matrix_mult16_ref. Produces bit identical results to that path without a board attached.
+ */
+int gemm_s8_tiled_ref(int32_t *c, const int8_t *a, const int8_t *b, size_t m, size_t k, size_t n);
+
+/**
+ * @brief Plain triple loop reference, exact in int32.
+ */
+void gemm_s8_ref(int32_t *c, const int8_t *a, const int8_t *b, size_t m, size_t k, size_t n);
@@ -0,0 +1,82 @@
+#include "flat_hashtable.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for an open addressing hashtable with flat storage.
+ */
+
+int fht_value_copy(const fht_values_t *values, void **dst, void *value)
+{
+	if (values->copy) {
+		ES_FWD_INT_NM(values->copy(dst, value));
+	} else if (values->size && value != NULL) {
+		/*NULL can't be copied but is still a valid mapping*/
+		ES_NEW_ASRT_NM(*dst = malloc(values->size));
+		memcpy(*dst, value, values->size);
+	} else {
+		*dst = value;
+	}
+	return 0;
+}
+
+void fht_value_free(const fht_values_t *values, void *value)
+{
+	if (values->free)
+		values->free(value);
+	else if (values->size)
+		free(value);
+}
+
+int fht_slots_alloc(uint8_t **ctrl, void **keys, size_t key_size, void ***values, size_t capacity)
+{
+	/* Control bytes first, capacity is a multiple of FHT_GROUP so the keys stay aligned */
+	uint8_t *slots = malloc(capacity * (1 + key_size + sizeof(void *)));
+	ES_NEW_ASRT_NM(slots);
+	memset(slots, FHT_CTRL_EMPTY, capacity);
+	*ctrl   = slots;
+	*keys   = slots + capacity;
+	*values = (void **) (slots + capacity * (1 + key_size));
+	return 0;
+}
+
+static size_t _int_hash(uint32_t key)
+{
+	/* fht_mix spreads the bits */
+	return key;
+}
+
+static bool _int_equal(uint32_t a, uint32_t b)
+{
+	return a == b;
+}
+
+static int _int_copy(uint32_t *dst, uint32_t key)
+{
+	*dst = key;
+	return 0;
+}
+
+static void _int_free(UNUSED uint32_t key) {}
+
+FHT_DEFINE(fht_int, uint32_t, _int_hash, _int_equal, _int_copy, _int_free)
+
+static bool _str_equal(const char *a, const char *b)
+{
+	return strcmp(a, b) == 0;
+}
+
+static int _str_copy(const char **dst, const char *key)
+{
+	ES_NEW_ASRT_NM(*dst = strdup(key));
+	return 0;
+}
+
+static void _str_free(const char *key)
+{
+	free((char *) key);
+}
+
+FHT_DEFINE(fht_str, const char *, ht_str_hash, _str_equal, _str_copy, _str_free)
@@ -0,0 +1,451 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * This is an implementation for an open addressing hashtable with flat storage. Keys, values and
+ * one control byte per slot live in three contiguous arrays, and the capacity is a power of 2. A
+ * control byte holds 7 bits of the key's hash, so a lookup compares a whole group of control bytes
+ * at once (SSE2, or a 64 bit word elsewhere) and only touches the keys whose byte matched.
+ *
+ * The table is instantiated per key type with macros, so hashing and comparing keys are inlined
+ * instead of called through pointers. fht_int (uint32_t keys) and fht_str (strings, copied on
+ * insert) are instantiated here. Values follow the semantics of hashtable.h: pointers that are
+ * stored as is, or copied by value_size or value_copy and released by value_free.
+ *
+ * Differences to hashtable.h:
+ *    - Any uint32_t is a valid int key, including 0
+ *    - Deleting never moves entries, so any key may be deleted from within fht_*_foreach
+ *    - The table only grows, fht_*_purge empties it without shrinking
+ *
+ * How to:
+ * 1. FHT_DECLARE(name, key type) where the table is used
+ * 2. FHT_DEFINE(name, key type, hash, equal, key copy, key free) in one source file
+ * 3. name_alloc, then name_set/name_get/... like the ht_* functions
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../errstack.h"
+#include "../util.h"
+#include "hashtable.h"
+
+#if !defined(FHT_NO_SIMD) && defined(__SSE2__)
+#	define FHT_SSE2
+#	include <emmintrin.h>
+#endif
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#	error "The control byte groups assume a little endian target"
+#endif
+
+/* Control bytes of a slot, a full slot holds the top 7 bits of its hash instead */
+#define FHT_CTRL_EMPTY   ((uint8_t) 0x80)
+#define FHT_CTRL_DELETED ((uint8_t) 0xFE)
+/* The table grows once full and deleted slots reach 7/8 of the capacity */
+#define FHT_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+#ifdef FHT_SSE2
+/* Slots whose control bytes are compared at once */
+#	define FHT_GROUP (16)
+/* One bit per slot of the group */
+typedef uint32_t fht_mask_t;
+
+static inline fht_mask_t fht_match(const uint8_t *ctrl, uint8_t h2)
+{
+	const __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+
+static inline fht_mask_t fht_match_empty(const uint8_t *ctrl)
+{
+	return fht_match(ctrl, FHT_CTRL_EMPTY);
+}
+
+/* Both have the sign bit set, full slots do not */
+static inline fht_mask_t fht_match_free(const uint8_t *ctrl)
+{
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) ctrl));
+}
+
+static inline size_t fht_mask_first(fht_mask_t mask)
+{
+	return __builtin_ctz(mask);
+}
+#else
+#	define FHT_GROUP (8)
+/* The high bit of each byte of the group */
+typedef uint64_t fht_mask_t;
+
+#	define _FHT_LSBS (0x0101010101010101ull)
+#	define _FHT_MSBS (0x8080808080808080ull)
+
+static inline uint64_t _fht_load(const uint8_t *ctrl)
+{
+	uint64_t group;
+	memcpy(&group, ctrl, sizeof(group));
+	return group;
+}
+
+/* May report a byte above a real match that does not match, which only costs a key compare */
+static inline fht_mask_t fht_match(const uint8_t *ctrl, uint8_t h2)
+{
+	const uint64_t x = _fht_load(ctrl) ^ (_FHT_LSBS * h2);
+	return (x - _FHT_LSBS) & ~x & _FHT_MSBS;
+}
+
+/* EMPTY is the only control byte with the high bit set and bit 1 clear */
+static inline fht_mask_t fht_match_empty(const uint8_t *ctrl)
+{
+	const uint64_t group = _fht_load(ctrl);
+	return group & ~(group << 6) & _FHT_MSBS;
+}
+
+static inline fht_mask_t fht_match_free(const uint8_t *ctrl)
+{
+	return _fht_load(ctrl) & _FHT_MSBS;
+}
+
+static inline size_t fht_mask_first(fht_mask_t mask)
+{
+	return __builtin_ctzll(mask) / 8;
+}
+#endif
+
+/* Spreads the bits of a hash, so weak hashes of consecutive keys still land in different groups */
+static inline uint64_t fht_mix(size_t hash)
+{
+	return (uint64_t) hash * 0x9E3779B97F4A7C15ull;
+}
+
+/* The top 7 bits go to the control byte, the ones below pick the first group */
+static inline uint8_t fht_h2(uint64_t hash)
+{
+	return hash >> 57;
+}
+
+static inline size_t fht_h1(uint64_t hash)
+{
+	return (size_t) (hash >> 25);
+}
+
+/* How values are stored, the value arguments of ht_alloc */
+typedef struct fht_values_s
+{
+	size_t size;
+	ht_alloc_func_t copy;
+	ht_free_func_t free;
+} fht_values_t;
+
+int fht_value_copy(const fht_values_t *values, void **dst, void *value);
+void fht_value_free(const fht_values_t *values, void *value);
+/* Control bytes, keys and values of capacity slots in one allocation, all slots empty */
+int fht_slots_alloc(uint8_t **ctrl, void **keys, size_t key_size, void ***values, size_t capacity);
+
+/**
+ * Declare the table type name##_st and its functions for keys of type key_t.
+ */
+#define FHT_DECLARE(name, key_t)                                                                   \
+	struct name##_s;                                                                               \
+	typedef struct name##_s name##_st;                                                             \
+	typedef int (*name##_foreach_func_t)(const name##_st *t, key_t key, void *value, void *data);  \
+                                                                                                   \
+	int name##_alloc(name##_st **dst,                                                              \
+	                 size_t value_size,                                                            \
+	                 ht_alloc_func_t value_copy,                                                   \
+	                 ht_free_func_t value_free);                                                   \
+	void name##_free(name##_st **to_free);                                                         \
+	void name##_purge(name##_st *t);                                                               \
+	/* 1 if the key is new, 0 if its value was replaced, negative on failure */                    \
+	int name##_set(name##_st *t, key_t key, void *value);                                          \
+	void **name##_emplace(name##_st *t, key_t key);                                                \
+	bool name##_has(const name##_st *t, key_t key);                                                \
+	void *name##_get(const name##_st *t, key_t key);                                               \
+	WARN_UNUSED void *name##_take(name##_st *t, key_t key);                                        \
+	void name##_delete(name##_st *t, key_t key);                                                   \
+	/* Deleting is safe from within body, inserting is not */                                      \
+	int name##_foreach(name##_st *t, name##_foreach_func_t body, void *data);                      \
+	size_t name##_buckets(const name##_st *t);                                                     \
+	size_t name##_size(const name##_st *t);                                                        \
+	double name##_density(const name##_st *t)
+
+/**
+ * Define the functions of FHT_DECLARE(name, key_t).
+ *
+ * @param hash size_t hash(key_t key)
+ * @param equal bool equal(key_t a, key_t b)
+ * @param key_copy int key_copy(key_t *dst, key_t key), negative on failure
+ * @param key_free void key_free(key_t key), releases what key_copy made
+ */
+#define FHT_DEFINE(name, key_t, hash, equal, key_copy, key_free)                                   \
+	struct name##_s                                                                                \
+	{                                                                                              \
+		uint8_t *ctrl;                                                                             \
+		key_t *keys;                                                                               \
+		void **values;                                                                             \
+		/* A power of 2 and a multiple of FHT_GROUP */                                             \
+		size_t capacity;                                                                           \
+		size_t size;                                                                               \
+		size_t deleted;                                                                            \
+		fht_values_t value_ops;                                                                    \
+	};                                                                                             \
+                                                                                                   \
+	static int _##name##_slots(name##_st *t, size_t capacity)                                      \
+	{                                                                                              \
+		return fht_slots_alloc(                                                                    \
+		    &t->ctrl, (void **) &t->keys, sizeof(key_t), &t->values, capacity);                    \
+	}                                                                                              \
+                                                                                                   \
+	int name##_alloc(name##_st **dst,                                                              \
+	                 size_t value_size,                                                            \
+	                 ht_alloc_func_t value_copy,                                                   \
+	                 ht_free_func_t value_free)                                                    \
+	{                                                                                              \
+		CLEANUP(name##_free) name##_st *tmp = NULL;                                                \
+		ES_NEW_ASRT_NM(dst);                                                                       \
+		ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));                                             \
+		ES_FWD_INT_NM(_##name##_slots(tmp, FHT_GROUP));                                            \
+		tmp->capacity       = FHT_GROUP;                                                           \
+		tmp->value_ops.size = value_size;                                                          \
+		tmp->value_ops.copy = value_copy;                                                          \
+		tmp->value_ops.free = value_free;                                                          \
+		*dst                = MOVE_PZ(tmp);                                                        \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	void name##_purge(name##_st *t)                                                                \
+	{                                                                                              \
+		size_t i;                                                                                  \
+		for (i = 0; i < t->capacity; i++) {                                                        \
+			if (!(t->ctrl[i] & 0x80)) {                                                            \
+				key_free(t->keys[i]);                                                              \
+				fht_value_free(&t->value_ops, t->values[i]);                                       \
+			}                                                                                      \
+		}                                                                                          \
+		memset(t->ctrl, FHT_CTRL_EMPTY, t->capacity);                                              \
+		t->size    = 0;                                                                            \
+		t->deleted = 0;                                                                            \
+	}                                                                                              \
+                                                                                                   \
+	void name##_free(name##_st **to_free)                                                          \
+	{                                                                                              \
+		if (to_free && *to_free) {                                                                 \
+			if ((*to_free)->ctrl) {                                                                \
+				name##_purge(*to_free);                                                            \
+				free((*to_free)->ctrl);                                                            \
+			}                                                                                      \
+			free(*to_free);                                                                        \
+			*to_free = NULL;                                                                       \
+		}                                                                                          \
+	}                                                                                              \
+                                                                                                   \
+	/* Slot of key, or capacity if it is not in the table */                                       \
+	static size_t _##name##_find(const name##_st *t, key_t key, uint64_t h)                        \
+	{                                                                                              \
+		const size_t mask = t->capacity / FHT_GROUP - 1;                                           \
+		size_t group      = fht_h1(h) & mask, step = 0;                                            \
+		while (true) {                                                                             \
+			const uint8_t *ctrl = &t->ctrl[group * FHT_GROUP];                                     \
+			fht_mask_t match;                                                                      \
+			for (match = fht_match(ctrl, fht_h2(h)); match; match &= match - 1) {                  \
+				const size_t i = group * FHT_GROUP + fht_mask_first(match);                        \
+				if (equal(t->keys[i], key)) {                                                      \
+					return i;                                                                      \
+				}                                                                                  \
+			}                                                                                      \
+			/* An insert would have taken the empty slot, so the key is in no later group */       \
+			if (fht_match_empty(ctrl) || step == mask) {                                           \
+				return t->capacity;                                                                \
+			}                                                                                      \
+			group = (group + ++step) & mask;                                                       \
+		}                                                                                          \
+	}                                                                                              \
+                                                                                                   \
+	/* First empty or deleted slot on the probe sequence of h, the load factor leaves one */       \
+	static size_t _##name##_free_slot(const name##_st *t, uint64_t h)                              \
+	{                                                                                              \
+		const size_t mask = t->capacity / FHT_GROUP - 1;                                           \
+		size_t group      = fht_h1(h) & mask, step = 0;                                            \
+		fht_mask_t match;                                                                          \
+		while (!(match = fht_match_free(&t->ctrl[group * FHT_GROUP]))) {                           \
+			group = (group + ++step) & mask;                                                       \
+		}                                                                                          \
+		return group * FHT_GROUP + fht_mask_first(match);                                          \
+	}                                                                                              \
+                                                                                                   \
+	static int _##name##_rehash(name##_st *t, size_t capacity)                                     \
+	{                                                                                              \
+		name##_st old = *t;                                                                        \
+		size_t i;                                                                                  \
+		ES_FWD_INT_NM(_##name##_slots(t, capacity));                                               \
+		t->capacity = capacity;                                                                    \
+		t->deleted  = 0;                                                                           \
+		for (i = 0; i < old.capacity; i++) {                                                       \
+			if (!(old.ctrl[i] & 0x80)) {                                                           \
+				const size_t slot = _##name##_free_slot(t, fht_mix(hash(old.keys[i])));            \
+				t->ctrl[slot]     = old.ctrl[i];                                                   \
+				t->keys[slot]     = old.keys[i];                                                   \
+				t->values[slot]   = old.values[i];                                                 \
+			}                                                                                      \
+		}                                                                                          \
+		free(old.ctrl);                                                                            \
+		return 0;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* Slot of key, inserted without a value if new. Returns 1 if inserted, 0 if found */          \
+	static int _##name##_upsert(name##_st *t, key_t key, size_t *dst)                              \
+	{                                                                                              \
+		const uint64_t h = fht_mix(hash(key));                                                     \
+		size_t slot      = _##name##_find(t, key, h);                                              \
+		if (slot < t->capacity) {                                                                  \
+			*dst = slot;                                                                           \
+			return 0;                                                                              \
+		}                                                                                          \
+		if (t->size + t->deleted >= FHT_MAX_LOAD(t->capacity)) {                                   \
+			/* Mostly deleted slots are reclaimed at the same capacity */                          \
+			const bool grow = t->size >= FHT_MAX_LOAD(t->capacity) / 2;                            \
+			ES_FWD_INT_NM(_##name##_rehash(t, grow ? 2 * t->capacity : t->capacity));              \
+		}                                                                                          \
+		slot = _##name##_free_slot(t, h);                                                          \
+		ES_FWD_INT_NM(key_copy(&t->keys[slot], key));                                              \
+		if (t->ctrl[slot] == FHT_CTRL_DELETED) {                                                   \
+			t->deleted--;                                                                          \
+		}                                                                                          \
+		t->ctrl[slot]   = fht_h2(h);                                                               \
+		t->values[slot] = NULL;                                                                    \
+		t->size++;                                                                                 \
+		*dst = slot;                                                                               \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	/* A group without an empty slot may be on the way to a later key, mark the slot deleted */    \
+	static void _##name##_erase(name##_st *t, size_t slot)                                         \
+	{                                                                                              \
+		const size_t group = slot / FHT_GROUP * FHT_GROUP;                                         \
+		key_free(t->keys[slot]);                                                                   \
+		if (fht_match_empty(&t->ctrl[group])) {                                                    \
+			t->ctrl[slot] = FHT_CTRL_EMPTY;                                                        \
+		} else {                                                                                   \
+			t->ctrl[slot] = FHT_CTRL_DELETED;                                                      \
+			t->deleted++;                                                                          \
+		}                                                                                          \
+		t->size--;                                                                                 \
+	}                                                                                              \
+                                                                                                   \
+	int name##_set(name##_st *t, key_t key, void *value)                                           \
+	{                                                                                              \
+		size_t slot;                                                                               \
+		int inserted;                                                                              \
+		void *copy;                                                                                \
+		ES_NEW_ASRT_NM(t);                                                                         \
+		ES_FWD_INT_NM(inserted = _##name##_upsert(t, key, &slot));                                 \
+		if (fht_value_copy(&t->value_ops, &copy, value) < 0) {                                     \
+			if (inserted) {                                                                        \
+				_##name##_erase(t, slot);                                                          \
+			}                                                                                      \
+			ES_FWD_INT_NM(-1);                                                                     \
+		}                                                                                          \
+		if (!inserted) {                                                                           \
+			fht_value_free(&t->value_ops, t->values[slot]);                                        \
+		}                                                                                          \
+		t->values[slot] = copy;                                                                    \
+		return inserted;                                                                           \
+	}                                                                                              \
+                                                                                                   \
+	void **name##_emplace(name##_st *t, key_t key)                                                 \
+	{                                                                                              \
+		size_t slot;                                                                               \
+		int inserted;                                                                              \
+		void *copy;                                                                                \
+		if (!t || (inserted = _##name##_upsert(t, key, &slot)) < 0) {                              \
+			return NULL;                                                                           \
+		}                                                                                          \
+		if (fht_value_copy(&t->value_ops, &copy, NULL) < 0) {                                      \
+			if (inserted) {                                                                        \
+				_##name##_erase(t, slot);                                                          \
+			}                                                                                      \
+			return NULL;                                                                           \
+		}                                                                                          \
+		if (!inserted) {                                                                           \
+			fht_value_free(&t->value_ops, t->values[slot]);                                        \
+		}                                                                                          \
+		t->values[slot] = copy;                                                                    \
+		return &t->values[slot];                                                                   \
+	}                                                                                              \
+                                                                                                   \
+	bool name##_has(const name##_st *t, key_t key)                                                 \
+	{                                                                                              \
+		return _##name##_find(t, key, fht_mix(hash(key))) < t->capacity;                           \
+	}                                                                                              \
+                                                                                                   \
+	void *name##_get(const name##_st *t, key_t key)                                                \
+	{                                                                                              \
+		const size_t slot = _##name##_find(t, key, fht_mix(hash(key)));                            \
+		return slot < t->capacity ? t->values[slot] : NULL;                                        \
+	}                                                                                              \
+                                                                                                   \
+	void *name##_take(name##_st *t, key_t key)                                                     \
+	{                                                                                              \
+		const size_t slot = _##name##_find(t, key, fht_mix(hash(key)));                            \
+		void *value;                                                                               \
+		if (slot == t->capacity) {                                                                 \
+			return NULL;                                                                           \
+		}                                                                                          \
+		value = t->values[slot];                                                                   \
+		_##name##_erase(t, slot);                                                                  \
+		return value;                                                                              \
+	}                                                                                              \
+                                                                                                   \
+	void name##_delete(name##_st *t, key_t key)                                                    \
+	{                                                                                              \
+		const size_t slot = _##name##_find(t, key, fht_mix(hash(key)));                            \
+		if (slot < t->capacity) {                                                                  \
+			fht_value_free(&t->value_ops, t->values[slot]);                                        \
+			_##name##_erase(t, slot);                                                              \
+		}                                                                                          \
+	}                                                                                              \
+                                                                                                   \
+	int name##_foreach(name##_st *t, name##_foreach_func_t body, void *data)                       \
+	{                                                                                              \
+		size_t i;                                                                                  \
+		ES_NEW_ASRT_NM(t);                                                                         \
+		for (i = 0; i < t->capacity; i++) {                                                        \
+			int ret;                                                                               \
+			if (t->ctrl[i] & 0x80) {                                                               \
+				continue;                                                                          \
+			}                                                                                      \
+			ES_NEW_INT_NM(ret = body(t, t->keys[i], t->values[i], data));                          \
+			if (ret == 0) {                                                                        \
+				return 0;                                                                          \
+			}                                                                                      \
+		}                                                                                          \
+		return 1;                                                                                  \
+	}                                                                                              \
+                                                                                                   \
+	size_t name##_buckets(const name##_st *t)                                                      \
+	{                                                                                              \
+		return t->capacity;                                                                        \
+	}                                                                                              \
+                                                                                                   \
+	size_t name##_size(const name##_st *t)                                                         \
+	{                                                                                              \
+		return t->size;                                                                            \
+	}                                                                                              \
+                                                                                                   \
+	double name##_density(const name##_st *t)                                                      \
+	{                                                                                              \
+		return (double) t->size / t->capacity;                                                     \
+	}
+
+/* uint32_t -> user defined data */
+FHT_DECLARE(fht_int, uint32_t);
+/* string -> user defined data. Keys are copied via strdup */
+FHT_DECLARE(fht_str, const char *);
+
+#define FHT_INT_CLEANUP CLEANUP(fht_int_free)
+#define FHT_STR_CLEANUP CLEANUP(fht_str_free)
@@ -252,6 +252,7 @@ void _adjust_by_density(ht_st *ht)
 int _new_node(_node_t **cur_node, ht_st *ht, void *key, void *value)
 {
 	CLEANUP(_cleanup_node) _node_t *tmp = NULL;
+	const bool is_new                   = !*cur_node;
 	if (*cur_node) {
 		tmp = *cur_node;
 		_cleanup_node_value(cur_node);
@@ -277,7 +278,8 @@ int _new_node(_node_t **cur_node, ht_st *ht, void *key, void *value)
 	}
 	*cur_node          = MOVE_PZ(tmp);
 	(*cur_node)->owner = ht;
-	(*cur_node)->owner->n_nodes++;
+	if (is_new)
+		ht->n_nodes++;
 	return 1;
 }
 
@@ -350,7 +352,6 @@ void *ht_take(ht_st *ht, void *key)
 	_node_t *ret_node = *head;
 	if (ret_node) {
 		void *ret = ret_node->value;
-		*head     = ret_node->next;
 		_cleanup_node_util(head, true);
 		_adjust_by_density(ht);
 		return ret;
@@ -409,7 +410,7 @@ double ht_density(ht_st *ht)
 
 size_t ht_int_hash(const void *key)
 {
-	uint32_t x = (uint32_t) key;
+	uint32_t x = (uint32_t) (uintptr_t) key;
 	x          = (x ^ 61) ^ (x >> 16);
 	x          = x + (x << 3);
 	x          = x ^ (x >> 4);
@@ -77,9 +77,11 @@ int64_t ht_arb_cmp_util(void *key1, void *key2, size_t size);
 /* Allocate an int -> user defined data hash table */
 #define ht_int_alloc(dst, value_size, value_copy, value_free)                                      \
 	ht_alloc(dst, ht_int_hash, ht_int_cmp, 0, NULL, NULL, value_size, value_copy, value_free)
-#define ht_int_set(ht, key, value) ht_set((ht), (void *) (uint32_t) (key), (void *) (value))
-#define ht_int_get(ht, key)        ht_get((ht), (void *) (uint32_t) (key))
-#define ht_int_delete(ht, key)     ht_delete(ht, (void *) (uint32_t) (key))
+/* An int key as the void * of the generic functions, e.g. for ht_take */
+#define HT_INT_KEY(key)            ((void *) (uintptr_t) (uint32_t) (key))
+#define ht_int_set(ht, key, value) ht_set((ht), HT_INT_KEY(key), (void *) (value))
+#define ht_int_get(ht, key)        ht_get((ht), HT_INT_KEY(key))
+#define ht_int_delete(ht, key)     ht_delete(ht, HT_INT_KEY(key))
 /* Allocate a string -> user defined data hash table. Copies via strdup */
 #define ht_str_alloc(dst, value_size, value_copy, value_free)                                      \
 	ht_alloc(dst,                                                                                  \
@@ -12,14 +12,15 @@
 #include <stdlib.h>
 #include <sys/epoll.h>
 
-#include "data-structures/hashtable.h"
+#include "data-structures/flat_hashtable.h"
 #include "errstack.h"
 #include "util.h"
 
 struct eh_ctx_s
 {
 	int epoll_fd;
-	ht_st *hooks;
+	/* fd -> eh_hook_st */
+	fht_int_st *hooks;
 	bool threaded;
 	bool oneshot;
 };
@@ -77,7 +78,7 @@ int eh_ctx_alloc(eh_ctx_st **const dst, const bool threaded, const bool oneshot)
 	tmp->threaded = threaded;
 	tmp->oneshot  = oneshot;
 	ES_NEW_INT_NM(tmp->epoll_fd = epoll_create1(EPOLL_CLOEXEC));
-	ES_FWD_INT_NM(ht_int_alloc(&tmp->hooks, 0, NULL, NULL));
+	ES_FWD_INT_NM(fht_int_alloc(&tmp->hooks, 0, NULL, NULL));
 	*dst = MOVE_PZ(tmp);
 	return 0;
 }
@@ -95,9 +96,9 @@ int eh_ctx_wait(eh_ctx_st *const ctx, const size_t max_events, const int ms)
 	int n_ev;
 	int i;
 	CLEANUP(_cleanup_epoll_event) struct epoll_event *evs = malloc(sizeof(*evs) * max_events);
-	ES_NEW_ASRT_NM(ctx);
+	ES_NEW_ASRT_NM(ctx && evs && max_events);
 	ES_NEW_INT_NM(ctx->epoll_fd);
-	ES_NEW_INT_ERRNO(n_ev = epoll_wait(ctx->epoll_fd, evs, 1, ms));
+	ES_NEW_INT_ERRNO(n_ev = epoll_wait(ctx->epoll_fd, evs, max_events, ms));
 	for (i = 0; i < n_ev; i++) {
 		bool new_events[EH_OPS_MAX] = {};
 		bool hangup                 = false;
@@ -150,7 +151,7 @@ int eh_ctx_reg_hook(eh_ctx_st *const ctx, eh_hook_st *const hook)
 	struct epoll_event to_add = {};
 	ES_NEW_ASRT_NM(ctx);
 	ES_NEW_ASRT_NM(hook && hook->owner == NULL);
-	ES_NEW_ASRT_NM(!ht_int_get(ctx->hooks, hook->fd));
+	ES_NEW_ASRT_NM(!fht_int_has(ctx->hooks, hook->fd));
 	hook->owner     = ctx;
 	to_add.data.ptr = hook;
 	to_add.events   = _get_epoll_flags(hook, EH_OPS_END);
@@ -161,7 +162,7 @@ int eh_ctx_reg_hook(eh_ctx_st *const ctx, eh_hook_st *const hook)
 		to_add.events |= EPOLLONESHOT;
 	}
 	ES_NEW_INT_ERRNO(epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, hook->fd, &to_add));
-	ES_NEW_INT_NM(ht_int_set(ctx->hooks, hook->fd, hook));
+	ES_NEW_INT_NM(fht_int_set(ctx->hooks, hook->fd, hook));
 	return 0;
 }
 
@@ -175,11 +176,11 @@ void eh_ctx_unreg_hook(eh_ctx_st *const ctx, eh_hook_st *const hook)
 		/*No need to handle errors, if it couldn't be deleted, it couldn't have been added*/
 		epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, hook->fd, NULL);
 	}
-	ht_int_delete(ctx->hooks, hook->fd);
+	fht_int_delete(ctx->hooks, hook->fd);
 }
 
-static int _ctx_cleanup_foreach(UNUSED const ht_st *ht,
-                                UNUSED void *key,
+static int _ctx_cleanup_foreach(UNUSED const fht_int_st *hooks,
+                                UNUSED uint32_t fd,
                                 void *value,
                                 UNUSED void *data)
 {
@@ -197,7 +198,9 @@ void eh_ctx_cleanup(eh_ctx_st **const dst)
 		(*dst)->epoll_fd = -1;
 	}
 	if ((*dst)->hooks) {
-		ht_foreach((*dst)->hooks, _ctx_cleanup_foreach, *dst);
+		/* Each hook unregisters itself, deleting from within the foreach is safe */
+		fht_int_foreach((*dst)->hooks, _ctx_cleanup_foreach, *dst);
+		fht_int_free(&(*dst)->hooks);
 	}
 	free(*dst);
 	*dst = NULL;
@@ -216,6 +219,14 @@ int eh_ctx_hook_alloc(eh_ctx_st *const ctx,
 	return 0;
 }
 
+eh_hook_st *eh_ctx_get_hook_by_fd(eh_ctx_st *const ctx, const int fd)
+{
+	if (!ctx || !ctx->hooks) {
+		return NULL;
+	}
+	return fht_int_get(ctx->hooks, fd);
+}
+
 int eh_hook_alloc(eh_hook_st **const dst,
                   const int fd,
                   void *const data,
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include "trace.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Per-thread trace rings and their Chrome trace export.
+ *
+ * Each ring has a single writer, its thread. The writer fills the slot and then publishes it by
+ * advancing head with release order. A dump reads head with acquire order, copies the slots and
+ * reads head again: slots the writer may have reused in between are dropped. Rings are linked into
+ * a list with a compare and swap and live until the process ends.
+ */
+
+#include <bsd/string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "errstack.h"
+#include "util.h"
+
+typedef struct _event_s
+{
+	uint64_t ts_ns;
+	const char *name;
+	int64_t value;
+	tr_phase_et phase;
+} _event_t;
+
+typedef struct _ring_s _ring_t;
+struct _ring_s
+{
+	/* Events ever recorded, the next slot is head % TR_RING_EVENTS */
+	uint64_t head;
+	pid_t tid;
+	char thread_name[32];
+	_ring_t *next;
+	_event_t events[TR_RING_EVENTS];
+};
+
+static _ring_t *_rings = NULL;
+static __thread _ring_t *_ring;
+/* Set when a ring could not be allocated, that thread records nothing */
+static __thread bool _ring_failed;
+
+static uint64_t _now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static _ring_t *_own_ring(void)
+{
+	_ring_t *ring;
+	if (_ring || _ring_failed) {
+		return _ring;
+	}
+	ring = calloc(1, sizeof(*ring));
+	if (!ring) {
+		_ring_failed = true;
+		return NULL;
+	}
+	ring->tid  = (pid_t) syscall(SYS_gettid);
+	ring->next = __atomic_load_n(&_rings, __ATOMIC_ACQUIRE);
+	while (!__atomic_compare_exchange_n(
+	    &_rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+	}
+	_ring = ring;
+	return ring;
+}
+
+void tr_record(const char *name, tr_phase_et phase, int64_t value)
+{
+	_ring_t *ring = _own_ring();
+	_event_t *event;
+	if (!ring) {
+		return;
+	}
+	event        = &ring->events[ring->head % TR_RING_EVENTS];
+	event->ts_ns = _now_ns();
+	event->name  = name;
+	event->value = value;
+	event->phase = phase;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void tr_thread_name(const char *name)
+{
+	_ring_t *ring = _own_ring();
+	if (ring) {
+		STRLCPY(ring->thread_name, name);
+	}
+}
+
+void tr_reset(void)
+{
+	_ring_t *ring;
+	for (ring = __atomic_load_n(&_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+		__atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+	}
+}
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+/* Chrome wants microseconds, the fraction keeps the nanoseconds */
+static void _write_event(FILE *f, const _ring_t *ring, const _event_t *event, bool *first)
+{
+	fprintf(f,
+	        "%s\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %llu.%03u, \"pid\": %d, \"tid\": %d",
+	        *first ? "" : ",",
+	        event->name,
+	        (char) event->phase,
+	        (unsigned long long) (event->ts_ns / 1000),
+	        (unsigned) (event->ts_ns % 1000),
+	        (int) getpid(),
+	        (int) ring->tid);
+	if (event->phase == TR_PHASE_INSTANT) {
+		fprintf(f, ", \"s\": \"t\", \"args\": {\"value\": %lld}", (long long) event->value);
+	}
+	fputc('}', f);
+	*first = false;
+}
+
+/* Copies the ring's published events, returns how many of them are intact */
+static size_t _snapshot(const _ring_t *ring, _event_t *dst)
+{
+	const uint64_t head  = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	const uint64_t first = head > TR_RING_EVENTS ? head - TR_RING_EVENTS : 0;
+	uint64_t i, after;
+	for (i = first; i < head; i++) {
+		dst[i - first] = ring->events[i % TR_RING_EVENTS];
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	after = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	/* The writer may be filling the slot of event after - TR_RING_EVENTS, that one and the ones
+	 * before it may have been overwritten while copying */
+	if (after >= TR_RING_EVENTS && after - TR_RING_EVENTS >= first) {
+		const uint64_t lost = MIN(after - TR_RING_EVENTS + 1 - first, head - first);
+		memmove(dst, dst + lost, (head - first - lost) * sizeof(*dst));
+		return head - first - lost;
+	}
+	return head - first;
+}
+
+int tr_dump_chrome(FILE *f)
+{
+	CLEANUP(_cleanup_free) _event_t *events = NULL;
+	const _ring_t *ring;
+	bool first = true;
+	int n      = 0;
+	size_t i, n_ring;
+	ES_NEW_ASRT_NM(f);
+	ES_NEW_ASRT_NM(events = malloc(TR_RING_EVENTS * sizeof(*events)));
+	fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+	for (ring = __atomic_load_n(&_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+		if (ring->thread_name[0]) {
+			fprintf(f,
+			        "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+			        "\"args\": {\"name\": \"%s\"}}",
+			        first ? "" : ",",
+			        (int) getpid(),
+			        (int) ring->tid,
+			        ring->thread_name);
+			first = false;
+		}
+		n_ring = _snapshot(ring, events);
+		for (i = 0; i < n_ring; i++) {
+			_write_event(f, ring, &events[i], &first);
+		}
+		n += n_ring;
+	}
+	fprintf(f, "\n]}\n");
+	ES_NEW_ASRT(!ferror(f), "Failed to write the trace");
+	return n;
+}
+
+int tr_dump_chrome_file(const char *path)
+{
+	CLEAN_FILE FILE *f = NULL;
+	int n;
+	ES_NEW_ASRT(f = fopen(path, "w"), "Failed to open %s", path);
+	ES_FWD_INT(n = tr_dump_chrome(f), "Failed to dump to %s", path);
+	return n;
+}
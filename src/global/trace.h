@@ -0,0 +1,68 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Timestamped event tracing for the hot paths. Every thread records into its own ring of the last
+ * TR_RING_EVENTS events, so recording takes no lock and does no I/O. tr_dump_chrome writes all
+ * rings as Chrome trace JSON, which chrome://tracing and https://ui.perfetto.dev open as a
+ * timeline.
+ *
+ * The TR_* macros are only compiled in with TR_ENABLE (TRACE := 1 in the makefile), otherwise they
+ * expand to nothing and their arguments are not evaluated.
+ *
+ * How to:
+ * 1. Wrap the interesting parts with TR_BEGIN/TR_END, mark single points with TR_INSTANT
+ * 2. Optionally name the thread with tr_thread_name
+ * 3. tr_dump_chrome when the timeline is wanted
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Events per thread, a power of 2. Older events are overwritten */
+#define TR_RING_EVENTS (4096)
+
+typedef enum tr_phase_e
+{
+	TR_PHASE_BEGIN   = 'B',
+	TR_PHASE_END     = 'E',
+	TR_PHASE_INSTANT = 'i',
+} tr_phase_et;
+
+/**
+ * @brief Record one event in the calling thread's ring.
+ *
+ * @param name Must outlive the trace, use string literals
+ * @param value Shown as the event's argument
+ */
+void tr_record(const char *name, tr_phase_et phase, int64_t value);
+/* Name shown for the calling thread, truncated to 31 characters */
+void tr_thread_name(const char *name);
+/* Forget all recorded events. Only while no thread records */
+void tr_reset(void);
+/**
+ * @brief Write the events of all threads as Chrome trace JSON. Safe while other threads record,
+ * events overwritten during the dump are left out. Once a ring has wrapped, its oldest slot may be
+ * the one being written, so at most TR_RING_EVENTS - 1 of its events are written.
+ *
+ * @returns The number of events written, negative on failure
+ */
+int tr_dump_chrome(FILE *f);
+/* tr_dump_chrome into a new file at path */
+int tr_dump_chrome_file(const char *path);
+
+#ifdef TR_ENABLE
+/* Start of a duration, name a string literal */
+#	define TR_BEGIN(name) ({ tr_record(name, TR_PHASE_BEGIN, 0); })
+/* End of the innermost duration of the same name */
+#	define TR_END(name) ({ tr_record(name, TR_PHASE_END, 0); })
+/* A point in time with a value, e.g. how many descriptors were submitted */
+#	define TR_INSTANT(name, value) ({ tr_record(name, TR_PHASE_INSTANT, (int64_t) (value)); })
+#else
+#	define TR_BEGIN(name)          ({ ; })
+#	define TR_END(name)            ({ ; })
+#	define TR_INSTANT(name, value) ({ (void) sizeof(value); })
+#endif
@@ -0,0 +1,595 @@
+#include "graph.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Execution graph, arena planning and the node interpreter.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "errstack.h"
+#include "util.h"
+
+#define _ALIGN_UP(x) (((x) + GR_ALIGN - 1) / GR_ALIGN * GR_ALIGN)
+
+struct gr_s
+{
+	gr_tensor_t *tensors;
+	size_t n_tensors;
+	size_t tensors_cap;
+	gr_node_t *nodes;
+	size_t n_nodes;
+	size_t nodes_cap;
+	size_t inputs[GR_MAX_IO];
+	size_t n_inputs;
+	size_t outputs[GR_MAX_IO];
+	size_t n_outputs;
+	bool finalized;
+	mp_report_t plan;
+};
+
+static const size_t _type_size[] = {
+    [GR_TYPE_INT8]    = 1,
+    [GR_TYPE_INT32]   = 4,
+    [GR_TYPE_FLOAT32] = 4,
+};
+
+/* Grow *array of elm_size elements so one more fits */
+static int _grow(void **array, size_t *cap, size_t n, size_t elm_size)
+{
+	void *tmp;
+	if (n < *cap) {
+		return 0;
+	}
+	ES_NEW_ASRT_NM(tmp = realloc(*array, MAX(*cap * 2, (size_t) 8) * elm_size));
+	*array = tmp;
+	*cap   = MAX(*cap * 2, (size_t) 8);
+	return 0;
+}
+
+static size_t _elements(const gr_tensor_t *tensor)
+{
+	return tensor->size / _type_size[tensor->type];
+}
+
+int gr_alloc(gr_st **dst)
+{
+	ES_NEW_ASRT_NM(dst);
+	ES_NEW_ASRT_NM(*dst = calloc(1, sizeof(**dst)));
+	return 0;
+}
+
+void gr_cleanup(gr_st **graph)
+{
+	size_t i;
+	if (!*graph) {
+		return;
+	}
+	for (i = 0; i < (*graph)->n_tensors; i++) {
+		free((*graph)->tensors[i].name);
+		free((*graph)->tensors[i].data);
+	}
+	for (i = 0; i < (*graph)->n_nodes; i++) {
+		nn_op_cleanup(&(*graph)->nodes[i].op);
+	}
+	free((*graph)->tensors);
+	free((*graph)->nodes);
+	free(*graph);
+	*graph = NULL;
+}
+
+int gr_add_tensor(gr_st *graph, const gr_tensor_t *tensor, size_t *idx)
+{
+	gr_tensor_t *dst;
+	size_t elements = 1, i;
+	ES_NEW_ASRT_NM(graph && tensor && idx && !graph->finalized);
+	ES_NEW_ASRT(tensor->type < ARRAY_SIZE(_type_size) && tensor->rank <= GR_MAX_RANK,
+	            "Tensor %s has type %d and rank %zu",
+	            tensor->name,
+	            tensor->type,
+	            tensor->rank);
+	for (i = 0; i < tensor->rank; i++) {
+		elements *= tensor->shape[i];
+	}
+	ES_NEW_ASRT(tensor->size == elements * _type_size[tensor->type],
+	            "Tensor %s has %zu bytes for %zu elements",
+	            tensor->name,
+	            tensor->size,
+	            elements);
+	ES_NEW_ASRT(tensor->type != GR_TYPE_INT8 || tensor->data || tensor->quant.scale > 0,
+	            "Activation %s is not quantized",
+	            tensor->name);
+	ES_FWD_INT_NM(
+	    _grow((void **) &graph->tensors, &graph->tensors_cap, graph->n_tensors, sizeof(*dst)));
+	dst       = &graph->tensors[graph->n_tensors];
+	*dst      = *tensor;
+	dst->name = NULL;
+	dst->data = NULL;
+	ES_NEW_ASRT_NM(dst->name = strdup(tensor->name ? tensor->name : ""));
+	if (tensor->data) {
+		if (!(dst->data = malloc(MAX(tensor->size, (size_t) 1)))) {
+			free(dst->name);
+			ES_NEW_ASRT_NM(false);
+		}
+		memcpy(dst->data, tensor->data, tensor->size);
+	}
+	*idx = graph->n_tensors++;
+	return 0;
+}
+
+/* Check that a node's tensors agree with what its kind computes */
+static int _check_node(const gr_st *graph, const gr_node_t *node, const nn_op_st *op)
+{
+	const gr_tensor_t *in, *out;
+	size_t i, out_h, out_w;
+	ES_NEW_ASRT(node->n_inputs >= 1 && node->n_inputs <= GR_MAX_IO && node->n_outputs == 1,
+	            "%zu inputs and %zu outputs",
+	            node->n_inputs,
+	            node->n_outputs);
+	for (i = 0; i < node->n_inputs; i++) {
+		ES_NEW_ASRT(node->inputs[i] < graph->n_tensors, "Input %zu is no tensor", i);
+	}
+	ES_NEW_ASRT(node->outputs[0] < graph->n_tensors, "Output is no tensor");
+	in  = &graph->tensors[node->inputs[0]];
+	out = &graph->tensors[node->outputs[0]];
+	ES_NEW_ASRT(!out->data, "Output %s is a constant", out->name);
+	ES_NEW_ASRT((in->type == GR_TYPE_INT8 || node->kind == GR_KIND_QUANTIZE) &&
+	                (out->type == GR_TYPE_INT8 || node->kind == GR_KIND_DEQUANTIZE),
+	            "Unsupported types %d -> %d",
+	            in->type,
+	            out->type);
+	switch (node->kind) {
+	case GR_KIND_GEMM:
+		ES_NEW_ASRT_NM(op && node->n_inputs == 1);
+		ES_NEW_ASRT(nn_op_input_size(op, node->batch) == in->size &&
+		                nn_op_output_size(op, node->batch) == out->size,
+		            "%zu -> %zu bytes, the op takes %zu -> %zu",
+		            in->size,
+		            out->size,
+		            nn_op_input_size(op, node->batch),
+		            nn_op_output_size(op, node->batch));
+		break;
+	case GR_KIND_MAX_POOL:
+	case GR_KIND_AVG_POOL:
+		nn_pool_output_dims(&node->pool, &out_h, &out_w);
+		ES_NEW_ASRT(
+		    in->size == node->pool.batch * node->pool.in_h * node->pool.in_w * node->pool.c &&
+		        out->size == node->pool.batch * out_h * out_w * node->pool.c,
+		    "Pool shapes do not match its tensors");
+		ES_NEW_ASRT(in->quant.scale == out->quant.scale &&
+		                in->quant.zero_point == out->quant.zero_point,
+		            "Pool changes the quantization");
+		break;
+	case GR_KIND_ADD:
+		ES_NEW_ASRT(node->n_inputs == 2 &&
+		                graph->tensors[node->inputs[1]].type == GR_TYPE_INT8 &&
+		                graph->tensors[node->inputs[1]].size == in->size && out->size == in->size,
+		            "Add needs two int8 inputs of the output's shape");
+		break;
+	case GR_KIND_QUANTIZE:
+	case GR_KIND_DEQUANTIZE:
+		ES_NEW_ASRT((node->kind == GR_KIND_QUANTIZE) == (in->type == GR_TYPE_FLOAT32) &&
+		                (node->kind == GR_KIND_DEQUANTIZE) == (out->type == GR_TYPE_FLOAT32),
+		            "Unsupported types %d -> %d",
+		            in->type,
+		            out->type);
+		/* fall through */
+	case GR_KIND_RESHAPE:
+	case GR_KIND_REQUANTIZE:
+		ES_NEW_ASRT(_elements(in) == _elements(out), "Element count changes");
+		break;
+	case GR_KIND_SOFTMAX:
+		ES_NEW_ASRT(in->size == out->size && in->rank >= 1 && in->shape[in->rank - 1] > 0,
+		            "Softmax shapes");
+		break;
+	default:
+		ES_NEW_ASRT(false, "Unknown node kind %d", node->kind);
+	}
+	return 0;
+}
+
+int gr_add_node(gr_st *graph, gr_node_t *node)
+{
+	NN_OP_CLEANUP nn_op_st *op = node ? MOVE_PZ(node->op) : NULL;
+	gr_node_t *dst;
+	ES_NEW_ASRT_NM(graph && node && !graph->finalized);
+	ES_FWD_INT(_check_node(graph, node, op), "Node %zu (%s)", graph->n_nodes, node->op_name);
+	ES_FWD_INT_NM(
+	    _grow((void **) &graph->nodes, &graph->nodes_cap, graph->n_nodes, sizeof(*dst)));
+	dst     = &graph->nodes[graph->n_nodes++];
+	*dst    = *node;
+	dst->op = MOVE_PZ(op);
+	return 0;
+}
+
+int gr_set_io(gr_st *graph,
+              const size_t *inputs,
+              size_t n_inputs,
+              const size_t *outputs,
+              size_t n_outputs)
+{
+	size_t i;
+	ES_NEW_ASRT_NM(graph && !graph->finalized);
+	ES_NEW_ASRT(n_inputs <= GR_MAX_IO && n_outputs <= GR_MAX_IO && n_outputs > 0,
+	            "%zu inputs and %zu outputs",
+	            n_inputs,
+	            n_outputs);
+	for (i = 0; i < n_inputs; i++) {
+		ES_NEW_ASRT(inputs[i] < graph->n_tensors, "Graph input %zu is no tensor", i);
+		graph->inputs[i] = inputs[i];
+	}
+	for (i = 0; i < n_outputs; i++) {
+		ES_NEW_ASRT(outputs[i] < graph->n_tensors, "Graph output %zu is no tensor", i);
+		graph->outputs[i] = outputs[i];
+	}
+	graph->n_inputs  = n_inputs;
+	graph->n_outputs = n_outputs;
+	return 0;
+}
+
+/* First and last node touching each activation, graph inputs are alive before node 0 */
+static int _lifetimes(gr_st *graph)
+{
+	const long end = (long) graph->n_nodes;
+	size_t t, n, i;
+	for (t = 0; t < graph->n_tensors; t++) {
+		graph->tensors[t].first = end + 1;
+		graph->tensors[t].last  = -1;
+	}
+	for (i = 0; i < graph->n_inputs; i++) {
+		graph->tensors[graph->inputs[i]].first = -1;
+	}
+	for (n = 0; n < graph->n_nodes; n++) {
+		const gr_node_t *node = &graph->nodes[n];
+		for (i = 0; i < node->n_inputs; i++) {
+			gr_tensor_t *tensor = &graph->tensors[node->inputs[i]];
+			ES_NEW_ASRT(tensor->data || tensor->first < (long) n,
+			            "Node %zu reads %s before it is written",
+			            n,
+			            tensor->name);
+			tensor->last = MAX(tensor->last, (long) n);
+		}
+		for (i = 0; i < node->n_outputs; i++) {
+			gr_tensor_t *tensor = &graph->tensors[node->outputs[i]];
+			ES_NEW_ASRT(tensor->first > end, "%s is written twice", tensor->name);
+			tensor->first = (long) n;
+			tensor->last  = MAX(tensor->last, (long) n);
+		}
+	}
+	for (i = 0; i < graph->n_outputs; i++) {
+		gr_tensor_t *tensor = &graph->tensors[graph->outputs[i]];
+		ES_NEW_ASRT(!tensor->data && tensor->first <= end,
+		            "Graph output %s is never written",
+		            tensor->name);
+		tensor->last = end;
+	}
+	return 0;
+}
+
+static bool _is_planned(const gr_tensor_t *tensor)
+{
+	return !tensor->data && tensor->first <= tensor->last;
+}
+
+static bool _is_graph_io(const gr_st *graph, size_t t)
+{
+	size_t i;
+	for (i = 0; i < graph->n_inputs; i++) {
+		if (graph->inputs[i] == t) {
+			return true;
+		}
+	}
+	for (i = 0; i < graph->n_outputs; i++) {
+		if (graph->outputs[i] == t) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Number of times tensor t is read, and the last node reading it */
+static size_t _readers(const gr_st *graph, size_t t, size_t *reader)
+{
+	size_t n, i, count = 0;
+	for (n = 0; n < graph->n_nodes; n++) {
+		for (i = 0; i < graph->nodes[n].n_inputs; i++) {
+			if (graph->nodes[n].inputs[i] == t) {
+				*reader = n;
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+/*
+ * Fold the activation after node n into its GEMM epilogue: a Relu, Relu6 or Quantize that keeps
+ * the quantization and is the only reader of the GEMM's output. The GEMM then writes the
+ * activation's output itself, and the tensor in between is never written or allocated.
+ */
+static bool _fuse_activation(gr_st *graph, size_t n)
+{
+	gr_node_t *node = &graph->nodes[n];
+	const gr_tensor_t *mid, *out;
+	gr_node_t *act;
+	size_t reader;
+	int32_t min, max;
+	if (node->kind != GR_KIND_GEMM || _is_graph_io(graph, node->outputs[0]) ||
+	    _readers(graph, node->outputs[0], &reader) != 1) {
+		return false;
+	}
+	act = &graph->nodes[reader];
+	mid = &graph->tensors[node->outputs[0]];
+	out = &graph->tensors[act->outputs[0]];
+	if (act->kind != GR_KIND_REQUANTIZE || mid->quant.scale != out->quant.scale ||
+	    mid->quant.zero_point != out->quant.zero_point) {
+		return false;
+	}
+	nn_activation_range(act->act, &out->quant, &min, &max);
+	nn_op_clamp_output(node->op, min, max);
+	node->outputs[0] = act->outputs[0];
+	node->fused_name = act->op_name;
+	memmove(act, act + 1, (graph->n_nodes - reader - 1) * sizeof(*act));
+	graph->n_nodes--;
+	return true;
+}
+
+static void _fuse(gr_st *graph)
+{
+	size_t n;
+	for (n = 0; n < graph->n_nodes; n++) {
+		while (_fuse_activation(graph, n)) {
+		}
+	}
+}
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+/* Elementwise CPU nodes can write over their first input if it dies with them */
+static bool _in_place(const gr_st *graph, const gr_node_t *node, size_t n)
+{
+	const gr_tensor_t *in  = &graph->tensors[node->inputs[0]];
+	const gr_tensor_t *out = &graph->tensors[node->outputs[0]];
+	return (node->kind == GR_KIND_ADD || node->kind == GR_KIND_REQUANTIZE ||
+	        node->kind == GR_KIND_RESHAPE) &&
+	       !in->data && in->first >= 0 && in->last == (long) n && in->size == out->size;
+}
+
+#define _IN_PLACE (SIZE_MAX)
+
+/*
+ * Hand the activations with their lifetimes to the planner and take back the offsets. The output
+ * of an in-place node joins the buffer of its input, which then lives until the output dies.
+ */
+static int _plan(gr_st *graph)
+{
+	CLEANUP(_cleanup_free) mp_buffer_t *buffers = NULL;
+	CLEANUP(_cleanup_free) size_t *owner        = NULL;
+	size_t t, n, n_buffers = 0;
+	ES_NEW_ASRT_NM(buffers = calloc(graph->n_tensors, sizeof(*buffers)));
+	ES_NEW_ASRT_NM(owner = calloc(graph->n_tensors, sizeof(*owner)));
+	for (n = 0; n < graph->n_nodes; n++) {
+		if (_in_place(graph, &graph->nodes[n], n)) {
+			owner[graph->nodes[n].outputs[0]] = _IN_PLACE;
+		}
+	}
+	for (t = 0; t < graph->n_tensors; t++) {
+		if (_is_planned(&graph->tensors[t]) && owner[t] != _IN_PLACE) {
+			buffers[n_buffers].size  = graph->tensors[t].size;
+			buffers[n_buffers].first = graph->tensors[t].first;
+			buffers[n_buffers].last  = graph->tensors[t].last;
+			owner[t]                 = n_buffers++;
+		}
+	}
+	/* In node order, so an input that is itself computed in place already has its buffer */
+	for (n = 0; n < graph->n_nodes; n++) {
+		const gr_node_t *node = &graph->nodes[n];
+		if (_in_place(graph, node, n)) {
+			mp_buffer_t *buffer     = &buffers[owner[node->inputs[0]]];
+			owner[node->outputs[0]] = owner[node->inputs[0]];
+			buffer->last            = MAX(buffer->last, graph->tensors[node->outputs[0]].last);
+		}
+	}
+	ES_FWD_INT_NM(mp_plan(buffers, n_buffers, GR_ALIGN, &graph->plan));
+	for (t = 0; t < graph->n_tensors; t++) {
+		if (_is_planned(&graph->tensors[t])) {
+			graph->tensors[t].offset = buffers[owner[t]].offset;
+		}
+	}
+	return 0;
+}
+
+int gr_finalize(gr_st *graph)
+{
+	ES_NEW_ASRT_NM(graph && !graph->finalized);
+	ES_NEW_ASRT(graph->n_nodes > 0 && graph->n_outputs > 0, "Empty graph");
+	/* Checks that every node comes after the producers of its inputs, which _fuse relies on */
+	ES_FWD_INT_NM(_lifetimes(graph));
+	_fuse(graph);
+	/* Again with the node indices left after fusing */
+	ES_FWD_INT_NM(_lifetimes(graph));
+	ES_FWD_INT_NM(_plan(graph));
+	graph->finalized = true;
+	return 0;
+}
+
+size_t gr_arena_size(const gr_st *graph)
+{
+	return graph->plan.arena_size;
+}
+
+size_t gr_unshared_size(const gr_st *graph)
+{
+	size_t t, size = 0;
+	for (t = 0; t < graph->n_tensors; t++) {
+		if (_is_planned(&graph->tensors[t])) {
+			size += _ALIGN_UP(graph->tensors[t].size);
+		}
+	}
+	return size;
+}
+
+const mp_report_t *gr_plan_report(const gr_st *graph)
+{
+	return &graph->plan;
+}
+
+size_t gr_n_tensors(const gr_st *graph)
+{
+	return graph->n_tensors;
+}
+
+const gr_tensor_t *gr_tensor(const gr_st *graph, size_t idx)
+{
+	return idx < graph->n_tensors ? &graph->tensors[idx] : NULL;
+}
+
+size_t gr_n_nodes(const gr_st *graph)
+{
+	return graph->n_nodes;
+}
+
+const gr_node_t *gr_node(const gr_st *graph, size_t idx)
+{
+	return idx < graph->n_nodes ? &graph->nodes[idx] : NULL;
+}
+
+size_t gr_n_inputs(const gr_st *graph)
+{
+	return graph->n_inputs;
+}
+
+size_t gr_input(const gr_st *graph, size_t i)
+{
+	return graph->inputs[i];
+}
+
+size_t gr_n_outputs(const gr_st *graph)
+{
+	return graph->n_outputs;
+}
+
+size_t gr_output(const gr_st *graph, size_t i)
+{
+	return graph->outputs[i];
+}
+
+void *gr_tensor_data(const gr_st *graph, void *arena, size_t idx)
+{
+	const gr_tensor_t *tensor = &graph->tensors[idx];
+	return tensor->data ? tensor->data : (uint8_t *) arena + tensor->offset;
+}
+
+static int _run_node(gr_st *graph, const gr_node_t *node, dev_st *dev, void *arena)
+{
+	const gr_tensor_t *in  = &graph->tensors[node->inputs[0]];
+	const gr_tensor_t *out = &graph->tensors[node->outputs[0]];
+	const void *src        = gr_tensor_data(graph, arena, node->inputs[0]);
+	void *dst              = gr_tensor_data(graph, arena, node->outputs[0]);
+	switch (node->kind) {
+	case GR_KIND_GEMM:
+		ES_FWD_INT_NM(nn_op_run(node->op, dev, dst, src, node->batch));
+		break;
+	case GR_KIND_RESHAPE:
+		if (dst != src) {
+			memcpy(dst, src, out->size);
+		}
+		break;
+	case GR_KIND_MAX_POOL:
+		nn_ref_max_pool(dst, src, &node->pool);
+		break;
+	case GR_KIND_AVG_POOL:
+		nn_ref_avg_pool(dst, src, &node->pool);
+		break;
+	case GR_KIND_ADD:
+		nn_ref_add(dst,
+		           src,
+		           &in->quant,
+		           gr_tensor_data(graph, arena, node->inputs[1]),
+		           &graph->tensors[node->inputs[1]].quant,
+		           &out->quant,
+		           node->act,
+		           out->size);
+		break;
+	case GR_KIND_REQUANTIZE:
+		nn_ref_requantize(dst, src, &in->quant, &out->quant, node->act, out->size);
+		break;
+	case GR_KIND_QUANTIZE:
+		nn_ref_quantize(dst, src, &out->quant, out->size);
+		break;
+	case GR_KIND_DEQUANTIZE:
+		nn_ref_dequantize(dst, src, &in->quant, in->size);
+		break;
+	case GR_KIND_SOFTMAX:
+		nn_ref_softmax(dst,
+		               src,
+		               &in->quant,
+		               &out->quant,
+		               node->beta,
+		               in->size / in->shape[in->rank - 1],
+		               in->shape[in->rank - 1]);
+		break;
+	}
+	return 0;
+}
+
+int gr_run(gr_st *graph, dev_st *dev, void *arena)
+{
+	size_t n;
+	ES_NEW_ASRT_NM(graph && graph->finalized && (arena || !graph->plan.arena_size));
+	for (n = 0; n < graph->n_nodes; n++) {
+		ES_FWD_INT(_run_node(graph, &graph->nodes[n], dev, arena),
+		           "Node %zu (%s)",
+		           n,
+		           graph->nodes[n].op_name);
+	}
+	return 0;
+}
+
+static void _print_shape(const gr_tensor_t *tensor, FILE *f)
+{
+	size_t i;
+	fputc('[', f);
+	for (i = 0; i < tensor->rank; i++) {
+		fprintf(f, i ? ", %zu" : "%zu", tensor->shape[i]);
+	}
+	fputc(']', f);
+}
+
+void gr_print(const gr_st *graph, FILE *f)
+{
+	size_t n;
+	for (n = 0; n < graph->n_nodes; n++) {
+		const gr_node_t *node     = &graph->nodes[n];
+		const gr_tensor_t *output = &graph->tensors[node->outputs[0]];
+		char name[64];
+		snprintf(name,
+		         sizeof(name),
+		         "%s%s%s",
+		         node->op_name,
+		         node->fused_name ? "+" : "",
+		         node->fused_name ? node->fused_name : "");
+		fprintf(f,
+		        "%3zu %-20s %-6s %-24s",
+		        n,
+		        name,
+		        node->kind == GR_KIND_GEMM ? "device" : "cpu",
+		        output->name);
+		_print_shape(output, f);
+		if (graph->finalized) {
+			fprintf(f, " @0x%zx", output->offset);
+		}
+		fputc('\n', f);
+	}
+	if (graph->finalized) {
+		fputs("arena: ", f);
+		mp_print_report(&graph->plan, f);
+	}
+}
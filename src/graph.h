@@ -0,0 +1,168 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Execution graph for quantized models. Nodes run in the order they were added (a model file
+ * already stores them topologically sorted). GEMM shaped ops (FullyConnected, Conv2D,
+ * DepthwiseConv2D) are prepared nn_ops and run on the device, everything else runs one of the CPU
+ * kernels of nn_ref.
+ *
+ * Every activation lives in one arena. When the graph is finalized each tensor gets the range of
+ * nodes it is alive for, from the node that writes it to the last node that reads it, and
+ * mem_plan.h places the tensors so that those whose ranges do not overlap share memory. The arena
+ * can be any memory, e.g. a region of the udmabuf after gemm_staging_size, so that activations
+ * stay in DMA-able memory.
+ *
+ * How to:
+ * 1. gr_alloc, then gr_add_tensor / gr_add_node / gr_set_io (usually done by tfl_import)
+ * 2. gr_finalize to plan the arena
+ * 3. Provide gr_arena_size bytes, write inputs at gr_tensor_data, gr_run, read the outputs
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "device.h"
+#include "mem_plan.h"
+#include "nn_ops.h"
+#include "nn_ref.h"
+
+#define GR_MAX_RANK (4)
+#define GR_MAX_IO   (3)
+/* Alignment of every activation in the arena */
+#define GR_ALIGN (32)
+
+typedef enum gr_type_e
+{
+	GR_TYPE_INT8,
+	GR_TYPE_INT32,
+	GR_TYPE_FLOAT32,
+} gr_type_et;
+
+typedef struct gr_tensor_s
+{
+	/* Owned by the graph */
+	char *name;
+	gr_type_et type;
+	size_t rank;
+	size_t shape[GR_MAX_RANK];
+	/* Per-tensor quantization of int8 tensors */
+	nn_quant_t quant;
+	/* Bytes */
+	size_t size;
+	/* Constant contents, owned by the graph. NULL for activations */
+	void *data;
+	/* Set by gr_finalize for activations: arena offset and the nodes it is alive for */
+	size_t offset;
+	long first;
+	long last;
+} gr_tensor_t;
+
+typedef enum gr_kind_e
+{
+	/* A prepared nn_op, run on the device */
+	GR_KIND_GEMM,
+	/* Same bytes, new shape */
+	GR_KIND_RESHAPE,
+	GR_KIND_MAX_POOL,
+	GR_KIND_AVG_POOL,
+	GR_KIND_ADD,
+	/* int8 to int8 Quantize, Relu and Relu6 */
+	GR_KIND_REQUANTIZE,
+	/* float to int8 */
+	GR_KIND_QUANTIZE,
+	/* int8 to float */
+	GR_KIND_DEQUANTIZE,
+	GR_KIND_SOFTMAX,
+} gr_kind_et;
+
+typedef struct gr_node_s
+{
+	gr_kind_et kind;
+	/* Name of the source op, for gr_print */
+	const char *op_name;
+	/* Name of the activation gr_finalize folded into a GEMM's epilogue, NULL for none */
+	const char *fused_name;
+	size_t n_inputs;
+	size_t inputs[GR_MAX_IO];
+	size_t n_outputs;
+	size_t outputs[GR_MAX_IO];
+	/* GR_KIND_GEMM: owned by the graph once added, and the number of samples per run */
+	nn_op_st *op;
+	size_t batch;
+	/* GR_KIND_*_POOL */
+	nn_pool_params_t pool;
+	/* GR_KIND_ADD and GR_KIND_REQUANTIZE */
+	nn_act_et act;
+	/* GR_KIND_SOFTMAX */
+	float beta;
+} gr_node_t;
+
+struct gr_s;
+typedef struct gr_s gr_st;
+
+int gr_alloc(gr_st **dst);
+void gr_cleanup(gr_st **graph);
+
+#define GR_CLEANUP CLEANUP(gr_cleanup)
+
+/**
+ * @brief Add a tensor, name and data (size bytes, may be NULL) are copied.
+ *
+ * @param idx Set to the index of the tensor
+ */
+int gr_add_tensor(gr_st *graph, const gr_tensor_t *tensor, size_t *idx);
+/**
+ * @brief Append a copy of node. The graph takes node->op, even on failure, and clears it.
+ */
+int gr_add_node(gr_st *graph, gr_node_t *node);
+int gr_set_io(gr_st *graph,
+              const size_t *inputs,
+              size_t n_inputs,
+              const size_t *outputs,
+              size_t n_outputs);
+
+/**
+ * @brief Check the graph and lay the activations out in the arena. No changes after this.
+ *
+ * Before planning, a Relu / Relu6 / Quantize that keeps the quantization and is the only reader
+ * of a GEMM's output is folded into the GEMM, which then clamps in its epilogue while the block is
+ * in cache; gr_n_nodes drops accordingly. Add, Relu, Relu6, Quantize and Reshape nodes write over
+ * their first input when it dies with them.
+ */
+int gr_finalize(gr_st *graph);
+
+size_t gr_arena_size(const gr_st *graph);
+/* Sum of the activation sizes, what the arena would take without sharing */
+size_t gr_unshared_size(const gr_st *graph);
+/* Footprint of the arena plan: size, peak live bytes and where the peak is */
+const mp_report_t *gr_plan_report(const gr_st *graph);
+
+size_t gr_n_tensors(const gr_st *graph);
+const gr_tensor_t *gr_tensor(const gr_st *graph, size_t idx);
+size_t gr_n_nodes(const gr_st *graph);
+const gr_node_t *gr_node(const gr_st *graph, size_t idx);
+size_t gr_n_inputs(const gr_st *graph);
+size_t gr_input(const gr_st *graph, size_t i);
+size_t gr_n_outputs(const gr_st *graph);
+size_t gr_output(const gr_st *graph, size_t i);
+
+/**
+ * @brief Where a tensor lives: its constant data, or its place in the arena.
+ */
+void *gr_tensor_data(const gr_st *graph, void *arena, size_t idx);
+
+/**
+ * @brief Run every node once.
+ *
+ * @param dev Device for the GEMM nodes, NULL to run them on the CPU
+ * @param arena gr_arena_size bytes, GR_ALIGN aligned, holding the inputs
+ */
+int gr_run(gr_st *graph, dev_st *dev, void *arena);
+
+void gr_print(const gr_st *graph, FILE *f);
@@ -0,0 +1,255 @@
+#include "job_queue.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Asynchronous submission of tile multiplications.
+ */
+
+#include <hps.h>
+#include <stdlib.h>
+
+#include "errstack.h"
+#include "systolic.h"
+#include "trace.h"
+
+#define _READS_PER_JOB (2)
+/* Largest group of jobs whose operands are streamed together */
+#define _MAX_GROUP (MSGDMA_READ_CSR_DESCRIPTOR_FIFO_DEPTH / _READS_PER_JOB)
+
+struct jq_s
+{
+	dev_st *dev;
+	jq_handle_t submitted;
+	jq_handle_t completed;
+	/* dev->send_count after the last instruction of this queue */
+	uint32_t send_count;
+
+	/* Free FIFO slots known without reading a CSR. Refreshed only when they run out. */
+	struct
+	{
+		int32_t instr;
+		int32_t read;
+		int32_t write;
+	} credits;
+};
+
+int jq_alloc(jq_st **dst, dev_st *dev)
+{
+	jq_st *tmp;
+	ES_NEW_ASRT_NM(dst && dev);
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	tmp->dev        = dev;
+	tmp->send_count = dev->send_count;
+	*dst            = tmp;
+	return 0;
+}
+
+void jq_cleanup(jq_st **jq)
+{
+	if (!*jq) {
+		return;
+	}
+	free(*jq);
+	*jq = NULL;
+}
+
+/* Completions are only ours while nobody else sent instructions to the device */
+static int _check_owner(const jq_st *jq)
+{
+	ES_NEW_ASRT(jq->dev->send_count == jq->send_count,
+	            "%u instructions were sent to the device outside of the queue",
+	            jq->dev->send_count - jq->send_count);
+	return 0;
+}
+
+static void _refresh_credits(jq_st *jq)
+{
+	const int32_t instr_fill = dev_read_reg(jq->dev, DEV_REG_INSTR_FILL);
+	const int32_t read_fill  = dev_read_reg(jq->dev, DEV_REG_RD_FILL) & 0xFFFF;
+	const int32_t write_fill = dev_read_reg(jq->dev, DEV_REG_WR_FIFO_FILL);
+	jq->credits.instr        = FIFO_INSTR_IN_FIFO_DEPTH - instr_fill;
+	jq->credits.read         = MSGDMA_READ_CSR_DESCRIPTOR_FIFO_DEPTH - read_fill;
+	jq->credits.write        = DMA_WRITE_FIFO_IN_FIFO_DEPTH - write_fill;
+}
+
+/* Read descriptors for a group of jobs, left operands first */
+static void _group_reads(dev_read_desc_t *dst, const jq_job_t *jobs, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		dst[i] = (dev_read_desc_t){
+		    .phys_addr = jobs[i].left_phys,
+		    .n_bytes   = sizeof(matrix_t),
+		    .channel   = DEV_CHANNEL_LEFT,
+		};
+		dst[n + i] = (dev_read_desc_t){
+		    .phys_addr = jobs[i].right_phys,
+		    .n_bytes   = sizeof(matrix_t),
+		    .channel   = DEV_CHANNEL_RIGHT,
+		};
+	}
+}
+
+/* Largest prefix of jobs that fits in the current credits once its reads are merged */
+static size_t _fit_group(jq_st *jq, dev_read_desc_t *descs, const jq_job_t *jobs, size_t n)
+{
+	const size_t lead = MAX(jq->dev->read_lead_bytes / sizeof(matrix_t), (size_t) 1);
+	size_t group      = MIN(MIN(n, lead), (size_t) _MAX_GROUP);
+	group             = MIN(group, (size_t) MAX(MIN(jq->credits.instr, jq->credits.write), 0));
+	for (; group > 0; group--) {
+		_group_reads(descs, jobs, group);
+		if ((int32_t) dev_count_reads(descs, 2 * group) <= jq->credits.read) {
+			break;
+		}
+	}
+	return group;
+}
+
+int jq_submit_batch(jq_st *jq, const jq_job_t *jobs, size_t n, jq_handle_t *first)
+{
+	dev_read_desc_t descs[2 * _MAX_GROUP];
+	bool refreshed = false;
+	size_t done    = 0;
+	ES_NEW_ASRT_NM(jq && (jobs || n == 0));
+	ES_FWD_INT_NM(_check_owner(jq));
+	if (first) {
+		*first = jq->submitted;
+	}
+	while (done < n) {
+		const size_t group = _fit_group(jq, descs, &jobs[done], n - done);
+		size_t j;
+		if (group == 0) {
+			if (refreshed) {
+				/* The FIFOs are full, the caller retries once the device made room */
+				TR_INSTANT("fifo_stall", n - done);
+				break;
+			}
+			_refresh_credits(jq);
+			refreshed = true;
+			continue;
+		}
+		TR_INSTANT("submit", group);
+		/* _fit_group left enough read credits for the whole group */
+		dev_send_reads_in(jq->dev, descs, 2 * group, &jq->credits.read);
+		for (j = 0; j < group; j++) {
+			dev_send_write(jq->dev, jobs[done + j].dst_phys);
+		}
+		for (j = 0; j < group; j++) {
+			dev_send_instr(jq->dev, SA_INSTR(SA_DIM, SA_DIM));
+		}
+		jq->credits.instr -= group;
+		jq->credits.write -= group;
+		jq->submitted += group;
+		done += group;
+	}
+	jq->send_count = jq->dev->send_count;
+	return (int) done;
+}
+
+int jq_submit(jq_st *jq,
+              jq_handle_t *handle,
+              uint32_t dst_phys,
+              uint32_t left_phys,
+              uint32_t right_phys)
+{
+	const jq_job_t job = {
+	    .dst_phys   = dst_phys,
+	    .left_phys  = left_phys,
+	    .right_phys = right_phys,
+	};
+	int ret;
+	ES_FWD_INT_NM(ret = jq_submit_batch(jq, &job, 1, handle));
+	return ret;
+}
+
+int jq_poll(jq_st *jq)
+{
+	jq_handle_t completed;
+	int n_new;
+	if (jq->completed == jq->submitted) {
+		return 0;
+	}
+	ES_FWD_INT_NM(_check_owner(jq));
+	completed = jq->submitted - dev_writes_outstanding(jq->dev);
+	/* Never go backwards, the count is sampled from two registers */
+	if (completed <= jq->completed) {
+		return 0;
+	}
+	n_new         = (int) (completed - jq->completed);
+	jq->completed = completed;
+	TR_INSTANT("complete", n_new);
+	return n_new;
+}
+
+bool jq_is_done(const jq_st *jq, jq_handle_t handle)
+{
+	return handle < jq->completed;
+}
+
+typedef struct _wait_arg_s
+{
+	jq_st *jq;
+	jq_handle_t handle;
+	/* jq_poll failed, the handle may never be seen complete */
+	bool failed;
+} _wait_arg_t;
+
+static int _block(void *arg, int ms)
+{
+	_wait_arg_t *wait = arg;
+	return dev_block(wait->jq->dev, ms);
+}
+
+static bool _job_done(void *arg)
+{
+	_wait_arg_t *wait = arg;
+	if (jq_is_done(wait->jq, wait->handle)) {
+		return true;
+	}
+	wait->failed = jq_poll(wait->jq) < 0;
+	return wait->failed || jq_is_done(wait->jq, wait->handle);
+}
+
+int jq_wait(jq_st *jq, jq_handle_t handle)
+{
+	_wait_arg_t wait = {.jq = jq, .handle = handle};
+	int ret;
+	ES_NEW_ASRT(handle < jq->submitted,
+	            "Handle %llu was never submitted",
+	            (unsigned long long) handle);
+	if (!jq_is_done(jq, handle)) {
+		TR_BEGIN("wait");
+		ret = wt_wait(&jq->dev->waiter, _job_done, jq->dev->block ? _block : NULL, &wait);
+		TR_END("wait");
+		ES_FWD_INT(ret, "Failed to block on handle %llu", (unsigned long long) handle);
+		ES_NEW_ASRT(!wait.failed, "Lost track of handle %llu", (unsigned long long) handle);
+	}
+	return 0;
+}
+
+int jq_wait_all(jq_st *jq)
+{
+	if (jq->submitted == 0) {
+		return 0;
+	}
+	ES_FWD_INT_NM(jq_wait(jq, jq->submitted - 1));
+	return 0;
+}
+
+uint64_t jq_in_flight(const jq_st *jq)
+{
+	return jq->submitted - jq->completed;
+}
+
+uint64_t jq_submitted(const jq_st *jq)
+{
+	return jq->submitted;
+}
+
+dev_st *jq_dev(const jq_st *jq)
+{
+	return jq->dev;
+}
@@ -0,0 +1,111 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Asynchronous submission of tile multiplications. Jobs are pushed straight into the device FIFOs
+ * and complete in submission order, so a handle is just the job's sequence number.
+ *
+ * Completions are counted from the write DMA of the whole device, so a queue owns its device from
+ * jq_alloc until jq_cleanup. Any other instruction sent in between (matrix_mult16, gemm_s8, a
+ * second queue) is detected through dev->send_count and fails the next jq_submit, jq_poll or
+ * jq_wait.
+ *
+ * How to:
+ * 1. jq_alloc on an open device
+ * 2. jq_submit as many jobs as the FIFOs accept (it returns 0 when they are full)
+ * 3. jq_poll from the host loop, or jq_wait on a handle before touching its result
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "device.h"
+
+typedef uint64_t jq_handle_t;
+
+typedef struct jq_job_s
+{
+	/* Physical address of the column-major result */
+	uint32_t dst_phys;
+	/* Physical address of the column-major left operand */
+	uint32_t left_phys;
+	/* Physical address of the row-major right operand */
+	uint32_t right_phys;
+} jq_job_t;
+
+struct jq_s;
+typedef struct jq_s jq_st;
+
+int jq_alloc(jq_st **dst, dev_st *dev);
+void jq_cleanup(jq_st **jq);
+
+#define JQ_CLEANUP CLEANUP(jq_cleanup)
+
+/**
+ * @brief Queue dst = left x right without waiting for it.
+ *
+ * @param jq Working queue
+ * @param handle Where to store the handle of the new job, may be NULL
+ * @param dst_phys Physical address of the column-major result
+ * @param left_phys Physical address of the column-major left operand
+ * @param right_phys Physical address of the row-major right operand
+ * @return 1 if submitted, 0 if the device FIFOs are full, < 0 on failure
+ */
+int jq_submit(jq_st *jq,
+              jq_handle_t *handle,
+              uint32_t dst_phys,
+              uint32_t left_phys,
+              uint32_t right_phys);
+
+/**
+ * @brief Queue several jobs with as few bridge accesses as possible. The fill levels are read at
+ * most once. Jobs go out in groups: the left operands of a group back to back, then its right
+ * operands, so operands that are contiguous in memory share a read descriptor. A group never
+ * streams more than dev->read_lead_bytes on one channel ahead of the other.
+ *
+ * @param jq Working queue
+ * @param jobs Jobs to submit in order
+ * @param n Number of jobs
+ * @param first Where to store the handle of jobs[0], the rest follow consecutively. May be NULL
+ * @return Number of jobs submitted, possibly 0 if the device FIFOs are full. < 0 on failure
+ */
+int jq_submit_batch(jq_st *jq, const jq_job_t *jobs, size_t n, jq_handle_t *first);
+
+/**
+ * @brief Check the device for completed jobs.
+ *
+ * @return Number of jobs that completed since the last poll, < 0 if the device was used by
+ * something else
+ */
+int jq_poll(jq_st *jq);
+
+/**
+ * @brief Check a handle against the last poll, does not touch the device.
+ */
+bool jq_is_done(const jq_st *jq, jq_handle_t handle);
+
+/**
+ * @brief Block until a job has completed.
+ *
+ * @return >= 0 on success, < 0 if the handle was never submitted or the device was used by
+ * something else
+ */
+int jq_wait(jq_st *jq, jq_handle_t handle);
+
+/**
+ * @brief Block until every submitted job has completed.
+ */
+int jq_wait_all(jq_st *jq);
+
+/**
+ * @brief Number of jobs submitted but not yet seen complete.
+ */
+uint64_t jq_in_flight(const jq_st *jq);
+/**
+ * @brief Number of jobs ever submitted, which is also the handle of the next one.
+ */
+uint64_t jq_submitted(const jq_st *jq);
+dev_st *jq_dev(const jq_st *jq);
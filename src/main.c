@@ -16,264 +16,174 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #define soc_cv_av
+#include "device.h"
 #include "errstack.h"
+#include "gemm.h"
+#include "graph.h"
 #include "hwlib.h"
 #include "memory_utils.h"
+#include "sampler.h"
 #include "socal/hps.h"
 #include "socal/socal.h"
+#include "systolic.h"
+#include "tflite.h"
+#include "trace.h"
 #include "util.h"
 
-// Cyclone V Hard Processor System Technical Reference Manual, Table 2-2
-#define HPS2FPGA_BASE (0xC0000000)
-// Size of 2 MiB, can be as much as 960 MiB
-#define HPS2FPGA_SPAN (0x00200000)
 // Cyclone V Hard Processor System Technical Reference Manual, Table 2-3
 #define SDRAMCSR_BASE (0xFFC20000)
 // Cyclone V Hard Processor System Technical Reference Manual, Table 2-3
 #define SDRAMCSR_SPAN (0x000E0000)
+// Bytes of device memory when running against the emulator
+#define EMU_MEM_SIZE (1 << 20)
 
-#define FIFO_IS_FULL(csr)    !!(*(csr + 1) & 0b000001)
-#define FIFO_IS_EMPTY(csr)   !!(*(csr + 1) & 0b000010)
-#define FIFO_FILL_LEVEL(csr) (*csr)
-
-#pragma pack(push, 1)
-typedef struct matrix_intrinsic_s
-{
-	uint8_t data[16][16];
-} matrix_t;
-#pragma pack(pop)
-
-struct prog_state_s
+static int _sdram_csr_print(void)
 {
-	int fd_dev_mem;
-	void *virtual_base;
-
-	udmabuf_t udmabuf;
-
-	int32_t send_count;
-	int32_t recv_count;
-
-	volatile uint64_t *fifo_instr;
-	volatile int32_t *fifo_instr_csr;
-	volatile int32_t *pio_status;
-	volatile uint32_t *systolic_csr;
-
-	struct
-	{
-		volatile uint32_t *csr;
-		volatile uint32_t *descriptor;
-	} read_dma;
-
-	struct
-	{
-		volatile uint32_t *csr;
-		volatile uint64_t *descriptor;
-	} write_dma;
-};
+	CLEAN_FD int fd_dev_mem = -1;
+	volatile void *sdramcsr_base;
+	ES_NEW_INT_ERRNO(fd_dev_mem = open("/dev/mem", (O_RDWR | O_SYNC)));
+	ES_NEW_ASRT_ERRNO((sdramcsr_base = mmap(NULL,
+	                                        SDRAMCSR_SPAN,
+	                                        PROT_READ | PROT_WRITE,
+	                                        MAP_SHARED,
+	                                        fd_dev_mem,
+	                                        SDRAMCSR_BASE)) != MAP_FAILED);
+	mu_sdram_csr_print(sdramcsr_base);
+	munmap((void *) sdramcsr_base, SDRAMCSR_SPAN);
+	return 0;
+}
 
-static void _state_cleanup(struct prog_state_s *state)
+/* Compare a tiled GEMM on the FPGA against the software model of the same tiling */
+static int _gemm_check(dev_st *dev, size_t m, size_t k, size_t n)
 {
-	if (state->virtual_base) {
-		munmap(state->virtual_base, HPS2FPGA_SPAN);
-		state->virtual_base = NULL;
+	int8_t a[m * k], b[k * n];
+	int32_t actual[m * n], expected[m * n];
+	size_t i, n_tiles, n_bad = 0;
+	struct timespec start, end;
+	double elapsed;
+	for (i = 0; i < m * k; i++) {
+		a[i] = (int8_t) (rand() % 3 - 1);
 	}
-	if (state->fd_dev_mem >= 0) {
-again:
-		int res = close(state->fd_dev_mem);
-		if (res <= 0 && errno == EINTR) {
-			goto again;
-		}
-		state->fd_dev_mem = -1;
+	for (i = 0; i < k * n; i++) {
+		b[i] = (int8_t) (rand() % 3 - 1);
 	}
-	cleanup_udmabuf(&state->udmabuf);
-}
-
-void print_state(struct prog_state_s *s)
-{
-	printf("sys_state: 0x%08x\n", *(s->systolic_csr));
-	printf("sys_n_col: 0x%08x\n", *(s->systolic_csr + 1));
-	printf("sys_n_row: 0x%08x\n", *(s->systolic_csr + 2));
-	printf("sys_cycle: 0x%08x\n", *(s->systolic_csr + 3));
-	printf("sys_stream: 0x%08x\n", *(s->systolic_csr + 4));
-	printf("sys_c0: 0x%08x\n", *(s->systolic_csr + 5));
-	printf("sys_c1: 0x%08x\n", *(s->systolic_csr + 6));
-	printf("sys_c2: 0x%08x\n", *(s->systolic_csr + 7));
-	printf("sys_c3: 0x%08x\n", *(s->systolic_csr + 8));
-	printf("sys_c4: 0x%08x\n", *(s->systolic_csr + 9));
-	printf("sys_c5: 0x%08x\n", *(s->systolic_csr + 10));
-	printf("sys_c6: 0x%08x\n", *(s->systolic_csr + 11));
-	printf("sys_c7: 0x%08x\n", *(s->systolic_csr + 12));
-	printf("wr_status: 0x%08x\n", *(s->write_dma.csr));
-	printf("wr_fill: 0x%08x\n", *(s->write_dma.csr + 2));
-	printf("rd_status: 0x%08x\n", *(s->read_dma.csr));
-	printf("rd_fill: 0x%08x\n\n", *(s->read_dma.csr + 2));
-}
-
-static int _send_instr(struct prog_state_s *s, uint64_t data)
-{
-	int retval = 0;
-	int n      = FIFO_INSTR_IN_CSR_FIFO_DEPTH - FIFO_FILL_LEVEL(s->fifo_instr_csr);
-	if (n > 0) {
-		*(s->fifo_instr) = data;
-		retval           = 1;
-		s->send_count += 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ES_FWD_INT_NM(gemm_s8(dev, actual, a, b, m, k, n));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ES_FWD_INT_NM(gemm_s8_tiled_ref(expected, a, b, m, k, n));
+	for (i = 0; i < m * n; i++) {
+		n_bad += actual[i] != expected[i];
 	}
-	return retval;
-}
-
-#define _SEND_INSTR(state, n_rows, n_cols)                                                         \
-	({                                                                                             \
-		uint64_t _send_val = (n_cols & 0b111111) | ((n_rows & 0b111111) << 6);                     \
-		while (_send_instr(state, _send_val) == 0)                                                 \
-			sched_yield();                                                                         \
-	})
-
-static int _send_read(struct prog_state_s *s,
-                      uint32_t phys_addr,
-                      uint32_t n_bytes,
-                      uint32_t channel)
-{
-	// ES_NEW_ASRT((phys_addr & 0x1F) == 0, "physical address must be 32 byte aligned");
-	// ES_NEW_ASRT((n_bytes & 0x1F) == 0, "length must be in 32 byte increments");
-	*s->read_dma.descriptor       = phys_addr;
-	*(s->read_dma.descriptor + 2) = n_bytes;
-	// Go bit and early done enable
-	*(s->read_dma.descriptor + 3) = (1u << 31) | (1u << 24) | (channel & 0xFF);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	n_tiles = (m + SA_DIM - 1) / SA_DIM;
+	n_tiles *= (k + SA_DIM - 1) / SA_DIM;
+	n_tiles *= (n + SA_DIM - 1) / SA_DIM;
+	printf("gemm %zux%zux%zu: %zu/%zu mismatches, %zu tiles in %.6f s (%.0f tiles/s)\n",
+	       m,
+	       k,
+	       n,
+	       n_bad,
+	       m * n,
+	       n_tiles,
+	       elapsed,
+	       n_tiles / elapsed);
+	ES_NEW_ASRT(n_bad == 0, "FPGA result does not match the software model");
 	return 0;
 }
 
-static int _send_write(struct prog_state_s *s, uint32_t phys_addr)
-{
-	// ES_NEW_ASRT((phys_addr & 0x1F) == 0, "physical address must be 32 byte aligned");
-	// ES_NEW_ASRT((n_bytes & 0x1F) == 0, "length must be in 32 byte increments");
-	*(s->write_dma.descriptor) = phys_addr;
-	return 0;
-}
-
-/**
- * @brief Perform a matrix multiplication with FPGA hardware
- *
- * @param s program state handle for hardware
- * @param dst column-major order
- * @param left_src column-major order
- * @param right_src row-major order
- */
-void matrix_mult16(struct prog_state_s *s, matrix_t *dst, matrix_t *left_src, matrix_t *right_src)
+/* Run a .tflite model once on zeroed inputs, with the activations in device memory */
+static int _model_run(dev_st *dev, const char *path)
 {
-	_send_read(s, (uint32_t) left_src, sizeof(matrix_t), 1);
-	printf("send read1\n");
-	_send_read(s, (uint32_t) right_src, sizeof(matrix_t), 0);
-	printf("send read2\n");
-	_send_write(s, (uint32_t) dst);
-	printf("send write\n");
-	_SEND_INSTR(s, 16, 16);
-	printf("send instr\n");
-
-	while (({
-		uint32_t status = *(s->write_dma.csr);
-		status;
-	})) {
-		sched_yield();
+	GR_CLEANUP gr_st *graph = NULL;
+	const size_t offset     = gemm_staging_size(dev, GEMM_PIPELINE_DEPTH);
+	uint8_t *arena          = (uint8_t *) dev->virtual_base + offset;
+	struct timespec start, end;
+	size_t i;
+	ES_FWD_INT(tfl_load(&graph, path), "Failed to import %s", path);
+	gr_print(graph, stdout);
+	ES_NEW_ASRT(offset % GR_ALIGN == 0 && offset + gr_arena_size(graph) <= dev->size,
+	            "Arena of %zu bytes does not fit after %zu bytes of staging",
+	            gr_arena_size(graph),
+	            offset);
+	for (i = 0; i < gr_n_inputs(graph); i++) {
+		const size_t idx = gr_input(graph, i);
+		memset(gr_tensor_data(graph, arena, idx), 0, gr_tensor(graph, idx)->size);
 	}
-	return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ES_FWD_INT_NM(gr_run(graph, dev, arena));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("ran %zu nodes in %.6f s\n",
+	       gr_n_nodes(graph),
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9);
+	return 0;
 }
 
-void _print_mat(matrix_t *src, bool col_major)
+/* Offline: plan the activations of each model and report the footprint, no device needed */
+static int _model_plan(int n, char **paths)
 {
-	for (int i = 0; i < 16; i++) {
-		for (int j = 0; j < 16; j++) {
-			int v = col_major ? src->data[j][i] : src->data[i][j];
-			printf("%02x ", v);
-		}
-		printf("\n");
+	int i;
+	for (i = 0; i < n; i++) {
+		GR_CLEANUP gr_st *graph = NULL;
+		ES_FWD_INT(tfl_load(&graph, paths[i]), "Failed to import %s", paths[i]);
+		printf("%s: ", paths[i]);
+		mp_print_report(gr_plan_report(graph), stdout);
 	}
+	return 0;
 }
 
-static int _pipeline(int argc, char **argv)
+static int _commands(dev_st *dev, int argc, char **argv)
 {
-	puts("starting pipeline");
-	CLEANUP(_state_cleanup) struct prog_state_s state = {};
-	volatile void *sdramcsr_base;
-
-	ES_NEW_INT_ERRNO(state.fd_dev_mem = open("/dev/mem", (O_RDWR | O_SYNC)));
-	ES_NEW_ASRT_ERRNO((state.virtual_base = mmap(NULL,
-	                                             HPS2FPGA_SPAN,
-	                                             PROT_READ | PROT_WRITE,
-	                                             MAP_SHARED,
-	                                             state.fd_dev_mem,
-	                                             HPS2FPGA_BASE)) != MAP_FAILED);
-	ES_NEW_ASRT_ERRNO((sdramcsr_base = mmap(NULL,
-	                                        SDRAMCSR_SPAN,
-	                                        PROT_READ | PROT_WRITE,
-	                                        MAP_SHARED,
-	                                        state.fd_dev_mem,
-	                                        SDRAMCSR_BASE)) != MAP_FAILED);
-	ES_FWD_INT(mu_get_udmabuf(&state.udmabuf, 0), "Failed to get udmabuf0");
-
-	state = (struct prog_state_s){
-	    .fd_dev_mem     = state.fd_dev_mem,
-	    .virtual_base   = state.virtual_base,
-	    .udmabuf        = state.udmabuf,
-	    .fifo_instr     = (void *) (state.virtual_base + FIFO_INSTR_IN_BASE),
-	    .fifo_instr_csr = (void *) (state.virtual_base + FIFO_INSTR_IN_CSR_BASE),
-	    .pio_status     = (void *) (state.virtual_base + PIO_0_BASE),
-	    .systolic_csr   = (void *) (state.virtual_base + SYSTOLIC_CORE_BASE),
-	    .read_dma =
-	        {
-	            .csr        = (void *) (state.virtual_base + MSGDMA_READ_CSR_BASE),
-	            .descriptor = (void *) (state.virtual_base + MSGDMA_READ_DESCRIPTOR_SLAVE_BASE),
-	        },
-	    .write_dma =
-	        {
-	            .csr        = (void *) (state.virtual_base + DMA_WRITE_BASE),
-	            .descriptor = (void *) (state.virtual_base + DMA_WRITE_FIFO_IN_BASE),
-	        },
-	};
-
 	if (argc > 1) {
 		const char arg = argv[1][0];
 		if (arg == '1') {
-			print_state(&state);
+			dev_print_state(dev);
 		} else if (arg == '2') {
-			matrix_t *mat_v = state.udmabuf.virtual_base;
+			matrix_t *mat_v = dev->virtual_base;
 			printf("dst\n");
-			_print_mat(&mat_v[0], true);
+			print_mat(&mat_v[0], true);
 			printf("src1\n");
-			_print_mat(&mat_v[1], true);
+			print_mat(&mat_v[1], true);
 			printf("src2\n");
-			_print_mat(&mat_v[2], true);
+			print_mat(&mat_v[2], true);
 		} else if (arg == '3') {
 			printf("Write DMA CSR: \n\t0x%08x\n\t0x%08x\n\t0x%08x\n\t0x%08x\n",
-			       *(state.write_dma.csr),
-			       *(state.write_dma.csr + 1),
-			       *(state.write_dma.csr + 2),
-			       *(state.write_dma.csr + 3));
+			       dev_read_reg(dev, DEV_REG_WR_STATUS),
+			       dev_read_reg(dev, DEV_REG_WR_CSR1),
+			       dev_read_reg(dev, DEV_REG_WR_FILL),
+			       dev_read_reg(dev, DEV_REG_WR_CSR3));
 
 		} else if (arg == '4') {
 			printf("Sending null write to DMA write\n");
-			*(state.write_dma.descriptor) = 0ull;
+			dev_send_write(dev, 0);
 		} else if (arg == '5') {
 			printf("Sending default write to DMA write\n");
-			*(state.write_dma.descriptor) = state.udmabuf.phys_addr;
+			dev_send_write(dev, dev->phys_addr);
 		} else if (arg == '6') {
-			memset(state.udmabuf.virtual_base, 0, sizeof(matrix_t));
-			ES_FWD_INT_NM(mu_udmabuf_sync_for_device(&state.udmabuf, 0, state.udmabuf.size));
+			memset(dev->virtual_base, 0, sizeof(matrix_t));
+			ES_FWD_INT_NM(dev_sync_for_device(dev, 0, dev->size));
 		} else if (arg == '7') {
-			mu_sdram_csr_print(sdramcsr_base);
+			ES_FWD_INT_NM(_sdram_csr_print());
 		} else if (arg == '8') {
-			ES_FWD_INT_NM(mu_udmabuf_sync_for_cpu(&state.udmabuf, 0, state.udmabuf.size));
-			matrix_t *mat_v = state.udmabuf.virtual_base;
-			_print_mat(&mat_v[0], false);
+			ES_FWD_INT_NM(dev_sync_for_cpu(dev, 0, dev->size));
+			matrix_t *mat_v = dev->virtual_base;
+			print_mat(&mat_v[0], false);
+		} else if (arg == '9') {
+			ES_FWD_INT_NM(_gemm_check(dev, 40, 70, 23));
+			wt_print_stats(&dev->waiter, "device waits", stdout);
+		} else if (arg == 'm') {
+			ES_NEW_ASRT(argc > 2, "Usage: %s m <model.tflite>", argv[0]);
+			ES_FWD_INT_NM(_model_run(dev, argv[2]));
 		}
 		return 0;
 	}
-	// memset(state.udmabuf.virtual_base, 0, sizeof(matrix_t) * 3);
+	// memset(dev->virtual_base, 0, sizeof(matrix_t) * 3);
 	// Write two 16x16 matricies
 	{
-		matrix_t *mat = state.udmabuf.virtual_base;
+		matrix_t *mat = dev->virtual_base;
 		memset(mat, 0, sizeof(matrix_t) * 3);
 		for (int i = 0; i < 16; i++) {
 			mat[2].data[i][i]            = i;  // rhs, rowmajor
@@ -286,39 +196,86 @@ static int _pipeline(int argc, char **argv)
 		}
 		printf("Done patterning\n");
 	}
-	ES_FWD_INT_NM(mu_udmabuf_sync_for_device(&state.udmabuf, 0, state.udmabuf.size));
+	ES_FWD_INT_NM(dev_sync_for_device(dev, 0, dev->size));
 	printf("Done sync1\n");
 	{
-		matrix_t *mat_v = state.udmabuf.virtual_base;
+		matrix_t *mat_v = dev->virtual_base;
 		printf("dst\n");
-		_print_mat(&mat_v[0], true);
+		print_mat(&mat_v[0], true);
 		printf("src1\n");
-		_print_mat(&mat_v[1], true);
+		print_mat(&mat_v[1], true);
 		printf("src2\n");
-		_print_mat(&mat_v[2], true);
+		print_mat(&mat_v[2], true);
 
-		matrix_t *mat = (void *) state.udmabuf.phys_addr;
-		printf("%08x, %08x, %08x\n", (uint32_t) &mat[0], (uint32_t) &mat[1], (uint32_t) &mat[2]);
-		matrix_mult16(&state, &mat[0], &mat[1], &mat[2]);
-		ES_FWD_INT_NM(mu_udmabuf_sync_for_cpu(&state.udmabuf, 0, state.udmabuf.size));
+		const uint32_t mat  = dev->phys_addr;
+		const uint32_t tile = sizeof(matrix_t);
+		printf("%08x, %08x, %08x\n", mat, mat + tile, mat + 2 * tile);
+		ES_FWD_INT_NM(matrix_mult16(dev, mat, mat + tile, mat + 2 * tile));
+		ES_FWD_INT_NM(dev_sync_for_cpu(dev, 0, dev->size));
 		printf("Done sync2\n");
 
 		printf("dst\n");
-		_print_mat(&mat_v[0], true);
+		print_mat(&mat_v[0], true);
 		printf("src1\n");
-		_print_mat(&mat_v[1], true);
+		print_mat(&mat_v[1], true);
 		printf("src2\n");
-		_print_mat(&mat_v[2], true);
+		print_mat(&mat_v[2], true);
 	}
-	printf("instr_n=%u\n", *state.fifo_instr_csr);
+	printf("instr_n=%u\n", dev_read_reg(dev, DEV_REG_INSTR_FILL));
+	return 0;
+}
+
+/* Runs the commands under the register sampler when $SYSTOLIC_METRICS names a file for it */
+static int _sampled(dev_st *dev, int argc, char **argv)
+{
+	const char *metrics_path  = getenv("SYSTOLIC_METRICS");
+	SM_CLEANUP sm_st *sampler = NULL;
+	int ret;
+	if (!metrics_path) {
+		ES_FWD_INT_NM(_commands(dev, argc, argv));
+		return 0;
+	}
+	ES_FWD_INT_NM(sm_alloc(&sampler, dev, NULL));
+	ES_FWD_INT_NM(sm_start(sampler));
+	ret = _commands(dev, argc, argv);
+	ES_FWD_INT_NM(sm_stop(sampler));
+	/* Also after a failure, the counters up to it show what the device was doing */
+	ES_FWD_INT_NM(sm_write_prometheus_file(sampler, metrics_path));
+	ES_FWD_INT_NM(ret);
+	return 0;
+}
+
+static int _pipeline(int argc, char **argv)
+{
+	puts("starting pipeline");
+	DEV_CLEANUP dev_st *dev = NULL;
+
+	if (argc > 1 && argv[1][0] == 'p') {
+		ES_FWD_INT_NM(_model_plan(argc - 2, argv + 2));
+		return 0;
+	}
+
+	if (getenv("SYSTOLIC_EMU")) {
+		ES_FWD_INT(dev_emu_open(&dev, EMU_MEM_SIZE, 0), "Failed to open emulator");
+	} else {
+		ES_FWD_INT(dev_hw_open(&dev, 0), "Failed to open FPGA with udmabuf0");
+	}
+	ES_FWD_INT_NM(_sampled(dev, argc, argv));
 	return 0;
 }
 
 int main(int argc, char **argv)
 {
-	int retval = -1;
+	const char *trace_path = getenv("SYSTOLIC_TRACE");
+	int retval             = -1;
 	/* Execute program */
 	retval = _pipeline(argc, argv);
+	/* Also after a failure, the timeline up to it is the interesting part */
+	if (trace_path && tr_dump_chrome_file(trace_path) < 0) {
+		printf("Trace dump failed: [ ");
+		ES_PRINT();
+		printf("\n ]\n");
+	}
 	if (retval < 0) {
 		ES_FWD("Pipeline failed");
 		printf("Unrecoverable: [ ");
@@ -0,0 +1,149 @@
+#include "mem_plan.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Greedy by size placement of buffers with lifetimes.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "errstack.h"
+#include "util.h"
+
+#define _ALIGN_UP(x, align) (((x) + (align) - 1) & ~((align) - 1))
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+static bool _alive_together(const mp_buffer_t *a, const mp_buffer_t *b)
+{
+	return a->first <= b->last && b->first <= a->last;
+}
+
+/* Largest first, ties by the step they come alive so the plan does not depend on qsort */
+static int _cmp_size(const void *a, const void *b)
+{
+	const mp_buffer_t *ba = *(const mp_buffer_t *const *) a;
+	const mp_buffer_t *bb = *(const mp_buffer_t *const *) b;
+	if (ba->size != bb->size) {
+		return ba->size < bb->size ? 1 : -1;
+	}
+	if (ba->first != bb->first) {
+		return ba->first > bb->first ? 1 : -1;
+	}
+	return (ba > bb) - (ba < bb);
+}
+
+static int _cmp_offset(const void *a, const void *b)
+{
+	const mp_buffer_t *ba = *(const mp_buffer_t *const *) a;
+	const mp_buffer_t *bb = *(const mp_buffer_t *const *) b;
+	return (ba->offset > bb->offset) - (ba->offset < bb->offset);
+}
+
+/*
+ * Smallest gap between the placed buffers that are alive with buffer, or the end of the highest
+ * of them. neighbours has room for every buffer.
+ */
+static size_t _place(const mp_buffer_t *buffer,
+                     mp_buffer_t **placed,
+                     size_t n_placed,
+                     mp_buffer_t **neighbours,
+                     size_t align)
+{
+	size_t i, n = 0, end = 0, best = 0, best_gap = SIZE_MAX;
+	for (i = 0; i < n_placed; i++) {
+		if (_alive_together(buffer, placed[i])) {
+			neighbours[n++] = placed[i];
+		}
+	}
+	qsort(neighbours, n, sizeof(*neighbours), _cmp_offset);
+	for (i = 0; i < n; i++) {
+		if (neighbours[i]->offset > end) {
+			const size_t gap = neighbours[i]->offset - end;
+			if (gap >= buffer->size && gap < best_gap) {
+				best     = end;
+				best_gap = gap;
+			}
+		}
+		end = MAX(end, _ALIGN_UP(neighbours[i]->offset + neighbours[i]->size, align));
+	}
+	return best_gap == SIZE_MAX ? end : best;
+}
+
+static void _report(const mp_buffer_t *buffers, size_t n, size_t align, mp_report_t *report)
+{
+	size_t i, j;
+	report->n_buffers     = n;
+	report->arena_size    = 0;
+	report->unshared_size = 0;
+	report->peak_live     = 0;
+	report->peak_step     = 0;
+	for (i = 0; i < n; i++) {
+		size_t live = 0;
+		report->arena_size =
+		    MAX(report->arena_size, _ALIGN_UP(buffers[i].offset + buffers[i].size, align));
+		report->unshared_size += _ALIGN_UP(buffers[i].size, align);
+		/* The live bytes only grow when a buffer comes alive, so the peak is at some first */
+		for (j = 0; j < n; j++) {
+			if (buffers[j].first <= buffers[i].first && buffers[i].first <= buffers[j].last) {
+				live += _ALIGN_UP(buffers[j].size, align);
+			}
+		}
+		if (live > report->peak_live ||
+		    (live == report->peak_live && buffers[i].first < report->peak_step)) {
+			report->peak_live = live;
+			report->peak_step = buffers[i].first;
+		}
+	}
+}
+
+int mp_plan(mp_buffer_t *buffers, size_t n, size_t align, mp_report_t *report)
+{
+	CLEANUP(_cleanup_free) mp_buffer_t **order      = NULL;
+	CLEANUP(_cleanup_free) mp_buffer_t **neighbours = NULL;
+	size_t i;
+	ES_NEW_ASRT_NM(buffers || n == 0);
+	ES_NEW_ASRT(align > 0 && (align & (align - 1)) == 0, "Alignment %zu is no power of 2", align);
+	for (i = 0; i < n; i++) {
+		ES_NEW_ASRT(buffers[i].first <= buffers[i].last,
+		            "Buffer %zu dies at %ld before it is alive at %ld",
+		            i,
+		            buffers[i].last,
+		            buffers[i].first);
+	}
+	if (n > 0) {
+		ES_NEW_ASRT_NM(order = malloc(n * sizeof(*order)));
+		ES_NEW_ASRT_NM(neighbours = malloc(n * sizeof(*neighbours)));
+		for (i = 0; i < n; i++) {
+			order[i] = &buffers[i];
+		}
+		qsort(order, n, sizeof(*order), _cmp_size);
+		for (i = 0; i < n; i++) {
+			order[i]->offset = _place(order[i], order, i, neighbours, align);
+		}
+	}
+	if (report) {
+		_report(buffers, n, align, report);
+	}
+	return 0;
+}
+
+void mp_print_report(const mp_report_t *report, FILE *f)
+{
+	fprintf(f,
+	        "%zu buffers: arena %zu bytes, peak live %zu bytes at step %ld, %zu without "
+	        "sharing\n",
+	        report->n_buffers,
+	        report->arena_size,
+	        report->peak_live,
+	        report->peak_step,
+	        report->unshared_size);
+}
@@ -0,0 +1,59 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Static memory planner for buffers with known lifetimes, such as the activations of a model.
+ * Each buffer is alive for an inclusive range of steps (e.g. the nodes of a graph); buffers that
+ * are never alive at the same step may share memory.
+ *
+ * Placement is greedy by size: the largest buffer is placed first, and every following buffer
+ * goes into the smallest gap, between the buffers already placed that it is alive with, that is
+ * large enough. If no gap fits it goes after the highest of them. The arena this yields is
+ * usually at or close to the peak of bytes alive at any one step, which no placement can beat.
+ *
+ * The planner only works on sizes and lifetimes, so it runs offline (e.g. to check which models
+ * fit a udmabuf) as well as when a model is loaded.
+ *
+ * How to:
+ * 1. Fill an array of mp_buffer_t with sizes and lifetimes
+ * 2. mp_plan it, the offsets and a report on the footprint are filled in
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct mp_buffer_s
+{
+	size_t size;
+	/* First and last step the buffer is alive for, inclusive */
+	long first;
+	long last;
+	/* Set by mp_plan */
+	size_t offset;
+} mp_buffer_t;
+
+typedef struct mp_report_s
+{
+	/* Bytes the planned buffers take, what has to be provided */
+	size_t arena_size;
+	/* Sum of the aligned buffer sizes, what they would take without sharing */
+	size_t unshared_size;
+	/* Most aligned bytes alive at one step, no placement can use less */
+	size_t peak_live;
+	/* First step where peak_live bytes are alive */
+	long peak_step;
+	size_t n_buffers;
+} mp_report_t;
+
+/**
+ * @brief Assign offsets so that buffers alive at the same step do not overlap.
+ *
+ * @param align Power of two every offset is a multiple of
+ * @param report Footprint of the plan, may be NULL
+ */
+int mp_plan(mp_buffer_t *buffers, size_t n, size_t align, mp_report_t *report);
+
+void mp_print_report(const mp_report_t *report, FILE *f);
@@ -1,4 +1,5 @@
 
+#define _GNU_SOURCE
 #define _XOPEN_SOURCE 500
 #include "memory_utils.h"
 
@@ -15,69 +16,230 @@
 
 #include "util.h"
 
-#define _PRESENT_IN_RAM(entry) (!!((pagemap_entry >> 63) & 1))
-#define _SWAPPED(entry)        (!!((pagemap_entry >> 62) & 1))
+#define _PFN_MASK              (((uint64_t) 1 << 55) - 1)
+#define _PRESENT_IN_RAM(entry) (!!(((entry) >> 63) & 1))
+#define _SWAPPED(entry)        (!!(((entry) >> 62) & 1))
+/* Without CAP_SYS_ADMIN the kernel reports every frame as 0 */
+#define _HAS_FRAME(entry) (((entry) & _PFN_MASK) != 0)
 
-int _get_pagemap_entry(uint64_t *dst, uint64_t virtual_addr)
+/* Pagemap entries of an mlocked range, indexed from first_page */
+typedef struct _pinned_s
 {
-	int read_count;
-	char proc_pid_pagemap[256];
-	CLEAN_FD int pagemap_fd = -1;
+	uint64_t first_page;
+	size_t n_pages;
+	uint64_t *entries;
+} _pinned_t;
 
-	uint64_t virtual_page_n = virtual_addr / sysconf(_SC_PAGE_SIZE);
+struct mu_pagemap_s
+{
+	int fd;
+	uint64_t page_size;
+	_pinned_t *pinned;
+	size_t n_pinned;
+};
 
-	ES_NEW_INT_NM(
-	    snprintf(proc_pid_pagemap, sizeof(proc_pid_pagemap), "/proc/%d/pagemap", getpid()));
-	ES_NEW_INT_ERRNO(pagemap_fd = open(proc_pid_pagemap, O_RDONLY));
-	ES_NEW_INT_ERRNO(
-	    read_count = pread(pagemap_fd, (void *) dst, sizeof(*dst), virtual_page_n * sizeof(*dst)));
-	ES_NEW_ASRT(read_count == sizeof(*dst), "Failed to read in one go");
+int mu_pagemap_open(mu_pagemap_st **dst)
+{
+	mu_pagemap_st *tmp;
+	CLEAN_FD int fd = -1;
+	ES_NEW_ASRT_NM(dst);
+	ES_NEW_INT_ERRNO(fd = open("/proc/self/pagemap", O_RDONLY));
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	tmp->fd        = MOVE_VN(fd);
+	tmp->page_size = sysconf(_SC_PAGE_SIZE);
+	*dst           = tmp;
 	return 0;
 }
 
-int mu_virt_to_phys(uint64_t *phys_addr, uint64_t virtual_addr)
+void mu_pagemap_cleanup(mu_pagemap_st **pagemap)
 {
-	uint64_t pagemap_entry;
-	uint64_t pageframe_n;
-	ES_NEW_ASRT(phys_addr, "NULL check failed");
-	ES_FWD_INT_NM(_get_pagemap_entry(&pagemap_entry, virtual_addr));
-	ES_NEW_ASRT(_PRESENT_IN_RAM(entry), "Expected entry exists in RAM");
-	ES_NEW_ASRT(!_SWAPPED(entry), "Expected entry is not swapped");
+	size_t i;
+	if (!*pagemap) {
+		return;
+	}
+	for (i = 0; i < (*pagemap)->n_pinned; i++) {
+		_pinned_t *pinned = &(*pagemap)->pinned[i];
+		munlock((void *) (pinned->first_page * (*pagemap)->page_size),
+		        pinned->n_pages * (*pagemap)->page_size);
+		free(pinned->entries);
+	}
+	free((*pagemap)->pinned);
+	close((*pagemap)->fd);
+	free(*pagemap);
+	*pagemap = NULL;
+}
 
-	pageframe_n = pagemap_entry & (((uint64_t) 1 << 55) - 1);
-	*phys_addr  = pageframe_n * sysconf(_SC_PAGE_SIZE) + virtual_addr % sysconf(_SC_PAGE_SIZE);
+static const _pinned_t *_find_pinned(const mu_pagemap_st *pagemap, uint64_t first, size_t n)
+{
+	size_t i;
+	for (i = 0; i < pagemap->n_pinned; i++) {
+		const _pinned_t *pinned = &pagemap->pinned[i];
+		if (first >= pinned->first_page && first + n <= pinned->first_page + pinned->n_pages) {
+			return pinned;
+		}
+	}
+	return NULL;
+}
 
+/* Entries for pages [first, first + n), from the pin cache or with a single pread */
+static int _get_entries(mu_pagemap_st *pagemap, uint64_t *dst, uint64_t first, size_t n)
+{
+	const _pinned_t *pinned = _find_pinned(pagemap, first, n);
+	ssize_t read_count;
+	if (pinned) {
+		memcpy(dst, &pinned->entries[first - pinned->first_page], n * sizeof(*dst));
+		return 0;
+	}
+	ES_NEW_INT_ERRNO(read_count = pread(pagemap->fd, dst, n * sizeof(*dst), first * sizeof(*dst)));
+	ES_NEW_ASRT((size_t) read_count == n * sizeof(*dst), "Failed to read in one go");
 	return 0;
 }
 
-int mu_is_continuous(bool *is_continuous, uint64_t virtual_addr_a, uint64_t virtual_addr_b)
+int mu_pagemap_virt_to_phys(mu_pagemap_st *pagemap, uint64_t *phys_addr, uint64_t virtual_addr)
 {
-	uint64_t virtual_page_na  = virtual_addr_a / sysconf(_SC_PAGE_SIZE);
-	uint64_t virtual_page_nb  = virtual_addr_b / sysconf(_SC_PAGE_SIZE);
-	uint64_t pageframe_n_last = 0;
+	uint64_t pagemap_entry;
+	ES_NEW_ASRT(pagemap && phys_addr, "NULL check failed");
+	ES_FWD_INT_NM(_get_entries(pagemap, &pagemap_entry, virtual_addr / pagemap->page_size, 1));
+	ES_NEW_ASRT(_PRESENT_IN_RAM(pagemap_entry), "Expected entry exists in RAM");
+	ES_NEW_ASRT(!_SWAPPED(pagemap_entry), "Expected entry is not swapped");
+	ES_NEW_ASRT(_HAS_FRAME(pagemap_entry), "Page frame hidden, reading it needs CAP_SYS_ADMIN");
+	*phys_addr = (pagemap_entry & _PFN_MASK) * pagemap->page_size +
+	             virtual_addr % pagemap->page_size;
+	return 0;
+}
 
-	ES_NEW_ASRT(virtual_addr_a < virtual_addr_b, "Expected a < b");
+int mu_pagemap_frames(mu_pagemap_st *pagemap,
+                      uint64_t *page_phys,
+                      uint64_t virtual_addr,
+                      size_t n_pages)
+{
+	size_t i;
+	ES_NEW_ASRT(pagemap && page_phys, "NULL check failed");
+	ES_FWD_INT_NM(_get_entries(pagemap, page_phys, virtual_addr / pagemap->page_size, n_pages));
+	for (i = 0; i < n_pages; i++) {
+		const uint64_t entry = page_phys[i];
+		ES_NEW_ASRT(_PRESENT_IN_RAM(entry) && !_SWAPPED(entry), "Page %zu is not resident", i);
+		ES_NEW_ASRT(_HAS_FRAME(entry), "Page frame hidden, reading it needs CAP_SYS_ADMIN");
+		page_phys[i] = (entry & _PFN_MASK) * pagemap->page_size;
+	}
+	return 0;
+}
 
-	for (uint64_t i = virtual_page_na; i <= virtual_page_nb; i++) {
-		uint64_t pagemap_entry;
-		uint64_t pageframe_n;
-		ES_FWD_INT_NM(_get_pagemap_entry(&pagemap_entry, i * sysconf(_SC_PAGE_SIZE)));
-		if (!_PRESENT_IN_RAM(pagemap_entry) || _SWAPPED(pagemap_entry)) {
-			*is_continuous = false;
-			return 0;
+size_t mu_pagemap_page_size(const mu_pagemap_st *pagemap)
+{
+	return pagemap->page_size;
+}
+
+static bool _entries_continuous(const uint64_t *entries, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		if (!_PRESENT_IN_RAM(entries[i]) || _SWAPPED(entries[i]) || !_HAS_FRAME(entries[i])) {
+			return false;
 		}
-		pageframe_n = pagemap_entry & (((uint64_t) 1 << 55) - 1);
-		if (i == virtual_page_na) {
-			pageframe_n_last = pageframe_n;
-			continue;
+		if (i && (entries[i - 1] & _PFN_MASK) + 1 != (entries[i] & _PFN_MASK)) {
+			return false;
 		}
-		if (pageframe_n_last + 1 != pageframe_n) {
-			*is_continuous = false;
-			return 0;
+	}
+	return true;
+}
+
+int mu_pagemap_is_continuous(mu_pagemap_st *pagemap,
+                             bool *is_continuous,
+                             uint64_t virtual_addr_a,
+                             uint64_t virtual_addr_b)
+{
+	uint64_t first, n;
+	const _pinned_t *pinned;
+	uint64_t *entries;
+	int ret;
+	ES_NEW_ASRT(pagemap && is_continuous, "NULL check failed");
+	ES_NEW_ASRT(virtual_addr_a < virtual_addr_b, "Expected a < b");
+	first = virtual_addr_a / pagemap->page_size;
+	n     = virtual_addr_b / pagemap->page_size - first + 1;
+	if ((pinned = _find_pinned(pagemap, first, n))) {
+		*is_continuous = _entries_continuous(&pinned->entries[first - pinned->first_page], n);
+		return 0;
+	}
+	ES_NEW_ASRT_NM(entries = malloc(n * sizeof(*entries)));
+	ret = _get_entries(pagemap, entries, first, n);
+	if (ret >= 0) {
+		*is_continuous = _entries_continuous(entries, n);
+	}
+	free(entries);
+	ES_FWD_INT_NM(ret);
+	return 0;
+}
+
+int mu_pagemap_pin(mu_pagemap_st *pagemap, void *virtual_addr, size_t size)
+{
+	_pinned_t pinned;
+	_pinned_t *grown;
+	void *page_addr;
+	size_t page_bytes;
+	int ret;
+	ES_NEW_ASRT(pagemap && virtual_addr && size, "NULL check failed");
+	pinned.first_page = (uint64_t) virtual_addr / pagemap->page_size;
+	pinned.n_pages    = ((uint64_t) virtual_addr + size - 1) / pagemap->page_size;
+	pinned.n_pages    = pinned.n_pages - pinned.first_page + 1;
+	page_addr         = (void *) (pinned.first_page * pagemap->page_size);
+	page_bytes        = pinned.n_pages * pagemap->page_size;
+
+	ES_NEW_ASRT_NM(grown = realloc(pagemap->pinned, (pagemap->n_pinned + 1) * sizeof(*grown)));
+	pagemap->pinned = grown;
+	ES_NEW_ASRT_NM(pinned.entries = malloc(pinned.n_pages * sizeof(*pinned.entries)));
+	/* Pages have to be resident and stay put for the cached frames to remain true */
+	if ((ret = mlock(page_addr, page_bytes)) < 0) {
+		free(pinned.entries);
+		ES_NEW_INT_ERRNO(ret);
+	}
+	if ((ret = _get_entries(pagemap, pinned.entries, pinned.first_page, pinned.n_pages)) < 0) {
+		munlock(page_addr, page_bytes);
+		free(pinned.entries);
+		ES_FWD_INT_NM(ret);
+	}
+	pagemap->pinned[pagemap->n_pinned++] = pinned;
+	return 0;
+}
+
+int mu_pagemap_unpin(mu_pagemap_st *pagemap, void *virtual_addr)
+{
+	const uint64_t page = (uint64_t) virtual_addr / pagemap->page_size;
+	size_t i;
+	for (i = 0; i < pagemap->n_pinned; i++) {
+		_pinned_t *pinned = &pagemap->pinned[i];
+		if (pinned->first_page != page) {
+			continue;
 		}
-		pageframe_n_last = pageframe_n;
+		munlock((void *) (pinned->first_page * pagemap->page_size),
+		        pinned->n_pages * pagemap->page_size);
+		free(pinned->entries);
+		*pinned = pagemap->pinned[--pagemap->n_pinned];
+		return 0;
 	}
-	*is_continuous = true;
+	ES_NEW("%p was not pinned", virtual_addr);
+	return -1;
+}
+
+/* Opened on first use and kept for the life of the process */
+static mu_pagemap_st *_shared_pagemap;
+
+int mu_virt_to_phys(uint64_t *phys_addr, uint64_t virtual_addr)
+{
+	if (!_shared_pagemap) {
+		ES_FWD_INT_NM(mu_pagemap_open(&_shared_pagemap));
+	}
+	ES_FWD_INT_NM(mu_pagemap_virt_to_phys(_shared_pagemap, phys_addr, virtual_addr));
+	return 0;
+}
+
+int mu_is_continuous(bool *is_continuous, uint64_t virtual_addr_a, uint64_t virtual_addr_b)
+{
+	if (!_shared_pagemap) {
+		ES_FWD_INT_NM(mu_pagemap_open(&_shared_pagemap));
+	}
+	ES_FWD_INT_NM(
+	    mu_pagemap_is_continuous(_shared_pagemap, is_continuous, virtual_addr_a, virtual_addr_b));
 	return 0;
 }
 
@@ -140,17 +302,24 @@ int _write_attr(int id, const char *attr_name, enum attr_format fmt, uint32_t va
 	return 0;
 }
 
-int _write_sync_for(int id, const char *attr_name, uint32_t upper, uint32_t lower)
+int _open_attr(int *dst, int id, const char *attr_name)
 {
 	char file_name[64];
-	char attr[1024] = {};
-	CLEAN_FD int fd;
 	ES_NEW_INT(
 	    snprintf(file_name, sizeof(file_name), "/sys/class/u-dma-buf/udmabuf%d/%s", id, attr_name),
 	    "failed to make file name");
-	ES_NEW_INT_ERRNO(fd = open(file_name, O_WRONLY));
-	snprintf(attr, sizeof(attr), "0x%08X%08X", upper, lower);
-	ES_NEW_INT_ERRNO(write(fd, attr, strlen(attr)));
+	ES_NEW_INT_ERRNO(*dst = open(file_name, O_WRONLY));
+	return 0;
+}
+
+int _write_sync_for(int fd, uint32_t upper, uint32_t lower)
+{
+	char attr[32];
+	int n;
+	ES_NEW_ASRT(fd >= 0, "sync attribute not open");
+	n = snprintf(attr, sizeof(attr), "0x%08X%08X", upper, lower);
+	/* sysfs attributes are parsed from offset 0 on every write */
+	ES_NEW_INT_ERRNO(pwrite(fd, attr, n, 0));
 	return 0;
 }
 
@@ -163,43 +332,97 @@ int _mmap_udmabuf(udmabuf_t *src_dst, int id)
 	ES_NEW_INT_ERRNO(fd = open(file_name, O_RDWR));
 	src_dst->fd           = fd;
 	src_dst->virtual_base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	ES_NEW_ASRT_ERRNO((int) src_dst->virtual_base > 0);
+	ES_NEW_ASRT_ERRNO(src_dst->virtual_base != MAP_FAILED);
 	fd = -1;
 	return 0;
 }
 
+bool mu_udmabuf_exists(int id)
+{
+	char file_name[64];
+	if (id < 0 || id >= MU_UDMABUF_MAX) {
+		return false;
+	}
+	snprintf(file_name, sizeof(file_name), "/sys/class/u-dma-buf/udmabuf%d/phys_addr", id);
+	return access(file_name, R_OK) == 0;
+}
+
 int mu_get_udmabuf(udmabuf_t *dst, int id)
 {
-	CLEANUP(cleanup_udmabuf) udmabuf_t tmp = {.id = id, .fd = -1};
-	ES_NEW_ASRT(id >= 0 && id < 8, "id must be in [0,8), it was %d", id);
+	CLEANUP(cleanup_udmabuf) udmabuf_t tmp = MU_UDMABUF_EMPTY;
+	tmp.id                                 = id;
+	ES_NEW_ASRT(id >= 0 && id < MU_UDMABUF_MAX, "id must be in [0,8), it was %d", id);
 	ES_FWD_INT_NM(_read_attr(&tmp.size, id, "size", ATTR_FORMAT_INT));
 	ES_FWD_INT_NM(_read_attr(&tmp.phys_addr, id, "phys_addr", ATTR_FORMAT_HEX));
 	ES_FWD_INT_NM(_write_attr(id, "sync_mode", ATTR_FORMAT_INT, MU_SYNC_MODE_CACHE_ENABLE2));
+	ES_FWD_INT_NM(_open_attr(&tmp.sync_for_cpu_fd, id, "sync_for_cpu"));
+	ES_FWD_INT_NM(_open_attr(&tmp.sync_for_device_fd, id, "sync_for_device"));
 	ES_FWD_INT_NM(_mmap_udmabuf(&tmp, id));
 	memcpy(dst, &tmp, sizeof(*dst));
-	tmp = (udmabuf_t){.fd = -1};
+	tmp = MU_UDMABUF_EMPTY;
 	return 0;
 }
 
+/* The low 4 bits of the size word carry direction and the sync flag, so round the size up */
+#define _SYNC_WORD(size, flag)                                                                     \
+	((((size) + 0xF) & 0xFFFFFFF0) | (MU_SYNC_DIRECTION_DMA_BIDIRECTIONAL << 2) | (flag))
+
 int mu_udmabuf_sync_for_cpu(udmabuf_t *target, uint32_t sync_offset, uint32_t sync_size)
 {
-	const uint32_t sync_direction = MU_SYNC_DIRECTION_DMA_BIDIRECTIONAL;
-	const uint32_t sync_for_cpu   = 1;
-	ES_FWD_INT_NM(_write_sync_for(target->id,
-	                              "sync_for_cpu",
-	                              (sync_offset & 0xFFFFFFFF),
-	                              (sync_size & 0xFFFFFFF0) | (sync_direction << 2) | sync_for_cpu));
+	ES_FWD_INT_NM(_write_sync_for(
+	    target->sync_for_cpu_fd, sync_offset, _SYNC_WORD(sync_size, MU_SYNC_FOR_CPU_ENABLE)));
 	return 0;
 }
+
 int mu_udmabuf_sync_for_device(udmabuf_t *target, uint32_t sync_offset, uint32_t sync_size)
 {
-	const uint32_t sync_direction  = MU_SYNC_DIRECTION_DMA_BIDIRECTIONAL;
-	const uint32_t sync_for_device = 1;
-	ES_FWD_INT_NM(
-	    _write_sync_for(target->id,
-	                    "sync_for_device",
-	                    (sync_offset & 0xFFFFFFFF),
-	                    (sync_size & 0xFFFFFFF0) | (sync_direction << 2) | sync_for_device));
+	ES_FWD_INT_NM(_write_sync_for(
+	    target->sync_for_device_fd, sync_offset, _SYNC_WORD(sync_size, MU_SYNC_FOR_DEVICE_ENABLE)));
+	return 0;
+}
+
+static int _cmp_sync_range(const void *a, const void *b)
+{
+	const mu_sync_range_t *ra = a, *rb = b;
+	return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+size_t mu_sync_ranges_merge(mu_sync_range_t *ranges, size_t n)
+{
+	size_t i, n_out = 0;
+	qsort(ranges, n, sizeof(*ranges), _cmp_sync_range);
+	for (i = 0; i < n; i++) {
+		mu_sync_range_t *last = n_out ? &ranges[n_out - 1] : NULL;
+		if (ranges[i].size == 0) {
+			continue;
+		}
+		if (last && ranges[i].offset <= last->offset + last->size) {
+			uint32_t end = MAX(last->offset + last->size, ranges[i].offset + ranges[i].size);
+			last->size   = end - last->offset;
+			continue;
+		}
+		ranges[n_out++] = ranges[i];
+	}
+	return n_out;
+}
+
+int mu_udmabuf_sync_ranges_for_cpu(udmabuf_t *target, mu_sync_range_t *ranges, size_t n)
+{
+	size_t i;
+	n = mu_sync_ranges_merge(ranges, n);
+	for (i = 0; i < n; i++) {
+		ES_FWD_INT_NM(mu_udmabuf_sync_for_cpu(target, ranges[i].offset, ranges[i].size));
+	}
+	return 0;
+}
+
+int mu_udmabuf_sync_ranges_for_device(udmabuf_t *target, mu_sync_range_t *ranges, size_t n)
+{
+	size_t i;
+	n = mu_sync_ranges_merge(ranges, n);
+	for (i = 0; i < n; i++) {
+		ES_FWD_INT_NM(mu_udmabuf_sync_for_device(target, ranges[i].offset, ranges[i].size));
+	}
 	return 0;
 }
 
@@ -214,6 +437,12 @@ void cleanup_udmabuf(udmabuf_t *to_clean)
 	if (to_clean->fd >= 0) {
 		close(to_clean->fd);
 	}
+	if (to_clean->sync_for_cpu_fd >= 0) {
+		close(to_clean->sync_for_cpu_fd);
+	}
+	if (to_clean->sync_for_device_fd >= 0) {
+		close(to_clean->sync_for_device_fd);
+	}
 }
 
 #define _SDRAM_CSR_PRINTF(sig) printf("%30s: 0x%08X\n", #sig, *(volatile uint32_t *) (src + sig))
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "util.h"
+
 // sync_mode options
 #define MU_SYNC_MODE_CACHE_ENABLE2        (0)
 #define MU_SYNC_MODE_CACHE_OPTION         (1)
@@ -41,16 +44,88 @@ struct udmabuf_s
 	uint32_t phys_addr;
 	uint32_t size;
 	// uint32_t dma_coherent;
+	/* sysfs sync attributes, kept open for the lifetime of the buffer */
+	int sync_for_cpu_fd;
+	int sync_for_device_fd;
 };
 typedef struct udmabuf_s udmabuf_t;
 
+/* A udmabuf_t that is safe to pass to cleanup_udmabuf */
+#define MU_UDMABUF_EMPTY ((udmabuf_t){.fd = -1, .sync_for_cpu_fd = -1, .sync_for_device_fd = -1})
+
+/* Byte range of a udmabuf to sync */
+typedef struct mu_sync_range_s
+{
+	uint32_t offset;
+	uint32_t size;
+} mu_sync_range_t;
+
+/**
+ * A handle on /proc/self/pagemap. It stays open, reads a whole range of entries per pread, and
+ * remembers the translations of pinned (mlocked) ranges so they cost no syscall at all.
+ *
+ * The kernel only shows page frames to a process with CAP_SYS_ADMIN, to everyone else it reports
+ * frame 0. Translations fail in that case instead of returning physical address 0.
+ */
+struct mu_pagemap_s;
+typedef struct mu_pagemap_s mu_pagemap_st;
+
+int mu_pagemap_open(mu_pagemap_st **dst);
+void mu_pagemap_cleanup(mu_pagemap_st **pagemap);
+
+#define MU_PAGEMAP_CLEANUP CLEANUP(mu_pagemap_cleanup)
+
+int mu_pagemap_virt_to_phys(mu_pagemap_st *pagemap, uint64_t *phys_addr, uint64_t virtual_addr);
+/**
+ * @brief Physical address of n_pages consecutive pages, starting with the page that holds
+ * virtual_addr. Fails if any of them is not resident.
+ */
+int mu_pagemap_frames(mu_pagemap_st *pagemap,
+                      uint64_t *page_phys,
+                      uint64_t virtual_addr,
+                      size_t n_pages);
+size_t mu_pagemap_page_size(const mu_pagemap_st *pagemap);
+/**
+ * @brief Check that [virtual_addr_a, virtual_addr_b] is backed by consecutive page frames. The
+ * whole range is read with a single pread unless it is pinned.
+ */
+int mu_pagemap_is_continuous(mu_pagemap_st *pagemap,
+                             bool *is_continuous,
+                             uint64_t virtual_addr_a,
+                             uint64_t virtual_addr_b);
+/**
+ * @brief mlock a range and cache its page frames. Until mu_pagemap_unpin, translations inside the
+ * range are served from the cache.
+ */
+int mu_pagemap_pin(mu_pagemap_st *pagemap, void *virtual_addr, size_t size);
+int mu_pagemap_unpin(mu_pagemap_st *pagemap, void *virtual_addr);
+
+/* Same as the mu_pagemap_* calls, on a handle shared by the whole process */
 int mu_virt_to_phys(uint64_t *phys_addr, uint64_t virtual_addr);
 int mu_is_continuous(bool *is_continuous, uint64_t virtual_addr_a, uint64_t virtual_addr_b);
 void *mu_alloc(int n_pages);
 
+/* Number of udmabuf devices the u-dma-buf module can create */
+#define MU_UDMABUF_MAX (8)
+
+/* True if /dev/udmabuf<id> was configured when the module was loaded */
+bool mu_udmabuf_exists(int id);
 int mu_get_udmabuf(udmabuf_t *dst, int id);
 int mu_udmabuf_sync_for_cpu(udmabuf_t *target, uint32_t sync_offset, uint32_t sync_size);
 int mu_udmabuf_sync_for_device(udmabuf_t *target, uint32_t sync_offset, uint32_t sync_size);
+/**
+ * @brief Sort ranges and merge the ones that overlap or touch, in place.
+ *
+ * @return Number of ranges left
+ */
+size_t mu_sync_ranges_merge(mu_sync_range_t *ranges, size_t n);
+/**
+ * @brief Sync several ranges, one sysfs write per range left after merging.
+ *
+ * @param ranges Ranges to sync, reordered and merged in place
+ */
+int mu_udmabuf_sync_ranges_for_cpu(udmabuf_t *target, mu_sync_range_t *ranges, size_t n);
+int mu_udmabuf_sync_ranges_for_device(udmabuf_t *target, mu_sync_range_t *ranges, size_t n);
 
 void cleanup_udmabuf(udmabuf_t *to_clean);
 
@@ -0,0 +1,616 @@
+#include "nn_ops.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Quantized FullyConnected, Conv2D and DepthwiseConv2D on top of gemm_s8_fused, or
+ * gemm_s8_pretiled when the weights are resident.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errstack.h"
+#include "gemm.h"
+#include "util.h"
+
+struct nn_op_s
+{
+	bool is_conv;
+	/* Conv2D geometry, unused for FullyConnected */
+	struct
+	{
+		size_t in_h, in_w, in_c;
+		size_t k_h, k_w;
+		size_t stride_h, stride_w;
+		size_t dilation_h, dilation_w;
+		size_t pad_top, pad_left;
+		size_t out_h, out_w;
+	} conv;
+
+	/* GEMM depth and number of output channels */
+	size_t k;
+	size_t n;
+	/* k x n row-major, the filter transposed once. NULL when the weights are resident */
+	int8_t *weights;
+	/* Tiles of a weight file loaded into device memory, valid when resident */
+	bool resident;
+	uint32_t b_tiles_phys;
+	/* Bias with the constant zero point terms folded in */
+	int32_t *bias;
+	int32_t *multipliers;
+	int *shifts;
+	/* Per channel filter zero points, NULL when the filter is symmetric */
+	int32_t *weight_zero_points;
+	int32_t input_zero_point;
+	int32_t output_zero_point;
+	int32_t act_min;
+	int32_t act_max;
+
+	/* Scratch kept between runs */
+	int32_t *acc;
+	size_t acc_size;
+	int8_t *lowered;
+	size_t lowered_size;
+	int32_t *row_sums;
+	size_t row_sums_size;
+};
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+/* High word of 2ab, rounded to nearest with ties upwards, as in gemmlowp */
+static int32_t _saturating_rounding_doubling_high_mul(int32_t a, int32_t b)
+{
+	const int64_t ab    = (int64_t) a * b;
+	const int64_t nudge = ab >= 0 ? (1ll << 30) : (1 - (1ll << 30));
+	if (a == b && a == INT32_MIN) {
+		return INT32_MAX;
+	}
+	return (int32_t) ((ab + nudge) / (1ll << 31));
+}
+
+/* Round to nearest, ties away from zero */
+static int32_t _rounding_divide_by_pot(int32_t x, int exponent)
+{
+	const int32_t mask      = (int32_t) ((1ll << exponent) - 1);
+	const int32_t remainder = x & mask;
+	const int32_t threshold = (mask >> 1) + (x < 0);
+	return (x >> exponent) + (remainder > threshold);
+}
+
+void nn_quantize_multiplier(double m, int32_t *multiplier, int *shift)
+{
+	int64_t q_fixed;
+	double q;
+	if (m == 0) {
+		*multiplier = 0;
+		*shift      = 0;
+		return;
+	}
+	q       = frexp(m, shift);
+	q_fixed = llround(q * (1ll << 31));
+	if (q_fixed == (1ll << 31)) {
+		q_fixed /= 2;
+		++*shift;
+	}
+	if (*shift < -31) {
+		*shift  = 0;
+		q_fixed = 0;
+	}
+	*multiplier = (int32_t) q_fixed;
+}
+
+int32_t nn_multiply_by_quantized_multiplier(int32_t x, int32_t multiplier, int shift)
+{
+	const int left  = shift > 0 ? shift : 0;
+	const int right = shift > 0 ? 0 : -shift;
+	return _rounding_divide_by_pot(
+	    _saturating_rounding_doubling_high_mul((int32_t) ((uint32_t) x << left), multiplier),
+	    right);
+}
+
+void nn_activation_range(nn_act_et act, const nn_quant_t *output, int32_t *min, int32_t *max)
+{
+	*min = INT8_MIN;
+	*max = INT8_MAX;
+	if (act == NN_ACT_RELU || act == NN_ACT_RELU6) {
+		*min = MAX(*min, output->zero_point);
+	}
+	if (act == NN_ACT_RELU6) {
+		*max = MIN(*max, output->zero_point + (int32_t) lroundf(6.0f / output->scale));
+	}
+}
+
+void nn_op_cleanup(nn_op_st **op)
+{
+	if (!*op) {
+		return;
+	}
+	free((*op)->weights);
+	free((*op)->bias);
+	free((*op)->multipliers);
+	free((*op)->shifts);
+	free((*op)->weight_zero_points);
+	free((*op)->acc);
+	free((*op)->lowered);
+	free((*op)->row_sums);
+	free(*op);
+	*op = NULL;
+}
+
+static int _check_quant(const nn_quant_t *input,
+                        const nn_filter_quant_t *filter_q,
+                        const nn_quant_t *output,
+                        size_t n)
+{
+	size_t i;
+	ES_NEW_ASRT(input->scale > 0 && output->scale > 0, "Activation scales must be positive");
+	ES_NEW_ASRT(input->zero_point >= INT8_MIN && input->zero_point <= INT8_MAX &&
+	                output->zero_point >= INT8_MIN && output->zero_point <= INT8_MAX,
+	            "Activation zero points out of int8 range");
+	ES_NEW_ASRT(filter_q->scales, "Filter has no scales");
+	ES_NEW_ASRT(filter_q->n == 1 || filter_q->n == n,
+	            "%zu filter scales for %zu output channels",
+	            filter_q->n,
+	            n);
+	for (i = 0; i < filter_q->n; i++) {
+		ES_NEW_ASRT(filter_q->scales[i] > 0, "Filter scale %zu is not positive", i);
+	}
+	return 0;
+}
+
+/*
+ * sum_k (x - zx)(w - zw) = sum_k x w - zx sum_k w - zw sum_k x + k zx zw. Everything but the GEMM
+ * and the zw sum_k x term is fixed per channel and goes into the bias.
+ */
+static int _prepare_quant(nn_op_st *op,
+                          const int32_t *filter_sums,
+                          const int32_t *bias,
+                          const nn_quant_t *input,
+                          const nn_filter_quant_t *filter_q,
+                          const nn_quant_t *output,
+                          nn_act_et act)
+{
+	const size_t k = op->k, n = op->n;
+	bool asymmetric = false;
+	size_t o, i;
+	ES_FWD_INT_NM(_check_quant(input, filter_q, output, n));
+	ES_NEW_ASRT_NM(op->bias = malloc(n * sizeof(*op->bias)));
+	ES_NEW_ASRT_NM(op->multipliers = malloc(n * sizeof(*op->multipliers)));
+	ES_NEW_ASRT_NM(op->shifts = malloc(n * sizeof(*op->shifts)));
+	if (filter_q->zero_points) {
+		for (i = 0; i < filter_q->n; i++) {
+			asymmetric |= filter_q->zero_points[i] != 0;
+		}
+	}
+	if (asymmetric) {
+		ES_NEW_ASRT_NM(op->weight_zero_points = malloc(n * sizeof(*op->weight_zero_points)));
+	}
+	op->input_zero_point  = input->zero_point;
+	op->output_zero_point = output->zero_point;
+	nn_activation_range(act, output, &op->act_min, &op->act_max);
+
+	for (o = 0; o < n; o++) {
+		const size_t q   = filter_q->n == 1 ? 0 : o;
+		const int32_t zw = asymmetric ? filter_q->zero_points[q] : 0;
+		op->bias[o]      = (bias ? bias[o] : 0) - input->zero_point * filter_sums[o] +
+		                   (int32_t) k * input->zero_point * zw;
+		if (asymmetric) {
+			op->weight_zero_points[o] = zw;
+		}
+		nn_quantize_multiplier((double) input->scale * filter_q->scales[q] / output->scale,
+		                       &op->multipliers[o],
+		                       &op->shifts[o]);
+	}
+	return 0;
+}
+
+/* Transpose the filter into the right operand of the GEMM, summing each channel on the way */
+static int _prepare(nn_op_st *op,
+                    const int8_t *filter,
+                    const int32_t *bias,
+                    const nn_quant_t *input,
+                    const nn_filter_quant_t *filter_q,
+                    const nn_quant_t *output,
+                    nn_act_et act)
+{
+	CLEANUP(_cleanup_free) int32_t *sums = NULL;
+	const size_t k = op->k, n = op->n;
+	size_t o, i;
+	ES_NEW_ASRT_NM(filter);
+	ES_NEW_ASRT(k > 0 && n > 0, "Empty filter");
+	ES_NEW_ASRT_NM(op->weights = malloc(k * n * sizeof(*op->weights)));
+	ES_NEW_ASRT_NM(sums = calloc(n, sizeof(*sums)));
+	for (o = 0; o < n; o++) {
+		for (i = 0; i < k; i++) {
+			op->weights[i * n + o] = filter[o * k + i];
+			sums[o] += filter[o * k + i];
+		}
+	}
+	ES_FWD_INT_NM(_prepare_quant(op, sums, bias, input, filter_q, output, act));
+	return 0;
+}
+
+/* Everything but the weights comes from the tensor, the weights stay where wf_load put them */
+static int _prepare_resident(nn_op_st *op,
+                             const wf_st *wf,
+                             const wf_tensor_t *tensor,
+                             const da_span_t *loaded,
+                             const nn_quant_t *input,
+                             const nn_quant_t *output,
+                             nn_act_et act)
+{
+	nn_filter_quant_t filter_q;
+	ES_NEW_ASRT_NM(wf && tensor && loaded);
+	ES_NEW_ASRT(tensor->k == op->k && tensor->n == op->n,
+	            "Tensor %s is %ux%u, the op needs %zux%zu",
+	            tensor->name,
+	            tensor->k,
+	            tensor->n,
+	            op->k,
+	            op->n);
+	ES_NEW_ASRT(op->k <= GEMM_MAX_K, "Tensor %s is too deep for the device", tensor->name);
+	filter_q = (nn_filter_quant_t){
+	    .scales      = wf_scales(wf, tensor),
+	    .zero_points = wf_zero_points(wf, tensor),
+	    .n           = tensor->n_quant,
+	};
+	ES_FWD_INT_NM(_prepare_quant(
+	    op, wf_sums(wf, tensor), wf_bias(wf, tensor), input, &filter_q, output, act));
+	op->resident     = true;
+	op->b_tiles_phys = wf_tiles_phys(tensor, loaded);
+	return 0;
+}
+
+int nn_fc_prepare(nn_op_st **dst, const nn_fc_params_t *params)
+{
+	NN_OP_CLEANUP nn_op_st *op = NULL;
+	ES_NEW_ASRT_NM(dst && params);
+	ES_NEW_ASRT_NM(op = calloc(1, sizeof(*op)));
+	op->k = params->in_features;
+	op->n = params->out_features;
+	ES_FWD_INT(_prepare(op,
+	                    params->weights,
+	                    params->bias,
+	                    &params->input,
+	                    &params->weight_q,
+	                    &params->output,
+	                    params->act),
+	           "FullyConnected %zu -> %zu",
+	           params->in_features,
+	           params->out_features);
+	*dst = MOVE_PZ(op);
+	return 0;
+}
+
+int nn_fc_prepare_resident(nn_op_st **dst,
+                           const nn_fc_params_t *params,
+                           const wf_st *wf,
+                           const wf_tensor_t *tensor,
+                           const da_span_t *loaded)
+{
+	NN_OP_CLEANUP nn_op_st *op = NULL;
+	ES_NEW_ASRT_NM(dst && params);
+	ES_NEW_ASRT_NM(op = calloc(1, sizeof(*op)));
+	op->k = params->in_features;
+	op->n = params->out_features;
+	ES_FWD_INT(
+	    _prepare_resident(op, wf, tensor, loaded, &params->input, &params->output, params->act),
+	    "FullyConnected %zu -> %zu",
+	    params->in_features,
+	    params->out_features);
+	*dst = MOVE_PZ(op);
+	return 0;
+}
+
+void nn_conv_dim(size_t in,
+                 size_t kernel,
+                 size_t stride,
+                 size_t dilation,
+                 nn_pad_et padding,
+                 size_t *out,
+                 size_t *pad_before)
+{
+	const size_t effective = (kernel - 1) * dilation + 1;
+	size_t total;
+	if (padding == NN_PAD_VALID) {
+		*out        = in >= effective ? (in - effective) / stride + 1 : 0;
+		*pad_before = 0;
+		return;
+	}
+	*out        = (in + stride - 1) / stride;
+	total       = (*out - 1) * stride + effective;
+	total       = total > in ? total - in : 0;
+	*pad_before = total / 2;
+}
+
+/* Output geometry and GEMM shape of a Conv2D */
+static int _conv_alloc(nn_op_st **dst, const nn_conv2d_params_t *params)
+{
+	NN_OP_CLEANUP nn_op_st *op = NULL;
+	ES_NEW_ASRT_NM(dst && params);
+	ES_NEW_ASRT(params->in_h && params->in_w && params->in_c && params->k_h && params->k_w &&
+	                params->stride_h && params->stride_w,
+	            "Conv2D with an empty dimension or zero stride");
+	ES_NEW_ASRT_NM(op = calloc(1, sizeof(*op)));
+	op->is_conv         = true;
+	op->conv.in_h       = params->in_h;
+	op->conv.in_w       = params->in_w;
+	op->conv.in_c       = params->in_c;
+	op->conv.k_h        = params->k_h;
+	op->conv.k_w        = params->k_w;
+	op->conv.stride_h   = params->stride_h;
+	op->conv.stride_w   = params->stride_w;
+	op->conv.dilation_h = MAX(params->dilation_h, (size_t) 1);
+	op->conv.dilation_w = MAX(params->dilation_w, (size_t) 1);
+	nn_conv_dim(op->conv.in_h,
+	            op->conv.k_h,
+	            op->conv.stride_h,
+	            op->conv.dilation_h,
+	            params->padding,
+	            &op->conv.out_h,
+	            &op->conv.pad_top);
+	nn_conv_dim(op->conv.in_w,
+	            op->conv.k_w,
+	            op->conv.stride_w,
+	            op->conv.dilation_w,
+	            params->padding,
+	            &op->conv.out_w,
+	            &op->conv.pad_left);
+	ES_NEW_ASRT(op->conv.out_h && op->conv.out_w, "Filter larger than the input");
+	op->k = params->k_h * params->k_w * params->in_c;
+	op->n = params->out_c;
+	*dst  = MOVE_PZ(op);
+	return 0;
+}
+
+int nn_conv2d_prepare(nn_op_st **dst, const nn_conv2d_params_t *params)
+{
+	NN_OP_CLEANUP nn_op_st *op = NULL;
+	ES_FWD_INT_NM(_conv_alloc(&op, params));
+	ES_FWD_INT(_prepare(op,
+	                    params->filter,
+	                    params->bias,
+	                    &params->input,
+	                    &params->filter_q,
+	                    &params->output,
+	                    params->act),
+	           "Conv2D %zux%zux%zu -> %zu",
+	           params->k_h,
+	           params->k_w,
+	           params->in_c,
+	           params->out_c);
+	*dst = MOVE_PZ(op);
+	return 0;
+}
+
+int nn_conv2d_prepare_resident(nn_op_st **dst,
+                               const nn_conv2d_params_t *params,
+                               const wf_st *wf,
+                               const wf_tensor_t *tensor,
+                               const da_span_t *loaded)
+{
+	NN_OP_CLEANUP nn_op_st *op = NULL;
+	ES_FWD_INT_NM(_conv_alloc(&op, params));
+	ES_FWD_INT(
+	    _prepare_resident(op, wf, tensor, loaded, &params->input, &params->output, params->act),
+	    "Conv2D %zux%zux%zu -> %zu",
+	    params->k_h,
+	    params->k_w,
+	    params->in_c,
+	    params->out_c);
+	*dst = MOVE_PZ(op);
+	return 0;
+}
+
+int nn_depthwise_conv2d_prepare(nn_op_st **dst, const nn_depthwise_conv2d_params_t *params)
+{
+	CLEANUP(_cleanup_free) int8_t *filter = NULL;
+	nn_conv2d_params_t conv;
+	size_t out_c, taps, o, t;
+	ES_NEW_ASRT_NM(dst && params && params->filter);
+	ES_NEW_ASRT(params->in_c && params->depth_multiplier && params->k_h && params->k_w,
+	            "DepthwiseConv2D with an empty dimension");
+	out_c = params->in_c * params->depth_multiplier;
+	taps  = params->k_h * params->k_w;
+	ES_NEW_ASRT(params->filter_q.n == 1 || params->filter_q.n == out_c,
+	            "%zu filter scales for %zu output channels",
+	            params->filter_q.n,
+	            out_c);
+	ES_NEW_ASRT_NM(filter = malloc(out_c * taps * params->in_c));
+	/* Taps of other input channels hold the zero point, so they add nothing to the sum */
+	for (o = 0; o < out_c; o++) {
+		const size_t q     = params->filter_q.n == 1 ? 0 : o;
+		const int32_t zero = params->filter_q.zero_points ? params->filter_q.zero_points[q] : 0;
+		const size_t c     = o / params->depth_multiplier;
+		int8_t *row        = &filter[o * taps * params->in_c];
+		ES_NEW_ASRT(zero >= INT8_MIN && zero <= INT8_MAX, "Filter zero point %d", zero);
+		memset(row, (uint8_t) zero, taps * params->in_c);
+		for (t = 0; t < taps; t++) {
+			row[t * params->in_c + c] = params->filter[t * out_c + o];
+		}
+	}
+	conv = (nn_conv2d_params_t){
+	    .in_h       = params->in_h,
+	    .in_w       = params->in_w,
+	    .in_c       = params->in_c,
+	    .out_c      = out_c,
+	    .k_h        = params->k_h,
+	    .k_w        = params->k_w,
+	    .stride_h   = params->stride_h,
+	    .stride_w   = params->stride_w,
+	    .dilation_h = params->dilation_h,
+	    .dilation_w = params->dilation_w,
+	    .padding    = params->padding,
+	    .filter     = filter,
+	    .bias       = params->bias,
+	    .input      = params->input,
+	    .filter_q   = params->filter_q,
+	    .output     = params->output,
+	    .act        = params->act,
+	};
+	ES_FWD_INT(nn_conv2d_prepare(dst, &conv), "DepthwiseConv2D x%zu", params->depth_multiplier);
+	return 0;
+}
+
+/* Clamping to [act_min, act_max] and then to [min, max] is one clamp to the clamped bounds */
+void nn_op_clamp_output(nn_op_st *op, int32_t min, int32_t max)
+{
+	op->act_min = MIN(MAX(op->act_min, min), max);
+	op->act_max = MIN(MAX(op->act_max, min), max);
+}
+
+size_t nn_op_input_size(const nn_op_st *op, size_t batch)
+{
+	if (op->is_conv) {
+		return batch * op->conv.in_h * op->conv.in_w * op->conv.in_c;
+	}
+	return batch * op->k;
+}
+
+size_t nn_op_output_size(const nn_op_st *op, size_t batch)
+{
+	if (op->is_conv) {
+		return batch * op->conv.out_h * op->conv.out_w * op->n;
+	}
+	return batch * op->n;
+}
+
+void nn_op_gemm_shape(const nn_op_st *op, size_t *m, size_t *k, size_t *n)
+{
+	*m = op->is_conv ? op->conv.out_h * op->conv.out_w : 1;
+	*k = op->k;
+	*n = op->n;
+}
+
+static int _reserve(void **buf, size_t *size, size_t needed)
+{
+	void *tmp;
+	if (needed <= *size) {
+		return 0;
+	}
+	ES_NEW_ASRT_NM(tmp = realloc(*buf, needed));
+	*buf  = tmp;
+	*size = needed;
+	return 0;
+}
+
+static bool _is_pointwise(const nn_op_st *op)
+{
+	return op->conv.k_h == 1 && op->conv.k_w == 1 && op->conv.stride_h == 1 &&
+	       op->conv.stride_w == 1 && op->conv.pad_top == 0 && op->conv.pad_left == 0;
+}
+
+/* One row per output pixel, (ky, kx, ic) order to match the filter. Padding is the zero point. */
+static void _im2col(const nn_op_st *op, int8_t *dst, const int8_t *input, size_t batch)
+{
+	const size_t in_c = op->conv.in_c;
+	size_t b, oy, ox, ky, kx;
+	for (b = 0; b < batch; b++) {
+		const int8_t *image = &input[b * op->conv.in_h * op->conv.in_w * in_c];
+		for (oy = 0; oy < op->conv.out_h; oy++) {
+			for (ox = 0; ox < op->conv.out_w; ox++) {
+				for (ky = 0; ky < op->conv.k_h; ky++) {
+					const size_t iy = oy * op->conv.stride_h + ky * op->conv.dilation_h;
+					for (kx = 0; kx < op->conv.k_w; kx++) {
+						const size_t ix = ox * op->conv.stride_w + kx * op->conv.dilation_w;
+						/* iy and ix are offset by the padding, unsigned wrap covers < 0 */
+						if (iy - op->conv.pad_top < op->conv.in_h &&
+						    ix - op->conv.pad_left < op->conv.in_w) {
+							const size_t pixel = (iy - op->conv.pad_top) * op->conv.in_w +
+							                     (ix - op->conv.pad_left);
+							memcpy(dst, &image[pixel * in_c], in_c);
+						} else {
+							memset(dst, (uint8_t) op->input_zero_point, in_c);
+						}
+						dst += in_c;
+					}
+				}
+			}
+		}
+	}
+}
+
+typedef struct _epilogue_s
+{
+	const nn_op_st *op;
+	int8_t *output;
+} _epilogue_t;
+
+/* Requantize and clamp a finished block of accumulators straight into the int8 output */
+static void _requantize(void *arg,
+                        const int32_t *c,
+                        size_t ld,
+                        size_t row,
+                        size_t col,
+                        size_t rows,
+                        size_t cols)
+{
+	const _epilogue_t *epi = arg;
+	const nn_op_st *op     = epi->op;
+	size_t i, j;
+	for (i = 0; i < rows; i++) {
+		int8_t *out = &epi->output[(row + i) * op->n + col];
+		for (j = 0; j < cols; j++) {
+			const size_t o = col + j;
+			int32_t acc    = c[i * ld + j] + op->bias[o];
+			if (op->weight_zero_points) {
+				acc -= op->weight_zero_points[o] * op->row_sums[row + i];
+			}
+			acc = nn_multiply_by_quantized_multiplier(acc, op->multipliers[o], op->shifts[o]);
+			acc += op->output_zero_point;
+			out[j] = (int8_t) MIN(MAX(acc, op->act_min), op->act_max);
+		}
+	}
+}
+
+int nn_op_run(nn_op_st *op, dev_st *dev, int8_t *output, const int8_t *input, size_t batch)
+{
+	_epilogue_t epi = {.op = op, .output = output};
+	const int8_t *lowered;
+	size_t m, per_sample, k, n, r, i;
+	ES_NEW_ASRT_NM(op && output && input);
+	ES_NEW_ASRT(dev || !op->resident, "The weights of this op are only in device memory");
+	nn_op_gemm_shape(op, &per_sample, &k, &n);
+	/* Too deep for the int32 partial sums of the device path, the op runs on the CPU instead */
+	if (k > GEMM_MAX_K) {
+		dev = NULL;
+	}
+	m = batch * per_sample;
+	if (!m) {
+		return 0;
+	}
+	lowered = input;
+	if (op->is_conv && !_is_pointwise(op)) {
+		ES_FWD_INT_NM(_reserve((void **) &op->lowered, &op->lowered_size, m * k));
+		_im2col(op, op->lowered, input, batch);
+		lowered = op->lowered;
+	}
+	if (op->weight_zero_points) {
+		ES_FWD_INT_NM(
+		    _reserve((void **) &op->row_sums, &op->row_sums_size, m * sizeof(*op->row_sums)));
+		for (r = 0; r < m; r++) {
+			int32_t sum = 0;
+			for (i = 0; i < k; i++) {
+				sum += lowered[r * k + i];
+			}
+			op->row_sums[r] = sum;
+		}
+	}
+	ES_FWD_INT_NM(_reserve((void **) &op->acc, &op->acc_size, m * n * sizeof(*op->acc)));
+	if (op->resident) {
+		ES_FWD_INT_NM(gemm_s8_pretiled(
+		    dev, op->acc, lowered, op->b_tiles_phys, m, k, n, _requantize, &epi));
+	} else {
+		ES_FWD_INT_NM(
+		    gemm_s8_fused(dev, op->acc, lowered, op->weights, m, k, n, _requantize, &epi));
+	}
+	return 0;
+}
@@ -0,0 +1,209 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Quantized int8 neural network operators with TensorFlow Lite semantics, run as GEMMs on the
+ * systolic array:
+ *    - FullyConnected: input [batch, in] x weights [out, in]^T
+ *    - Conv2D: NHWC input, filter [out_c, k_h, k_w, in_c], lowered with im2col
+ *    - DepthwiseConv2D: filter [k_h, k_w, in_c * depth_multiplier], run as a Conv2D whose filter
+ *      is zero (the filter zero point) outside of each output channel's own input channel. This
+ *      multiplies the GEMM depth by in_c, but keeps every op on the array
+ *
+ * Tensors use real = scale * (q - zero_point). Activations have one scale and zero point, filters
+ * one (per-tensor) or one per output channel (per-channel). Bias is int32 with scale
+ * input_scale * filter_scale and zero point 0. The zero point terms are folded into the bias when
+ * the op is prepared, and the requantization to the output scale and the activation clamp run in
+ * the GEMM epilogue, on each output block as soon as it is read back.
+ *
+ * The GEMM is exact on the device (see gemm.h). Without a device the same lowering runs on the CPU,
+ * which is the reference for the accelerated path. An op that sums more than GEMM_MAX_K products
+ * per output also runs on the CPU.
+ *
+ * Weights can also come from a weight file loaded into device memory (see weight_file.h). Such an
+ * op is prepared from the tensor's bias, scales and weight sums only, and multiplies with
+ * gemm_s8_pretiled, so neither preparing nor running it touches the weights on the host.
+ *
+ * How to:
+ * 1. Fill nn_fc_params_t or nn_conv2d_params_t from the model
+ * 2. nn_fc_prepare / nn_conv2d_prepare / nn_depthwise_conv2d_prepare, once per layer. Or
+ *    nn_fc_prepare_resident / nn_conv2d_prepare_resident after wf_load
+ * 3. nn_op_run per inference, output is nn_op_output_size(op, batch) int8 elements
+ * 4. nn_op_cleanup
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device.h"
+#include "dma_arena.h"
+#include "weight_file.h"
+
+typedef enum nn_act_e
+{
+	NN_ACT_NONE,
+	NN_ACT_RELU,
+	NN_ACT_RELU6,
+} nn_act_et;
+
+typedef enum nn_pad_e
+{
+	/* Output covers every input position, zero point padding split evenly with the extra after */
+	NN_PAD_SAME,
+	/* Only positions where the filter fits entirely */
+	NN_PAD_VALID,
+} nn_pad_et;
+
+/* Quantization of an activation tensor */
+typedef struct nn_quant_s
+{
+	float scale;
+	int32_t zero_point;
+} nn_quant_t;
+
+/* Quantization of a filter, as stored in the TFLite schema */
+typedef struct nn_filter_quant_s
+{
+	const float *scales;
+	/* NULL for symmetric filters */
+	const int32_t *zero_points;
+	/* 1 for per-tensor, the number of output channels for per-channel */
+	size_t n;
+} nn_filter_quant_t;
+
+typedef struct nn_fc_params_s
+{
+	size_t in_features;
+	size_t out_features;
+	/* out_features x in_features row-major */
+	const int8_t *weights;
+	/* out_features entries, NULL for none */
+	const int32_t *bias;
+	nn_quant_t input;
+	nn_filter_quant_t weight_q;
+	nn_quant_t output;
+	nn_act_et act;
+} nn_fc_params_t;
+
+typedef struct nn_conv2d_params_s
+{
+	size_t in_h, in_w, in_c;
+	size_t out_c;
+	size_t k_h, k_w;
+	size_t stride_h, stride_w;
+	/* 0 is treated as 1 */
+	size_t dilation_h, dilation_w;
+	nn_pad_et padding;
+	/* out_c x k_h x k_w x in_c */
+	const int8_t *filter;
+	/* out_c entries, NULL for none */
+	const int32_t *bias;
+	nn_quant_t input;
+	nn_filter_quant_t filter_q;
+	nn_quant_t output;
+	nn_act_et act;
+} nn_conv2d_params_t;
+
+typedef struct nn_depthwise_conv2d_params_s
+{
+	size_t in_h, in_w, in_c;
+	/* Output channels per input channel, out_c = in_c * depth_multiplier */
+	size_t depth_multiplier;
+	size_t k_h, k_w;
+	size_t stride_h, stride_w;
+	/* 0 is treated as 1 */
+	size_t dilation_h, dilation_w;
+	nn_pad_et padding;
+	/* k_h x k_w x out_c, output channel o reads input channel o / depth_multiplier */
+	const int8_t *filter;
+	/* out_c entries, NULL for none */
+	const int32_t *bias;
+	nn_quant_t input;
+	nn_filter_quant_t filter_q;
+	nn_quant_t output;
+	nn_act_et act;
+} nn_depthwise_conv2d_params_t;
+
+struct nn_op_s;
+typedef struct nn_op_s nn_op_st;
+
+/**
+ * @brief Convert a real multiplier to a Q31 multiplier and a power of two exponent, as TFLite's
+ * QuantizeMultiplier does: m ~= multiplier * 2^(shift - 31).
+ */
+void nn_quantize_multiplier(double m, int32_t *multiplier, int *shift);
+
+/**
+ * @brief x * multiplier * 2^(shift - 31) with TFLite's (gemmlowp's) rounding, bit exact.
+ */
+int32_t nn_multiply_by_quantized_multiplier(int32_t x, int32_t multiplier, int shift);
+
+/**
+ * @brief Clamp range of a quantized output for an activation, as TFLite computes it.
+ */
+void nn_activation_range(nn_act_et act, const nn_quant_t *output, int32_t *min, int32_t *max);
+
+/**
+ * @brief Output size and leading padding of one spatial dimension, as TFLite's
+ * ComputePaddingHeightWidth. Shared by convolutions and pooling.
+ */
+void nn_conv_dim(size_t in,
+                 size_t kernel,
+                 size_t stride,
+                 size_t dilation,
+                 nn_pad_et padding,
+                 size_t *out,
+                 size_t *pad_before);
+
+int nn_fc_prepare(nn_op_st **dst, const nn_fc_params_t *params);
+int nn_conv2d_prepare(nn_op_st **dst, const nn_conv2d_params_t *params);
+int nn_depthwise_conv2d_prepare(nn_op_st **dst, const nn_depthwise_conv2d_params_t *params);
+/**
+ * @brief Prepare an op on a tensor of a weight file whose data section wf_load put at loaded.
+ * params gives the shape, the activation quantization and act; its weights, bias and weight
+ * quantization are ignored in favour of the tensor's. A depthwise filter has to be written as the
+ * equivalent Conv2D filter.
+ *
+ * The op only runs on a device, and its depth has to be at most GEMM_MAX_K. loaded has to stay
+ * in place as long as the op is used.
+ */
+int nn_fc_prepare_resident(nn_op_st **dst,
+                           const nn_fc_params_t *params,
+                           const wf_st *wf,
+                           const wf_tensor_t *tensor,
+                           const da_span_t *loaded);
+int nn_conv2d_prepare_resident(nn_op_st **dst,
+                               const nn_conv2d_params_t *params,
+                               const wf_st *wf,
+                               const wf_tensor_t *tensor,
+                               const da_span_t *loaded);
+void nn_op_cleanup(nn_op_st **op);
+
+#define NN_OP_CLEANUP CLEANUP(nn_op_cleanup)
+
+/**
+ * @brief Run a prepared op on a batch.
+ *
+ * @param op Prepared op
+ * @param dev Device to run the GEMM on, NULL to run on the CPU. Required with resident weights
+ * @param output nn_op_output_size(op, batch) elements, [batch, out] or NHWC
+ * @param input [batch, in] or NHWC
+ * @param batch Number of samples
+ * @return >= 0 on success, < 0 on failure
+ */
+int nn_op_run(nn_op_st *op, dev_st *dev, int8_t *output, const int8_t *input, size_t batch);
+
+/**
+ * @brief Clamp the output of a prepared op to [min, max] after its own activation, as a Relu or
+ * Relu6 that keeps the output quantization would. Lets a following activation run in the
+ * epilogue instead of as a pass of its own over the output.
+ */
+void nn_op_clamp_output(nn_op_st *op, int32_t min, int32_t max);
+
+size_t nn_op_input_size(const nn_op_st *op, size_t batch);
+size_t nn_op_output_size(const nn_op_st *op, size_t batch);
+/* GEMM shape of one sample: rows of the lowered input, reduction depth and output channels */
+void nn_op_gemm_shape(const nn_op_st *op, size_t *m, size_t *k, size_t *n);
@@ -0,0 +1,210 @@
+#include "nn_ref.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Quantized CPU kernels.
+ */
+
+#include <math.h>
+
+#include "util.h"
+
+/* Bits int8 Add shifts its inputs up by before rescaling, as TFLite */
+#define _ADD_LEFT_SHIFT (20)
+
+static int8_t _clamp(int32_t value, int32_t min, int32_t max)
+{
+	return (int8_t) MIN(MAX(value, min), max);
+}
+
+void nn_pool_output_dims(const nn_pool_params_t *params, size_t *out_h, size_t *out_w)
+{
+	size_t pad;
+	nn_conv_dim(params->in_h, params->k_h, params->stride_h, 1, params->padding, out_h, &pad);
+	nn_conv_dim(params->in_w, params->k_w, params->stride_w, 1, params->padding, out_w, &pad);
+}
+
+/* Reduce the window [y0, y1) x [x0, x1) of one channel */
+typedef int32_t (*_pool_ft)(const int8_t *input,
+                            const nn_pool_params_t *params,
+                            size_t y0,
+                            size_t y1,
+                            size_t x0,
+                            size_t x1);
+
+static int32_t _max_window(const int8_t *input,
+                           const nn_pool_params_t *params,
+                           size_t y0,
+                           size_t y1,
+                           size_t x0,
+                           size_t x1)
+{
+	int32_t max = INT8_MIN;
+	size_t y, x;
+	for (y = y0; y < y1; y++) {
+		for (x = x0; x < x1; x++) {
+			max = MAX(max, input[(y * params->in_w + x) * params->c]);
+		}
+	}
+	return max;
+}
+
+/* Rounded to nearest, ties away from zero */
+static int32_t _avg_window(const int8_t *input,
+                           const nn_pool_params_t *params,
+                           size_t y0,
+                           size_t y1,
+                           size_t x0,
+                           size_t x1)
+{
+	const int32_t count = (int32_t) ((y1 - y0) * (x1 - x0));
+	int32_t sum         = 0;
+	size_t y, x;
+	for (y = y0; y < y1; y++) {
+		for (x = x0; x < x1; x++) {
+			sum += input[(y * params->in_w + x) * params->c];
+		}
+	}
+	if (!count) {
+		return 0;
+	}
+	return sum > 0 ? (sum + count / 2) / count : (sum - count / 2) / count;
+}
+
+/* Padding is left out of the window rather than filled */
+static void _pool(int8_t *output, const int8_t *input, const nn_pool_params_t *params, _pool_ft f)
+{
+	size_t out_h, out_w, pad_top, pad_left, b, oy, ox, ch;
+	int32_t min, max;
+	nn_conv_dim(params->in_h, params->k_h, params->stride_h, 1, params->padding, &out_h, &pad_top);
+	nn_conv_dim(
+	    params->in_w, params->k_w, params->stride_w, 1, params->padding, &out_w, &pad_left);
+	nn_activation_range(params->act, &params->quant, &min, &max);
+	for (b = 0; b < params->batch; b++) {
+		const int8_t *image = &input[b * params->in_h * params->in_w * params->c];
+		for (oy = 0; oy < out_h; oy++) {
+			/* Window clipped to the image */
+			const long top  = (long) (oy * params->stride_h) - (long) pad_top;
+			const size_t y0 = (size_t) MAX(top, 0l);
+			const size_t y1 = (size_t) MIN(top + (long) params->k_h, (long) params->in_h);
+			for (ox = 0; ox < out_w; ox++) {
+				const long left = (long) (ox * params->stride_w) - (long) pad_left;
+				const size_t x0 = (size_t) MAX(left, 0l);
+				const size_t x1 = (size_t) MIN(left + (long) params->k_w, (long) params->in_w);
+				for (ch = 0; ch < params->c; ch++) {
+					*output++ = _clamp(f(&image[ch], params, y0, y1, x0, x1), min, max);
+				}
+			}
+		}
+	}
+}
+
+void nn_ref_max_pool(int8_t *output, const int8_t *input, const nn_pool_params_t *params)
+{
+	_pool(output, input, params, _max_window);
+}
+
+void nn_ref_avg_pool(int8_t *output, const int8_t *input, const nn_pool_params_t *params)
+{
+	_pool(output, input, params, _avg_window);
+}
+
+void nn_ref_add(int8_t *output,
+                const int8_t *a,
+                const nn_quant_t *a_q,
+                const int8_t *b,
+                const nn_quant_t *b_q,
+                const nn_quant_t *output_q,
+                nn_act_et act,
+                size_t n)
+{
+	/* Both inputs are brought to twice the larger scale, with 20 bits of headroom */
+	const double twice_max = 2.0 * MAX(a_q->scale, b_q->scale);
+	int32_t a_mult, b_mult, out_mult, min, max;
+	int a_shift, b_shift, out_shift;
+	size_t i;
+	nn_quantize_multiplier(a_q->scale / twice_max, &a_mult, &a_shift);
+	nn_quantize_multiplier(b_q->scale / twice_max, &b_mult, &b_shift);
+	nn_quantize_multiplier(
+	    twice_max / ((1 << _ADD_LEFT_SHIFT) * (double) output_q->scale), &out_mult, &out_shift);
+	nn_activation_range(act, output_q, &min, &max);
+	for (i = 0; i < n; i++) {
+		const int32_t a_val = (a[i] - a_q->zero_point) * (1 << _ADD_LEFT_SHIFT);
+		const int32_t b_val = (b[i] - b_q->zero_point) * (1 << _ADD_LEFT_SHIFT);
+		const int32_t sum   = nn_multiply_by_quantized_multiplier(a_val, a_mult, a_shift) +
+		                    nn_multiply_by_quantized_multiplier(b_val, b_mult, b_shift);
+		output[i] = _clamp(nn_multiply_by_quantized_multiplier(sum, out_mult, out_shift) +
+		                       output_q->zero_point,
+		                   min,
+		                   max);
+	}
+}
+
+void nn_ref_requantize(int8_t *output,
+                       const int8_t *input,
+                       const nn_quant_t *input_q,
+                       const nn_quant_t *output_q,
+                       nn_act_et act,
+                       size_t n)
+{
+	int32_t mult, min, max;
+	int shift;
+	size_t i;
+	nn_quantize_multiplier((double) input_q->scale / output_q->scale, &mult, &shift);
+	nn_activation_range(act, output_q, &min, &max);
+	for (i = 0; i < n; i++) {
+		const int32_t value =
+		    nn_multiply_by_quantized_multiplier(input[i] - input_q->zero_point, mult, shift);
+		output[i] = _clamp(value + output_q->zero_point, min, max);
+	}
+}
+
+void nn_ref_quantize(int8_t *output, const float *input, const nn_quant_t *q, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		const int32_t value = (int32_t) roundf(input[i] / q->scale) + q->zero_point;
+		output[i]           = _clamp(value, INT8_MIN, INT8_MAX);
+	}
+}
+
+void nn_ref_dequantize(float *output, const int8_t *input, const nn_quant_t *q, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		output[i] = (float) ((double) q->scale * (input[i] - q->zero_point));
+	}
+}
+
+void nn_ref_softmax(int8_t *output,
+                    const int8_t *input,
+                    const nn_quant_t *input_q,
+                    const nn_quant_t *output_q,
+                    float beta,
+                    size_t rows,
+                    size_t depth)
+{
+	size_t r, i;
+	for (r = 0; r < rows; r++) {
+		const int8_t *in = &input[r * depth];
+		int8_t *out      = &output[r * depth];
+		int32_t max      = INT8_MIN;
+		double sum       = 0;
+		for (i = 0; i < depth; i++) {
+			max = MAX(max, in[i]);
+		}
+		/* Subtracting the max keeps exp() <= 1, the zero point cancels out */
+		for (i = 0; i < depth; i++) {
+			sum += exp((double) beta * input_q->scale * (in[i] - max));
+		}
+		for (i = 0; i < depth; i++) {
+			const double p = exp((double) beta * input_q->scale * (in[i] - max)) / sum;
+			out[i] = _clamp((int32_t) lround(p / output_q->scale) + output_q->zero_point,
+			                INT8_MIN,
+			                INT8_MAX);
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * CPU kernels for the quantized ops that do not map onto the systolic array. They follow the
+ * TFLite reference kernels for int8 and are bit exact with them, except softmax, which is computed
+ * in float instead of with TFLite's fixed point exp table and may differ by one step.
+ *
+ * How to:
+ * Call them directly, tensors are NHWC or flat and the caller owns every buffer.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nn_ops.h"
+
+typedef struct nn_pool_params_s
+{
+	size_t batch;
+	size_t in_h, in_w, c;
+	size_t k_h, k_w;
+	size_t stride_h, stride_w;
+	nn_pad_et padding;
+	nn_act_et act;
+	/* Input and output quantization, TFLite requires them to match */
+	nn_quant_t quant;
+} nn_pool_params_t;
+
+void nn_pool_output_dims(const nn_pool_params_t *params, size_t *out_h, size_t *out_w);
+void nn_ref_max_pool(int8_t *output, const int8_t *input, const nn_pool_params_t *params);
+void nn_ref_avg_pool(int8_t *output, const int8_t *input, const nn_pool_params_t *params);
+
+/**
+ * @brief Element wise a + b of n elements with TFLite's int8 Add, both inputs the same shape.
+ */
+void nn_ref_add(int8_t *output,
+                const int8_t *a,
+                const nn_quant_t *a_q,
+                const int8_t *b,
+                const nn_quant_t *b_q,
+                const nn_quant_t *output_q,
+                nn_act_et act,
+                size_t n);
+
+/**
+ * @brief Rescale to the output quantization and clamp. This is int8 Quantize with NN_ACT_NONE and
+ * Relu / Relu6 otherwise.
+ */
+void nn_ref_requantize(int8_t *output,
+                       const int8_t *input,
+                       const nn_quant_t *input_q,
+                       const nn_quant_t *output_q,
+                       nn_act_et act,
+                       size_t n);
+
+void nn_ref_quantize(int8_t *output, const float *input, const nn_quant_t *q, size_t n);
+void nn_ref_dequantize(float *output, const int8_t *input, const nn_quant_t *q, size_t n);
+
+/**
+ * @brief Softmax over the last dimension of a [rows, depth] tensor.
+ */
+void nn_ref_softmax(int8_t *output,
+                    const int8_t *input,
+                    const nn_quant_t *input_q,
+                    const nn_quant_t *output_q,
+                    float beta,
+                    size_t rows,
+                    size_t depth);
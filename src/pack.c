@@ -0,0 +1,665 @@
+#include "pack.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Tile packing kernels.
+ */
+
+#include <string.h>
+
+#include "util.h"
+
+#if !defined(PK_NO_SIMD) && defined(__ARM_NEON)
+#define _PK_NEON
+#include <arm_neon.h>
+#elif !defined(PK_NO_SIMD) && defined(__SSE2__)
+#define _PK_SSE2
+#include <emmintrin.h>
+#endif
+
+#define _DIGIT_MASK ((1 << PK_DIGIT_BITS) - 1)
+/* Two's complement of a digit: xor then subtract the sign bit */
+#define _DIGIT_SIGN (1 << (PK_DIGIT_BITS - 1))
+
+#if defined(_PK_NEON) || defined(_PK_SSE2)
+
+#ifdef _PK_NEON
+#define _BACKEND "neon"
+
+typedef uint8x16_t _vec_t;
+
+static inline _vec_t _load(const void *src)
+{
+	return vld1q_u8(src);
+}
+
+static inline void _store(void *dst, _vec_t v)
+{
+	vst1q_u8(dst, v);
+}
+
+static inline _vec_t _zero(void)
+{
+	return vdupq_n_u8(0);
+}
+
+/* Interleave the bytes of a and b: lo = a0 b0 .. a7 b7, hi = a8 b8 .. a15 b15 */
+static inline void _zip(_vec_t *lo, _vec_t *hi, _vec_t a, _vec_t b)
+{
+	const uint8x16x2_t zipped = vzipq_u8(a, b);
+	*lo                       = zipped.val[0];
+	*hi                       = zipped.val[1];
+}
+
+typedef int32x4_t _vec32_t;
+
+static inline _vec32_t _load32(const int32_t *src)
+{
+	return vld1q_s32(src);
+}
+
+static inline void _store32(int32_t *dst, _vec32_t v)
+{
+	vst1q_s32(dst, v);
+}
+
+static inline _vec32_t _add32(_vec32_t a, _vec32_t b)
+{
+	return vaddq_s32(a, b);
+}
+
+static inline void _transpose4(_vec32_t v[4])
+{
+	const int32x4x2_t p = vtrnq_s32(v[0], v[1]);
+	const int32x4x2_t q = vtrnq_s32(v[2], v[3]);
+	v[0]                = vcombine_s32(vget_low_s32(p.val[0]), vget_low_s32(q.val[0]));
+	v[1]                = vcombine_s32(vget_low_s32(p.val[1]), vget_low_s32(q.val[1]));
+	v[2]                = vcombine_s32(vget_high_s32(p.val[0]), vget_high_s32(q.val[0]));
+	v[3]                = vcombine_s32(vget_high_s32(p.val[1]), vget_high_s32(q.val[1]));
+}
+
+/* dst[0..15] += sign extended bytes of v */
+static inline void _widen_add(int32_t *dst, _vec_t v)
+{
+	const int8x16_t s  = vreinterpretq_s8_u8(v);
+	const int16x8_t lo = vmovl_s8(vget_low_s8(s));
+	const int16x8_t hi = vmovl_s8(vget_high_s8(s));
+	vst1q_s32(&dst[0], vaddq_s32(vld1q_s32(&dst[0]), vmovl_s16(vget_low_s16(lo))));
+	vst1q_s32(&dst[4], vaddq_s32(vld1q_s32(&dst[4]), vmovl_s16(vget_high_s16(lo))));
+	vst1q_s32(&dst[8], vaddq_s32(vld1q_s32(&dst[8]), vmovl_s16(vget_low_s16(hi))));
+	vst1q_s32(&dst[12], vaddq_s32(vld1q_s32(&dst[12]), vmovl_s16(vget_high_s16(hi))));
+}
+
+static inline _vec_t _set1(uint8_t x)
+{
+	return vdupq_n_u8(x);
+}
+
+static inline _vec_t _xor(_vec_t a, _vec_t b)
+{
+	return veorq_u8(a, b);
+}
+
+static inline _vec_t _sub(_vec_t a, _vec_t b)
+{
+	return vsubq_u8(a, b);
+}
+
+/* (v >> shift) & _DIGIT_MASK per byte */
+static inline _vec_t _digit(_vec_t v, int shift)
+{
+	return vandq_u8(vshlq_u8(v, vdupq_n_s8(-shift)), vdupq_n_u8(_DIGIT_MASK));
+}
+
+typedef int16x8_t _vec16_t;
+
+static inline _vec16_t _zero16(void)
+{
+	return vdupq_n_s16(0);
+}
+
+/* Widen the bytes of v to int16, as int8 if is_signed, else as uint8 */
+static inline void _widen16(_vec16_t *lo, _vec16_t *hi, _vec_t v, bool is_signed)
+{
+	if (is_signed) {
+		*lo = vmovl_s8(vget_low_s8(vreinterpretq_s8_u8(v)));
+		*hi = vmovl_s8(vget_high_s8(vreinterpretq_s8_u8(v)));
+	} else {
+		*lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(v)));
+		*hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(v)));
+	}
+}
+
+static inline _vec16_t _shl_add16(_vec16_t acc, _vec16_t v, int shift)
+{
+	return vaddq_s16(acc, vshlq_s16(v, vdupq_n_s16(shift)));
+}
+
+static inline _vec32_t _zero32(void)
+{
+	return vdupq_n_s32(0);
+}
+
+static inline void _widen32(_vec32_t *lo, _vec32_t *hi, _vec16_t v)
+{
+	*lo = vmovl_s16(vget_low_s16(v));
+	*hi = vmovl_s16(vget_high_s16(v));
+}
+
+static inline _vec32_t _shl_add32(_vec32_t acc, _vec32_t v, int shift)
+{
+	return vaddq_s32(acc, vshlq_s32(v, vdupq_n_s32(shift)));
+}
+
+#else
+#define _BACKEND "sse2"
+
+typedef __m128i _vec_t;
+
+static inline _vec_t _load(const void *src)
+{
+	return _mm_loadu_si128(src);
+}
+
+static inline void _store(void *dst, _vec_t v)
+{
+	_mm_storeu_si128(dst, v);
+}
+
+static inline _vec_t _zero(void)
+{
+	return _mm_setzero_si128();
+}
+
+static inline void _zip(_vec_t *lo, _vec_t *hi, _vec_t a, _vec_t b)
+{
+	*lo = _mm_unpacklo_epi8(a, b);
+	*hi = _mm_unpackhi_epi8(a, b);
+}
+
+typedef __m128i _vec32_t;
+
+static inline _vec32_t _load32(const int32_t *src)
+{
+	return _mm_loadu_si128((const __m128i *) src);
+}
+
+static inline void _store32(int32_t *dst, _vec32_t v)
+{
+	_mm_storeu_si128((__m128i *) dst, v);
+}
+
+static inline _vec32_t _add32(_vec32_t a, _vec32_t b)
+{
+	return _mm_add_epi32(a, b);
+}
+
+static inline void _transpose4(_vec32_t v[4])
+{
+	const __m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+	const __m128i t1 = _mm_unpacklo_epi32(v[2], v[3]);
+	const __m128i t2 = _mm_unpackhi_epi32(v[0], v[1]);
+	const __m128i t3 = _mm_unpackhi_epi32(v[2], v[3]);
+	v[0]             = _mm_unpacklo_epi64(t0, t1);
+	v[1]             = _mm_unpackhi_epi64(t0, t1);
+	v[2]             = _mm_unpacklo_epi64(t2, t3);
+	v[3]             = _mm_unpackhi_epi64(t2, t3);
+}
+
+static inline void _add4(int32_t *dst, __m128i v)
+{
+	_mm_storeu_si128((__m128i *) dst, _mm_add_epi32(_mm_loadu_si128((__m128i *) dst), v));
+}
+
+static inline void _widen_add(int32_t *dst, _vec_t v)
+{
+	const __m128i sign8 = _mm_cmpgt_epi8(_mm_setzero_si128(), v);
+	const __m128i lo    = _mm_unpacklo_epi8(v, sign8);
+	const __m128i hi    = _mm_unpackhi_epi8(v, sign8);
+	const __m128i lo_s  = _mm_srai_epi16(lo, 15);
+	const __m128i hi_s  = _mm_srai_epi16(hi, 15);
+	_add4(&dst[0], _mm_unpacklo_epi16(lo, lo_s));
+	_add4(&dst[4], _mm_unpackhi_epi16(lo, lo_s));
+	_add4(&dst[8], _mm_unpacklo_epi16(hi, hi_s));
+	_add4(&dst[12], _mm_unpackhi_epi16(hi, hi_s));
+}
+
+static inline _vec_t _set1(uint8_t x)
+{
+	return _mm_set1_epi8((char) x);
+}
+
+static inline _vec_t _xor(_vec_t a, _vec_t b)
+{
+	return _mm_xor_si128(a, b);
+}
+
+static inline _vec_t _sub(_vec_t a, _vec_t b)
+{
+	return _mm_sub_epi8(a, b);
+}
+
+/* There is no byte shift, the bits shifted in from the neighbouring byte are masked off */
+static inline _vec_t _digit(_vec_t v, int shift)
+{
+	return _mm_and_si128(_mm_srl_epi16(v, _mm_cvtsi32_si128(shift)), _set1(_DIGIT_MASK));
+}
+
+typedef __m128i _vec16_t;
+
+static inline _vec16_t _zero16(void)
+{
+	return _mm_setzero_si128();
+}
+
+static inline void _widen16(_vec16_t *lo, _vec16_t *hi, _vec_t v, bool is_signed)
+{
+	if (is_signed) {
+		*lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+		*hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+	} else {
+		*lo = _mm_unpacklo_epi8(v, _mm_setzero_si128());
+		*hi = _mm_unpackhi_epi8(v, _mm_setzero_si128());
+	}
+}
+
+static inline _vec16_t _shl_add16(_vec16_t acc, _vec16_t v, int shift)
+{
+	return _mm_add_epi16(acc, _mm_sll_epi16(v, _mm_cvtsi32_si128(shift)));
+}
+
+static inline _vec32_t _zero32(void)
+{
+	return _mm_setzero_si128();
+}
+
+static inline void _widen32(_vec32_t *lo, _vec32_t *hi, _vec16_t v)
+{
+	*lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+	*hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+}
+
+static inline _vec32_t _shl_add32(_vec32_t acc, _vec32_t v, int shift)
+{
+	return _mm_add_epi32(acc, _mm_sll_epi32(v, _mm_cvtsi32_si128(shift)));
+}
+#endif
+
+/*
+ * Interleaving row i with row i + 8 moves element (r, c) of the 8 bit index r3r2r1r0c3c2c1c0 to
+ * r2r1r0c3c2c1c0r3, a rotation by one bit. Four rounds swap the row and column bits.
+ */
+static void _transpose(_vec_t v[SA_DIM])
+{
+	_vec_t tmp[SA_DIM];
+	int round, i;
+	for (round = 0; round < 4; round++) {
+		for (i = 0; i < SA_DIM / 2; i++) {
+			_zip(&tmp[2 * i], &tmp[2 * i + 1], v[i], v[i + SA_DIM / 2]);
+		}
+		for (i = 0; i < SA_DIM; i++) {
+			v[i] = tmp[i];
+		}
+	}
+}
+
+/* Load a rows x cols block as SA_DIM full rows, zero beyond the block, without reading past it */
+static void _load_block(_vec_t v[SA_DIM], const int8_t *src, size_t ld, size_t rows, size_t cols)
+{
+	size_t i;
+	for (i = 0; i < rows; i++) {
+		if (cols == SA_DIM) {
+			v[i] = _load(&src[i * ld]);
+		} else {
+			uint8_t row[SA_DIM] = {0};
+			memcpy(row, &src[i * ld], cols);
+			v[i] = _load(row);
+		}
+	}
+	for (; i < SA_DIM; i++) {
+		v[i] = _zero();
+	}
+}
+
+static void _load_tile(_vec_t v[SA_DIM], const matrix_t *src)
+{
+	size_t i;
+	for (i = 0; i < SA_DIM; i++) {
+		v[i] = _load(src->data[i]);
+	}
+}
+
+static void _store_tile(matrix_t *dst, const _vec_t v[SA_DIM])
+{
+	size_t i;
+	for (i = 0; i < SA_DIM; i++) {
+		_store(dst->data[i], v[i]);
+	}
+}
+
+void pk_tile_col_major(matrix_t *dst, const int8_t *src, size_t ld, size_t rows, size_t cols)
+{
+	_vec_t v[SA_DIM];
+	_load_block(v, src, ld, rows, cols);
+	_transpose(v);
+	_store_tile(dst, v);
+}
+
+void pk_tile_row_major(matrix_t *dst, const int8_t *src, size_t ld, size_t rows, size_t cols)
+{
+	_vec_t v[SA_DIM];
+	_load_block(v, src, ld, rows, cols);
+	_store_tile(dst, v);
+}
+
+void pk_untile_col_major(int8_t *dst, size_t ld, const matrix_t *src, size_t rows, size_t cols)
+{
+	_vec_t v[SA_DIM];
+	size_t i;
+	_load_tile(v, src);
+	_transpose(v);
+	for (i = 0; i < rows; i++) {
+		if (cols == SA_DIM) {
+			_store(&dst[i * ld], v[i]);
+		} else {
+			uint8_t row[SA_DIM];
+			_store(row, v[i]);
+			memcpy(&dst[i * ld], row, cols);
+		}
+	}
+}
+
+void pk_accumulate_col_major(int32_t *dst,
+                             size_t ld,
+                             const matrix_t *src,
+                             size_t rows,
+                             size_t cols)
+{
+	_vec_t v[SA_DIM];
+	size_t i, j;
+	_load_tile(v, src);
+	_transpose(v);
+	for (i = 0; i < rows; i++) {
+		if (cols == SA_DIM) {
+			_widen_add(&dst[i * ld], v[i]);
+		} else {
+			int8_t row[SA_DIM];
+			_store(row, v[i]);
+			for (j = 0; j < cols; j++) {
+				dst[i * ld + j] += row[j];
+			}
+		}
+	}
+}
+
+void pk_accumulate32_col_major(int32_t *dst,
+                               size_t ld,
+                               const matrix32_t *src,
+                               size_t rows,
+                               size_t cols)
+{
+	size_t i, j, l;
+	for (i = 0; i + 4 <= rows; i += 4) {
+		for (j = 0; j + 4 <= cols; j += 4) {
+			_vec32_t v[4];
+			for (l = 0; l < 4; l++) {
+				v[l] = _load32(&src->data[j + l][i]);
+			}
+			_transpose4(v);
+			for (l = 0; l < 4; l++) {
+				int32_t *out = &dst[(i + l) * ld + j];
+				_store32(out, _add32(_load32(out), v[l]));
+			}
+		}
+		for (; j < cols; j++) {
+			for (l = 0; l < 4; l++) {
+				dst[(i + l) * ld + j] += src->data[j][i + l];
+			}
+		}
+	}
+	for (; i < rows; i++) {
+		for (j = 0; j < cols; j++) {
+			dst[i * ld + j] += src->data[j][i];
+		}
+	}
+}
+
+void pk_digits_signed(matrix_t dst[PK_N_DIGITS], const matrix_t *src)
+{
+	const _vec_t sign = _set1(_DIGIT_SIGN);
+	size_t i, d;
+	for (i = 0; i < SA_DIM; i++) {
+		const _vec_t v = _load(src->data[i]);
+		for (d = 0; d < PK_N_DIGITS - 1; d++) {
+			_store(dst[d].data[i], _digit(v, PK_DIGIT_BITS * d));
+		}
+		_store(dst[d].data[i], _sub(_xor(_digit(v, PK_DIGIT_BITS * d), sign), sign));
+	}
+}
+
+void pk_digits_offset(matrix_t dst[PK_N_DIGITS], const matrix_t *src)
+{
+	const _vec_t offset = _set1(PK_DIGIT_OFFSET);
+	size_t i, d;
+	for (i = 0; i < SA_DIM; i++) {
+		/* Adding 128 flips the top bit */
+		const _vec_t v = _xor(_load(src->data[i]), offset);
+		for (d = 0; d < PK_N_DIGITS; d++) {
+			_store(dst[d].data[i], _digit(v, PK_DIGIT_BITS * d));
+		}
+	}
+}
+
+/*
+ * One column at a time: the products of left digit i are summed in int16 (at most 144 * 85), then
+ * widened and summed in int32. Only the products of the signed top digit are sign extended.
+ */
+void pk_digits_combine(matrix32_t *dst, const matrix_t *products)
+{
+	size_t col, i, j, l;
+	for (col = 0; col < SA_DIM; col++) {
+		_vec32_t out[4] = {_zero32(), _zero32(), _zero32(), _zero32()};
+		for (i = 0; i < PK_N_DIGITS; i++) {
+			const bool is_signed = i == PK_N_DIGITS - 1;
+			_vec16_t sum[2]      = {_zero16(), _zero16()};
+			_vec32_t wide[4];
+			for (j = 0; j < PK_N_DIGITS; j++) {
+				_vec16_t p[2];
+				_widen16(&p[0], &p[1], _load(products[i * PK_N_DIGITS + j].data[col]), is_signed);
+				sum[0] = _shl_add16(sum[0], p[0], PK_DIGIT_BITS * j);
+				sum[1] = _shl_add16(sum[1], p[1], PK_DIGIT_BITS * j);
+			}
+			_widen32(&wide[0], &wide[1], sum[0]);
+			_widen32(&wide[2], &wide[3], sum[1]);
+			for (l = 0; l < 4; l++) {
+				out[l] = _shl_add32(out[l], wide[l], PK_DIGIT_BITS * i);
+			}
+		}
+		for (l = 0; l < 4; l++) {
+			_store32(&dst->data[col][4 * l], out[l]);
+		}
+	}
+}
+
+#else
+#define _BACKEND "scalar"
+
+void pk_tile_col_major(matrix_t *dst, const int8_t *src, size_t ld, size_t rows, size_t cols)
+{
+	size_t i, j;
+	if (rows < SA_DIM || cols < SA_DIM) {
+		memset(dst, 0, sizeof(*dst));
+	}
+	for (i = 0; i < rows; i++) {
+		for (j = 0; j < cols; j++) {
+			dst->data[j][i] = (uint8_t) src[i * ld + j];
+		}
+	}
+}
+
+void pk_tile_row_major(matrix_t *dst, const int8_t *src, size_t ld, size_t rows, size_t cols)
+{
+	size_t i;
+	if (rows < SA_DIM || cols < SA_DIM) {
+		memset(dst, 0, sizeof(*dst));
+	}
+	for (i = 0; i < rows; i++) {
+		memcpy(dst->data[i], &src[i * ld], cols);
+	}
+}
+
+void pk_untile_col_major(int8_t *dst, size_t ld, const matrix_t *src, size_t rows, size_t cols)
+{
+	size_t i, j;
+	for (i = 0; i < rows; i++) {
+		for (j = 0; j < cols; j++) {
+			dst[i * ld + j] = (int8_t) src->data[j][i];
+		}
+	}
+}
+
+void pk_accumulate_col_major(int32_t *dst,
+                             size_t ld,
+                             const matrix_t *src,
+                             size_t rows,
+                             size_t cols)
+{
+	size_t i, j;
+	for (i = 0; i < rows; i++) {
+		for (j = 0; j < cols; j++) {
+			dst[i * ld + j] += (int8_t) src->data[j][i];
+		}
+	}
+}
+
+void pk_accumulate32_col_major(int32_t *dst,
+                               size_t ld,
+                               const matrix32_t *src,
+                               size_t rows,
+                               size_t cols)
+{
+	size_t i, j;
+	for (i = 0; i < rows; i++) {
+		for (j = 0; j < cols; j++) {
+			dst[i * ld + j] += src->data[j][i];
+		}
+	}
+}
+
+void pk_digits_signed(matrix_t dst[PK_N_DIGITS], const matrix_t *src)
+{
+	size_t i, j, d;
+	for (i = 0; i < SA_DIM; i++) {
+		for (j = 0; j < SA_DIM; j++) {
+			const uint8_t v = src->data[i][j];
+			for (d = 0; d < PK_N_DIGITS - 1; d++) {
+				dst[d].data[i][j] = (v >> (PK_DIGIT_BITS * d)) & _DIGIT_MASK;
+			}
+			dst[d].data[i][j] = (uint8_t) ((int8_t) v >> (PK_DIGIT_BITS * d));
+		}
+	}
+}
+
+void pk_digits_offset(matrix_t dst[PK_N_DIGITS], const matrix_t *src)
+{
+	size_t i, j, d;
+	for (i = 0; i < SA_DIM; i++) {
+		for (j = 0; j < SA_DIM; j++) {
+			const uint8_t v = src->data[i][j] ^ PK_DIGIT_OFFSET;
+			for (d = 0; d < PK_N_DIGITS; d++) {
+				dst[d].data[i][j] = (v >> (PK_DIGIT_BITS * d)) & _DIGIT_MASK;
+			}
+		}
+	}
+}
+
+void pk_digits_combine(matrix32_t *dst, const matrix_t *products)
+{
+	size_t col, row, i, j;
+	for (col = 0; col < SA_DIM; col++) {
+		for (row = 0; row < SA_DIM; row++) {
+			int32_t acc = 0;
+			for (i = 0; i < PK_N_DIGITS; i++) {
+				for (j = 0; j < PK_N_DIGITS; j++) {
+					const uint8_t p = products[i * PK_N_DIGITS + j].data[col][row];
+					/* Only the products of the signed top digit can be negative */
+					const int32_t v = i == PK_N_DIGITS - 1 ? (int8_t) p : p;
+					acc += v * (1 << (PK_DIGIT_BITS * (i + j)));
+				}
+			}
+			dst->data[col][row] = acc;
+		}
+	}
+}
+#endif
+
+const char *pk_backend(void)
+{
+	return _BACKEND;
+}
+
+void pk_matrix_col_major(matrix_t *dst, const int8_t *src, size_t ld, size_t rows, size_t cols)
+{
+	size_t ti, tj;
+	for (ti = 0; ti < PK_N_TILES(rows); ti++) {
+		for (tj = 0; tj < PK_N_TILES(cols); tj++) {
+			pk_tile_col_major(dst++,
+			                  &src[ti * SA_DIM * ld + tj * SA_DIM],
+			                  ld,
+			                  MIN(rows - ti * SA_DIM, (size_t) SA_DIM),
+			                  MIN(cols - tj * SA_DIM, (size_t) SA_DIM));
+		}
+	}
+}
+
+void pk_matrix_row_major(matrix_t *dst, const int8_t *src, size_t ld, size_t rows, size_t cols)
+{
+	size_t ti, tj;
+	for (ti = 0; ti < PK_N_TILES(rows); ti++) {
+		for (tj = 0; tj < PK_N_TILES(cols); tj++) {
+			pk_tile_row_major(dst++,
+			                  &src[ti * SA_DIM * ld + tj * SA_DIM],
+			                  ld,
+			                  MIN(rows - ti * SA_DIM, (size_t) SA_DIM),
+			                  MIN(cols - tj * SA_DIM, (size_t) SA_DIM));
+		}
+	}
+}
+
+void pk_matrix_row_major_digits(matrix_t *dst,
+                                const int8_t *src,
+                                size_t ld,
+                                size_t rows,
+                                size_t cols)
+{
+	size_t ti, tj;
+	for (ti = 0; ti < PK_N_TILES(rows); ti++) {
+		for (tj = 0; tj < PK_N_TILES(cols); tj++) {
+			matrix_t tile;
+			pk_tile_row_major(&tile,
+			                  &src[ti * SA_DIM * ld + tj * SA_DIM],
+			                  ld,
+			                  MIN(rows - ti * SA_DIM, (size_t) SA_DIM),
+			                  MIN(cols - tj * SA_DIM, (size_t) SA_DIM));
+			pk_digits_offset(dst, &tile);
+			dst += PK_N_DIGITS;
+		}
+	}
+}
+
+void pk_unmatrix_col_major(int8_t *dst, size_t ld, const matrix_t *src, size_t rows, size_t cols)
+{
+	size_t ti, tj;
+	for (ti = 0; ti < PK_N_TILES(rows); ti++) {
+		for (tj = 0; tj < PK_N_TILES(cols); tj++) {
+			pk_untile_col_major(&dst[ti * SA_DIM * ld + tj * SA_DIM],
+			                    ld,
+			                    src++,
+			                    MIN(rows - ti * SA_DIM, (size_t) SA_DIM),
+			                    MIN(cols - tj * SA_DIM, (size_t) SA_DIM));
+		}
+	}
+}
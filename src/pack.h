@@ -0,0 +1,131 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Conversion between dense row-major int8 matrices and the tile layouts of matrix_mult16: the left
+ * operand and the result are column-major tiles, the right operand is a row-major tile. Every
+ * kernel does the transpose, the zero padding of ragged edges and the placement into the tile in a
+ * single pass over the source.
+ *
+ * Tiles are moved as 16 vectors of 16 bytes. NEON is used when the compiler targets it
+ * (-mfpu=neon), SSE2 on x86 so the same code path is tested on the host, and plain loops otherwise
+ * or when built with -DPK_NO_SIMD. int32 tiles are transposed in 4 x 4 blocks of int32 vectors.
+ *
+ * The array returns only the low byte of each 16 element dot product. For an exact product the
+ * operands are split into PK_N_DIGITS digit tiles of PK_DIGIT_BITS bits each, small enough that
+ * every product of two digit tiles fits in that byte, and pk_digits_combine adds the products back
+ * up in int32. The left digits keep the sign in the top digit, the right operand is offset by
+ * PK_DIGIT_OFFSET so that all of its digits are unsigned.
+ *
+ * How to:
+ * 1. pk_tile_* for one tile at a time, e.g. straight into a staging slot
+ * 2. pk_matrix_* to pack a whole matrix into a contiguous run of tiles
+ * 3. pk_digits_* to split packed tiles for an exact product and reassemble the results
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "systolic.h"
+
+/* Tiles needed to cover x elements */
+#define PK_N_TILES(x) (((x) + SA_DIM - 1) / SA_DIM)
+
+/* A sum of SA_DIM digit products stays in [0, 144], or in [-96, 48] with the signed top digit */
+#define PK_DIGIT_BITS (2)
+#define PK_N_DIGITS   (8 / PK_DIGIT_BITS)
+/* Added to the right operand before it is split */
+#define PK_DIGIT_OFFSET (128)
+
+/**
+ * @brief Name of the kernels compiled in: "neon", "sse2" or "scalar".
+ */
+const char *pk_backend(void);
+
+/**
+ * @brief Pack a rows x cols (<= SA_DIM) block of a row-major matrix into a column-major tile.
+ *
+ * @param dst Tile to fill, unused elements are zeroed
+ * @param src Top left element of the block
+ * @param ld Row stride of src in elements
+ */
+void pk_tile_col_major(matrix_t *dst, const int8_t *src, size_t ld, size_t rows, size_t cols);
+/**
+ * @brief Pack a rows x cols (<= SA_DIM) block of a row-major matrix into a row-major tile.
+ */
+void pk_tile_row_major(matrix_t *dst, const int8_t *src, size_t ld, size_t rows, size_t cols);
+/**
+ * @brief Copy the top left rows x cols of a column-major tile into a row-major int8 block.
+ *
+ * @param dst Top left element of the block
+ * @param ld Row stride of dst in elements
+ */
+void pk_untile_col_major(int8_t *dst, size_t ld, const matrix_t *src, size_t rows, size_t cols);
+/**
+ * @brief Add the top left rows x cols of a column-major tile into a row-major int32 block.
+ */
+void pk_accumulate_col_major(int32_t *dst,
+                             size_t ld,
+                             const matrix_t *src,
+                             size_t rows,
+                             size_t cols);
+
+/**
+ * @brief Add the top left rows x cols of a column-major int32 tile into a row-major int32 block.
+ */
+void pk_accumulate32_col_major(int32_t *dst,
+                               size_t ld,
+                               const matrix32_t *src,
+                               size_t rows,
+                               size_t cols);
+
+/**
+ * @brief Pack a whole rows x cols row-major matrix into column-major tiles.
+ *
+ * @param dst PK_N_TILES(rows) * PK_N_TILES(cols) tiles. Tile (ti, tj) goes to
+ * dst[ti * PK_N_TILES(cols) + tj]
+ * @param ld Row stride of src in elements
+ */
+void pk_matrix_col_major(matrix_t *dst, const int8_t *src, size_t ld, size_t rows, size_t cols);
+/**
+ * @brief Same as pk_matrix_col_major, with row-major tiles.
+ */
+void pk_matrix_row_major(matrix_t *dst, const int8_t *src, size_t ld, size_t rows, size_t cols);
+/**
+ * @brief Inverse of pk_matrix_col_major.
+ */
+void pk_unmatrix_col_major(int8_t *dst, size_t ld, const matrix_t *src, size_t rows, size_t cols);
+/**
+ * @brief pk_matrix_row_major followed by pk_digits_offset on every tile.
+ *
+ * @param dst PK_N_DIGITS tiles per tile of pk_matrix_row_major, tile (ti, tj) starts at
+ * dst[(ti * PK_N_TILES(cols) + tj) * PK_N_DIGITS]
+ */
+void pk_matrix_row_major_digits(matrix_t *dst,
+                                const int8_t *src,
+                                size_t ld,
+                                size_t rows,
+                                size_t cols);
+
+/**
+ * @brief Split a packed left operand into digit tiles, least significant first, so that
+ * src = sum(dst[i] << (PK_DIGIT_BITS * i)). The top digit is signed, in [-2, 1], the others are in
+ * [0, 3]. Zero padding stays zero.
+ */
+void pk_digits_signed(matrix_t dst[PK_N_DIGITS], const matrix_t *src);
+/**
+ * @brief Split a packed right operand into digit tiles in [0, 3], least significant first, so that
+ * src + PK_DIGIT_OFFSET = sum(dst[i] << (PK_DIGIT_BITS * i)).
+ */
+void pk_digits_offset(matrix_t dst[PK_N_DIGITS], const matrix_t *src);
+/**
+ * @brief Reassemble the exact product of two split tiles from the products of their digits.
+ *
+ * @param dst Column-major, left x (right + PK_DIGIT_OFFSET)
+ * @param products PK_N_DIGITS * PK_N_DIGITS column-major results of the array:
+ * products[i * PK_N_DIGITS + j] is left digit i times right digit j
+ */
+void pk_digits_combine(matrix32_t *dst, const matrix_t *products);
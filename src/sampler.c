@@ -0,0 +1,332 @@
+#include "sampler.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Register sampling and the stats derived from it.
+ *
+ * Registers are read outside of the lock and with dev_peek_reg, so the host thread is held up by
+ * neither the bridge accesses of a sample nor a reader of the stats for longer than a copy.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "errstack.h"
+#include "util.h"
+
+struct sm_s
+{
+	dev_st *dev;
+	sm_config_t cfg;
+	pthread_t thread;
+	bool running;
+
+	/* Protects everything below */
+	pthread_mutex_t lock;
+	sm_sample_t *samples;
+	/* Samples ever taken, the next one goes to n_samples % cfg.capacity */
+	uint64_t n_samples;
+	uint64_t cycles;
+	uint64_t stream_bytes;
+};
+
+static const dev_reg_et _sampled[] = {
+    DEV_REG_SYS_STATE,
+    DEV_REG_SYS_CYCLE,
+    DEV_REG_SYS_STREAM,
+    DEV_REG_SYS_C0,
+    DEV_REG_SYS_C1,
+    DEV_REG_SYS_C2,
+    DEV_REG_SYS_C3,
+    DEV_REG_SYS_C4,
+    DEV_REG_SYS_C5,
+    DEV_REG_SYS_C6,
+    DEV_REG_SYS_C7,
+    DEV_REG_WR_STATUS,
+    DEV_REG_WR_FIFO_FILL,
+    DEV_REG_RD_STATUS,
+    DEV_REG_RD_FILL,
+    DEV_REG_INSTR_FILL,
+};
+
+static uint64_t _now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int sm_alloc(sm_st **dst, dev_st *dev, const sm_config_t *cfg)
+{
+	SM_CLEANUP sm_st *sm = NULL;
+	ES_NEW_ASRT_NM(dst && dev);
+	ES_NEW_ASRT_NM(sm = calloc(1, sizeof(*sm)));
+	pthread_mutex_init(&sm->lock, NULL);
+	sm->dev = dev;
+	sm->cfg = cfg ? *cfg : SM_CONFIG_DEFAULT;
+	ES_NEW_ASRT(sm->cfg.capacity && sm->cfg.clock_hz, "Capacity and clock must not be 0");
+	ES_NEW_ASRT(sm->samples = calloc(sm->cfg.capacity, sizeof(*sm->samples)),
+	            "Failed to allocate %u samples",
+	            sm->cfg.capacity);
+	*dst = MOVE_PZ(sm);
+	return 0;
+}
+
+void sm_cleanup(sm_st **sm)
+{
+	if (!*sm) {
+		return;
+	}
+	sm_stop(*sm);
+	pthread_mutex_destroy(&(*sm)->lock);
+	free((*sm)->samples);
+	free(*sm);
+	*sm = NULL;
+}
+
+static const sm_sample_t *_at(const sm_st *sm, uint64_t n)
+{
+	return &sm->samples[n % sm->cfg.capacity];
+}
+
+static void _take(sm_st *sm)
+{
+	sm_sample_t sample = {0};
+	size_t i;
+	sample.ts_ns = _now_ns();
+	for (i = 0; i < ARRAY_SIZE(_sampled); i++) {
+		sample.regs[_sampled[i]] = dev_peek_reg(sm->dev, _sampled[i]);
+	}
+	pthread_mutex_lock(&sm->lock);
+	if (sm->n_samples) {
+		const sm_sample_t *prev = _at(sm, sm->n_samples - 1);
+		/* The counters are 32 bit and wrap, fine as long as they wrap at most once per period */
+		sm->cycles += (uint32_t) (sample.regs[DEV_REG_SYS_CYCLE] - prev->regs[DEV_REG_SYS_CYCLE]);
+		sm->stream_bytes +=
+		    (uint32_t) (sample.regs[DEV_REG_SYS_STREAM] - prev->regs[DEV_REG_SYS_STREAM]);
+	}
+	sm->samples[sm->n_samples % sm->cfg.capacity] = sample;
+	sm->n_samples++;
+	pthread_mutex_unlock(&sm->lock);
+}
+
+int sm_sample(sm_st *sm)
+{
+	ES_NEW_ASRT(!__atomic_load_n(&sm->running, __ATOMIC_ACQUIRE), "The sampler thread runs");
+	_take(sm);
+	return 0;
+}
+
+static void *_run(void *arg)
+{
+	sm_st *sm = arg;
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (true) {
+		/* Absolute deadlines, so the time a sample takes does not stretch the period */
+		next.tv_nsec += sm->cfg.period_ns % 1000000000;
+		next.tv_sec += sm->cfg.period_ns / 1000000000 + next.tv_nsec / 1000000000;
+		next.tv_nsec %= 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+		}
+		if (!__atomic_load_n(&sm->running, __ATOMIC_ACQUIRE)) {
+			return NULL;
+		}
+		_take(sm);
+	}
+}
+
+int sm_start(sm_st *sm)
+{
+	int err;
+	ES_NEW_ASRT(!sm->running, "The sampler thread already runs");
+	/* The first sample is the baseline of the counters, it has to come before any new work */
+	_take(sm);
+	__atomic_store_n(&sm->running, true, __ATOMIC_RELEASE);
+	if ((err = pthread_create(&sm->thread, NULL, _run, sm)) != 0) {
+		__atomic_store_n(&sm->running, false, __ATOMIC_RELEASE);
+		ES_NEW_ASRT(false, "Failed to start the sampler thread: %s", strerror(err));
+	}
+	return 0;
+}
+
+int sm_stop(sm_st *sm)
+{
+	if (!sm->running) {
+		return 0;
+	}
+	__atomic_store_n(&sm->running, false, __ATOMIC_RELEASE);
+	pthread_join(sm->thread, NULL);
+	_take(sm);
+	return 0;
+}
+
+int sm_get_sample(sm_st *sm, uint32_t i, sm_sample_t *dst)
+{
+	uint64_t first;
+	pthread_mutex_lock(&sm->lock);
+	first = sm->n_samples > sm->cfg.capacity ? sm->n_samples - sm->cfg.capacity : 0;
+	if (first + i >= sm->n_samples) {
+		pthread_mutex_unlock(&sm->lock);
+		ES_NEW_ASRT(false, "No sample %u of %llu", i, (unsigned long long) sm->n_samples);
+	}
+	*dst = *_at(sm, first + i);
+	pthread_mutex_unlock(&sm->lock);
+	return 0;
+}
+
+/* Read descriptors are the low half of the msgdma fill levels */
+static uint32_t _read_fill(const sm_sample_t *s)
+{
+	return s->regs[DEV_REG_RD_FILL] & 0xFFFF;
+}
+
+static bool _is_idle(const sm_sample_t *s)
+{
+	return !s->regs[DEV_REG_INSTR_FILL] && !_read_fill(s) &&
+	       !s->regs[DEV_REG_WR_FIFO_FILL] && !s->regs[DEV_REG_WR_STATUS] &&
+	       !s->regs[DEV_REG_RD_STATUS];
+}
+
+static bool _is_full(const sm_sample_t *s)
+{
+	return s->regs[DEV_REG_INSTR_FILL] >= FIFO_INSTR_IN_FIFO_DEPTH ||
+	       _read_fill(s) >= MSGDMA_READ_CSR_DESCRIPTOR_FIFO_DEPTH ||
+	       s->regs[DEV_REG_WR_FIFO_FILL] >= DMA_WRITE_FIFO_IN_FIFO_DEPTH;
+}
+
+/* Sums over the window, the caller holds the lock */
+static void _window_stats(const sm_st *sm, sm_stats_t *dst)
+{
+	const uint64_t first = sm->n_samples - dst->n_window;
+	uint64_t cycles = 0, stream = 0, stalls = 0, n_full = 0, n_idle = 0;
+	double instr = 0, read = 0, write = 0, elapsed_cycles;
+	uint64_t i;
+	for (i = first; i < sm->n_samples; i++) {
+		const sm_sample_t *s = _at(sm, i);
+		instr += (double) s->regs[DEV_REG_INSTR_FILL] / FIFO_INSTR_IN_FIFO_DEPTH;
+		read += (double) _read_fill(s) / MSGDMA_READ_CSR_DESCRIPTOR_FIFO_DEPTH;
+		write += (double) s->regs[DEV_REG_WR_FIFO_FILL] / DMA_WRITE_FIFO_IN_FIFO_DEPTH;
+		n_full += _is_full(s);
+		n_idle += _is_idle(s);
+		if (i > first) {
+			const sm_sample_t *prev = _at(sm, i - 1);
+			const uint32_t delta    = s->regs[DEV_REG_SYS_CYCLE] - prev->regs[DEV_REG_SYS_CYCLE];
+			cycles += delta;
+			stream += (uint32_t) (s->regs[DEV_REG_SYS_STREAM] - prev->regs[DEV_REG_SYS_STREAM]);
+			stalls += prev->regs[DEV_REG_INSTR_FILL] && !delta;
+		}
+	}
+	dst->instr_occupancy    = instr / dst->n_window;
+	dst->read_occupancy     = read / dst->n_window;
+	dst->write_occupancy    = write / dst->n_window;
+	dst->backpressure_ratio = (double) n_full / dst->n_window;
+	dst->idle_ratio         = (double) n_idle / dst->n_window;
+	dst->sys_state          = _at(sm, sm->n_samples - 1)->regs[DEV_REG_SYS_STATE];
+	if (dst->n_window < 2) {
+		return;
+	}
+	dst->window_ns       = _at(sm, sm->n_samples - 1)->ts_ns - _at(sm, first)->ts_ns;
+	dst->dma_stall_ratio = (double) stalls / (dst->n_window - 1);
+	elapsed_cycles       = (double) dst->window_ns * sm->cfg.clock_hz / 1e9;
+	if (elapsed_cycles > 0) {
+		dst->array_utilization  = MIN(cycles / elapsed_cycles, 1.0);
+		dst->stream_bytes_per_s = stream * 1e9 / dst->window_ns;
+	}
+}
+
+void sm_get_stats(sm_st *sm, sm_stats_t *dst)
+{
+	memset(dst, 0, sizeof(*dst));
+	pthread_mutex_lock(&sm->lock);
+	dst->n_samples    = sm->n_samples;
+	dst->n_window     = MIN(sm->n_samples, (uint64_t) sm->cfg.capacity);
+	dst->cycles       = sm->cycles;
+	dst->stream_bytes = sm->stream_bytes;
+	if (dst->n_window) {
+		_window_stats(sm, dst);
+	}
+	pthread_mutex_unlock(&sm->lock);
+}
+
+static void _metric(FILE *f, const char *name, const char *type, const char *help)
+{
+	fprintf(f, "# HELP systolic_%s %s\n# TYPE systolic_%s %s\n", name, help, name, type);
+}
+
+int sm_write_prometheus(sm_st *sm, FILE *f)
+{
+	sm_sample_t last = {0};
+	sm_stats_t stats;
+	int i;
+	sm_get_stats(sm, &stats);
+	if (stats.n_window) {
+		ES_FWD_INT_NM(sm_get_sample(sm, stats.n_window - 1, &last));
+	}
+	_metric(f, "samples_total", "counter", "Register samples taken.");
+	fprintf(f, "systolic_samples_total %llu\n", (unsigned long long) stats.n_samples);
+	_metric(f, "array_cycles_total", "counter", "Cycles the array computed.");
+	fprintf(f, "systolic_array_cycles_total %llu\n", (unsigned long long) stats.cycles);
+	_metric(f, "stream_bytes_total", "counter", "Operand bytes streamed into the array.");
+	fprintf(f, "systolic_stream_bytes_total %llu\n", (unsigned long long) stats.stream_bytes);
+	_metric(f, "window_seconds", "gauge", "Time covered by the samples the ratios are taken over.");
+	fprintf(f, "systolic_window_seconds %.6f\n", stats.window_ns / 1e9);
+	_metric(f, "array_utilization", "gauge", "Fraction of elapsed cycles the array computed.");
+	fprintf(f, "systolic_array_utilization %.4f\n", stats.array_utilization);
+	_metric(f, "stream_bytes_per_second", "gauge", "Operand bytes streamed per second.");
+	fprintf(f, "systolic_stream_bytes_per_second %.0f\n", stats.stream_bytes_per_s);
+	_metric(f, "fifo_occupancy", "gauge", "Mean fill of a FIFO as a fraction of its depth.");
+	fprintf(f, "systolic_fifo_occupancy{fifo=\"instr\"} %.4f\n", stats.instr_occupancy);
+	fprintf(f, "systolic_fifo_occupancy{fifo=\"read\"} %.4f\n", stats.read_occupancy);
+	fprintf(f, "systolic_fifo_occupancy{fifo=\"write\"} %.4f\n", stats.write_occupancy);
+	_metric(f, "fifo_fill", "gauge", "Entries in a FIFO at the newest sample.");
+	fprintf(f, "systolic_fifo_fill{fifo=\"instr\"} %u\n", last.regs[DEV_REG_INSTR_FILL]);
+	fprintf(f, "systolic_fifo_fill{fifo=\"read\"} %u\n", _read_fill(&last));
+	fprintf(f, "systolic_fifo_fill{fifo=\"write\"} %u\n", last.regs[DEV_REG_WR_FIFO_FILL]);
+	_metric(f,
+	        "dma_stall_ratio",
+	        "gauge",
+	        "Fraction of sample periods the array had instructions but retired none.");
+	fprintf(f, "systolic_dma_stall_ratio %.4f\n", stats.dma_stall_ratio);
+	_metric(f, "backpressure_ratio", "gauge", "Fraction of samples with a full FIFO.");
+	fprintf(f, "systolic_backpressure_ratio %.4f\n", stats.backpressure_ratio);
+	_metric(f, "idle_ratio", "gauge", "Fraction of samples with nothing queued on the device.");
+	fprintf(f, "systolic_idle_ratio %.4f\n", stats.idle_ratio);
+	_metric(f, "sys_state", "gauge", "sys_state register at the newest sample.");
+	fprintf(f, "systolic_sys_state %u\n", stats.sys_state);
+	_metric(f, "core_counter", "gauge", "sys_c0 to sys_c7 registers at the newest sample.");
+	for (i = 0; i <= DEV_REG_SYS_C7 - DEV_REG_SYS_C0; i++) {
+		fprintf(f, "systolic_core_counter{index=\"%d\"} %u\n", i, last.regs[DEV_REG_SYS_C0 + i]);
+	}
+	ES_NEW_ASRT(!ferror(f), "Failed to write the metrics");
+	return 0;
+}
+
+static int _write_file(sm_st *sm, const char *path)
+{
+	CLEAN_FILE FILE *f = fopen(path, "w");
+	ES_NEW_ASRT(f, "Failed to open %s", path);
+	ES_FWD_INT_NM(sm_write_prometheus(sm, f));
+	ES_NEW_ASRT(fflush(f) == 0, "Failed to write %s", path);
+	return 0;
+}
+
+int sm_write_prometheus_file(sm_st *sm, const char *path)
+{
+	char tmp[PATH_MAX];
+	ES_NEW_ASRT(snprintf(tmp, sizeof(tmp), "%s.tmp", path) < (int) sizeof(tmp),
+	            "Path too long: %s",
+	            path);
+	if (_write_file(sm, tmp) < 0 || rename(tmp, path) != 0) {
+		remove(tmp);
+		ES_FWD_INT(-1, "Failed to write %s", path);
+	}
+	return 0;
+}
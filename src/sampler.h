@@ -0,0 +1,119 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Periodic snapshots of the systolic core and DMA registers, kept as a time series from which the
+ * sampler derives where the time goes:
+ *    - array utilization: cycles the array computed out of the cycles that elapsed
+ *    - FIFO occupancy: mean fill of the instruction, read descriptor and write descriptor FIFOs
+ *    - DMA stall: the array had instructions queued but retired none, so it waited for operands
+ *      or write descriptors
+ *    - backpressure: a FIFO was full, so the host could not submit
+ *    - idle: nothing was queued anywhere, so the device waited for the host
+ * The stats are read back with sm_get_stats or written in the Prometheus text format, e.g. for the
+ * node_exporter textfile collector.
+ *
+ * How to:
+ * 1. sm_alloc on an open device
+ * 2. sm_start to sample every cfg.period_ns from a thread, or sm_sample at points of interest
+ * 3. sm_get_stats / sm_write_prometheus_file, sm_stop when done
+ */
+
+#include <hps.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "device.h"
+
+typedef struct sm_config_s
+{
+	/* Samples kept, older ones are overwritten */
+	uint32_t capacity;
+	/* Time between two samples of sm_start */
+	uint64_t period_ns;
+	/* Clock of the systolic core, converts elapsed time into cycles */
+	uint64_t clock_hz;
+} sm_config_t;
+
+/* The core runs on the clock of the PIO next to it */
+#define SM_CONFIG_DEFAULT                                                                          \
+	((sm_config_t){.capacity = 1024, .period_ns = 1000000, .clock_hz = PIO_0_FREQ})
+
+typedef struct sm_sample_s
+{
+	/* CLOCK_MONOTONIC */
+	uint64_t ts_ns;
+	/* Indexed by dev_reg_et, registers that are not sampled stay 0 */
+	uint32_t regs[DEV_REG_MAX];
+} sm_sample_t;
+
+typedef struct sm_stats_s
+{
+	/* Samples taken since sm_alloc, and how many of them the window below covers */
+	uint64_t n_samples;
+	uint32_t n_window;
+	uint64_t window_ns;
+	/* Totals since sm_alloc */
+	uint64_t cycles;
+	uint64_t stream_bytes;
+	/* Over the window, all in [0, 1] */
+	double array_utilization;
+	double instr_occupancy;
+	double read_occupancy;
+	double write_occupancy;
+	double dma_stall_ratio;
+	double backpressure_ratio;
+	double idle_ratio;
+	double stream_bytes_per_s;
+	/* DEV_REG_SYS_STATE of the newest sample */
+	uint32_t sys_state;
+} sm_stats_t;
+
+struct sm_s;
+typedef struct sm_s sm_st;
+
+/**
+ * @brief Create a sampler. It does not sample until sm_start or sm_sample.
+ *
+ * @param dst Where to store the new sampler
+ * @param dev Device to sample, must outlive the sampler
+ * @param cfg Settings, NULL for SM_CONFIG_DEFAULT
+ * @return >= 0 on success, < 0 on failure
+ */
+int sm_alloc(sm_st **dst, dev_st *dev, const sm_config_t *cfg);
+/* Stops the thread if it runs. __attribute__((cleanup())) safe, including NULL */
+void sm_cleanup(sm_st **sm);
+
+#define SM_CLEANUP CLEANUP(sm_cleanup)
+
+/**
+ * @brief Take one sample now. Not while the thread of sm_start runs.
+ */
+int sm_sample(sm_st *sm);
+/**
+ * @brief Take one sample now, then every cfg.period_ns from a new thread until sm_stop.
+ */
+int sm_start(sm_st *sm);
+/**
+ * @brief Stop and join the thread of sm_start, takes one last sample. Nothing if it is not running.
+ */
+int sm_stop(sm_st *sm);
+
+/**
+ * @brief Copy the i-th oldest sample still kept. Safe while the thread runs.
+ *
+ * @return >= 0 on success, < 0 if there is no such sample
+ */
+int sm_get_sample(sm_st *sm, uint32_t i, sm_sample_t *dst);
+/* Safe while the thread runs */
+void sm_get_stats(sm_st *sm, sm_stats_t *dst);
+/**
+ * @brief Write the stats and the newest sample in the Prometheus text exposition format.
+ */
+int sm_write_prometheus(sm_st *sm, FILE *f);
+/* Writes to path.tmp and renames it, so a scraper never sees half a file */
+int sm_write_prometheus_file(sm_st *sm, const char *path);
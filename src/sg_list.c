@@ -0,0 +1,137 @@
+#include "sg_list.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Scatter-gather descriptor lists for user buffers.
+ */
+
+#include <hps.h>
+#include <stdlib.h>
+
+#include "data-structures/vec.h"
+#include "errstack.h"
+
+#define _DMA_ALIGN (32)
+
+struct sg_list_s
+{
+	uint32_t channel;
+	size_t n_bytes;
+	/* dev_read_desc_t */
+	vec_t *descs;
+};
+
+int sg_alloc(sg_list_st **dst, uint32_t channel)
+{
+	sg_list_st *tmp;
+	ES_NEW_ASRT_NM(dst);
+	ES_NEW_ASRT_NM(tmp = calloc(1, sizeof(*tmp)));
+	if (vec_alloc(&tmp->descs, sizeof(dev_read_desc_t)) < 0) {
+		free(tmp);
+		ES_FWD_INT_NM(-1);
+	}
+	tmp->channel = channel;
+	*dst         = tmp;
+	return 0;
+}
+
+void sg_cleanup(sg_list_st **sg)
+{
+	if (!*sg) {
+		return;
+	}
+	vec_cleanup(&(*sg)->descs);
+	free(*sg);
+	*sg = NULL;
+}
+
+/* Add one physically contiguous run, growing the last descriptor when it ends where this starts */
+static int _append_run(sg_list_st *sg, uint64_t phys, size_t n_bytes)
+{
+	ES_NEW_ASRT(phys + n_bytes <= ((uint64_t) 1 << 32),
+	            "Run at 0x%llx is out of reach of the DMA",
+	            (unsigned long long) phys);
+	while (n_bytes) {
+		dev_read_desc_t *last = vec_size(sg->descs) ? vec_back(sg->descs) : NULL;
+		uint32_t chunk;
+		if (last && last->phys_addr + last->n_bytes == phys &&
+		    last->n_bytes < MSGDMA_READ_CSR_MAX_BYTE) {
+			chunk = MIN(n_bytes, (size_t) (MSGDMA_READ_CSR_MAX_BYTE - last->n_bytes));
+			last->n_bytes += chunk;
+		} else {
+			dev_read_desc_t desc = {.phys_addr = phys, .channel = sg->channel};
+			chunk                = MIN(n_bytes, (size_t) MSGDMA_READ_CSR_MAX_BYTE);
+			desc.n_bytes         = chunk;
+			ES_FWD_INT_NM(vec_push_back(sg->descs, &desc));
+		}
+		phys += chunk;
+		n_bytes -= chunk;
+		sg->n_bytes += chunk;
+	}
+	return 0;
+}
+
+int sg_append_pages(sg_list_st *sg,
+                    const uint64_t *page_phys,
+                    size_t page_size,
+                    size_t first_offset,
+                    size_t size)
+{
+	size_t page = 0;
+	ES_NEW_ASRT_NM(sg && page_phys && page_size);
+	ES_NEW_ASRT(first_offset < page_size, "Offset %zu is past the first page", first_offset);
+	while (size) {
+		const size_t n_bytes = MIN(size, page_size - first_offset);
+		ES_FWD_INT_NM(_append_run(sg, page_phys[page] + first_offset, n_bytes));
+		size -= n_bytes;
+		first_offset = 0;
+		page++;
+	}
+	return 0;
+}
+
+int sg_append_buffer(sg_list_st *sg, const dp_st *pool, const void *virt, size_t size)
+{
+	da_span_t region;
+	size_t offset;
+	int i;
+	ES_NEW_ASRT_NM(sg && pool && virt && size);
+	ES_NEW_ASRT((uintptr_t) virt % _DMA_ALIGN == 0, "%p is not aligned to 32 bytes", virt);
+	ES_NEW_ASRT((i = dp_region_of_virt(pool, virt)) >= 0, "%p is not memory of the pool", virt);
+	region = dp_region_span(pool, i);
+	offset = (const uint8_t *) virt - (uint8_t *) region.virt;
+	/* Regions are physically contiguous, the buffer is one run as long as it stays inside */
+	ES_NEW_ASRT(size <= region.size - offset,
+	            "Buffer %p of %zu bytes runs past region %d",
+	            virt,
+	            size,
+	            i);
+	ES_FWD_INT_NM(_append_run(sg, region.phys + offset, size));
+	return 0;
+}
+
+void sg_clear(sg_list_st *sg)
+{
+	while (vec_size(sg->descs)) {
+		vec_pop_back(sg->descs);
+	}
+	sg->n_bytes = 0;
+}
+
+const dev_read_desc_t *sg_descs(sg_list_st *sg)
+{
+	return vec_size(sg->descs) ? vec_front(sg->descs) : NULL;
+}
+
+size_t sg_count(sg_list_st *sg)
+{
+	return vec_size(sg->descs);
+}
+
+size_t sg_bytes(const sg_list_st *sg)
+{
+	return sg->n_bytes;
+}
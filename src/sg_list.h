@@ -0,0 +1,71 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Scatter-gather lists of msgdma read descriptors. Buffers are split into physically contiguous
+ * runs, and every run becomes one or more descriptors of at most MSGDMA_READ_CSR_MAX_BYTE, so the
+ * device reads tensors where they already are instead of having them gathered into one staging
+ * buffer first.
+ *
+ * The FPGA-to-SDRAM port is not coherent, so whatever the DMA reads has to be cleaned out of the
+ * CPU caches first, down through the L2. User space cannot do that for arbitrary pages, only the
+ * udmabuf driver can for its own buffers. sg_append_buffer therefore only takes memory of a dma
+ * pool (dp_get), which is synced with dp_sync_for_device. sg_append_pages takes raw frames, for
+ * memory the caller knows to be safe.
+ *
+ * How to:
+ * 1. sg_alloc a list for one read channel
+ * 2. dp_sync_for_device and sg_append_buffer every buffer to read, in order
+ * 3. dev_send_reads(dev, sg_descs(sg), sg_count(sg)) until everything is sent
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device.h"
+#include "dma_pool.h"
+
+struct sg_list_s;
+typedef struct sg_list_s sg_list_st;
+
+int sg_alloc(sg_list_st **dst, uint32_t channel);
+void sg_cleanup(sg_list_st **sg);
+
+#define SG_CLEANUP CLEANUP(sg_cleanup)
+
+/**
+ * @brief Append descriptors for [virt, virt + size), which has to lie in one region of pool.
+ *
+ * @param sg Working list
+ * @param pool Pool the buffer was taken from
+ * @param virt Start of the buffer, aligned to 32 bytes
+ * @param size Number of bytes
+ * @return 0 on success, < 0 if the buffer is not memory of the pool
+ */
+int sg_append_buffer(sg_list_st *sg, const dp_st *pool, const void *virt, size_t size);
+
+/**
+ * @brief Append descriptors for size bytes starting first_offset bytes into a run of pages.
+ *
+ * @param sg Working list
+ * @param page_phys Physical address of every page touched, in virtual order
+ * @param page_size Size of the pages in page_phys
+ * @param first_offset Offset of the first byte into page_phys[0]
+ * @param size Number of bytes
+ * @return 0 on success, < 0 on failure
+ */
+int sg_append_pages(sg_list_st *sg,
+                    const uint64_t *page_phys,
+                    size_t page_size,
+                    size_t first_offset,
+                    size_t size);
+
+/* Forget every descriptor, keeping the storage */
+void sg_clear(sg_list_st *sg);
+
+const dev_read_desc_t *sg_descs(sg_list_st *sg);
+size_t sg_count(sg_list_st *sg);
+size_t sg_bytes(const sg_list_st *sg);
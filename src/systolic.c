@@ -0,0 +1,67 @@
+#include "systolic.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Host side interface to the systolic array core and its DMA engines.
+ */
+
+#include <sched.h>
+#include <stdio.h>
+
+#include "errstack.h"
+#include "trace.h"
+#include "util.h"
+
+#define _SEND_INSTR(dev, n_rows, n_cols)                                                           \
+	({                                                                                             \
+		uint64_t _send_val = SA_INSTR(n_rows, n_cols);                                             \
+		while (dev_try_send_instr(dev, _send_val) == 0) {                                          \
+			TR_INSTANT("fifo_stall", 1);                                                           \
+			sched_yield();                                                                         \
+		}                                                                                          \
+	})
+
+int matrix_mult16(dev_st *dev, uint32_t dst_phys, uint32_t left_phys, uint32_t right_phys)
+{
+	int ret;
+	TR_INSTANT("submit", 1);
+	dev_send_read(dev, left_phys, sizeof(matrix_t), DEV_CHANNEL_LEFT);
+	dev_send_read(dev, right_phys, sizeof(matrix_t), DEV_CHANNEL_RIGHT);
+	dev_send_write(dev, dst_phys);
+	_SEND_INSTR(dev, SA_DIM, SA_DIM);
+
+	TR_BEGIN("wait");
+	ret = dev_wait_idle(dev);
+	TR_END("wait");
+	ES_FWD_INT_NM(ret);
+	TR_INSTANT("complete", 1);
+	return 0;
+}
+
+void matrix_mult16_ref(matrix_t *dst, const matrix_t *left_src, const matrix_t *right_src)
+{
+	int i, j, k;
+	for (i = 0; i < SA_DIM; i++) {
+		for (j = 0; j < SA_DIM; j++) {
+			int32_t acc = 0;
+			for (k = 0; k < SA_DIM; k++) {
+				acc += (int8_t) left_src->data[k][i] * (int8_t) right_src->data[k][j];
+			}
+			dst->data[j][i] = (uint8_t) acc;
+		}
+	}
+}
+
+void print_mat(const matrix_t *src, bool col_major)
+{
+	for (int i = 0; i < SA_DIM; i++) {
+		for (int j = 0; j < SA_DIM; j++) {
+			int v = col_major ? src->data[j][i] : src->data[i][j];
+			printf("%02x ", v);
+		}
+		printf("\n");
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Host side interface to the systolic array core and its DMA engines.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "device.h"
+
+#define SA_DIM (16)
+
+/* Instruction word for the array */
+#define SA_INSTR(n_rows, n_cols) ((uint64_t) (((n_cols) & 0b111111) | (((n_rows) & 0b111111) << 6)))
+
+#pragma pack(push, 1)
+typedef struct matrix_intrinsic_s
+{
+	uint8_t data[SA_DIM][SA_DIM];
+} matrix_t;
+typedef struct matrix32_intrinsic_s
+{
+	int32_t data[SA_DIM][SA_DIM];
+} matrix32_t;
+#pragma pack(pop)
+
+/**
+ * @brief Perform a matrix multiplication with FPGA hardware
+ *
+ * @param dev device handle
+ * @param dst_phys column-major order, physical address
+ * @param left_phys column-major order, physical address
+ * @param right_phys row-major order, physical address
+ * @return >= 0 on success, < 0 if waiting for the result failed
+ */
+int matrix_mult16(dev_st *dev, uint32_t dst_phys, uint32_t left_phys, uint32_t right_phys);
+
+/**
+ * @brief Software model of matrix_mult16. Operands are virtual addresses with the same layouts as
+ * matrix_mult16, and the result is truncated to 8 bits per element exactly like the hardware.
+ *
+ * @param dst column-major order
+ * @param left_src column-major order
+ * @param right_src row-major order
+ */
+void matrix_mult16_ref(matrix_t *dst, const matrix_t *left_src, const matrix_t *right_src);
+
+void print_mat(const matrix_t *src, bool col_major);
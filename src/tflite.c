@@ -0,0 +1,720 @@
+#include "tflite.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * TFLite model importer.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "errstack.h"
+#include "flatbuffer.h"
+#include "util.h"
+
+#define _IDENTIFIER     "TFL3"
+#define _SCHEMA_VERSION (3)
+
+/* Field ids of the tables used, from tensorflow/lite/schema/schema.fbs */
+enum
+{
+	_MODEL_VERSION        = 0,
+	_MODEL_OPERATOR_CODES = 1,
+	_MODEL_SUBGRAPHS      = 2,
+	_MODEL_BUFFERS        = 4,
+
+	_OPCODE_DEPRECATED_BUILTIN = 0,
+	_OPCODE_BUILTIN            = 3,
+
+	_SUBGRAPH_TENSORS   = 0,
+	_SUBGRAPH_INPUTS    = 1,
+	_SUBGRAPH_OUTPUTS   = 2,
+	_SUBGRAPH_OPERATORS = 3,
+
+	_TENSOR_SHAPE        = 0,
+	_TENSOR_TYPE         = 1,
+	_TENSOR_BUFFER       = 2,
+	_TENSOR_NAME         = 3,
+	_TENSOR_QUANTIZATION = 4,
+
+	_QUANT_SCALE      = 2,
+	_QUANT_ZERO_POINT = 3,
+	_QUANT_DIMENSION  = 6,
+
+	_BUFFER_DATA   = 0,
+	_BUFFER_OFFSET = 1,
+
+	_OP_OPCODE_INDEX = 0,
+	_OP_INPUTS       = 1,
+	_OP_OUTPUTS      = 2,
+	_OP_OPTIONS_TYPE = 3,
+	_OP_OPTIONS      = 4,
+};
+
+/* BuiltinOperator */
+enum
+{
+	_ADD               = 0,
+	_AVERAGE_POOL_2D   = 1,
+	_CONCATENATION     = 2,
+	_CONV_2D           = 3,
+	_DEPTHWISE_CONV_2D = 4,
+	_DEQUANTIZE        = 6,
+	_FULLY_CONNECTED   = 9,
+	_LOGISTIC          = 14,
+	_MAX_POOL_2D       = 17,
+	_MUL               = 18,
+	_RELU              = 19,
+	_RELU6             = 21,
+	_RESHAPE           = 22,
+	_SOFTMAX           = 25,
+	_TANH              = 28,
+	_PAD               = 34,
+	_TRANSPOSE         = 39,
+	_MEAN              = 40,
+	_SUB               = 41,
+	_SQUEEZE           = 43,
+	_STRIDED_SLICE     = 45,
+	_QUANTIZE          = 114,
+	_HARD_SWISH        = 117,
+};
+
+/* BuiltinOptions */
+enum
+{
+	_OPTIONS_NONE            = 0,
+	_OPTIONS_CONV_2D         = 1,
+	_OPTIONS_DEPTHWISE       = 2,
+	_OPTIONS_POOL_2D         = 5,
+	_OPTIONS_FULLY_CONNECTED = 8,
+	_OPTIONS_SOFTMAX         = 9,
+	_OPTIONS_ADD             = 11,
+	_OPTIONS_RESHAPE         = 17,
+	_OPTIONS_SQUEEZE         = 30,
+};
+
+/* TensorType */
+enum
+{
+	_TYPE_FLOAT32 = 0,
+	_TYPE_INT32   = 2,
+	_TYPE_INT8    = 9,
+};
+
+/* ActivationFunctionType */
+enum
+{
+	_ACT_NONE  = 0,
+	_ACT_RELU  = 1,
+	_ACT_RELU6 = 3,
+};
+
+static const char *const _op_names[] = {
+    [_ADD]               = "ADD",
+    [_AVERAGE_POOL_2D]   = "AVERAGE_POOL_2D",
+    [_CONCATENATION]     = "CONCATENATION",
+    [_CONV_2D]           = "CONV_2D",
+    [_DEPTHWISE_CONV_2D] = "DEPTHWISE_CONV_2D",
+    [_DEQUANTIZE]        = "DEQUANTIZE",
+    [_FULLY_CONNECTED]   = "FULLY_CONNECTED",
+    [_LOGISTIC]          = "LOGISTIC",
+    [_MAX_POOL_2D]       = "MAX_POOL_2D",
+    [_MUL]               = "MUL",
+    [_RELU]              = "RELU",
+    [_RELU6]             = "RELU6",
+    [_RESHAPE]           = "RESHAPE",
+    [_SOFTMAX]           = "SOFTMAX",
+    [_TANH]              = "TANH",
+    [_PAD]               = "PAD",
+    [_TRANSPOSE]         = "TRANSPOSE",
+    [_MEAN]              = "MEAN",
+    [_SUB]               = "SUB",
+    [_SQUEEZE]           = "SQUEEZE",
+    [_STRIDED_SLICE]     = "STRIDED_SLICE",
+    [_QUANTIZE]          = "QUANTIZE",
+    [_HARD_SWISH]        = "HARD_SWISH",
+};
+
+/* Model tensor not added to the graph yet */
+#define _UNMAPPED SIZE_MAX
+
+typedef struct _ctx_s
+{
+	gr_st *graph;
+	fb_vector_t buffers;
+	fb_vector_t tensors;
+	int32_t *codes;
+	size_t n_codes;
+	/* Graph tensor of every model tensor */
+	size_t *map;
+} _ctx_t;
+
+/* A model tensor as read from the file */
+typedef struct _tensor_s
+{
+	const char *name;
+	int type;
+	size_t rank;
+	size_t shape[GR_MAX_RANK];
+	size_t elements;
+	/* Contents of constant tensors, NULL otherwise */
+	const uint8_t *data;
+	size_t data_size;
+	fb_vector_t scales;
+	fb_vector_t zero_points;
+	int32_t quantized_dimension;
+} _tensor_t;
+
+typedef struct _op_s
+{
+	int32_t code;
+	fb_vector_t inputs;
+	fb_vector_t outputs;
+	uint8_t options_type;
+	fb_table_t options;
+} _op_t;
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+static void _ctx_cleanup(_ctx_t *ctx)
+{
+	gr_cleanup(&ctx->graph);
+	free(ctx->codes);
+	free(ctx->map);
+}
+
+const char *tfl_op_name(int32_t code)
+{
+	if (code < 0 || code >= (int32_t) ARRAY_SIZE(_op_names) || !_op_names[code]) {
+		return "UNKNOWN";
+	}
+	return _op_names[code];
+}
+
+static size_t _type_size(int type)
+{
+	return type == _TYPE_INT8 ? 1 : 4;
+}
+
+static int _read_tensor(_tensor_t *dst, const _ctx_t *ctx, int32_t idx)
+{
+	fb_table_t table, quant, buffer;
+	fb_vector_t shape, data;
+	uint32_t buffer_idx;
+	size_t i, len;
+	memset(dst, 0, sizeof(*dst));
+	ES_NEW_ASRT(idx >= 0 && (uint32_t) idx < ctx->tensors.len, "No tensor %d", idx);
+	ES_FWD_INT_NM(fb_vector_table(&table, &ctx->tensors, idx));
+	ES_FWD_INT_NM(fb_string(&dst->name, &len, &table, _TENSOR_NAME));
+	ES_FWD_INT_NM(fb_vector(&shape, &table, _TENSOR_SHAPE, 4));
+	dst->type = fb_i8(&table, _TENSOR_TYPE, 0);
+	ES_NEW_ASRT(dst->type == _TYPE_INT8 || dst->type == _TYPE_INT32 || dst->type == _TYPE_FLOAT32,
+	            "%s has tensor type %d, only int8, int32 and float32 are supported",
+	            dst->name,
+	            dst->type);
+	ES_NEW_ASRT(shape.len <= GR_MAX_RANK, "%s has rank %u", dst->name, shape.len);
+	dst->rank     = shape.len;
+	dst->elements = 1;
+	for (i = 0; i < dst->rank; i++) {
+		const int32_t dim = fb_vector_i32(&shape, i);
+		ES_NEW_ASRT(dim > 0 && dst->elements <= SIZE_MAX / 4 / (size_t) dim,
+		            "%s has dimension %zu of %d",
+		            dst->name,
+		            i,
+		            dim);
+		dst->shape[i] = dim;
+		dst->elements *= dim;
+	}
+
+	buffer_idx = fb_u32(&table, _TENSOR_BUFFER, 0);
+	ES_NEW_ASRT(buffer_idx < ctx->buffers.len, "%s uses buffer %u", dst->name, buffer_idx);
+	ES_FWD_INT_NM(fb_vector_table(&buffer, &ctx->buffers, buffer_idx));
+	ES_NEW_ASRT(fb_u64(&buffer, _BUFFER_OFFSET, 0) <= 1,
+	            "%s is stored outside of the flatbuffer",
+	            dst->name);
+	ES_FWD_INT_NM(fb_vector(&data, &buffer, _BUFFER_DATA, 1));
+	if (data.len) {
+		dst->data      = fb_vector_data(&data);
+		dst->data_size = data.len;
+		ES_NEW_ASRT(dst->data_size == dst->elements * _type_size(dst->type),
+		            "%s has %zu bytes of data for %zu elements",
+		            dst->name,
+		            dst->data_size,
+		            dst->elements);
+	}
+
+	ES_FWD_INT_NM(fb_table(&quant, &table, _TENSOR_QUANTIZATION));
+	ES_FWD_INT_NM(fb_vector(&dst->scales, &quant, _QUANT_SCALE, 4));
+	ES_FWD_INT_NM(fb_vector(&dst->zero_points, &quant, _QUANT_ZERO_POINT, 8));
+	dst->quantized_dimension = fb_i32(&quant, _QUANT_DIMENSION, 0);
+	ES_NEW_ASRT(!dst->zero_points.len || dst->zero_points.len == dst->scales.len,
+	            "%s has %u scales and %u zero points",
+	            dst->name,
+	            dst->scales.len,
+	            dst->zero_points.len);
+	return 0;
+}
+
+/* Per-tensor quantization of an activation */
+static int _quant(nn_quant_t *dst, const _tensor_t *tensor)
+{
+	int64_t zero;
+	ES_NEW_ASRT(tensor->scales.len == 1, "%s is not quantized per-tensor", tensor->name);
+	zero       = tensor->zero_points.len ? fb_vector_i64(&tensor->zero_points, 0) : 0;
+	dst->scale = fb_vector_f32(&tensor->scales, 0);
+	ES_NEW_ASRT(dst->scale > 0 && zero >= INT8_MIN && zero <= INT8_MAX,
+	            "%s has scale %g and zero point %lld",
+	            tensor->name,
+	            dst->scale,
+	            (long long) zero);
+	dst->zero_point = (int32_t) zero;
+	return 0;
+}
+
+/* Graph tensor of a model tensor, added on first use */
+static int _map(size_t *dst, _ctx_t *ctx, int32_t idx)
+{
+	static const gr_type_et types[] = {
+	    [_TYPE_FLOAT32] = GR_TYPE_FLOAT32,
+	    [_TYPE_INT32]   = GR_TYPE_INT32,
+	    [_TYPE_INT8]    = GR_TYPE_INT8,
+	};
+	gr_tensor_t desc = {0};
+	_tensor_t tensor;
+	size_t i;
+	if (idx >= 0 && (uint32_t) idx < ctx->tensors.len && ctx->map[idx] != _UNMAPPED) {
+		*dst = ctx->map[idx];
+		return 0;
+	}
+	ES_FWD_INT_NM(_read_tensor(&tensor, ctx, idx));
+	desc.name = (char *) tensor.name;
+	desc.type = types[tensor.type];
+	desc.rank = tensor.rank;
+	for (i = 0; i < tensor.rank; i++) {
+		desc.shape[i] = tensor.shape[i];
+	}
+	desc.size = tensor.elements * _type_size(tensor.type);
+	desc.data = (void *) tensor.data;
+	if (tensor.type == _TYPE_INT8) {
+		ES_FWD_INT_NM(_quant(&desc.quant, &tensor));
+	}
+	ES_FWD_INT_NM(gr_add_tensor(ctx->graph, &desc, &ctx->map[idx]));
+	*dst = ctx->map[idx];
+	return 0;
+}
+
+/* Model tensor index of input i, -1 when the op leaves it out */
+static int32_t _input(const _op_t *op, size_t i)
+{
+	return i < op->inputs.len ? fb_vector_i32(&op->inputs, i) : -1;
+}
+
+static int _act(nn_act_et *dst, uint8_t act)
+{
+	ES_NEW_ASRT(act == _ACT_NONE || act == _ACT_RELU || act == _ACT_RELU6,
+	            "Fused activation %u is not supported",
+	            act);
+	*dst = act == _ACT_RELU ? NN_ACT_RELU : act == _ACT_RELU6 ? NN_ACT_RELU6 : NN_ACT_NONE;
+	return 0;
+}
+
+static nn_pad_et _padding(const fb_table_t *options)
+{
+	return fb_u8(options, 0, 0) == 1 ? NN_PAD_VALID : NN_PAD_SAME;
+}
+
+/* Filter scales and zero points, per-tensor or per-channel along dim */
+static int _filter_quant(nn_filter_quant_t *dst,
+                         float **scales,
+                         int32_t **zero_points,
+                         const _tensor_t *filter,
+                         size_t n,
+                         int32_t dim)
+{
+	size_t i;
+	ES_NEW_ASRT(filter->scales.len == 1 ||
+	                (filter->scales.len == n && filter->quantized_dimension == dim),
+	            "%s has %u scales along dimension %d for %zu channels",
+	            filter->name,
+	            filter->scales.len,
+	            filter->quantized_dimension,
+	            n);
+	ES_NEW_ASRT_NM(*scales = malloc(filter->scales.len * sizeof(**scales)));
+	for (i = 0; i < filter->scales.len; i++) {
+		(*scales)[i] = fb_vector_f32(&filter->scales, i);
+	}
+	if (filter->zero_points.len) {
+		ES_NEW_ASRT_NM(*zero_points = malloc(filter->scales.len * sizeof(**zero_points)));
+		for (i = 0; i < filter->scales.len; i++) {
+			const int64_t zero = fb_vector_i64(&filter->zero_points, i);
+			ES_NEW_ASRT(zero >= INT8_MIN && zero <= INT8_MAX,
+			            "%s zero point %lld",
+			            filter->name,
+			            (long long) zero);
+			(*zero_points)[i] = (int32_t) zero;
+		}
+	}
+	dst->scales      = *scales;
+	dst->zero_points = *zero_points;
+	dst->n           = filter->scales.len;
+	return 0;
+}
+
+/* Copy of an optional int32 bias of n entries, the buffer may not be aligned */
+static int _bias(int32_t **dst, const _ctx_t *ctx, int32_t idx, size_t n)
+{
+	_tensor_t bias;
+	if (idx < 0) {
+		return 0;
+	}
+	ES_FWD_INT_NM(_read_tensor(&bias, ctx, idx));
+	ES_NEW_ASRT(bias.type == _TYPE_INT32 && bias.data && bias.elements == n,
+	            "Bias %s is not %zu constant int32",
+	            bias.name,
+	            n);
+	ES_NEW_ASRT_NM(*dst = malloc(n * sizeof(**dst)));
+	memcpy(*dst, bias.data, n * sizeof(**dst));
+	return 0;
+}
+
+/* Filter and activations of a GEMM op, in and out int8 and filter int8 constant */
+static int _gemm_operands(_tensor_t *in,
+                          _tensor_t *filter,
+                          _tensor_t *out,
+                          nn_quant_t *in_q,
+                          nn_quant_t *out_q,
+                          const _ctx_t *ctx,
+                          const _op_t *op)
+{
+	ES_NEW_ASRT(op->outputs.len == 1, "%u outputs", op->outputs.len);
+	ES_FWD_INT_NM(_read_tensor(in, ctx, _input(op, 0)));
+	ES_FWD_INT_NM(_read_tensor(filter, ctx, _input(op, 1)));
+	ES_FWD_INT_NM(_read_tensor(out, ctx, fb_vector_i32(&op->outputs, 0)));
+	ES_NEW_ASRT(in->type == _TYPE_INT8 && out->type == _TYPE_INT8 && !in->data,
+	            "Only int8 activations run on the array");
+	ES_NEW_ASRT(filter->type == _TYPE_INT8 && filter->data,
+	            "Filter %s is not constant int8",
+	            filter->name);
+	ES_FWD_INT_NM(_quant(in_q, in));
+	ES_FWD_INT_NM(_quant(out_q, out));
+	return 0;
+}
+
+static int _import_fc(_ctx_t *ctx, const _op_t *op, gr_node_t *node)
+{
+	CLEANUP(_cleanup_free) float *scales       = NULL;
+	CLEANUP(_cleanup_free) int32_t *zero_points = NULL;
+	CLEANUP(_cleanup_free) int32_t *bias        = NULL;
+	_tensor_t in, filter, out;
+	nn_fc_params_t params = {0};
+	ES_FWD_INT_NM(_gemm_operands(&in, &filter, &out, &params.input, &params.output, ctx, op));
+	ES_NEW_ASRT(filter.rank == 2, "Weights %s have rank %zu", filter.name, filter.rank);
+	ES_NEW_ASRT(fb_u8(&op->options, 1, 0) == 0, "Only the default weights format is supported");
+	params.out_features = filter.shape[0];
+	params.in_features  = filter.shape[1];
+	params.weights      = (const int8_t *) filter.data;
+	ES_NEW_ASRT(in.elements % params.in_features == 0,
+	            "%zu inputs for %zu features",
+	            in.elements,
+	            params.in_features);
+	ES_FWD_INT_NM(
+	    _filter_quant(&params.weight_q, &scales, &zero_points, &filter, params.out_features, 0));
+	ES_FWD_INT_NM(_bias(&bias, ctx, _input(op, 2), params.out_features));
+	params.bias = bias;
+	ES_FWD_INT_NM(_act(&params.act, fb_u8(&op->options, 0, 0)));
+	node->batch = in.elements / params.in_features;
+	ES_FWD_INT_NM(nn_fc_prepare(&node->op, &params));
+	return 0;
+}
+
+static int _import_conv(_ctx_t *ctx, const _op_t *op, gr_node_t *node)
+{
+	CLEANUP(_cleanup_free) float *scales       = NULL;
+	CLEANUP(_cleanup_free) int32_t *zero_points = NULL;
+	CLEANUP(_cleanup_free) int32_t *bias        = NULL;
+	_tensor_t in, filter, out;
+	nn_conv2d_params_t params = {0};
+	ES_FWD_INT_NM(_gemm_operands(&in, &filter, &out, &params.input, &params.output, ctx, op));
+	ES_NEW_ASRT(in.rank == 4 && filter.rank == 4 && filter.shape[3] == in.shape[3],
+	            "Conv2D needs NHWC input and an OHWI filter");
+	params.in_h       = in.shape[1];
+	params.in_w       = in.shape[2];
+	params.in_c       = in.shape[3];
+	params.out_c      = filter.shape[0];
+	params.k_h        = filter.shape[1];
+	params.k_w        = filter.shape[2];
+	params.padding    = _padding(&op->options);
+	params.stride_w   = fb_i32(&op->options, 1, 0);
+	params.stride_h   = fb_i32(&op->options, 2, 0);
+	params.dilation_w = fb_i32(&op->options, 4, 1);
+	params.dilation_h = fb_i32(&op->options, 5, 1);
+	params.filter     = (const int8_t *) filter.data;
+	ES_FWD_INT_NM(
+	    _filter_quant(&params.filter_q, &scales, &zero_points, &filter, params.out_c, 0));
+	ES_FWD_INT_NM(_bias(&bias, ctx, _input(op, 2), params.out_c));
+	params.bias = bias;
+	ES_FWD_INT_NM(_act(&params.act, fb_u8(&op->options, 3, 0)));
+	node->batch = in.shape[0];
+	ES_FWD_INT_NM(nn_conv2d_prepare(&node->op, &params));
+	return 0;
+}
+
+static int _import_depthwise(_ctx_t *ctx, const _op_t *op, gr_node_t *node)
+{
+	CLEANUP(_cleanup_free) float *scales       = NULL;
+	CLEANUP(_cleanup_free) int32_t *zero_points = NULL;
+	CLEANUP(_cleanup_free) int32_t *bias        = NULL;
+	_tensor_t in, filter, out;
+	nn_depthwise_conv2d_params_t params = {0};
+	size_t out_c;
+	ES_FWD_INT_NM(_gemm_operands(&in, &filter, &out, &params.input, &params.output, ctx, op));
+	ES_NEW_ASRT(in.rank == 4 && filter.rank == 4 && filter.shape[0] == 1 &&
+	                filter.shape[3] % in.shape[3] == 0,
+	            "DepthwiseConv2D needs NHWC input and a 1HWO filter");
+	out_c                   = filter.shape[3];
+	params.in_h             = in.shape[1];
+	params.in_w             = in.shape[2];
+	params.in_c             = in.shape[3];
+	params.depth_multiplier = out_c / in.shape[3];
+	params.k_h              = filter.shape[1];
+	params.k_w              = filter.shape[2];
+	params.padding          = _padding(&op->options);
+	params.stride_w         = fb_i32(&op->options, 1, 0);
+	params.stride_h         = fb_i32(&op->options, 2, 0);
+	params.dilation_w       = fb_i32(&op->options, 5, 1);
+	params.dilation_h       = fb_i32(&op->options, 6, 1);
+	params.filter           = (const int8_t *) filter.data;
+	ES_FWD_INT_NM(_filter_quant(&params.filter_q, &scales, &zero_points, &filter, out_c, 3));
+	ES_FWD_INT_NM(_bias(&bias, ctx, _input(op, 2), out_c));
+	params.bias = bias;
+	ES_FWD_INT_NM(_act(&params.act, fb_u8(&op->options, 4, 0)));
+	node->batch = in.shape[0];
+	ES_FWD_INT_NM(nn_depthwise_conv2d_prepare(&node->op, &params));
+	return 0;
+}
+
+static int _import_pool(_ctx_t *ctx, const _op_t *op, gr_node_t *node)
+{
+	_tensor_t in;
+	ES_FWD_INT_NM(_read_tensor(&in, ctx, _input(op, 0)));
+	ES_NEW_ASRT(in.rank == 4 && in.type == _TYPE_INT8, "Pooling needs int8 NHWC input");
+	ES_FWD_INT_NM(_quant(&node->pool.quant, &in));
+	node->pool.batch    = in.shape[0];
+	node->pool.in_h     = in.shape[1];
+	node->pool.in_w     = in.shape[2];
+	node->pool.c        = in.shape[3];
+	node->pool.padding  = _padding(&op->options);
+	node->pool.stride_w = fb_i32(&op->options, 1, 0);
+	node->pool.stride_h = fb_i32(&op->options, 2, 0);
+	node->pool.k_w      = fb_i32(&op->options, 3, 0);
+	node->pool.k_h      = fb_i32(&op->options, 4, 0);
+	ES_NEW_ASRT(node->pool.stride_w && node->pool.stride_h && node->pool.k_w && node->pool.k_h,
+	            "Pooling with an empty window or stride");
+	ES_FWD_INT_NM(_act(&node->pool.act, fb_u8(&op->options, 5, 0)));
+	return 0;
+}
+
+/* Map a model operator to a node */
+static int _import_op(_ctx_t *ctx, const _op_t *op, gr_node_t *node)
+{
+	_tensor_t in;
+	size_t i;
+	node->op_name  = tfl_op_name(op->code);
+	node->n_inputs = 1;
+	switch (op->code) {
+	case _FULLY_CONNECTED:
+		node->kind = GR_KIND_GEMM;
+		ES_FWD_INT_NM(_import_fc(ctx, op, node));
+		break;
+	case _CONV_2D:
+		node->kind = GR_KIND_GEMM;
+		ES_FWD_INT_NM(_import_conv(ctx, op, node));
+		break;
+	case _DEPTHWISE_CONV_2D:
+		node->kind = GR_KIND_GEMM;
+		ES_FWD_INT_NM(_import_depthwise(ctx, op, node));
+		break;
+	case _MAX_POOL_2D:
+	case _AVERAGE_POOL_2D:
+		node->kind = op->code == _MAX_POOL_2D ? GR_KIND_MAX_POOL : GR_KIND_AVG_POOL;
+		ES_FWD_INT_NM(_import_pool(ctx, op, node));
+		break;
+	case _ADD:
+		node->kind     = GR_KIND_ADD;
+		node->n_inputs = 2;
+		ES_FWD_INT_NM(_act(&node->act, fb_u8(&op->options, 0, 0)));
+		break;
+	case _RELU:
+	case _RELU6:
+		node->kind = GR_KIND_REQUANTIZE;
+		node->act  = op->code == _RELU ? NN_ACT_RELU : NN_ACT_RELU6;
+		break;
+	case _QUANTIZE:
+		ES_FWD_INT_NM(_read_tensor(&in, ctx, _input(op, 0)));
+		node->kind = in.type == _TYPE_FLOAT32 ? GR_KIND_QUANTIZE : GR_KIND_REQUANTIZE;
+		node->act  = NN_ACT_NONE;
+		break;
+	case _DEQUANTIZE:
+		node->kind = GR_KIND_DEQUANTIZE;
+		break;
+	case _RESHAPE:
+	case _SQUEEZE:
+		/* The new shape is the output tensor's, a shape input is not needed */
+		node->kind = GR_KIND_RESHAPE;
+		break;
+	case _SOFTMAX:
+		node->kind = GR_KIND_SOFTMAX;
+		node->beta = fb_f32(&op->options, 0, 0.0f);
+		break;
+	default:
+		ES_NEW_ASRT(false, "Operator %s (%d) is not supported", tfl_op_name(op->code), op->code);
+	}
+	ES_NEW_ASRT(op->inputs.len >= node->n_inputs && op->outputs.len == 1,
+	            "%u inputs and %u outputs",
+	            op->inputs.len,
+	            op->outputs.len);
+	for (i = 0; i < node->n_inputs; i++) {
+		ES_FWD_INT_NM(_map(&node->inputs[i], ctx, _input(op, i)));
+	}
+	node->n_outputs = 1;
+	ES_FWD_INT_NM(_map(&node->outputs[0], ctx, fb_vector_i32(&op->outputs, 0)));
+	return 0;
+}
+
+/* Options of an op, checked to be of the table type the op expects */
+static int _read_op(_op_t *dst, const _ctx_t *ctx, const fb_table_t *table)
+{
+	static const uint8_t options_of[] = {
+	    [_ADD]               = _OPTIONS_ADD,
+	    [_AVERAGE_POOL_2D]   = _OPTIONS_POOL_2D,
+	    [_CONV_2D]           = _OPTIONS_CONV_2D,
+	    [_DEPTHWISE_CONV_2D] = _OPTIONS_DEPTHWISE,
+	    [_FULLY_CONNECTED]   = _OPTIONS_FULLY_CONNECTED,
+	    [_MAX_POOL_2D]       = _OPTIONS_POOL_2D,
+	    [_RESHAPE]           = _OPTIONS_RESHAPE,
+	    [_SOFTMAX]           = _OPTIONS_SOFTMAX,
+	    [_SQUEEZE]           = _OPTIONS_SQUEEZE,
+	};
+	const uint32_t opcode = fb_u32(table, _OP_OPCODE_INDEX, 0);
+	ES_NEW_ASRT(opcode < ctx->n_codes, "Operator code %u of %zu", opcode, ctx->n_codes);
+	dst->code = ctx->codes[opcode];
+	ES_FWD_INT_NM(fb_vector(&dst->inputs, table, _OP_INPUTS, 4));
+	ES_FWD_INT_NM(fb_vector(&dst->outputs, table, _OP_OUTPUTS, 4));
+	ES_FWD_INT_NM(fb_table(&dst->options, table, _OP_OPTIONS));
+	dst->options_type = fb_u8(table, _OP_OPTIONS_TYPE, _OPTIONS_NONE);
+	if (dst->options_type != _OPTIONS_NONE) {
+		ES_NEW_ASRT(dst->code >= 0 && dst->code < (int32_t) ARRAY_SIZE(options_of) &&
+		                dst->options_type == options_of[dst->code],
+		            "%s has options of type %u",
+		            tfl_op_name(dst->code),
+		            dst->options_type);
+	}
+	return 0;
+}
+
+static int _read_codes(_ctx_t *ctx, const fb_table_t *model)
+{
+	fb_vector_t codes;
+	fb_table_t code;
+	size_t i;
+	ES_FWD_INT_NM(fb_vector(&codes, model, _MODEL_OPERATOR_CODES, 4));
+	ES_NEW_ASRT_NM(ctx->codes = calloc(MAX(codes.len, 1u), sizeof(*ctx->codes)));
+	for (i = 0; i < codes.len; i++) {
+		ES_FWD_INT_NM(fb_vector_table(&code, &codes, i));
+		/* Codes past 127 only fit the newer field, older files only set the deprecated one */
+		ctx->codes[i] = MAX((int32_t) fb_i8(&code, _OPCODE_DEPRECATED_BUILTIN, 0),
+		                    fb_i32(&code, _OPCODE_BUILTIN, 0));
+	}
+	ctx->n_codes = codes.len;
+	return 0;
+}
+
+static int _read_io(_ctx_t *ctx, const fb_table_t *subgraph)
+{
+	size_t inputs[GR_MAX_IO], outputs[GR_MAX_IO], i;
+	fb_vector_t in, out;
+	ES_FWD_INT_NM(fb_vector(&in, subgraph, _SUBGRAPH_INPUTS, 4));
+	ES_FWD_INT_NM(fb_vector(&out, subgraph, _SUBGRAPH_OUTPUTS, 4));
+	ES_NEW_ASRT(in.len <= GR_MAX_IO && out.len <= GR_MAX_IO,
+	            "%u inputs and %u outputs",
+	            in.len,
+	            out.len);
+	for (i = 0; i < in.len; i++) {
+		ES_FWD_INT_NM(_map(&inputs[i], ctx, fb_vector_i32(&in, i)));
+	}
+	for (i = 0; i < out.len; i++) {
+		ES_FWD_INT_NM(_map(&outputs[i], ctx, fb_vector_i32(&out, i)));
+	}
+	ES_FWD_INT_NM(gr_set_io(ctx->graph, inputs, in.len, outputs, out.len));
+	return 0;
+}
+
+int tfl_import(gr_st **dst, const void *buf, size_t size)
+{
+	CLEANUP(_ctx_cleanup) _ctx_t ctx = {0};
+	const fb_t fb                    = {.buf = buf, .size = size};
+	fb_table_t model, subgraph, table;
+	fb_vector_t subgraphs, operators;
+	size_t i;
+	ES_NEW_ASRT_NM(dst && buf);
+	ES_FWD_INT(fb_root(&model, &fb, _IDENTIFIER), "Not a TFLite model");
+	ES_NEW_ASRT(fb_u32(&model, _MODEL_VERSION, 0) == _SCHEMA_VERSION,
+	            "Schema version %u",
+	            fb_u32(&model, _MODEL_VERSION, 0));
+	ES_FWD_INT_NM(_read_codes(&ctx, &model));
+	ES_FWD_INT_NM(fb_vector(&ctx.buffers, &model, _MODEL_BUFFERS, 4));
+	ES_FWD_INT_NM(fb_vector(&subgraphs, &model, _MODEL_SUBGRAPHS, 4));
+	ES_NEW_ASRT(subgraphs.len >= 1, "Model has no subgraph");
+	ES_FWD_INT_NM(fb_vector_table(&subgraph, &subgraphs, 0));
+	ES_FWD_INT_NM(fb_vector(&ctx.tensors, &subgraph, _SUBGRAPH_TENSORS, 4));
+	ES_FWD_INT_NM(fb_vector(&operators, &subgraph, _SUBGRAPH_OPERATORS, 4));
+	ES_NEW_ASRT_NM(ctx.map = malloc(MAX(ctx.tensors.len, 1u) * sizeof(*ctx.map)));
+	for (i = 0; i < ctx.tensors.len; i++) {
+		ctx.map[i] = _UNMAPPED;
+	}
+	ES_FWD_INT_NM(gr_alloc(&ctx.graph));
+
+	for (i = 0; i < operators.len; i++) {
+		gr_node_t node = {0};
+		_op_t op;
+		ES_FWD_INT_NM(fb_vector_table(&table, &operators, i));
+		ES_FWD_INT(_read_op(&op, &ctx, &table), "Operator %zu", i);
+		if (_import_op(&ctx, &op, &node) < 0) {
+			nn_op_cleanup(&node.op);
+			ES_FWD_INT(-1, "Operator %zu (%s)", i, tfl_op_name(op.code));
+		}
+		ES_FWD_INT(gr_add_node(ctx.graph, &node), "Operator %zu", i);
+	}
+	ES_FWD_INT_NM(_read_io(&ctx, &subgraph));
+	ES_FWD_INT_NM(gr_finalize(ctx.graph));
+	*dst = MOVE_PZ(ctx.graph);
+	return 0;
+}
+
+int tfl_load(gr_st **dst, const char *path)
+{
+	CLEAN_FD int fd = -1;
+	struct stat st;
+	void *map;
+	int ret;
+	ES_NEW_ASRT_NM(dst && path);
+	ES_NEW_INT_ERRNO(fd = open(path, O_RDONLY));
+	ES_NEW_INT_ERRNO(fstat(fd, &st));
+	ES_NEW_ASRT(st.st_size > 0, "%s is empty", path);
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	ES_NEW_ASRT_ERRNO(map != MAP_FAILED);
+	ret = tfl_import(dst, map, st.st_size);
+	munmap(map, st.st_size);
+	ES_FWD_INT(ret, "Failed to import %s", path);
+	return 0;
+}
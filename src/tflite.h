@@ -0,0 +1,43 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Imports fully int8 quantized TensorFlow Lite models (.tflite flatbuffers, schema version 3) into
+ * an execution graph. The file is parsed with flatbuffer.h against the parts of the TFLite schema
+ * listed below, so neither TensorFlow nor the flatbuffers library is needed.
+ *
+ * Operators of the first subgraph are mapped as follows:
+ *    - FULLY_CONNECTED, CONV_2D, DEPTHWISE_CONV_2D: prepared nn_ops, run on the systolic array
+ *    - ADD, AVERAGE_POOL_2D, MAX_POOL_2D, RELU, RELU6, RESHAPE, SQUEEZE, SOFTMAX, QUANTIZE,
+ *      DEQUANTIZE: nn_ref kernels on the CPU
+ * Any other operator, float GEMMs and fused activations other than RELU / RELU6 fail the import
+ * with the name of what is missing.
+ *
+ * Weights are copied into the graph's ops, so the file is not needed after the import.
+ *
+ * How to:
+ * 1. tfl_load a file (or tfl_import a buffer)
+ * 2. Use the graph as described in graph.h
+ */
+
+#include <stddef.h>
+
+#include "graph.h"
+
+/**
+ * @brief Build a finalized graph from a .tflite file in memory.
+ */
+int tfl_import(gr_st **dst, const void *buf, size_t size);
+
+/**
+ * @brief tfl_import of a file, mapped for the duration of the import.
+ */
+int tfl_load(gr_st **dst, const char *path);
+
+/**
+ * @return Name of a TFLite builtin operator code, "UNKNOWN" for codes this file does not know
+ */
+const char *tfl_op_name(int32_t code);
@@ -0,0 +1,187 @@
+#include "waiter.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Spin, back off, then block.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "errstack.h"
+#include "util.h"
+
+#define _SUB_MASK ((1u << WT_HIST_SUB_BITS) - 1)
+
+static size_t _bucket_of(uint64_t value)
+{
+	unsigned msb;
+	if (value <= _SUB_MASK) {
+		return value;
+	}
+	msb = 63 - __builtin_clzll(value);
+	return ((size_t) (msb - WT_HIST_SUB_BITS + 1) << WT_HIST_SUB_BITS) +
+	       ((value >> (msb - WT_HIST_SUB_BITS)) & _SUB_MASK);
+}
+
+static uint64_t _bucket_lower(size_t bucket)
+{
+	unsigned msb;
+	if (bucket <= _SUB_MASK) {
+		return bucket;
+	}
+	msb = (bucket >> WT_HIST_SUB_BITS) + WT_HIST_SUB_BITS - 1;
+	return ((uint64_t) 1 << msb) + ((uint64_t) (bucket & _SUB_MASK) << (msb - WT_HIST_SUB_BITS));
+}
+
+static uint64_t _bucket_width(size_t bucket)
+{
+	if (bucket <= _SUB_MASK) {
+		return 1;
+	}
+	return (uint64_t) 1 << ((bucket >> WT_HIST_SUB_BITS) - 1);
+}
+
+void wt_hist_add(wt_hist_t *hist, uint64_t value)
+{
+	hist->buckets[_bucket_of(value)]++;
+	hist->count++;
+	hist->max = MAX(hist->max, value);
+}
+
+uint64_t wt_hist_quantile(const wt_hist_t *hist, double q)
+{
+	uint64_t target, seen = 0;
+	size_t i;
+	if (!hist->count) {
+		return 0;
+	}
+	if (q >= 1) {
+		return hist->max;
+	}
+	target = MAX((uint64_t) (q * hist->count + 0.5), (uint64_t) 1);
+	for (i = 0; i < WT_HIST_BUCKETS; i++) {
+		const uint64_t in_bucket = hist->buckets[i];
+		if (seen + in_bucket >= target) {
+			/* Spread the bucket's samples evenly over its range */
+			const uint64_t offset = _bucket_width(i) * (target - seen) / in_bucket;
+			return MIN(_bucket_lower(i) + offset, hist->max);
+		}
+		seen += in_bucket;
+	}
+	return hist->max;
+}
+
+double wt_hist_cdf(const wt_hist_t *hist, uint64_t value)
+{
+	const size_t last = _bucket_of(value);
+	uint64_t below    = 0;
+	size_t i;
+	if (!hist->count) {
+		return 0;
+	}
+	for (i = 0; i <= last; i++) {
+		below += hist->buckets[i];
+	}
+	return (double) below / hist->count;
+}
+
+void wt_init(wt_st *wt, const wt_config_t *cfg)
+{
+	memset(wt, 0, sizeof(*wt));
+	wt->cfg     = cfg ? *cfg : WT_CONFIG_DEFAULT;
+	wt->spin_ns = MIN(wt->cfg.initial_spin_ns, wt->cfg.max_spin_ns);
+}
+
+static uint64_t _now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Spin through the chosen quantile of waits when that is short enough. Otherwise spin to the cap
+ * only if most waits end inside it, and not at all when they mostly run long.
+ */
+static void _recalibrate(wt_st *wt)
+{
+	const uint64_t target = wt_hist_quantile(&wt->waits, wt->cfg.spin_quantile);
+	if (target <= wt->cfg.max_spin_ns) {
+		wt->spin_ns = target;
+	} else if (wt_hist_cdf(&wt->waits, wt->cfg.max_spin_ns) >= 0.5) {
+		wt->spin_ns = wt->cfg.max_spin_ns;
+	} else {
+		wt->spin_ns = 0;
+	}
+}
+
+static int _finish(wt_st *wt, uint64_t start, wt_phase_et phase)
+{
+	wt_hist_add(&wt->waits, _now_ns() - start);
+	wt->n_phase[phase]++;
+	if (wt->cfg.recalibrate_every && wt->waits.count % wt->cfg.recalibrate_every == 0) {
+		_recalibrate(wt);
+	}
+	return phase;
+}
+
+int wt_wait(wt_st *wt, wt_cond_ft cond, wt_block_ft block, void *arg)
+{
+	const uint64_t start = _now_ns();
+	uint64_t sleep_ns    = wt->cfg.min_sleep_ns;
+	uint64_t elapsed;
+	do {
+		if (cond(arg)) {
+			return _finish(wt, start, WT_PHASE_SPIN);
+		}
+		elapsed = _now_ns() - start;
+	} while (elapsed < wt->spin_ns);
+
+	while (!block || elapsed < wt->cfg.block_after_ns) {
+		const struct timespec nap = {.tv_sec  = sleep_ns / 1000000000,
+		                             .tv_nsec = sleep_ns % 1000000000};
+		nanosleep(&nap, NULL);
+		if (cond(arg)) {
+			return _finish(wt, start, WT_PHASE_SLEEP);
+		}
+		sleep_ns = MIN(2 * sleep_ns, wt->cfg.max_sleep_ns);
+		elapsed  = _now_ns() - start;
+	}
+
+	while (!cond(arg)) {
+		ES_FWD_INT_NM(block(arg, MAX(wt->cfg.max_sleep_ns / 1000000, (uint64_t) 1)));
+	}
+	return _finish(wt, start, WT_PHASE_BLOCK);
+}
+
+void wt_get_stats(const wt_st *wt, wt_stats_t *dst)
+{
+	dst->count   = wt->waits.count;
+	dst->p50_ns  = wt_hist_quantile(&wt->waits, 0.5);
+	dst->p99_ns  = wt_hist_quantile(&wt->waits, 0.99);
+	dst->max_ns  = wt->waits.max;
+	dst->spin_ns = wt->spin_ns;
+	memcpy(dst->n_phase, wt->n_phase, sizeof(dst->n_phase));
+}
+
+void wt_print_stats(const wt_st *wt, const char *name, FILE *out)
+{
+	wt_stats_t stats;
+	wt_get_stats(wt, &stats);
+	fprintf(out,
+	        "%s: %llu waits, p50 %llu ns, p99 %llu ns, max %llu ns, spin window %llu ns, "
+	        "ended spinning/sleeping/blocked %llu/%llu/%llu\n",
+	        name,
+	        (unsigned long long) stats.count,
+	        (unsigned long long) stats.p50_ns,
+	        (unsigned long long) stats.p99_ns,
+	        (unsigned long long) stats.max_ns,
+	        (unsigned long long) stats.spin_ns,
+	        (unsigned long long) stats.n_phase[WT_PHASE_SPIN],
+	        (unsigned long long) stats.n_phase[WT_PHASE_SLEEP],
+	        (unsigned long long) stats.n_phase[WT_PHASE_BLOCK]);
+}
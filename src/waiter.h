@@ -0,0 +1,123 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Hybrid wait for device conditions. A wait spins on the condition for a short window, then sleeps
+ * with exponentially growing nanosleeps, and after a while hands over to a blocking wait if the
+ * caller has one (e.g. the completion fd a source installs with cs_attach). The spin window is
+ * learned from the wait times seen so far: it covers most jobs when they are short, and shrinks to
+ * nothing when they are long enough that spinning would only burn the core.
+ *
+ * Wait times are kept in a log2 histogram, so p50/p99 can be read back at any time.
+ *
+ * How to:
+ * 1. wt_init a waiter (it has no resources, so it can be embedded)
+ * 2. wt_wait with a condition callback
+ * 3. wt_get_stats / wt_print_stats to look at the distribution
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Sub-buckets per power of two, keeps quantiles within ~19% */
+#define WT_HIST_SUB_BITS (2)
+#define WT_HIST_BUCKETS  (64 << WT_HIST_SUB_BITS)
+
+typedef struct wt_hist_s
+{
+	uint64_t buckets[WT_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t max;
+} wt_hist_t;
+
+void wt_hist_add(wt_hist_t *hist, uint64_t value);
+/* Estimate of the value below which a fraction q of the samples fall, q in [0, 1] */
+uint64_t wt_hist_quantile(const wt_hist_t *hist, double q);
+/* Fraction of samples <= value */
+double wt_hist_cdf(const wt_hist_t *hist, uint64_t value);
+
+typedef struct wt_config_s
+{
+	/* Spin window used until the first calibration */
+	uint64_t initial_spin_ns;
+	/* Never spin longer than this */
+	uint64_t max_spin_ns;
+	/* The spin window covers this fraction of the observed waits when it can */
+	double spin_quantile;
+	/* First and largest nanosleep of the backoff */
+	uint64_t min_sleep_ns;
+	uint64_t max_sleep_ns;
+	/* Time into the wait after which the blocking callback takes over */
+	uint64_t block_after_ns;
+	/* Recompute the spin window every this many waits */
+	uint32_t recalibrate_every;
+} wt_config_t;
+
+/* Defaults sized for CSR reads over the lightweight bridge of a Cortex-A9 */
+#define WT_CONFIG_DEFAULT                                                                          \
+	((wt_config_t){.initial_spin_ns   = 20000,                                                   \
+	               .max_spin_ns       = 100000,                                                  \
+	               .spin_quantile     = 0.9,                                                     \
+	               .min_sleep_ns      = 10000,                                                   \
+	               .max_sleep_ns      = 1000000,                                                 \
+	               .block_after_ns    = 10000000,                                                \
+	               .recalibrate_every = 64})
+
+typedef enum wt_phase_e
+{
+	WT_PHASE_SPIN,
+	WT_PHASE_SLEEP,
+	WT_PHASE_BLOCK,
+	WT_PHASE_MAX,
+} wt_phase_et;
+
+typedef struct wt_s
+{
+	wt_config_t cfg;
+	uint64_t spin_ns;
+	/* Wall time of every wait, from the call to the condition holding */
+	wt_hist_t waits;
+	/* Waits that ended in each phase */
+	uint64_t n_phase[WT_PHASE_MAX];
+} wt_st;
+
+typedef struct wt_stats_s
+{
+	uint64_t count;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	uint64_t max_ns;
+	uint64_t spin_ns;
+	uint64_t n_phase[WT_PHASE_MAX];
+} wt_stats_t;
+
+/* True once the waited-for condition holds */
+typedef bool (*wt_cond_ft)(void *arg);
+/* Sleep until the condition may hold or ms elapse, < 0 on failure */
+typedef int (*wt_block_ft)(void *arg, int ms);
+
+/**
+ * @brief Reset a waiter.
+ *
+ * @param wt Waiter to initialise
+ * @param cfg Policy, NULL for WT_CONFIG_DEFAULT
+ */
+void wt_init(wt_st *wt, const wt_config_t *cfg);
+
+/**
+ * @brief Wait until cond(arg) is true.
+ *
+ * @param wt Working waiter
+ * @param cond Condition to check, called once per poll
+ * @param block Blocking fallback, NULL to keep sleeping at max_sleep_ns
+ * @param arg Passed to cond and block
+ * @return The phase the wait ended in, < 0 if block failed
+ */
+int wt_wait(wt_st *wt, wt_cond_ft cond, wt_block_ft block, void *arg);
+
+void wt_get_stats(const wt_st *wt, wt_stats_t *dst);
+void wt_print_stats(const wt_st *wt, const char *name, FILE *out);
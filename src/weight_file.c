@@ -0,0 +1,350 @@
+#include "weight_file.h"
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Pre-tiled weight files.
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "errstack.h"
+#include "pack.h"
+#include "util.h"
+
+#define _ALIGN_UP(x) (((x) + WF_ALIGN - 1) / WF_ALIGN * WF_ALIGN)
+
+struct wf_s
+{
+	int fd;
+	const uint8_t *map;
+	size_t map_size;
+	const wf_header_t *header;
+	const wf_tensor_t *tensors;
+};
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+static size_t _tiles_size(size_t k, size_t n)
+{
+	return PK_N_TILES(k) * PK_N_TILES(n) * PK_N_DIGITS * sizeof(matrix_t);
+}
+
+/* Place the blobs of one tensor after *end, returns its table entry */
+static int _layout(wf_tensor_t *dst, const wf_src_t *src, size_t *end)
+{
+	size_t i;
+	memset(dst, 0, sizeof(*dst));
+	ES_NEW_ASRT(src->name && strlen(src->name) < WF_NAME_MAX, "Bad tensor name");
+	ES_NEW_ASRT(src->weights && src->k && src->n, "Tensor %s is empty", src->name);
+	ES_NEW_ASRT(src->rank <= WF_MAX_RANK, "Tensor %s has rank %u", src->name, src->rank);
+	ES_NEW_ASRT(src->scales && (src->n_quant == 1 || src->n_quant == src->n),
+	            "Tensor %s: %zu scales for %zu channels",
+	            src->name,
+	            src->n_quant,
+	            src->n);
+	strcpy(dst->name, src->name);
+	dst->rank = src->rank;
+	for (i = 0; i < src->rank; i++) {
+		dst->shape[i] = src->shape[i];
+	}
+	dst->k       = src->k;
+	dst->n       = src->n;
+	dst->n_quant = src->n_quant;
+
+	dst->tiles_offset       = *end;
+	*end                    = _ALIGN_UP(*end + _tiles_size(src->k, src->n));
+	dst->bias_offset        = src->bias ? *end : WF_NONE;
+	*end                    = _ALIGN_UP(*end + (src->bias ? src->n * sizeof(int32_t) : 0));
+	dst->scales_offset      = *end;
+	*end                    = _ALIGN_UP(*end + src->n_quant * sizeof(float));
+	dst->zero_points_offset = src->zero_points ? *end : WF_NONE;
+	*end += src->zero_points ? src->n_quant * sizeof(int32_t) : 0;
+	*end             = _ALIGN_UP(*end);
+	dst->sums_offset = *end;
+	*end             = _ALIGN_UP(*end + src->n * sizeof(int32_t));
+	ES_NEW_ASRT(*end < WF_NONE, "Weights exceed 4 GiB");
+	return 0;
+}
+
+static void _fill(uint8_t *data, const wf_tensor_t *tensor, const wf_src_t *src)
+{
+	int32_t *sums = (int32_t *) &data[tensor->sums_offset];
+	size_t i, j;
+	pk_matrix_row_major_digits(
+	    (matrix_t *) &data[tensor->tiles_offset], src->weights, src->n, src->k, src->n);
+	if (src->bias) {
+		memcpy(&data[tensor->bias_offset], src->bias, src->n * sizeof(int32_t));
+	}
+	memcpy(&data[tensor->scales_offset], src->scales, src->n_quant * sizeof(float));
+	if (src->zero_points) {
+		memcpy(&data[tensor->zero_points_offset], src->zero_points, src->n_quant * sizeof(int32_t));
+	}
+	for (i = 0; i < src->k; i++) {
+		for (j = 0; j < src->n; j++) {
+			sums[j] += src->weights[i * src->n + j];
+		}
+	}
+}
+
+static int _write_all(int fd, const void *src, size_t size)
+{
+	const uint8_t *at = src;
+	while (size) {
+		ssize_t n = write(fd, at, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		ES_NEW_INT_ERRNO(n);
+		at += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int _write_file(const char *path,
+                       const wf_header_t *header,
+                       const wf_tensor_t *tensors,
+                       const uint8_t *data)
+{
+	const uint8_t pad[WF_ALIGN] = {0};
+	const size_t table_end      = sizeof(*header) + header->n_tensors * sizeof(*tensors);
+	CLEAN_FD int fd             = -1;
+	ES_NEW_INT_ERRNO(fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+	ES_FWD_INT_NM(_write_all(fd, header, sizeof(*header)));
+	ES_FWD_INT_NM(_write_all(fd, tensors, header->n_tensors * sizeof(*tensors)));
+	ES_FWD_INT_NM(_write_all(fd, pad, header->data_offset - table_end));
+	ES_FWD_INT_NM(_write_all(fd, data, header->data_size));
+	ES_NEW_INT_ERRNO(fsync(fd));
+	return 0;
+}
+
+int wf_write(const char *path, const wf_src_t *tensors, size_t n)
+{
+	CLEANUP(_cleanup_free) wf_tensor_t *table = NULL;
+	CLEANUP(_cleanup_free) uint8_t *data      = NULL;
+	char tmp_path[4096];
+	wf_header_t header = {
+	    .magic     = WF_MAGIC,
+	    .version   = WF_VERSION,
+	    .tile_dim  = SA_DIM,
+	    .n_tensors = n,
+	};
+	size_t end = 0, i;
+	ES_NEW_ASRT_NM(path && (tensors || n == 0));
+	ES_NEW_ASRT_NM(table = calloc(MAX(n, (size_t) 1), sizeof(*table)));
+	for (i = 0; i < n; i++) {
+		ES_FWD_INT(_layout(&table[i], &tensors[i], &end), "Tensor %zu", i);
+	}
+	header.data_offset = _ALIGN_UP(sizeof(header) + n * sizeof(*table));
+	header.data_size   = end;
+	ES_NEW_ASRT_NM(data = calloc(MAX(end, (size_t) 1), 1));
+	for (i = 0; i < n; i++) {
+		_fill(data, &table[i], &tensors[i]);
+	}
+	/* Replace the file atomically, a crash leaves either the old or the new weights */
+	ES_NEW_ASRT(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) < (int) sizeof(tmp_path),
+	            "Path too long");
+	ES_FWD_INT(_write_file(tmp_path, &header, table, data), "Failed to write %s", tmp_path);
+	ES_NEW_INT_ERRNO(rename(tmp_path, path));
+	return 0;
+}
+
+/* A blob of size bytes at offset, inside the data section */
+static bool _blob_ok(const wf_header_t *header, uint32_t offset, uint64_t size, bool optional)
+{
+	if (offset == WF_NONE) {
+		return optional;
+	}
+	return offset % WF_ALIGN == 0 && offset <= header->data_size &&
+	       size <= header->data_size - offset;
+}
+
+static int _validate(const wf_st *wf)
+{
+	const wf_header_t *header = wf->header;
+	size_t i;
+	ES_NEW_ASRT(header->magic == WF_MAGIC, "Not a weight file");
+	ES_NEW_ASRT(header->version == WF_VERSION, "Weight file version %u", header->version);
+	ES_NEW_ASRT(header->tile_dim == SA_DIM,
+	            "Tiles packed for a %ux%u array",
+	            header->tile_dim,
+	            header->tile_dim);
+	ES_NEW_ASRT(header->n_tensors <= (wf->map_size - sizeof(*header)) / sizeof(wf_tensor_t),
+	            "Tensor table is truncated");
+	ES_NEW_ASRT(header->data_offset % WF_ALIGN == 0 &&
+	                header->data_offset >=
+	                    sizeof(*header) + header->n_tensors * sizeof(wf_tensor_t) &&
+	                header->data_offset <= wf->map_size &&
+	                header->data_size <= wf->map_size - header->data_offset,
+	            "Data section is truncated or misaligned");
+	for (i = 0; i < header->n_tensors; i++) {
+		const wf_tensor_t *t = &wf->tensors[i];
+		ES_NEW_ASRT(memchr(t->name, 0, sizeof(t->name)), "Tensor %zu name", i);
+		ES_NEW_ASRT(t->k && t->n && t->rank <= WF_MAX_RANK &&
+		                (t->n_quant == 1 || t->n_quant == t->n),
+		            "Tensor %s has a bad shape",
+		            t->name);
+		ES_NEW_ASRT(_blob_ok(header, t->tiles_offset, _tiles_size(t->k, t->n), false) &&
+		                _blob_ok(header, t->bias_offset, (uint64_t) t->n * 4, true) &&
+		                _blob_ok(header, t->scales_offset, (uint64_t) t->n_quant * 4, false) &&
+		                _blob_ok(header, t->zero_points_offset, (uint64_t) t->n_quant * 4, true) &&
+		                _blob_ok(header, t->sums_offset, (uint64_t) t->n * 4, false),
+		            "Tensor %s points outside of the data section",
+		            t->name);
+	}
+	return 0;
+}
+
+int wf_open(wf_st **dst, const char *path)
+{
+	CLEANUP(wf_cleanup) wf_st *wf = NULL;
+	struct stat st;
+	void *map;
+	ES_NEW_ASRT_NM(dst && path);
+	ES_NEW_ASRT_NM(wf = calloc(1, sizeof(*wf)));
+	wf->fd = -1;
+	ES_NEW_INT_ERRNO(wf->fd = open(path, O_RDONLY));
+	ES_NEW_INT_ERRNO(fstat(wf->fd, &st));
+	ES_NEW_ASRT((size_t) st.st_size >= sizeof(wf_header_t), "%s is too small", path);
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, wf->fd, 0);
+	ES_NEW_ASRT_ERRNO(map != MAP_FAILED);
+	wf->map      = map;
+	wf->map_size = st.st_size;
+	wf->header   = map;
+	wf->tensors  = (const wf_tensor_t *) (wf->map + sizeof(wf_header_t));
+	ES_FWD_INT(_validate(wf), "Bad weight file %s", path);
+	*dst = MOVE_PZ(wf);
+	return 0;
+}
+
+void wf_cleanup(wf_st **wf)
+{
+	if (!*wf) {
+		return;
+	}
+	if ((*wf)->map) {
+		munmap((void *) (*wf)->map, (*wf)->map_size);
+	}
+	cleanup_fd(&(*wf)->fd);
+	free(*wf);
+	*wf = NULL;
+}
+
+size_t wf_count(const wf_st *wf)
+{
+	return wf->header->n_tensors;
+}
+
+const wf_tensor_t *wf_tensor(const wf_st *wf, size_t i)
+{
+	return i < wf_count(wf) ? &wf->tensors[i] : NULL;
+}
+
+int wf_find(const wf_st *wf, const char *name)
+{
+	size_t i;
+	for (i = 0; i < wf_count(wf); i++) {
+		if (strcmp(wf->tensors[i].name, name) == 0) {
+			return (int) i;
+		}
+	}
+	return -1;
+}
+
+const void *wf_data(const wf_st *wf)
+{
+	return wf->map + wf->header->data_offset;
+}
+
+uint32_t wf_data_size(const wf_st *wf)
+{
+	return wf->header->data_size;
+}
+
+static const void *_blob(const wf_st *wf, uint32_t offset)
+{
+	return offset == WF_NONE ? NULL : (const uint8_t *) wf_data(wf) + offset;
+}
+
+const matrix_t *wf_tiles(const wf_st *wf, const wf_tensor_t *tensor)
+{
+	return _blob(wf, tensor->tiles_offset);
+}
+
+const int32_t *wf_bias(const wf_st *wf, const wf_tensor_t *tensor)
+{
+	return _blob(wf, tensor->bias_offset);
+}
+
+const float *wf_scales(const wf_st *wf, const wf_tensor_t *tensor)
+{
+	return _blob(wf, tensor->scales_offset);
+}
+
+const int32_t *wf_zero_points(const wf_st *wf, const wf_tensor_t *tensor)
+{
+	return _blob(wf, tensor->zero_points_offset);
+}
+
+const int32_t *wf_sums(const wf_st *wf, const wf_tensor_t *tensor)
+{
+	return _blob(wf, tensor->sums_offset);
+}
+
+static int _check_dst(const wf_st *wf, const da_span_t *dst)
+{
+	ES_NEW_ASRT_NM(wf && dst);
+	ES_NEW_ASRT(dst->size >= wf_data_size(wf),
+	            "0x%x bytes do not hold 0x%x bytes of weights",
+	            dst->size,
+	            wf_data_size(wf));
+	ES_NEW_ASRT(dst->phys % WF_ALIGN == 0, "Weights at 0x%x are not aligned", dst->phys);
+	return 0;
+}
+
+int wf_load(const wf_st *wf, dev_st *dev, const da_span_t *dst)
+{
+	ES_FWD_INT_NM(_check_dst(wf, dst));
+	memcpy(dst->virt, wf_data(wf), wf_data_size(wf));
+	ES_FWD_INT_NM(dev_sync_for_device(dev, dst->offset, wf_data_size(wf)));
+	return 0;
+}
+
+int wf_load_read(const wf_st *wf, dev_st *dev, const da_span_t *dst)
+{
+	uint8_t *at = dst ? dst->virt : NULL;
+	size_t done = 0;
+	ES_FWD_INT_NM(_check_dst(wf, dst));
+	while (done < wf_data_size(wf)) {
+		ssize_t n =
+		    pread(wf->fd, &at[done], wf_data_size(wf) - done, wf->header->data_offset + done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		ES_NEW_INT_ERRNO(n);
+		ES_NEW_ASRT(n > 0, "Weight file shrank while loading");
+		done += n;
+	}
+	ES_FWD_INT_NM(dev_sync_for_device(dev, dst->offset, wf_data_size(wf)));
+	return 0;
+}
+
+uint32_t wf_tiles_phys(const wf_tensor_t *tensor, const da_span_t *dst)
+{
+	return dst->phys + tensor->tiles_offset;
+}
@@ -0,0 +1,154 @@
+#pragma once
+/**
+ * Copyright by Benjamin Joseph Correia.
+ * Date: 2022-08-11
+ * License: MIT
+ *
+ * Description:
+ * Weight container whose data section is a byte for byte image of the weights in device memory.
+ * Every tensor is stored as the right operand of a GEMM (k x n, n the output channels), already
+ * packed into row-major matrix_t tiles and split into digits by pk_matrix_row_major_digits, so
+ * gemm_s8_pretiled can read it without touching the host. Bias, scales, zero points and the weight
+ * sums that zero point folding needs sit next to the tiles.
+ *
+ * Layout, little endian:
+ *    wf_header_t
+ *    wf_tensor_t[n_tensors]
+ *    padding to WF_ALIGN
+ *    data section: every blob starts on WF_ALIGN relative to the start of the section
+ *
+ * Because the data section only has to be aligned to WF_ALIGN (== DA_ALIGN), loading a model is
+ * one memcpy from the mapping (wf_load) or one read from the file (wf_load_read) into a region of
+ * the arena, after which tiles are addressed as region phys + tiles_offset.
+ *
+ * How to:
+ * 1. wf_write once, offline or on first start
+ * 2. wf_open to map it and look tensors up with wf_find / wf_tensor
+ * 3. wf_load or wf_load_read into a da_span_t of wf_data_size bytes
+ * 4. wf_tiles_phys for gemm_s8_pretiled, or nn_fc_prepare_resident / nn_conv2d_prepare_resident
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device.h"
+#include "dma_arena.h"
+#include "systolic.h"
+
+#define WF_MAGIC   (0x46574153u) /* "SAWF" */
+#define WF_VERSION (3)          /* 3: weight sums per output channel */
+#define WF_ALIGN   (32)
+#define WF_NAME_MAX (32)
+#define WF_MAX_RANK (4)
+/* Offset of a blob that is not present */
+#define WF_NONE (0xFFFFFFFFu)
+
+#pragma pack(push, 1)
+typedef struct wf_header_s
+{
+	uint32_t magic;
+	uint32_t version;
+	/* SA_DIM the tiles were packed for */
+	uint32_t tile_dim;
+	uint32_t n_tensors;
+	/* File offset of the data section, WF_ALIGN aligned */
+	uint32_t data_offset;
+	uint32_t data_size;
+	uint32_t reserved[2];
+} wf_header_t;
+
+typedef struct wf_tensor_s
+{
+	/* NUL terminated */
+	char name[WF_NAME_MAX];
+	/* Shape in the source model, e.g. [out_c, k_h, k_w, in_c] for a TFLite Conv2D filter */
+	uint32_t rank;
+	uint32_t shape[WF_MAX_RANK];
+	/* GEMM operand: k x n */
+	uint32_t k;
+	uint32_t n;
+	/* Number of scales and zero points: 1 per-tensor, n per-channel */
+	uint32_t n_quant;
+	/* Offsets into the data section, WF_ALIGN aligned or WF_NONE */
+	/* PK_N_TILES(k) * PK_N_TILES(n) * PK_N_DIGITS matrix_t, the digits of tile (ki, ni) start at
+	 * (ki * PK_N_TILES(n) + ni) * PK_N_DIGITS */
+	uint32_t tiles_offset;
+	/* n int32 */
+	uint32_t bias_offset;
+	/* n_quant float */
+	uint32_t scales_offset;
+	/* n_quant int32 */
+	uint32_t zero_points_offset;
+	/* n int32, the sum of the k weights of each output channel */
+	uint32_t sums_offset;
+} wf_tensor_t;
+#pragma pack(pop)
+
+/* One tensor to write */
+typedef struct wf_src_s
+{
+	const char *name;
+	uint32_t rank;
+	uint32_t shape[WF_MAX_RANK];
+	/* k x n row-major */
+	const int8_t *weights;
+	size_t k;
+	size_t n;
+	/* n entries or NULL */
+	const int32_t *bias;
+	/* n_quant entries, zero_points may be NULL for symmetric weights */
+	const float *scales;
+	const int32_t *zero_points;
+	size_t n_quant;
+} wf_src_t;
+
+struct wf_s;
+typedef struct wf_s wf_st;
+
+/**
+ * @brief Pack tensors and write them to path, replacing the file.
+ */
+int wf_write(const char *path, const wf_src_t *tensors, size_t n);
+
+/**
+ * @brief Map a weight file and validate its header and tensor table.
+ */
+int wf_open(wf_st **dst, const char *path);
+void wf_cleanup(wf_st **wf);
+
+#define WF_CLEANUP CLEANUP(wf_cleanup)
+
+size_t wf_count(const wf_st *wf);
+const wf_tensor_t *wf_tensor(const wf_st *wf, size_t i);
+/**
+ * @return Index of the tensor called name, < 0 if there is none
+ */
+int wf_find(const wf_st *wf, const char *name);
+
+/* The data section as mapped, blobs can be used from here without loading */
+const void *wf_data(const wf_st *wf);
+uint32_t wf_data_size(const wf_st *wf);
+const matrix_t *wf_tiles(const wf_st *wf, const wf_tensor_t *tensor);
+/* NULL when absent */
+const int32_t *wf_bias(const wf_st *wf, const wf_tensor_t *tensor);
+const float *wf_scales(const wf_st *wf, const wf_tensor_t *tensor);
+const int32_t *wf_zero_points(const wf_st *wf, const wf_tensor_t *tensor);
+const int32_t *wf_sums(const wf_st *wf, const wf_tensor_t *tensor);
+
+/**
+ * @brief Copy the data section into dst with one memcpy and hand it to the device.
+ *
+ * @param dst At least wf_data_size bytes, WF_ALIGN aligned
+ */
+int wf_load(const wf_st *wf, dev_st *dev, const da_span_t *dst);
+/**
+ * @brief Same as wf_load but read() the data section straight into dst, without faulting in the
+ * mapping first.
+ */
+int wf_load_read(const wf_st *wf, dev_st *dev, const da_span_t *dst);
+
+/**
+ * @brief Physical address of a tensor's tiles once the data section is loaded at dst.
+ */
+uint32_t wf_tiles_phys(const wf_tensor_t *tensor, const da_span_t *dst);
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+
+#include "completion.h"
+#include "device.h"
+#include "epoll_hook.h"
+#include "errstack.h"
+#include "job_queue.h"
+#include "systolic.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define N_JOBS 8
+
+static void _count_done(void *arg, uint32_t n_completed)
+{
+	*(uint32_t *) arg += n_completed;
+}
+
+/* Queue N_JOBS products of the first left/right tiles into consecutive dst tiles */
+static int _submit_jobs(dev_st *dev, jq_st *jq, jq_handle_t *last)
+{
+	const uint32_t phys = dev->phys_addr;
+	size_t i;
+	for (i = 0; i < N_JOBS; i++) {
+		ES_NEW_ASRT(jq_submit(jq,
+		                      last,
+		                      phys + (2 + i) * sizeof(matrix_t),
+		                      phys,
+		                      phys + sizeof(matrix_t)) == 1,
+		            "FIFOs full after %zu jobs",
+		            i);
+	}
+	return 0;
+}
+
+int test_1_eventfd_stand_in(void)
+{
+	DEV_CLEANUP dev_st *dev                = NULL;
+	JQ_CLEANUP jq_st *jq                   = NULL;
+	CLEANUP(eh_ctx_cleanup) eh_ctx_st *ctx = NULL;
+	CS_CLEANUP cs_st *cs                   = NULL;
+	uint32_t n_done                        = 0;
+	jq_handle_t last;
+	ES_FWD_INT_NM(dev_emu_open(&dev, (2 + N_JOBS) * sizeof(matrix_t), 0));
+	ES_FWD_INT_NM(jq_alloc(&jq, dev));
+	ES_FWD_INT_NM(eh_ctx_alloc(&ctx, false, false));
+	ES_FWD_INT_NM(cs_eventfd_open(&cs, jq));
+	ES_FWD_INT_NM(cs_attach(cs, ctx, _count_done, &n_done));
+	ES_FWD_INT_NM(_submit_jobs(dev, jq, &last));
+	/* Nothing raised the fd yet, so the wait must time out without spinning on the device */
+	ES_NEW_ASRT(eh_ctx_wait(ctx, 4, 10) == 0, "Woke up without an event");
+	ES_NEW_ASRT(cs_wakeups(cs) == 0, "Spurious wakeup");
+	ES_FWD_INT_NM(cs_signal(cs));
+	ES_NEW_ASRT(cs_wait(cs, last, 1000) == 1, "Jobs did not complete");
+	ES_NEW_ASRT(n_done == N_JOBS, "Callback saw %u of %d jobs", n_done, N_JOBS);
+	ES_NEW_ASRT(cs_wakeups(cs) == 1,
+	            "Expected one wakeup, got %llu",
+	            (unsigned long long) cs_wakeups(cs));
+	return 1;
+}
+
+int test_2_timer_fallback(void)
+{
+	DEV_CLEANUP dev_st *dev                = NULL;
+	JQ_CLEANUP jq_st *jq                   = NULL;
+	CLEANUP(eh_ctx_cleanup) eh_ctx_st *ctx = NULL;
+	CS_CLEANUP cs_st *cs                   = NULL;
+	jq_handle_t last;
+	ES_FWD_INT_NM(dev_emu_open(&dev, (2 + N_JOBS) * sizeof(matrix_t), 200000));
+	ES_FWD_INT_NM(jq_alloc(&jq, dev));
+	ES_FWD_INT_NM(eh_ctx_alloc(&ctx, false, false));
+	ES_FWD_INT_NM(cs_timer_open(&cs, jq, 500));
+	ES_FWD_INT_NM(cs_attach(cs, ctx, NULL, NULL));
+	ES_FWD_INT_NM(_submit_jobs(dev, jq, &last));
+	ES_NEW_ASRT(cs_wait(cs, last, 5000) == 1, "Jobs did not complete");
+	ES_NEW_ASRT(jq_in_flight(jq) == 0, "Jobs still in flight");
+	/* Disarmed once idle: no more ticks */
+	ES_NEW_ASRT(eh_ctx_wait(ctx, 4, 5) == 0, "Timer still armed");
+	return 1;
+}
+
+int test_3_timeout(void)
+{
+	DEV_CLEANUP dev_st *dev                = NULL;
+	JQ_CLEANUP jq_st *jq                   = NULL;
+	CLEANUP(eh_ctx_cleanup) eh_ctx_st *ctx = NULL;
+	CS_CLEANUP cs_st *cs                   = NULL;
+	jq_handle_t last;
+	ES_FWD_INT_NM(dev_emu_open(&dev, (2 + N_JOBS) * sizeof(matrix_t), 0));
+	ES_FWD_INT_NM(jq_alloc(&jq, dev));
+	ES_FWD_INT_NM(eh_ctx_alloc(&ctx, false, false));
+	ES_FWD_INT_NM(cs_eventfd_open(&cs, jq));
+	ES_NEW_ASRT(cs_wait(cs, 0, 0) < 0, "Waited on a detached source");
+	ES_FWD_INT_NM(cs_attach(cs, ctx, NULL, NULL));
+	ES_FWD_INT_NM(_submit_jobs(dev, jq, &last));
+	/* A handle that was never submitted is refused rather than waited on forever */
+	ES_NEW_ASRT(cs_wait(cs, last + 1, -1) < 0, "Waited on an unsubmitted handle");
+	/* Nothing raises the eventfd, so the submitted jobs are never seen complete */
+	ES_NEW_ASRT(cs_wait(cs, last, 20) == 0, "Jobs completed without a wakeup");
+	return 1;
+}
+
+/* Once attached, the device's own waits block on the fd instead of sleeping */
+int test_4_waits_block(void)
+{
+	DEV_CLEANUP dev_st *dev                = NULL;
+	JQ_CLEANUP jq_st *jq                   = NULL;
+	CLEANUP(eh_ctx_cleanup) eh_ctx_st *ctx = NULL;
+	CS_CLEANUP cs_st *cs                   = NULL;
+	wt_config_t cfg                        = WT_CONFIG_DEFAULT;
+	jq_handle_t last;
+	uint64_t wakeups;
+	uint32_t phys;
+	cfg.initial_spin_ns = 0;
+	cfg.block_after_ns  = 0;
+	ES_FWD_INT_NM(dev_emu_open(&dev, (2 + N_JOBS) * sizeof(matrix_t), 200000));
+	phys = dev->phys_addr;
+	wt_init(&dev->waiter, &cfg);
+	ES_FWD_INT_NM(jq_alloc(&jq, dev));
+	ES_FWD_INT_NM(eh_ctx_alloc(&ctx, false, false));
+	ES_FWD_INT_NM(cs_timer_open(&cs, jq, 500));
+	ES_FWD_INT_NM(cs_attach(cs, ctx, NULL, NULL));
+	ES_FWD_INT_NM(_submit_jobs(dev, jq, &last));
+	ES_FWD_INT_NM(jq_wait(jq, last));
+	ES_NEW_ASRT(dev->waiter.n_phase[WT_PHASE_BLOCK] == 1, "jq_wait did not block");
+	ES_NEW_ASRT((wakeups = cs_wakeups(cs)) > 0, "jq_wait did not wait on the fd");
+	ES_NEW_ASRT_NM(
+	    jq_submit(jq, &last, phys + 2 * sizeof(matrix_t), phys, phys + sizeof(matrix_t)) == 1);
+	ES_FWD_INT_NM(dev_wait_idle(dev));
+	ES_NEW_ASRT(dev->waiter.n_phase[WT_PHASE_BLOCK] == 2, "dev_wait_idle did not block");
+	ES_NEW_ASRT(cs_wakeups(cs) > wakeups, "dev_wait_idle did not wait on the fd");
+	cs_detach(cs);
+	ES_NEW_ASRT(!dev->block, "Detached source still blocks the device");
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_eventfd_stand_in,
+    test_2_timer_fallback,
+    test_3_timeout,
+    test_4_waits_block,
+};
+
+TESTER_MAIN(tests);
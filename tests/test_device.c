@@ -0,0 +1,123 @@
+#include <hps.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "errstack.h"
+#include "systolic.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define MEM_SIZE (1 << 16)
+
+int test_1_emu_mult(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	matrix_t *virt, expected;
+	uint32_t phys;
+	size_t i;
+	ES_FWD_INT_NM(dev_emu_open(&dev, MEM_SIZE, 0));
+	virt = dev->virtual_base;
+	phys = dev->phys_addr;
+	srand(2);
+	for (i = 0; i < sizeof(matrix_t); i++) {
+		((uint8_t *) &virt[1])[i] = rand();
+		((uint8_t *) &virt[2])[i] = rand();
+	}
+	ES_FWD_INT_NM(matrix_mult16(dev, phys, phys + sizeof(matrix_t), phys + 2 * sizeof(matrix_t)));
+	matrix_mult16_ref(&expected, &virt[1], &virt[2]);
+	ES_NEW_ASRT(memcmp(&expected, &virt[0], sizeof(expected)) == 0, "Product mismatch");
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_SYS_STATE) == 0, "Unexpected error state");
+	ES_NEW_ASRT(dev->send_count == 1, "Expected one instruction, got %u", dev->send_count);
+	return 1;
+}
+
+int test_2_emu_fifo_levels(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	int i;
+	ES_FWD_INT_NM(dev_emu_open(&dev, MEM_SIZE, 0));
+	/* Writes without operands never retire, one is held by the DMA and the rest queue */
+	for (i = 0; i < DMA_WRITE_FIFO_IN_FIFO_DEPTH + 1; i++) {
+		dev_send_write(dev, dev->phys_addr);
+	}
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_WR_FIFO_FILL) == DMA_WRITE_FIFO_IN_FIFO_DEPTH,
+	            "Write FIFO should be full");
+	ES_NEW_ASRT(dev_is_busy(dev), "Expected busy with queued writes");
+	ES_NEW_ASRT(dev_writes_outstanding(dev) == DMA_WRITE_FIFO_IN_FIFO_DEPTH + 1,
+	            "Wrong outstanding count");
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_SYS_STATE) == 0, "No overflow yet");
+	dev_send_write(dev, dev->phys_addr);
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_SYS_STATE) & DEV_SYS_STATE_OVERFLOW,
+	            "Expected overflow to be flagged");
+	/* Instructions queue up until operands arrive */
+	for (i = 0; i < FIFO_INSTR_IN_FIFO_DEPTH; i++) {
+		ES_NEW_ASRT(dev_try_send_instr(dev, SA_INSTR(SA_DIM, SA_DIM)) == 1, "Send %d failed", i);
+	}
+	ES_NEW_ASRT(dev_try_send_instr(dev, SA_INSTR(SA_DIM, SA_DIM)) == 0, "FIFO should be full");
+	/* One pair of operands retires exactly one instruction */
+	dev_send_read(dev, dev->phys_addr, sizeof(matrix_t), DEV_CHANNEL_LEFT);
+	dev_send_read(dev, dev->phys_addr, sizeof(matrix_t), DEV_CHANNEL_RIGHT);
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_INSTR_FILL) == FIFO_INSTR_IN_FIFO_DEPTH - 1,
+	            "Expected one retired instruction");
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_RD_FILL) == 0, "Read descriptors should be consumed");
+	return 1;
+}
+
+int test_3_emu_latency(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	ES_FWD_INT_NM(dev_emu_open(&dev, MEM_SIZE, 50 * 1000 * 1000));
+	dev_send_read(dev, dev->phys_addr, sizeof(matrix_t), DEV_CHANNEL_LEFT);
+	dev_send_read(dev, dev->phys_addr, sizeof(matrix_t), DEV_CHANNEL_RIGHT);
+	dev_send_write(dev, dev->phys_addr + sizeof(matrix_t));
+	ES_NEW_ASRT(dev_try_send_instr(dev, SA_INSTR(SA_DIM, SA_DIM)) == 1, "Send failed");
+	ES_NEW_ASRT(dev_is_busy(dev), "Should still be computing");
+	while (dev_is_busy(dev)) {
+		sched_yield();
+	}
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_INSTR_FILL) == 0, "Instruction should be retired");
+	return 1;
+}
+
+int test_4_coalesce_reads(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	dev_read_desc_t descs[40];
+	uint64_t reads_before;
+	size_t i, n;
+	ES_FWD_INT_NM(dev_emu_open(&dev, MEM_SIZE, 0));
+	for (i = 0; i < ARRAY_SIZE(descs); i++) {
+		descs[i] = (dev_read_desc_t){
+		    .phys_addr = dev->phys_addr + i * sizeof(matrix_t),
+		    .n_bytes   = sizeof(matrix_t),
+		    .channel   = DEV_CHANNEL_LEFT,
+		};
+	}
+	reads_before = dev->stats.reg_reads;
+	n            = dev_send_reads(dev, descs, ARRAY_SIZE(descs));
+	ES_NEW_ASRT(n == ARRAY_SIZE(descs), "Expected all descriptors sent, got %zu", n);
+	ES_NEW_ASRT(dev->stats.reg_reads - reads_before == 1, "Fill level should be read once");
+	/* 32 tiles hit MSGDMA_READ_CSR_MAX_BYTE, the remaining 8 fit in a second descriptor */
+	ES_NEW_ASRT(dev->stats.reg_writes == 2 * 3, "Expected two descriptors");
+
+	/* A channel switch or a gap stops a merge */
+	descs[3].channel = DEV_CHANNEL_RIGHT;
+	descs[6].phys_addr += 32;
+	ES_NEW_ASRT(dev_count_reads(descs, 8) == 5, "Count disagrees with the merge");
+	n = dev_coalesce_reads(descs, 8);
+	ES_NEW_ASRT(n == 5, "Expected 5 merged descriptors, got %zu", n);
+	ES_NEW_ASRT(descs[0].n_bytes == 3 * sizeof(matrix_t), "Bad first merge");
+	ES_NEW_ASRT(descs[2].n_bytes == 2 * sizeof(matrix_t), "Bad third merge");
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_emu_mult,
+    test_2_emu_fifo_levels,
+    test_3_emu_latency,
+    test_4_coalesce_reads,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,88 @@
+#include <stdlib.h>
+
+#include "device.h"
+#include "dma_arena.h"
+#include "errstack.h"
+#include "systolic.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define MEM_SIZE (64 * 1024)
+
+int test_1_bump(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	DA_CLEANUP da_st *da    = NULL;
+	da_span_t whole, a, b;
+	ES_FWD_INT_NM(dev_emu_open(&dev, MEM_SIZE, 0));
+	whole = da_span_of_dev(dev);
+	ES_FWD_INT_NM(da_alloc(&da, &whole, DA_MODE_BUMP));
+	ES_FWD_INT_NM(da_get(da, &a, 5));
+	ES_FWD_INT_NM(da_get(da, &b, sizeof(matrix_t)));
+	ES_NEW_ASRT(a.size == DA_ALIGN, "Size not rounded up: %u", a.size);
+	ES_NEW_ASRT(b.phys % DA_ALIGN == 0 && b.phys == a.phys + DA_ALIGN, "Bad placement");
+	ES_NEW_ASRT(dev_virt_to_phys(dev, b.virt) == b.phys, "Virtual and physical disagree");
+	ES_NEW_ASRT(b.offset == b.phys - dev->phys_addr, "Bad sync offset");
+	ES_NEW_ASRT(da_used(da) == DA_ALIGN + sizeof(matrix_t), "Bad used count %u", da_used(da));
+	da_reset(da);
+	ES_FWD_INT_NM(da_get(da, &b, MEM_SIZE));
+	ES_NEW_ASRT(b.phys == a.phys, "Reset did not rewind");
+	ES_NEW_ASRT(da_get(da, &a, 1) < 0, "Allocation past the end succeeded");
+	return 1;
+}
+
+int test_2_free_list(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	DA_CLEANUP da_st *da    = NULL;
+	da_span_t whole, regions[8], big;
+	size_t i;
+	ES_FWD_INT_NM(dev_emu_open(&dev, ARRAY_SIZE(regions) * sizeof(matrix_t), 0));
+	whole = da_span_of_dev(dev);
+	ES_FWD_INT_NM(da_alloc(&da, &whole, DA_MODE_FREE_LIST));
+	for (i = 0; i < ARRAY_SIZE(regions); i++) {
+		ES_FWD_INT_NM(da_get(da, &regions[i], sizeof(matrix_t)));
+	}
+	ES_NEW_ASRT(da_largest_free(da) == 0, "Arena should be full");
+	/* Free every other tile, nothing bigger than one tile is available */
+	for (i = 0; i < ARRAY_SIZE(regions); i += 2) {
+		ES_FWD_INT_NM(da_put(da, &regions[i]));
+	}
+	ES_NEW_ASRT(da_largest_free(da) == sizeof(matrix_t), "Fragments merged too early");
+	ES_NEW_ASRT(da_get(da, &big, 2 * sizeof(matrix_t)) < 0, "Fragmented get succeeded");
+	ES_NEW_ASRT(da_put(da, &regions[0]) < 0, "Double put not detected");
+	/* Filling the gaps coalesces everything back into one range */
+	for (i = 1; i < ARRAY_SIZE(regions); i += 2) {
+		ES_FWD_INT_NM(da_put(da, &regions[i]));
+	}
+	ES_NEW_ASRT(da_used(da) == 0, "Bad used count %u", da_used(da));
+	ES_FWD_INT_NM(da_get(da, &big, ARRAY_SIZE(regions) * sizeof(matrix_t)));
+	ES_NEW_ASRT(big.phys == regions[0].phys, "Whole range not recovered");
+	return 1;
+}
+
+int test_3_unaligned_parent(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	DA_CLEANUP da_st *da    = NULL;
+	da_span_t whole, sub, a;
+	ES_FWD_INT_NM(dev_emu_open(&dev, MEM_SIZE, 0));
+	whole = da_span_of_dev(dev);
+	sub   = (da_span_t){.virt   = (uint8_t *) whole.virt + 7,
+	                    .phys   = whole.phys + 7,
+	                    .offset = 7,
+	                    .size   = 1024};
+	ES_FWD_INT_NM(da_alloc(&da, &sub, DA_MODE_FREE_LIST));
+	ES_FWD_INT_NM(da_get(da, &a, 64));
+	ES_NEW_ASRT(a.phys % DA_ALIGN == 0 && a.offset == DA_ALIGN, "Parent not aligned up");
+	ES_NEW_ASRT(da_largest_free(da) == 1024 - DA_ALIGN - 64, "Tail not trimmed");
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_bump,
+    test_2_free_list,
+    test_3_unaligned_parent,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+
+#include "device.h"
+#include "dma_pool.h"
+#include "errstack.h"
+#include "systolic.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define REGION_SIZE (8 * sizeof(matrix_t))
+
+/* Split one emulated device into two regions standing in for two udmabufs */
+static int _two_region_pool(dp_st *pool, dev_st *dev)
+{
+	da_span_t span_a = da_span_of_dev(dev);
+	da_span_t span_b;
+	span_a.size = REGION_SIZE;
+	span_b      = (da_span_t){.virt   = (uint8_t *) span_a.virt + REGION_SIZE,
+	                          .phys   = span_a.phys + REGION_SIZE,
+	                          .offset = REGION_SIZE,
+	                          .size   = REGION_SIZE};
+	ES_NEW_ASRT_NM(dp_add_dev_span(pool, dev, &span_a, DP_USE_ACTIVATIONS) == 0);
+	ES_NEW_ASRT_NM(dp_add_dev_span(pool, dev, &span_b, DP_USE_WEIGHTS) == 1);
+	return 0;
+}
+
+int test_1_placement(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	DP_CLEANUP dp_st *pool  = NULL;
+	dp_buf_t act, weights;
+	ES_FWD_INT_NM(dev_emu_open(&dev, 2 * REGION_SIZE, 0));
+	ES_FWD_INT_NM(dp_alloc(&pool));
+	ES_FWD_INT_NM(_two_region_pool(pool, dev));
+	ES_FWD_INT_NM(dp_get(pool, &act, sizeof(matrix_t), DP_USE_ACTIVATIONS));
+	ES_FWD_INT_NM(dp_get(pool, &weights, sizeof(matrix_t), DP_USE_WEIGHTS));
+	ES_NEW_ASRT(act.region == 0 && weights.region == 1, "Hints not honoured");
+	ES_NEW_ASRT(dp_region_of_phys(pool, weights.span.phys) == 1, "Bad phys lookup");
+	ES_NEW_ASRT(dp_phys_to_virt(pool, act.span.phys + 3) == (uint8_t *) act.span.virt + 3,
+	            "Bad translation");
+	ES_NEW_ASRT(dp_phys_to_virt(pool, 0) == NULL, "Address outside the pool translated");
+	ES_FWD_INT_NM(dp_sync_for_device(pool, &weights));
+	ES_FWD_INT_NM(dp_sync_for_cpu(pool, &act));
+	ES_FWD_INT_NM(dp_put(pool, &act));
+	ES_FWD_INT_NM(dp_put(pool, &weights));
+	ES_NEW_ASRT(dp_region_used(pool, 0) == 0 && dp_region_used(pool, 1) == 0, "Leaked bytes");
+	return 1;
+}
+
+int test_2_spill(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	DP_CLEANUP dp_st *pool  = NULL;
+	dp_buf_t bufs[12];
+	size_t i;
+	ES_FWD_INT_NM(dev_emu_open(&dev, 2 * REGION_SIZE, 0));
+	ES_FWD_INT_NM(dp_alloc(&pool));
+	ES_FWD_INT_NM(_two_region_pool(pool, dev));
+	/* More weights than the weight region holds: the rest lands in the activation region */
+	for (i = 0; i < ARRAY_SIZE(bufs); i++) {
+		ES_FWD_INT_NM(dp_get(pool, &bufs[i], sizeof(matrix_t), DP_USE_WEIGHTS));
+		ES_NEW_ASRT(
+		    bufs[i].region == (i < 8 ? 1 : 0), "Buffer %zu in region %d", i, bufs[i].region);
+	}
+	ES_NEW_ASRT(dp_get(pool, &bufs[0], 5 * sizeof(matrix_t), DP_USE_ANY) < 0, "Overcommitted");
+	return 1;
+}
+
+int test_3_empty_mask(void)
+{
+	DP_CLEANUP dp_st *pool = NULL;
+	dp_buf_t buf;
+	int ret;
+	ES_FWD_INT_NM(dp_alloc(&pool));
+	ES_FWD_INT_NM(ret = dp_add_udmabufs(pool, 0, DP_USE_ANY));
+	ES_NEW_ASRT(ret == 0 && dp_n_regions(pool) == 0, "Empty mask opened buffers");
+	ES_NEW_ASRT(dp_get(pool, &buf, 1, DP_USE_ANY) < 0, "Empty pool handed out memory");
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_placement,
+    test_2_spill,
+    test_3_empty_mask,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "data-structures/flat_hashtable.h"
+#include "data-structures/hashtable.h"
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+
+int test_1_basic(void)
+{
+	FHT_STR_CLEANUP fht_str_st *t = NULL;
+	char key[16];
+	long i;
+	ES_FWD_INT(fht_str_alloc(&t, 0, NULL, NULL), "Failed to alloc");
+	for (i = 1; i <= 9; i++) {
+		snprintf(key, sizeof(key), "key%ld", i);
+		ES_NEW_ASRT_NM(fht_str_set(t, key, (void *) (10 + i)) == 1);
+	}
+	/* The keys are copies, the buffer can be reused */
+	for (i = 1; i <= 9; i++) {
+		snprintf(key, sizeof(key), "key%ld", i);
+		ES_NEW_ASRT(fht_str_get(t, key) == (void *) (10 + i), "%s", key);
+	}
+	ES_NEW_ASRT_NM(fht_str_set(t, "key1", (void *) 21L) == 0);
+	ES_NEW_ASRT_NM(fht_str_get(t, "key1") == (void *) 21L);
+	ES_NEW_ASRT_NM(!fht_str_has(t, "key10") && fht_str_get(t, "key10") == NULL);
+	ES_NEW_ASRT_NM(fht_str_size(t) == 9);
+	return 1;
+}
+
+#define N 100000
+int test_2_large_insert(void)
+{
+	FHT_INT_CLEANUP fht_int_st *t = NULL;
+	long i;
+	ES_FWD_INT(fht_int_alloc(&t, 0, NULL, NULL), "Failed to alloc");
+
+	/* 0 is a key like any other */
+	for (i = 0; i < N; i++) {
+		ES_FWD_INT_NM(fht_int_set(t, i, (void *) (i * i)));
+	}
+	ES_NEW_ASRT_NM(fht_int_size(t) == N);
+	ES_NEW_ASRT(fht_int_density(t) <= 7.0 / 8, "Density %f", fht_int_density(t));
+
+	for (i = 0; i < N; i++) {
+		ES_NEW_ASRT_NM((long) fht_int_get(t, i) == i * i);
+		fht_int_delete(t, i);
+		ES_NEW_ASRT_NM(!fht_int_has(t, i));
+	}
+
+	ES_NEW_ASRT_NM(fht_int_size(t) == 0);
+	return 1;
+}
+
+/* Same operations on both tables, the flat one has to agree with the chained one */
+int test_3_against_ht(void)
+{
+	FHT_INT_CLEANUP fht_int_st *flat = NULL;
+	HT_CLEANUP ht_st *chained        = NULL;
+	size_t buckets;
+	int i;
+	ES_FWD_INT_NM(fht_int_alloc(&flat, 0, NULL, NULL));
+	ES_FWD_INT_NM(ht_int_alloc(&chained, 0, NULL, NULL));
+	srand(25);
+	for (i = 0; i < 200000; i++) {
+		/* Few keys and many deletes, so deleted slots pile up and get reclaimed */
+		const uint32_t key = 1 + rand() % 2000;
+		const long value   = rand();
+		switch (rand() % 3) {
+		case 0:
+			ES_NEW_ASRT(fht_int_set(flat, key, (void *) value) ==
+			                ht_int_set(chained, key, (void *) value),
+			            "Set %u",
+			            key);
+			break;
+		case 1:
+			ES_NEW_ASRT(fht_int_get(flat, key) == ht_int_get(chained, key), "Get %u", key);
+			break;
+		default:
+			ES_NEW_ASRT(fht_int_take(flat, key) == ht_take(chained, HT_INT_KEY(key)),
+			            "Take %u",
+			            key);
+			break;
+		}
+		ES_NEW_ASRT(fht_int_size(flat) == ht_size(chained), "Size after %d", i);
+	}
+	buckets = fht_int_buckets(flat);
+	ES_NEW_ASRT(buckets <= 4096, "Grew to %zu slots for %zu keys", buckets, fht_int_size(flat));
+	return 1;
+}
+
+static int _delete_odd(UNUSED const fht_int_st *t, uint32_t key, UNUSED void *value, void *data)
+{
+	if (key % 2) {
+		fht_int_delete(data, key);
+	}
+	return 1;
+}
+
+static int _copy_long(void **dst, void *value)
+{
+	ES_NEW_ASRT_NM(*dst = malloc(sizeof(long)));
+	**(long **) dst = value ? *(long *) value : -1;
+	return 0;
+}
+
+/* Values are copied and freed like in hashtable.h, deleting from foreach is safe */
+int test_4_values(void)
+{
+	FHT_INT_CLEANUP fht_int_st *t = NULL;
+	long value                    = 7;
+	void **slot;
+	uint32_t i;
+	ES_FWD_INT_NM(fht_int_alloc(&t, 0, _copy_long, free));
+	for (i = 0; i < 100; i++) {
+		ES_FWD_INT_NM(fht_int_set(t, i, &value));
+	}
+	value = 8;
+	ES_NEW_ASRT_NM(*(long *) fht_int_get(t, 3) == 7);
+	ES_NEW_ASRT_NM((slot = fht_int_emplace(t, 1000)) && **(long **) slot == -1);
+	ES_FWD_INT_NM(fht_int_foreach(t, _delete_odd, t));
+	ES_NEW_ASRT(fht_int_size(t) == 51, "%zu left", fht_int_size(t));
+	for (i = 0; i < 100; i++) {
+		ES_NEW_ASRT(fht_int_has(t, i) == !(i % 2), "Key %u", i);
+	}
+	free(fht_int_take(t, 2));
+	ES_NEW_ASRT_NM(!fht_int_has(t, 2) && fht_int_size(t) == 50);
+	fht_int_purge(t);
+	ES_NEW_ASRT_NM(fht_int_size(t) == 0 && !fht_int_has(t, 4));
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_basic,
+    test_2_large_insert,
+    test_3_against_ht,
+    test_4_values,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "errstack.h"
+#include "gemm.h"
+#include "pack.h"
+#include "test_utils.h"
+#include "util.h"
+
+static void _fill(int8_t *dst, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		dst[i] = (int8_t) rand();
+	}
+}
+
+int test_1_single_tile(void)
+{
+	matrix_t left = {}, right = {}, dst;
+	int i, j;
+	/* Same pattern as the on-board smoke test: ones times a banded matrix */
+	for (i = 0; i < SA_DIM; i++) {
+		right.data[i][i]                = i;
+		right.data[(i + 1) % SA_DIM][i] = 1;
+		right.data[(i + 2) % SA_DIM][i] = 2;
+		for (j = 0; j < SA_DIM; j++) {
+			left.data[i][j] = 1;
+		}
+	}
+	matrix_mult16_ref(&dst, &left, &right);
+	for (i = 0; i < SA_DIM; i++) {
+		for (j = 0; j < SA_DIM; j++) {
+			ES_NEW_ASRT(dst.data[j][i] == j + 3, "Wrong value at (%d, %d)", i, j);
+		}
+	}
+	return 1;
+}
+
+int test_2_pack(void)
+{
+	int8_t src[20 * 20];
+	int32_t acc[20 * 20] = {};
+	matrix_t tile;
+	size_t i, j;
+	for (i = 0; i < ARRAY_SIZE(src); i++) {
+		src[i] = (int8_t) i;
+	}
+	pk_tile_col_major(&tile, src, 20, 5, 7);
+	for (i = 0; i < SA_DIM; i++) {
+		for (j = 0; j < SA_DIM; j++) {
+			int8_t expected = (i < 5 && j < 7) ? src[i * 20 + j] : 0;
+			ES_NEW_ASRT((int8_t) tile.data[j][i] == expected, "Bad pack at (%zu, %zu)", i, j);
+		}
+	}
+	pk_accumulate_col_major(acc, 20, &tile, 5, 7);
+	for (i = 0; i < 20; i++) {
+		for (j = 0; j < 20; j++) {
+			int32_t expected = (i < 5 && j < 7) ? src[i * 20 + j] : 0;
+			ES_NEW_ASRT(acc[i * 20 + j] == expected, "Bad unpack at (%zu, %zu)", i, j);
+		}
+	}
+	pk_tile_row_major(&tile, src, 20, 16, 3);
+	for (i = 0; i < SA_DIM; i++) {
+		for (j = 0; j < SA_DIM; j++) {
+			int8_t expected = j < 3 ? src[i * 20 + j] : 0;
+			ES_NEW_ASRT((int8_t) tile.data[i][j] == expected, "Bad pack at (%zu, %zu)", i, j);
+		}
+	}
+	return 1;
+}
+
+int test_3_tiled_matches_ref(void)
+{
+	static const size_t shapes[][3] = {
+	    {1, 1, 1},
+	    {16, 16, 16},
+	    {17, 33, 15},
+	    {40, 70, 23},
+	    {64, 8, 48},
+	    {3, 700, 5},
+	};
+	size_t i, j;
+	srand(1);
+	for (i = 0; i < ARRAY_SIZE(shapes); i++) {
+		const size_t m = shapes[i][0], k = shapes[i][1], n = shapes[i][2];
+		int8_t a[m * k], b[k * n];
+		int32_t expected[m * n], actual[m * n];
+		_fill(a, m * k);
+		_fill(b, k * n);
+		gemm_s8_ref(expected, a, b, m, k, n);
+		ES_FWD_INT_NM(gemm_s8_tiled_ref(actual, a, b, m, k, n));
+		for (j = 0; j < m * n; j++) {
+			ES_NEW_ASRT(expected[j] == actual[j],
+			            "Shape %zux%zux%zu mismatch at %zu: %d != %d",
+			            m,
+			            k,
+			            n,
+			            j,
+			            expected[j],
+			            actual[j]);
+		}
+	}
+	return 1;
+}
+
+int test_4_emu_matches_ref(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	const size_t m = 37, k = 50, n = 29;
+	int8_t a[m * k], b[k * n];
+	int32_t expected[m * n], actual[m * n];
+	size_t i;
+	srand(3);
+	for (i = 0; i < m * k; i++) {
+		a[i] = (int8_t) rand();
+	}
+	for (i = 0; i < k * n; i++) {
+		b[i] = (int8_t) rand();
+	}
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 0));
+	/* Exact on an array with 8 bit results, despite full range operands */
+	ES_FWD_INT_NM(gemm_s8(dev, actual, a, b, m, k, n));
+	gemm_s8_ref(expected, a, b, m, k, n);
+	ES_NEW_ASRT(memcmp(expected, actual, sizeof(actual)) == 0, "Emulated GEMM mismatch");
+	return 1;
+}
+
+int test_5_pipeline_depths(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	const size_t m = 33, k = 40, n = 47;
+	const size_t depths[] = {1, 2, 3, GEMM_PIPELINE_MAX_DEPTH};
+	int8_t a[m * k], b[k * n];
+	int32_t expected[m * n], actual[m * n];
+	size_t i;
+	srand(5);
+	for (i = 0; i < m * k; i++) {
+		a[i] = (int8_t) rand();
+	}
+	for (i = 0; i < k * n; i++) {
+		b[i] = (int8_t) rand();
+	}
+	gemm_s8_ref(expected, a, b, m, k, n);
+	/* Latency makes several tiles genuinely in flight at once */
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 20000));
+	for (i = 0; i < ARRAY_SIZE(depths); i++) {
+		ES_FWD_INT_NM(gemm_s8_pipelined(dev, depths[i], actual, a, b, m, k, n));
+		ES_NEW_ASRT(memcmp(expected, actual, sizeof(actual)) == 0, "Depth %zu mismatch", depths[i]);
+	}
+	ES_NEW_ASRT(gemm_s8_pipelined(dev, 0, actual, a, b, m, k, n) < 0, "Depth 0 accepted");
+	return 1;
+}
+
+/* Batches of rows against few B tiles, with more and with fewer row tiles than slots */
+int test_6_cached_b_tiles(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	const size_t ms[] = {5, 100};
+	const size_t k = 40, n = 20;
+	int8_t a[100 * k], b[k * n];
+	int32_t expected[100 * n], actual[100 * n];
+	size_t i, depth;
+	srand(6);
+	for (i = 0; i < ARRAY_SIZE(a); i++) {
+		a[i] = (int8_t) rand();
+	}
+	for (i = 0; i < ARRAY_SIZE(b); i++) {
+		b[i] = (int8_t) rand();
+	}
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 20000));
+	for (i = 0; i < ARRAY_SIZE(ms); i++) {
+		gemm_s8_ref(expected, a, b, ms[i], k, n);
+		for (depth = 1; depth <= GEMM_PIPELINE_MAX_DEPTH; depth++) {
+			memset(actual, 0, sizeof(actual));
+			ES_FWD_INT_NM(gemm_s8_pipelined(dev, depth, actual, a, b, ms[i], k, n));
+			ES_NEW_ASRT(memcmp(expected, actual, ms[i] * n * sizeof(*actual)) == 0,
+			            "M %zu, depth %zu mismatch",
+			            ms[i],
+			            depth);
+		}
+	}
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_single_tile,
+    test_2_pack,
+    test_3_tiled_matches_ref,
+    test_4_emu_matches_ref,
+    test_5_pipeline_depths,
+    test_6_cached_b_tiles,
+};
+
+TESTER_MAIN(tests);
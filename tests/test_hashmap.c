@@ -1,3 +1,5 @@
+#include <stdio.h>
+
 #include "data-structures/hashtable.h"
 #include "errstack.h"
 #include "test_utils.h"
@@ -52,9 +54,49 @@ int test_2_large_insert(void)
 	return 1;
 }
 
+/* Setting a key again replaces its value, it is not a second node */
+int test_3_replace(void)
+{
+	HT_CLEANUP ht_st *t;
+	ES_FWD_INT(ht_str_alloc(&t, 0, NULL, NULL), "Failed to alloc");
+	ES_FWD_INT_NM(ht_str_set(t, "key1", 11L));
+	ES_FWD_INT_NM(ht_str_set(t, "key1", 21L));
+	ES_NEW_ASRT(ht_size(t) == 1, "Size %zu", ht_size(t));
+	ES_NEW_ASRT_NM((long) ht_str_get(t, "key1") == 21);
+	ht_delete(t, "key1");
+	ES_NEW_ASRT_NM(ht_size(t) == 0);
+	return 1;
+}
+
+/* More keys than buckets, so taking a key has to unlink it from a chain and keep the rest */
+int test_4_take(void)
+{
+	HT_CLEANUP ht_st *t;
+	char key[16];
+	long i;
+	ES_FWD_INT(ht_str_alloc(&t, 0, NULL, NULL), "Failed to alloc");
+	for (i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "key%ld", i);
+		ES_FWD_INT_NM(ht_str_set(t, key, i));
+	}
+	for (i = 0; i < 1000; i += 2) {
+		snprintf(key, sizeof(key), "key%ld", i);
+		ES_NEW_ASRT((long) ht_take(t, key) == i, "Take %s", key);
+		ES_NEW_ASRT(!ht_has(t, key), "Still has %s", key);
+	}
+	ES_NEW_ASRT(ht_size(t) == 500, "Size %zu", ht_size(t));
+	for (i = 1; i < 1000; i += 2) {
+		snprintf(key, sizeof(key), "key%ld", i);
+		ES_NEW_ASRT((long) ht_str_get(t, key) == i, "Lost %s", key);
+	}
+	return 1;
+}
+
 static test_function tests[] = {
     test_1_basic,
     test_2_large_insert,
+    test_3_replace,
+    test_4_take,
 };
 
 TESTER_MAIN(tests);
\ No newline at end of file
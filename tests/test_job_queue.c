@@ -0,0 +1,149 @@
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "errstack.h"
+#include "job_queue.h"
+#include "systolic.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define N_JOBS 100
+
+int test_1_many_in_flight(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	JQ_CLEANUP jq_st *jq    = NULL;
+	matrix_t *virt;
+	uint32_t phys;
+	uint64_t max_in_flight = 0;
+	size_t i;
+	ES_FWD_INT_NM(dev_emu_open(&dev, 3 * N_JOBS * sizeof(matrix_t), 1000));
+	ES_FWD_INT_NM(jq_alloc(&jq, dev));
+	virt = dev->virtual_base;
+	phys = dev->phys_addr;
+	srand(4);
+	for (i = 0; i < 2 * N_JOBS * sizeof(matrix_t); i++) {
+		((uint8_t *) &virt[N_JOBS])[i] = rand();
+	}
+	for (i = 0; i < N_JOBS; i++) {
+		int ret;
+		while ((ret = jq_submit(jq,
+		                        NULL,
+		                        phys + i * sizeof(matrix_t),
+		                        phys + (N_JOBS + 2 * i) * sizeof(matrix_t),
+		                        phys + (N_JOBS + 2 * i + 1) * sizeof(matrix_t))) == 0) {
+			jq_poll(jq);
+		}
+		ES_FWD_INT_NM(ret);
+		max_in_flight = MAX(max_in_flight, jq_in_flight(jq));
+	}
+	ES_FWD_INT_NM(jq_wait_all(jq));
+	ES_NEW_ASRT(jq_in_flight(jq) == 0, "Jobs still in flight");
+	ES_NEW_ASRT(max_in_flight > 1, "Jobs never overlapped");
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_SYS_STATE) == 0, "FIFO overflow");
+	for (i = 0; i < N_JOBS; i++) {
+		matrix_t expected;
+		matrix_mult16_ref(&expected, &virt[N_JOBS + 2 * i], &virt[N_JOBS + 2 * i + 1]);
+		ES_NEW_ASRT(memcmp(&expected, &virt[i], sizeof(expected)) == 0, "Job %zu mismatch", i);
+	}
+	return 1;
+}
+
+int test_2_in_order_handles(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	JQ_CLEANUP jq_st *jq    = NULL;
+	jq_handle_t handles[4];
+	size_t i;
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 10 * 1000 * 1000));
+	ES_FWD_INT_NM(jq_alloc(&jq, dev));
+	for (i = 0; i < ARRAY_SIZE(handles); i++) {
+		ES_NEW_ASRT(jq_submit(jq, &handles[i], dev->phys_addr, dev->phys_addr, dev->phys_addr) == 1,
+		            "Submit %zu failed",
+		            i);
+		ES_NEW_ASRT(handles[i] == i, "Handles should be sequence numbers");
+	}
+	jq_poll(jq);
+	ES_NEW_ASRT(!jq_is_done(jq, handles[0]), "Job can't be done before its latency");
+	ES_FWD_INT_NM(jq_wait(jq, handles[1]));
+	ES_NEW_ASRT(jq_is_done(jq, handles[0]), "Jobs complete in order");
+	ES_NEW_ASRT(jq_in_flight(jq) <= 2, "Expected at most two jobs left");
+	ES_NEW_ASRT(jq_wait(jq, 100) < 0, "Waiting on an unknown handle must fail");
+	ES_FWD_INT_NM(jq_wait_all(jq));
+	return 1;
+}
+
+int test_3_batch(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	JQ_CLEANUP jq_st *jq    = NULL;
+	jq_job_t jobs[N_JOBS];
+	matrix_t *virt;
+	uint32_t phys;
+	jq_handle_t first;
+	size_t i, done = 0;
+	ES_FWD_INT_NM(dev_emu_open(&dev, 3 * N_JOBS * sizeof(matrix_t), 0));
+	ES_FWD_INT_NM(jq_alloc(&jq, dev));
+	virt = dev->virtual_base;
+	phys = dev->phys_addr;
+	srand(5);
+	for (i = 0; i < 2 * N_JOBS * sizeof(matrix_t); i++) {
+		((uint8_t *) &virt[N_JOBS])[i] = rand();
+	}
+	/* Lefts and rights each contiguous so whole groups share one descriptor per channel */
+	for (i = 0; i < N_JOBS; i++) {
+		jobs[i] = (jq_job_t){
+		    .dst_phys   = phys + i * sizeof(matrix_t),
+		    .left_phys  = phys + (N_JOBS + i) * sizeof(matrix_t),
+		    .right_phys = phys + (2 * N_JOBS + i) * sizeof(matrix_t),
+		};
+	}
+	while (done < N_JOBS) {
+		int ret;
+		ES_FWD_INT_NM(ret = jq_submit_batch(jq, &jobs[done], N_JOBS - done, done ? NULL : &first));
+		done += ret;
+		jq_poll(jq);
+	}
+	ES_FWD_INT_NM(jq_wait_all(jq));
+	ES_NEW_ASRT(first == 0, "First handle should be 0");
+	ES_NEW_ASRT(dev_read_reg(dev, DEV_REG_SYS_STATE) == 0, "FIFO overflow");
+	/* One descriptor per channel per group instead of one per tile */
+	ES_NEW_ASRT(dev->stats.reg_writes < N_JOBS * 4,
+	            "Expected batching to save writes, got %llu",
+	            (unsigned long long) dev->stats.reg_writes);
+	for (i = 0; i < N_JOBS; i++) {
+		matrix_t expected;
+		matrix_mult16_ref(&expected, &virt[N_JOBS + i], &virt[2 * N_JOBS + i]);
+		ES_NEW_ASRT(memcmp(&expected, &virt[i], sizeof(expected)) == 0, "Job %zu mismatch", i);
+	}
+	return 1;
+}
+
+/* Anything else sending to the device breaks the completion count, so it is refused */
+int test_4_exclusive(void)
+{
+	DEV_CLEANUP dev_st *dev = NULL;
+	JQ_CLEANUP jq_st *jq    = NULL;
+	jq_handle_t handle;
+	uint32_t phys;
+	ES_FWD_INT_NM(dev_emu_open(&dev, 3 * sizeof(matrix_t), 1000 * 1000));
+	ES_FWD_INT_NM(jq_alloc(&jq, dev));
+	phys = dev->phys_addr;
+	ES_NEW_ASRT_NM(jq_submit(jq, &handle, phys, phys, phys) == 1);
+	ES_FWD_INT_NM(matrix_mult16(dev, phys, phys + sizeof(matrix_t), phys + 2 * sizeof(matrix_t)));
+	ES_NEW_ASRT(jq_poll(jq) < 0, "Foreign instruction not noticed by poll");
+	ES_NEW_ASRT(jq_wait(jq, handle) < 0, "Foreign instruction not noticed by wait");
+	ES_NEW_ASRT(jq_submit(jq, NULL, phys, phys, phys) < 0, "Foreign instruction not noticed");
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_many_in_flight,
+    test_2_in_order_handles,
+    test_3_batch,
+    test_4_exclusive,
+};
+
+TESTER_MAIN(tests);
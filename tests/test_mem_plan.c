@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "errstack.h"
+#include "mem_plan.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define ALIGN (32)
+
+/* No two buffers alive at the same step may share a byte */
+static int _check_plan(const mp_buffer_t *buffers, size_t n)
+{
+	size_t i, j;
+	for (i = 0; i < n; i++) {
+		ES_NEW_ASRT(buffers[i].offset % ALIGN == 0, "Buffer %zu is misaligned", i);
+		for (j = i + 1; j < n; j++) {
+			const mp_buffer_t *a = &buffers[i], *b = &buffers[j];
+			if (a->first > b->last || b->first > a->last) {
+				continue;
+			}
+			ES_NEW_ASRT(a->offset >= b->offset + b->size || b->offset >= a->offset + a->size,
+			            "Buffers %zu and %zu overlap",
+			            i,
+			            j);
+		}
+	}
+	return 0;
+}
+
+int test_1_chain(void)
+{
+	/* Each buffer is written at step i and read at i + 1, like the layers of a plain network */
+	mp_buffer_t buffers[] = {
+	    {512, 0, 1, 0},
+	    {256, 1, 2, 0},
+	    {128, 2, 3, 0},
+	    {64, 3, 4, 0},
+	};
+	mp_report_t report;
+	ES_FWD_INT_NM(mp_plan(buffers, ARRAY_SIZE(buffers), ALIGN, &report));
+	ES_FWD_INT_NM(_check_plan(buffers, ARRAY_SIZE(buffers)));
+	ES_NEW_ASRT(report.peak_live == 512 + 256 && report.peak_step == 1,
+	            "Peak %zu at %ld",
+	            report.peak_live,
+	            report.peak_step);
+	ES_NEW_ASRT(report.arena_size == report.peak_live, "Arena of %zu bytes", report.arena_size);
+	ES_NEW_ASRT(report.unshared_size == 960, "Unshared %zu bytes", report.unshared_size);
+	/* The third buffer fits into the space of the first once that is dead */
+	ES_NEW_ASRT(buffers[2].offset == 0, "Third buffer at %zu", buffers[2].offset);
+	ES_FWD_INT_NM(mp_plan(NULL, 0, ALIGN, &report));
+	ES_NEW_ASRT(report.arena_size == 0 && report.peak_live == 0, "Empty plan takes memory");
+	return 1;
+}
+
+int test_2_random(void)
+{
+	enum
+	{
+		N       = 300,
+		N_STEPS = 60,
+	};
+	mp_buffer_t buffers[N];
+	mp_report_t report;
+	size_t i, round;
+	srand(18);
+	for (round = 0; round < 20; round++) {
+		size_t peak = 0;
+		long step;
+		for (i = 0; i < N; i++) {
+			buffers[i].first = rand() % N_STEPS;
+			buffers[i].last  = buffers[i].first + rand() % 8;
+			/* Mostly small, a few large ones as in real models */
+			buffers[i].size = rand() % 10 ? 1 + rand() % 2000 : 1 + rand() % 50000;
+		}
+		ES_FWD_INT_NM(mp_plan(buffers, N, ALIGN, &report));
+		ES_FWD_INT(_check_plan(buffers, N), "Round %zu", round);
+		for (step = 0; step < N_STEPS + 8; step++) {
+			size_t live = 0;
+			for (i = 0; i < N; i++) {
+				if (buffers[i].first <= step && step <= buffers[i].last) {
+					live += (buffers[i].size + ALIGN - 1) / ALIGN * ALIGN;
+				}
+			}
+			peak = MAX(peak, live);
+		}
+		ES_NEW_ASRT(report.peak_live == peak, "Peak %zu, expected %zu", report.peak_live, peak);
+		ES_NEW_ASRT(report.arena_size >= peak && report.arena_size < report.unshared_size,
+		            "Arena of %zu bytes for a peak of %zu",
+		            report.arena_size,
+		            peak);
+	}
+	return 1;
+}
+
+int test_3_reject(void)
+{
+	mp_buffer_t buffers[] = {{64, 0, 1, 0}, {64, 3, 2, 0}};
+	ES_NEW_ASRT(mp_plan(buffers, 1, 24, NULL) < 0, "Planned with an alignment of 24");
+	ES_NEW_ASRT(mp_plan(buffers, 2, ALIGN, NULL) < 0, "Planned a buffer that dies before birth");
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_chain,
+    test_2_random,
+    test_3_reject,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,94 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "errstack.h"
+#include "memory_utils.h"
+#include "test_utils.h"
+#include "util.h"
+
+int test_1_merge_sync_ranges(void)
+{
+	mu_sync_range_t ranges[] = {
+	    {.offset = 512, .size = 256},
+	    {.offset = 0, .size = 256},
+	    {.offset = 256, .size = 64},
+	    {.offset = 4096, .size = 0},
+	    {.offset = 600, .size = 400},
+	    {.offset = 2048, .size = 256},
+	};
+	size_t n = mu_sync_ranges_merge(ranges, ARRAY_SIZE(ranges));
+	ES_NEW_ASRT(n == 3, "Expected 3 merged ranges, got %zu", n);
+	ES_NEW_ASRT(ranges[0].offset == 0 && ranges[0].size == 320, "Bad first range");
+	ES_NEW_ASRT(ranges[1].offset == 512 && ranges[1].size == 488, "Bad second range");
+	ES_NEW_ASRT(ranges[2].offset == 2048 && ranges[2].size == 256, "Bad third range");
+	return 1;
+}
+
+/* Frames are only visible with CAP_SYS_ADMIN, read one raw entry to find out */
+static bool _frames_visible(const void *touched)
+{
+	const long page = sysconf(_SC_PAGE_SIZE);
+	uint64_t entry  = 0;
+	int fd          = open("/proc/self/pagemap", O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	if (pread(fd, &entry, sizeof(entry), (uintptr_t) touched / page * sizeof(entry)) < 0) {
+		entry = 0;
+	}
+	close(fd);
+	return (entry & (((uint64_t) 1 << 55) - 1)) != 0;
+}
+
+int test_2_pagemap_cache(void)
+{
+	MU_PAGEMAP_CLEANUP mu_pagemap_st *pagemap = NULL;
+	const long page                           = sysconf(_SC_PAGE_SIZE);
+	uint8_t *buf                              = mu_alloc(4);
+	uint64_t uncached[4], cached;
+	bool cont_uncached, cont_cached;
+	int i;
+	ES_NEW_ASRT_NM(buf);
+	memset(buf, 1, 4 * page);
+	ES_FWD_INT_NM(mu_pagemap_open(&pagemap));
+	if (!_frames_visible(buf)) {
+		/* Unprivileged: frame 0 must not turn into physical address 0 */
+		ES_NEW_ASRT(mu_pagemap_virt_to_phys(pagemap, &cached, (uintptr_t) buf) < 0,
+		            "Hidden frame translated");
+		ES_NEW_ASRT(mu_pagemap_frames(pagemap, uncached, (uintptr_t) buf, 4) < 0,
+		            "Hidden frames returned");
+		free(buf);
+		return 1;
+	}
+	for (i = 0; i < 4; i++) {
+		ES_FWD_INT_NM(
+		    mu_pagemap_virt_to_phys(pagemap, &uncached[i], (uint64_t) &buf[i * page + 5]));
+		ES_NEW_ASRT(uncached[i] % page == 5, "Page offset lost");
+		ES_NEW_ASRT(uncached[i] >= (uint64_t) page, "Page %d translated to frame 0", i);
+	}
+	ES_FWD_INT_NM(mu_pagemap_is_continuous(
+	    pagemap, &cont_uncached, (uint64_t) buf, (uint64_t) &buf[4 * page - 1]));
+
+	ES_FWD_INT_NM(mu_pagemap_pin(pagemap, buf, 4 * page));
+	for (i = 0; i < 4; i++) {
+		ES_FWD_INT_NM(mu_pagemap_virt_to_phys(pagemap, &cached, (uint64_t) &buf[i * page + 5]));
+		ES_NEW_ASRT(cached == uncached[i], "Pinned translation differs for page %d", i);
+	}
+	ES_FWD_INT_NM(mu_pagemap_is_continuous(
+	    pagemap, &cont_cached, (uint64_t) buf, (uint64_t) &buf[4 * page - 1]));
+	ES_NEW_ASRT(cont_cached == cont_uncached, "Pinned continuity differs");
+	ES_FWD_INT_NM(mu_pagemap_unpin(pagemap, buf));
+	ES_NEW_ASRT(mu_pagemap_unpin(pagemap, buf) < 0, "Unpinned twice");
+	free(buf);
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_merge_sync_ranges,
+    test_2_pagemap_cache,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,481 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "device.h"
+#include "dma_arena.h"
+#include "errstack.h"
+#include "gemm.h"
+#include "nn_ops.h"
+#include "test_utils.h"
+#include "util.h"
+#include "weight_file.h"
+
+static void _fill(int8_t *dst, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		dst[i] = (int8_t) (rand() & 0xff);
+	}
+}
+
+/* Straight from the definition: sum of offset products, then the TFLite output stage */
+static int8_t _output_stage(int64_t acc,
+                            const nn_quant_t *input,
+                            float filter_scale,
+                            const nn_quant_t *output,
+                            nn_act_et act)
+{
+	int32_t multiplier, min, max, value;
+	int shift;
+	nn_quantize_multiplier(
+	    (double) input->scale * filter_scale / output->scale, &multiplier, &shift);
+	nn_activation_range(act, output, &min, &max);
+	value = nn_multiply_by_quantized_multiplier((int32_t) acc, multiplier, shift);
+	value += output->zero_point;
+	return (int8_t) MIN(MAX(value, min), max);
+}
+
+static size_t _count_mismatches(const int8_t *a, const int8_t *b, size_t n)
+{
+	size_t i, bad = 0;
+	for (i = 0; i < n; i++) {
+		bad += a[i] != b[i];
+	}
+	return bad;
+}
+
+int test_1_requantize(void)
+{
+	size_t i;
+	srand(11);
+	for (i = 0; i < 10000; i++) {
+		const double m  = ldexp((double) rand() / RAND_MAX + 0.5, rand() % 20 - 18);
+		const int32_t x = rand() % 2000001 - 1000000;
+		int32_t multiplier, result;
+		double exact;
+		int shift;
+		nn_quantize_multiplier(m, &multiplier, &shift);
+		result = nn_multiply_by_quantized_multiplier(x, multiplier, shift);
+		exact  = x * m;
+		ES_NEW_ASRT(fabs(result - exact) <= 1.0,
+		            "%d * %g gave %d, expected about %g",
+		            x,
+		            m,
+		            result,
+		            exact);
+	}
+	/* gemmlowp rounds ties of the high multiply upwards, and of the shift away from zero */
+	ES_NEW_ASRT(nn_multiply_by_quantized_multiplier(5, 1 << 30, 0) == 3, "2.5 should round to 3");
+	ES_NEW_ASRT(nn_multiply_by_quantized_multiplier(-5, 1 << 30, 0) == -2, "-2.5 should be -2");
+	ES_NEW_ASRT(nn_multiply_by_quantized_multiplier(-5, 1 << 30, -1) == -1, "-1.25 should be -1");
+	ES_NEW_ASRT(nn_multiply_by_quantized_multiplier(-6, 1 << 30, -1) == -2, "-1.5 should be -2");
+	return 1;
+}
+
+int test_2_fully_connected(void)
+{
+	enum { BATCH = 5, IN = 70, OUT = 37 };
+	NN_OP_CLEANUP nn_op_st *op = NULL;
+	DEV_CLEANUP dev_st *dev    = NULL;
+	int8_t weights[OUT * IN], input[BATCH * IN];
+	int8_t expected[BATCH * OUT], on_cpu[BATCH * OUT], on_dev[BATCH * OUT];
+	int32_t bias[OUT], zero_points[OUT];
+	float scales[OUT];
+	nn_fc_params_t params = {
+	    .in_features  = IN,
+	    .out_features = OUT,
+	    .weights      = weights,
+	    .bias         = bias,
+	    .input        = {.scale = 0.05f, .zero_point = -7},
+	    .weight_q     = {.scales = scales, .zero_points = zero_points, .n = OUT},
+	    .output       = {.scale = 0.9f, .zero_point = 3},
+	    .act          = NN_ACT_RELU,
+	};
+	size_t b, o, i;
+	srand(12);
+	_fill(weights, ARRAY_SIZE(weights));
+	_fill(input, ARRAY_SIZE(input));
+	for (o = 0; o < OUT; o++) {
+		bias[o]        = rand() % 20001 - 10000;
+		scales[o]      = 0.002f + 0.001f * (rand() % 10);
+		zero_points[o] = o % 3 == 0 ? rand() % 11 - 5 : 0;
+	}
+	for (b = 0; b < BATCH; b++) {
+		for (o = 0; o < OUT; o++) {
+			int64_t acc = bias[o];
+			for (i = 0; i < IN; i++) {
+				acc += (int64_t) (input[b * IN + i] - params.input.zero_point) *
+				       (weights[o * IN + i] - zero_points[o]);
+			}
+			expected[b * OUT + o] =
+			    _output_stage(acc, &params.input, scales[o], &params.output, params.act);
+		}
+	}
+	ES_FWD_INT_NM(nn_fc_prepare(&op, &params));
+	ES_NEW_ASRT(nn_op_output_size(op, BATCH) == BATCH * OUT, "Wrong output size");
+	ES_FWD_INT_NM(nn_op_run(op, NULL, on_cpu, input, BATCH));
+	ES_NEW_ASRT(_count_mismatches(expected, on_cpu, ARRAY_SIZE(expected)) == 0, "CPU mismatch");
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 0));
+	ES_FWD_INT_NM(nn_op_run(op, dev, on_dev, input, BATCH));
+	ES_NEW_ASRT(_count_mismatches(expected, on_dev, ARRAY_SIZE(expected)) == 0,
+	            "Device mismatch");
+	return 1;
+}
+
+typedef struct _conv_case_s
+{
+	size_t in_h, in_w, in_c, out_c, k_h, k_w, stride, dilation;
+	nn_pad_et padding;
+	nn_act_et act;
+	bool per_channel;
+} _conv_case_t;
+
+static void _conv_ref(int8_t *dst, const nn_conv2d_params_t *p, const int8_t *input, size_t batch)
+{
+	const size_t dil = MAX(p->dilation_h, (size_t) 1);
+	const size_t eff = (p->k_h - 1) * dil + 1;
+	size_t out_h, out_w, pad_t, pad_l, b, oy, ox, oc, ky, kx, ic;
+	if (p->padding == NN_PAD_VALID) {
+		out_h = (p->in_h - eff) / p->stride_h + 1;
+		out_w = (p->in_w - ((p->k_w - 1) * dil + 1)) / p->stride_w + 1;
+		pad_t = pad_l = 0;
+	} else {
+		out_h = (p->in_h + p->stride_h - 1) / p->stride_h;
+		out_w = (p->in_w + p->stride_w - 1) / p->stride_w;
+		pad_t = MAX((long) ((out_h - 1) * p->stride_h + eff) - (long) p->in_h, 0l) / 2;
+		pad_l = MAX((long) ((out_w - 1) * p->stride_w + (p->k_w - 1) * dil + 1) - (long) p->in_w,
+		            0l) /
+		        2;
+	}
+	for (b = 0; b < batch; b++) {
+		for (oy = 0; oy < out_h; oy++) {
+			for (ox = 0; ox < out_w; ox++) {
+				for (oc = 0; oc < p->out_c; oc++) {
+					const size_t q = p->filter_q.n == 1 ? 0 : oc;
+					int64_t acc    = p->bias[oc];
+					for (ky = 0; ky < p->k_h; ky++) {
+						for (kx = 0; kx < p->k_w; kx++) {
+							const long iy = (long) (oy * p->stride_h + ky * dil) - (long) pad_t;
+							const long ix = (long) (ox * p->stride_w + kx * dil) - (long) pad_l;
+							if (iy < 0 || ix < 0 || iy >= (long) p->in_h || ix >= (long) p->in_w) {
+								continue;
+							}
+							for (ic = 0; ic < p->in_c; ic++) {
+								const int8_t x =
+								    input[((b * p->in_h + iy) * p->in_w + ix) * p->in_c + ic];
+								const int8_t w =
+								    p->filter[((oc * p->k_h + ky) * p->k_w + kx) * p->in_c + ic];
+								acc += (int64_t) (x - p->input.zero_point) * w;
+							}
+						}
+					}
+					*dst++ = _output_stage(
+					    acc, &p->input, p->filter_q.scales[q], &p->output, p->act);
+				}
+			}
+		}
+	}
+}
+
+int test_3_conv2d(void)
+{
+	static const _conv_case_t cases[] = {
+	    {9, 11, 3, 20, 3, 3, 1, 1, NN_PAD_SAME, NN_ACT_RELU6, true},
+	    {10, 10, 8, 17, 3, 3, 2, 1, NN_PAD_SAME, NN_ACT_NONE, true},
+	    {12, 9, 5, 6, 3, 2, 1, 2, NN_PAD_VALID, NN_ACT_RELU, false},
+	    {7, 7, 33, 16, 1, 1, 1, 1, NN_PAD_VALID, NN_ACT_NONE, true},
+	};
+	const size_t batch = 2;
+	DEV_CLEANUP dev_st *dev = NULL;
+	size_t c, i;
+	srand(13);
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 0));
+	for (c = 0; c < ARRAY_SIZE(cases); c++) {
+		const _conv_case_t *cc = &cases[c];
+		const size_t n_filter  = cc->out_c * cc->k_h * cc->k_w * cc->in_c;
+		const size_t n_input   = batch * cc->in_h * cc->in_w * cc->in_c;
+		NN_OP_CLEANUP nn_op_st *op = NULL;
+		int8_t filter[n_filter], input[n_input];
+		int32_t bias[cc->out_c];
+		float scales[cc->out_c];
+		nn_conv2d_params_t params = {
+		    .in_h       = cc->in_h,
+		    .in_w       = cc->in_w,
+		    .in_c       = cc->in_c,
+		    .out_c      = cc->out_c,
+		    .k_h        = cc->k_h,
+		    .k_w        = cc->k_w,
+		    .stride_h   = cc->stride,
+		    .stride_w   = cc->stride,
+		    .dilation_h = cc->dilation,
+		    .dilation_w = cc->dilation,
+		    .padding    = cc->padding,
+		    .filter     = filter,
+		    .bias       = bias,
+		    .input      = {.scale = 0.1f, .zero_point = 12},
+		    .filter_q   = {.scales = scales, .n = cc->per_channel ? cc->out_c : 1},
+		    .output     = {.scale = 0.6f, .zero_point = -20},
+		    .act        = cc->act,
+		};
+		size_t n_out;
+		_fill(filter, n_filter);
+		_fill(input, n_input);
+		for (i = 0; i < cc->out_c; i++) {
+			bias[i]   = rand() % 4001 - 2000;
+			scales[i] = 0.003f + 0.0005f * (rand() % 8);
+		}
+		ES_FWD_INT(nn_conv2d_prepare(&op, &params), "Case %zu", c);
+		n_out = nn_op_output_size(op, batch);
+		{
+			int8_t expected[n_out], actual[n_out];
+			_conv_ref(expected, &params, input, batch);
+			ES_FWD_INT_NM(nn_op_run(op, dev, actual, input, batch));
+			ES_NEW_ASRT(_count_mismatches(expected, actual, n_out) == 0,
+			            "Case %zu: %zu of %zu outputs differ",
+			            c,
+			            _count_mismatches(expected, actual, n_out),
+			            n_out);
+		}
+	}
+	return 1;
+}
+
+/* Depthwise 3x3, SAME, stride 2 with per-channel asymmetric filters, from the definition */
+int test_4_depthwise_conv2d(void)
+{
+	enum { H = 9, W = 8, C = 5, MULT = 2, OUT_C = C * MULT, K = 3, S = 2, OH = 5, OW = 4 };
+	NN_OP_CLEANUP nn_op_st *op = NULL;
+	DEV_CLEANUP dev_st *dev    = NULL;
+	int8_t filter[K * K * OUT_C], input[H * W * C];
+	int8_t expected[OH * OW * OUT_C], actual[OH * OW * OUT_C];
+	int32_t bias[OUT_C], zero_points[OUT_C];
+	float scales[OUT_C];
+	nn_depthwise_conv2d_params_t params = {
+	    .in_h             = H,
+	    .in_w             = W,
+	    .in_c             = C,
+	    .depth_multiplier = MULT,
+	    .k_h              = K,
+	    .k_w              = K,
+	    .stride_h         = S,
+	    .stride_w         = S,
+	    .padding          = NN_PAD_SAME,
+	    .filter           = filter,
+	    .bias             = bias,
+	    .input            = {.scale = 0.07f, .zero_point = 5},
+	    .filter_q         = {.scales = scales, .zero_points = zero_points, .n = OUT_C},
+	    .output           = {.scale = 0.3f, .zero_point = -9},
+	    .act              = NN_ACT_RELU6,
+	};
+	size_t oy, ox, o, ky, kx;
+	srand(14);
+	_fill(filter, ARRAY_SIZE(filter));
+	_fill(input, ARRAY_SIZE(input));
+	for (o = 0; o < OUT_C; o++) {
+		bias[o]        = rand() % 2001 - 1000;
+		scales[o]      = 0.004f + 0.001f * (rand() % 5);
+		zero_points[o] = rand() % 7 - 3;
+	}
+	/* SAME with stride 2: one row of padding on each side, one column after */
+	for (oy = 0; oy < OH; oy++) {
+		for (ox = 0; ox < OW; ox++) {
+			for (o = 0; o < OUT_C; o++) {
+				int64_t acc = bias[o];
+				for (ky = 0; ky < K; ky++) {
+					for (kx = 0; kx < K; kx++) {
+						/* Unsigned wrap covers the row above */
+						const size_t iy = oy * S + ky - 1, ix = ox * S + kx;
+						if (iy < H && ix < W) {
+							acc += (int64_t) (input[(iy * W + ix) * C + o / MULT] - 5) *
+							       (filter[(ky * K + kx) * OUT_C + o] - zero_points[o]);
+						}
+					}
+				}
+				expected[(oy * OW + ox) * OUT_C + o] =
+				    _output_stage(acc, &params.input, scales[o], &params.output, params.act);
+			}
+		}
+	}
+	ES_FWD_INT_NM(nn_depthwise_conv2d_prepare(&op, &params));
+	ES_NEW_ASRT(nn_op_output_size(op, 1) == ARRAY_SIZE(expected), "Wrong output size");
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 0));
+	ES_FWD_INT_NM(nn_op_run(op, dev, actual, input, 1));
+	ES_NEW_ASRT(_count_mismatches(expected, actual, ARRAY_SIZE(expected)) == 0,
+	            "%zu mismatches",
+	            _count_mismatches(expected, actual, ARRAY_SIZE(expected)));
+	return 1;
+}
+
+/* Deeper than the device path can sum, still runs and matches the CPU */
+int test_5_deep_fallback(void)
+{
+	enum { IN = GEMM_MAX_K + SA_DIM, OUT = 3 };
+	static int8_t weights[OUT * IN], input[IN];
+	NN_OP_CLEANUP nn_op_st *op = NULL;
+	DEV_CLEANUP dev_st *dev    = NULL;
+	int8_t on_cpu[OUT], on_dev[OUT];
+	float scale = 0.01f;
+	nn_fc_params_t params = {
+	    .in_features  = IN,
+	    .out_features = OUT,
+	    .weights      = weights,
+	    .input        = {.scale = 0.05f, .zero_point = 0},
+	    .weight_q     = {.scales = &scale, .n = 1},
+	    .output       = {.scale = 200.0f, .zero_point = 0},
+	    .act          = NN_ACT_NONE,
+	};
+	srand(15);
+	_fill(weights, ARRAY_SIZE(weights));
+	_fill(input, ARRAY_SIZE(input));
+	ES_FWD_INT_NM(nn_fc_prepare(&op, &params));
+	ES_FWD_INT_NM(nn_op_run(op, NULL, on_cpu, input, 1));
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 0));
+	ES_FWD_INT_NM(nn_op_run(op, dev, on_dev, input, 1));
+	ES_NEW_ASRT(memcmp(on_cpu, on_dev, sizeof(on_cpu)) == 0, "Device and CPU disagree");
+	return 1;
+}
+
+/* [n, k] filter into the k x n GEMM operand a weight file stores */
+static void _transpose(int8_t *dst, const int8_t *src, size_t n, size_t k)
+{
+	size_t o, i;
+	for (o = 0; o < n; o++) {
+		for (i = 0; i < k; i++) {
+			dst[i * n + o] = src[o * k + i];
+		}
+	}
+}
+
+static int _write_weights(char *path, const wf_src_t *src, size_t n)
+{
+	CLEAN_FD int fd = -1;
+	ES_NEW_INT_ERRNO(fd = mkstemp(path));
+	ES_FWD_INT_NM(wf_write(path, src, n));
+	return 0;
+}
+
+/* Ops on weights loaded from a weight file agree with the ones prepared from the filter */
+int test_6_resident_weights(void)
+{
+	enum { BATCH = 3, IN = 50, OUT = 21, C_IN = 6, C_OUT = 9, HW = 7, TAPS = 9 };
+	NN_OP_CLEANUP nn_op_st *fc = NULL, *fc_resident = NULL;
+	NN_OP_CLEANUP nn_op_st *conv = NULL, *conv_resident = NULL;
+	WF_CLEANUP wf_st *wf    = NULL;
+	DEV_CLEANUP dev_st *dev = NULL;
+	int8_t weights[OUT * IN], filter[C_OUT * TAPS * C_IN];
+	int8_t weights_t[IN * OUT], filter_t[TAPS * C_IN * C_OUT];
+	int8_t fc_in[BATCH * IN], conv_in[BATCH * HW * HW * C_IN];
+	int8_t expected[BATCH * HW * HW * C_OUT], actual[BATCH * HW * HW * C_OUT];
+	int32_t bias[OUT], zero_points[OUT], filter_zero_point = -3;
+	float scales[OUT], filter_scale = 0.004f;
+	char path[] = "/tmp/test_nn_ops_XXXXXX";
+	da_span_t whole, loaded;
+	size_t staging, o;
+	nn_fc_params_t fc_params = {
+	    .in_features  = IN,
+	    .out_features = OUT,
+	    .weights      = weights,
+	    .bias         = bias,
+	    .input        = {.scale = 0.05f, .zero_point = -7},
+	    .weight_q     = {.scales = scales, .zero_points = zero_points, .n = OUT},
+	    .output       = {.scale = 0.9f, .zero_point = 3},
+	    .act          = NN_ACT_RELU,
+	};
+	nn_conv2d_params_t conv_params = {
+	    .in_h     = HW,
+	    .in_w     = HW,
+	    .in_c     = C_IN,
+	    .out_c    = C_OUT,
+	    .k_h      = 3,
+	    .k_w      = 3,
+	    .stride_h = 1,
+	    .stride_w = 1,
+	    .padding  = NN_PAD_SAME,
+	    .filter   = filter,
+	    .input    = {.scale = 0.1f, .zero_point = 12},
+	    .filter_q = {.scales = &filter_scale, .zero_points = &filter_zero_point, .n = 1},
+	    .output   = {.scale = 0.5f, .zero_point = -4},
+	    .act      = NN_ACT_RELU6,
+	};
+	const wf_src_t src[2] = {
+	    {
+	        .name        = "fc",
+	        .weights     = weights_t,
+	        .k           = IN,
+	        .n           = OUT,
+	        .bias        = bias,
+	        .scales      = scales,
+	        .zero_points = zero_points,
+	        .n_quant     = OUT,
+	    },
+	    {
+	        .name        = "conv",
+	        .weights     = filter_t,
+	        .k           = TAPS * C_IN,
+	        .n           = C_OUT,
+	        .scales      = &filter_scale,
+	        .zero_points = &filter_zero_point,
+	        .n_quant     = 1,
+	    },
+	};
+	srand(16);
+	_fill(weights, ARRAY_SIZE(weights));
+	_fill(filter, ARRAY_SIZE(filter));
+	_fill(fc_in, ARRAY_SIZE(fc_in));
+	_fill(conv_in, ARRAY_SIZE(conv_in));
+	for (o = 0; o < OUT; o++) {
+		bias[o]        = rand() % 20001 - 10000;
+		scales[o]      = 0.002f + 0.001f * (rand() % 10);
+		zero_points[o] = o % 3 == 0 ? rand() % 11 - 5 : 0;
+	}
+	_transpose(weights_t, weights, OUT, IN);
+	_transpose(filter_t, filter, C_OUT, TAPS * C_IN);
+	ES_FWD_INT_NM(_write_weights(path, src, ARRAY_SIZE(src)));
+	ES_FWD_INT_NM(wf_open(&wf, path));
+	unlink(path);
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 17, 0));
+	/* Resident weights go after the staging slots */
+	whole   = da_span_of_dev(dev);
+	staging = gemm_staging_size(dev, GEMM_PIPELINE_DEPTH);
+	loaded  = (da_span_t){
+	    .virt   = (uint8_t *) whole.virt + staging,
+	    .phys   = whole.phys + staging,
+	    .offset = whole.offset + staging,
+	    .size   = whole.size - staging,
+	};
+	ES_FWD_INT_NM(wf_load(wf, dev, &loaded));
+
+	ES_FWD_INT_NM(nn_fc_prepare(&fc, &fc_params));
+	ES_FWD_INT_NM(nn_fc_prepare_resident(
+	    &fc_resident, &fc_params, wf, wf_tensor(wf, wf_find(wf, "fc")), &loaded));
+	ES_NEW_ASRT(nn_op_run(fc_resident, NULL, actual, fc_in, BATCH) < 0, "Ran without a device");
+	ES_FWD_INT_NM(nn_op_run(fc, NULL, expected, fc_in, BATCH));
+	ES_FWD_INT_NM(nn_op_run(fc_resident, dev, actual, fc_in, BATCH));
+	ES_NEW_ASRT(_count_mismatches(expected, actual, BATCH * OUT) == 0, "FullyConnected mismatch");
+
+	ES_FWD_INT_NM(nn_conv2d_prepare(&conv, &conv_params));
+	ES_FWD_INT_NM(nn_conv2d_prepare_resident(
+	    &conv_resident, &conv_params, wf, wf_tensor(wf, wf_find(wf, "conv")), &loaded));
+	ES_FWD_INT_NM(nn_op_run(conv, NULL, expected, conv_in, BATCH));
+	ES_FWD_INT_NM(nn_op_run(conv_resident, dev, actual, conv_in, BATCH));
+	ES_NEW_ASRT(_count_mismatches(expected, actual, ARRAY_SIZE(expected)) == 0, "Conv2D mismatch");
+
+	ES_NEW_ASRT(nn_fc_prepare_resident(
+	                &fc_resident, &fc_params, wf, wf_tensor(wf, wf_find(wf, "conv")), &loaded) < 0,
+	            "Prepared on a tensor of the wrong shape");
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_requantize,
+    test_2_fully_connected,
+    test_3_conv2d,
+    test_4_depthwise_conv2d,
+    test_5_deep_fallback,
+    test_6_resident_weights,
+};
+
+TESTER_MAIN(tests);
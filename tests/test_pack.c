@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "errstack.h"
+#include "pack.h"
+#include "test_utils.h"
+#include "util.h"
+
+/* Leading dimension with slack, so reads past a block would pick up the sentinel */
+#define LD       (40)
+#define SENTINEL (0x5a)
+
+/* The kernels pack.c picks for this build */
+#if !defined(PK_NO_SIMD) && defined(__ARM_NEON)
+#define BACKEND "neon"
+#elif !defined(PK_NO_SIMD) && defined(__SSE2__)
+#define BACKEND "sse2"
+#else
+#define BACKEND "scalar"
+#endif
+
+static void _fill(int8_t *dst, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		dst[i] = (int8_t) (rand() & 0xff);
+	}
+}
+
+int test_1_tiles_every_shape(void)
+{
+	int8_t src[SA_DIM * LD];
+	size_t rows, cols, i, j;
+	ES_NEW_ASRT(strcmp(pk_backend(), BACKEND) == 0, "Built with the %s kernels", pk_backend());
+	_fill(src, ARRAY_SIZE(src));
+	for (rows = 0; rows <= SA_DIM; rows++) {
+		for (cols = 0; cols <= SA_DIM; cols++) {
+			matrix_t col, row;
+			memset(&col, SENTINEL, sizeof(col));
+			memset(&row, SENTINEL, sizeof(row));
+			pk_tile_col_major(&col, src, LD, rows, cols);
+			pk_tile_row_major(&row, src, LD, rows, cols);
+			for (i = 0; i < SA_DIM; i++) {
+				for (j = 0; j < SA_DIM; j++) {
+					const int8_t expected = (i < rows && j < cols) ? src[i * LD + j] : 0;
+					ES_NEW_ASRT((int8_t) col.data[j][i] == expected,
+					            "%zux%zu: bad col-major element (%zu, %zu)",
+					            rows,
+					            cols,
+					            i,
+					            j);
+					ES_NEW_ASRT((int8_t) row.data[i][j] == expected,
+					            "%zux%zu: bad row-major element (%zu, %zu)",
+					            rows,
+					            cols,
+					            i,
+					            j);
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+int test_2_untile_and_accumulate(void)
+{
+	matrix_t tile;
+	size_t rows, cols, i, j;
+	_fill((int8_t *) &tile, sizeof(tile));
+	for (rows = 1; rows <= SA_DIM; rows += 5) {
+		for (cols = 1; cols <= SA_DIM; cols++) {
+			int8_t out[SA_DIM * LD];
+			int32_t acc[SA_DIM * LD];
+			memset(out, SENTINEL, sizeof(out));
+			for (i = 0; i < ARRAY_SIZE(acc); i++) {
+				acc[i] = 1000;
+			}
+			pk_untile_col_major(out, LD, &tile, rows, cols);
+			pk_accumulate_col_major(acc, LD, &tile, rows, cols);
+			for (i = 0; i < SA_DIM; i++) {
+				for (j = 0; j < LD; j++) {
+					const bool inside = i < rows && j < cols;
+					const int8_t value = (int8_t) tile.data[j % SA_DIM][i];
+					ES_NEW_ASRT(out[i * LD + j] == (inside ? value : SENTINEL),
+					            "%zux%zu: bad untiled element (%zu, %zu)",
+					            rows,
+					            cols,
+					            i,
+					            j);
+					ES_NEW_ASRT(acc[i * LD + j] == 1000 + (inside ? value : 0),
+					            "%zux%zu: bad accumulated element (%zu, %zu)",
+					            rows,
+					            cols,
+					            i,
+					            j);
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+int test_3_accumulate32(void)
+{
+	matrix32_t tile;
+	size_t rows, cols, i, j;
+	for (i = 0; i < SA_DIM; i++) {
+		for (j = 0; j < SA_DIM; j++) {
+			tile.data[i][j] = rand() - RAND_MAX / 2;
+		}
+	}
+	for (rows = 1; rows <= SA_DIM; rows += 3) {
+		for (cols = 1; cols <= SA_DIM; cols++) {
+			int32_t acc[SA_DIM * LD];
+			for (i = 0; i < ARRAY_SIZE(acc); i++) {
+				acc[i] = (int32_t) i;
+			}
+			pk_accumulate32_col_major(acc, LD, &tile, rows, cols);
+			for (i = 0; i < SA_DIM; i++) {
+				for (j = 0; j < LD; j++) {
+					const int32_t added = (i < rows && j < cols) ? tile.data[j][i] : 0;
+					ES_NEW_ASRT(acc[i * LD + j] == (int32_t) (i * LD + j) + added,
+					            "%zux%zu: bad accumulated element (%zu, %zu)",
+					            rows,
+					            cols,
+					            i,
+					            j);
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+int test_4_matrix_round_trip(void)
+{
+	static const size_t shapes[][2] = {{1, 1}, {16, 16}, {17, 33}, {40, 70}, {64, 8}};
+	size_t s, i, j;
+	for (s = 0; s < ARRAY_SIZE(shapes); s++) {
+		const size_t rows = shapes[s][0], cols = shapes[s][1];
+		const size_t tiles_per_row = PK_N_TILES(cols);
+		int8_t src[rows * cols], back[rows * cols];
+		matrix_t col[PK_N_TILES(rows) * tiles_per_row];
+		matrix_t row[PK_N_TILES(rows) * tiles_per_row];
+		_fill(src, rows * cols);
+		pk_matrix_col_major(col, src, cols, rows, cols);
+		pk_matrix_row_major(row, src, cols, rows, cols);
+		pk_unmatrix_col_major(back, cols, col, rows, cols);
+		ES_NEW_ASRT(memcmp(src, back, sizeof(src)) == 0, "%zux%zu: round trip", rows, cols);
+		for (i = 0; i < rows; i++) {
+			for (j = 0; j < cols; j++) {
+				const matrix_t *tile = &row[i / SA_DIM * tiles_per_row + j / SA_DIM];
+				ES_NEW_ASRT((int8_t) tile->data[i % SA_DIM][j % SA_DIM] == src[i * cols + j],
+				            "%zux%zu: bad row-major tile element (%zu, %zu)",
+				            rows,
+				            cols,
+				            i,
+				            j);
+			}
+		}
+	}
+	return 1;
+}
+
+/* The digits add up to the operands, and the truncated digit products to the exact product */
+int test_5_digits(void)
+{
+	matrix_t left, right, left_digits[PK_N_DIGITS], right_digits[PK_N_DIGITS];
+	matrix_t products[PK_N_DIGITS * PK_N_DIGITS];
+	matrix32_t sum;
+	size_t i, j, d;
+	_fill((int8_t *) &left, sizeof(left));
+	_fill((int8_t *) &right, sizeof(right));
+	/* The extremes: row 0 of the left operand times columns 0 and 1 of the right one */
+	for (i = 0; i < SA_DIM; i++) {
+		left.data[i][0]  = 0x80;
+		right.data[i][0] = 0x80;
+		right.data[i][1] = 0x7f;
+	}
+	pk_digits_signed(left_digits, &left);
+	pk_digits_offset(right_digits, &right);
+	for (i = 0; i < SA_DIM; i++) {
+		for (j = 0; j < SA_DIM; j++) {
+			int32_t l = 0, r = 0;
+			for (d = 0; d < PK_N_DIGITS; d++) {
+				const int32_t top = (int8_t) left_digits[d].data[i][j];
+				l += (d == PK_N_DIGITS - 1 ? top : left_digits[d].data[i][j]) << (2 * d);
+				r += right_digits[d].data[i][j] << (2 * d);
+				ES_NEW_ASRT(right_digits[d].data[i][j] <= 3, "Right digit %zu too large", d);
+			}
+			ES_NEW_ASRT(l == (int8_t) left.data[i][j], "Bad left digits at (%zu, %zu)", i, j);
+			ES_NEW_ASRT(r == (int8_t) right.data[i][j] + PK_DIGIT_OFFSET,
+			            "Bad right digits at (%zu, %zu)",
+			            i,
+			            j);
+		}
+	}
+	for (i = 0; i < PK_N_DIGITS; i++) {
+		for (j = 0; j < PK_N_DIGITS; j++) {
+			matrix_mult16_ref(&products[i * PK_N_DIGITS + j], &left_digits[i], &right_digits[j]);
+		}
+	}
+	pk_digits_combine(&sum, products);
+	for (i = 0; i < SA_DIM; i++) {
+		for (j = 0; j < SA_DIM; j++) {
+			int32_t expected = 0;
+			for (d = 0; d < SA_DIM; d++) {
+				const int32_t r = (int8_t) right.data[d][j] + PK_DIGIT_OFFSET;
+				expected += (int8_t) left.data[d][i] * r;
+			}
+			ES_NEW_ASRT(sum.data[j][i] == expected,
+			            "Bad product at (%zu, %zu): %d != %d",
+			            i,
+			            j,
+			            sum.data[j][i],
+			            expected);
+		}
+	}
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_tiles_every_shape,
+    test_2_untile_and_accumulate,
+    test_3_accumulate32,
+    test_4_matrix_round_trip,
+    test_5_digits,
+};
+
+TESTER_MAIN(tests);
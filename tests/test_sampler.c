@@ -0,0 +1,135 @@
+#include <hps.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "errstack.h"
+#include "job_queue.h"
+#include "sampler.h"
+#include "systolic.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define N_JOBS 200
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+/* Instructions without operands fill the FIFO, the array waits on the DMA for all of them */
+int test_1_ratios(void)
+{
+	DEV_CLEANUP dev_st *dev   = NULL;
+	SM_CLEANUP sm_st *sampler = NULL;
+	sm_stats_t stats;
+	size_t i;
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 0));
+	ES_FWD_INT_NM(sm_alloc(&sampler, dev, NULL));
+	ES_FWD_INT_NM(sm_sample(sampler));
+	for (i = 0; i < FIFO_INSTR_IN_FIFO_DEPTH; i++) {
+		dev_send_instr(dev, SA_INSTR(SA_DIM, SA_DIM));
+	}
+	ES_FWD_INT_NM(sm_sample(sampler));
+	ES_FWD_INT_NM(sm_sample(sampler));
+	sm_get_stats(sampler, &stats);
+	ES_NEW_ASRT(stats.n_samples == 3 && stats.n_window == 3, "%u samples", stats.n_window);
+	ES_NEW_ASRT(stats.idle_ratio == 1.0 / 3, "Idle %f", stats.idle_ratio);
+	ES_NEW_ASRT(stats.backpressure_ratio == 2.0 / 3, "Backpressure %f", stats.backpressure_ratio);
+	ES_NEW_ASRT(stats.instr_occupancy == 2.0 / 3, "Occupancy %f", stats.instr_occupancy);
+	ES_NEW_ASRT(stats.dma_stall_ratio == 0.5, "DMA stall %f", stats.dma_stall_ratio);
+	ES_NEW_ASRT(stats.cycles == 0 && stats.array_utilization == 0, "The array ran");
+	return 1;
+}
+
+/* Counters sampled from a thread while jobs run add up to the work that was done */
+int test_2_thread(void)
+{
+	DEV_CLEANUP dev_st *dev           = NULL;
+	JQ_CLEANUP jq_st *jq              = NULL;
+	SM_CLEANUP sm_st *sampler         = NULL;
+	CLEANUP(_cleanup_free) char *text = NULL;
+	sm_config_t cfg                   = SM_CONFIG_DEFAULT;
+	uint32_t phys;
+	sm_stats_t stats;
+	char expected[64];
+	size_t i, size;
+	FILE *f;
+	int ret;
+	cfg.period_ns = 20000;
+	ES_FWD_INT_NM(dev_emu_open(&dev, 3 * N_JOBS * sizeof(matrix_t), 1000));
+	ES_FWD_INT_NM(jq_alloc(&jq, dev));
+	ES_FWD_INT_NM(sm_alloc(&sampler, dev, &cfg));
+	ES_FWD_INT_NM(sm_start(sampler));
+	ES_NEW_ASRT(sm_sample(sampler) < 0, "Sampled next to the thread");
+	phys = dev->phys_addr;
+	for (i = 0; i < N_JOBS; i++) {
+		while ((ret = jq_submit(jq,
+		                        NULL,
+		                        phys + i * sizeof(matrix_t),
+		                        phys + (N_JOBS + 2 * i) * sizeof(matrix_t),
+		                        phys + (N_JOBS + 2 * i + 1) * sizeof(matrix_t))) == 0) {
+			jq_poll(jq);
+		}
+		ES_FWD_INT_NM(ret);
+	}
+	ES_FWD_INT_NM(jq_wait_all(jq));
+	ES_FWD_INT_NM(sm_stop(sampler));
+	sm_get_stats(sampler, &stats);
+	ES_NEW_ASRT(stats.n_samples >= 2, "%llu samples", (unsigned long long) stats.n_samples);
+	ES_NEW_ASRT(stats.cycles == N_JOBS * 3 * SA_DIM,
+	            "%llu cycles",
+	            (unsigned long long) stats.cycles);
+	ES_NEW_ASRT(stats.stream_bytes == N_JOBS * 2 * sizeof(matrix_t), "Streamed bytes lost");
+	ES_NEW_ASRT(stats.array_utilization >= 0 && stats.array_utilization <= 1, "Bad utilization");
+	ES_NEW_ASRT(stats.sys_state == 0, "sys_state 0x%x", stats.sys_state);
+
+	ES_NEW_ASRT_NM(f = open_memstream(&text, &size));
+	ret = sm_write_prometheus(sampler, f);
+	fclose(f);
+	ES_FWD_INT_NM(ret);
+	snprintf(expected, sizeof(expected), "\nsystolic_array_cycles_total %d\n", N_JOBS * 3 * SA_DIM);
+	ES_NEW_ASRT(strstr(text, expected), "No cycle counter");
+	ES_NEW_ASRT(strstr(text, "# TYPE systolic_array_utilization gauge\n"), "No utilization");
+	ES_NEW_ASRT(strstr(text, "\nsystolic_fifo_occupancy{fifo=\"read\"} "), "No read occupancy");
+	ES_NEW_ASRT(strstr(text, "\nsystolic_core_counter{index=\"7\"} 0\n"), "No core counters");
+	return 1;
+}
+
+/* Only the newest samples are kept, oldest first */
+int test_3_window(void)
+{
+	DEV_CLEANUP dev_st *dev   = NULL;
+	SM_CLEANUP sm_st *sampler = NULL;
+	sm_config_t cfg           = SM_CONFIG_DEFAULT;
+	sm_sample_t a, b;
+	sm_stats_t stats;
+	size_t i;
+	cfg.capacity = 4;
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 0));
+	ES_FWD_INT_NM(sm_alloc(&sampler, dev, &cfg));
+	for (i = 0; i < 10; i++) {
+		ES_FWD_INT_NM(sm_sample(sampler));
+	}
+	sm_get_stats(sampler, &stats);
+	ES_NEW_ASRT(stats.n_samples == 10 && stats.n_window == 4, "%u in window", stats.n_window);
+	for (i = 1; i < cfg.capacity; i++) {
+		ES_FWD_INT_NM(sm_get_sample(sampler, i - 1, &a));
+		ES_FWD_INT_NM(sm_get_sample(sampler, i, &b));
+		ES_NEW_ASRT(a.ts_ns <= b.ts_ns, "Sample %zu out of order", i);
+	}
+	ES_NEW_ASRT(sm_get_sample(sampler, cfg.capacity, &a) < 0, "Read past the window");
+	ES_FWD_INT_NM(sm_get_sample(sampler, 0, &a));
+	ES_NEW_ASRT(stats.window_ns == b.ts_ns - a.ts_ns, "Window of %llu ns",
+	            (unsigned long long) stats.window_ns);
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_ratios,
+    test_2_thread,
+    test_3_window,
+};
+
+TESTER_MAIN(tests);
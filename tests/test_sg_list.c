@@ -0,0 +1,78 @@
+#include <hps.h>
+#include <stdlib.h>
+
+#include "dma_pool.h"
+#include "errstack.h"
+#include "sg_list.h"
+#include "test_utils.h"
+#include "util.h"
+
+#define PAGE (4096)
+
+int test_1_runs_and_caps(void)
+{
+	SG_CLEANUP sg_list_st *sg = NULL;
+	/* Three contiguous pages, a jump, then a lone page */
+	const uint64_t pages[] = {0x10000000, 0x10001000, 0x10002000, 0x20000000};
+	const dev_read_desc_t *descs;
+	ES_FWD_INT_NM(sg_alloc(&sg, 1));
+	ES_FWD_INT_NM(sg_append_pages(sg, pages, PAGE, 0x100, 4 * PAGE - 0x200));
+	descs = sg_descs(sg);
+	ES_NEW_ASRT(sg_count(sg) == 3, "Expected 3 descriptors, got %zu", sg_count(sg));
+	ES_NEW_ASRT(descs[0].phys_addr == 0x10000100 && descs[0].n_bytes == MSGDMA_READ_CSR_MAX_BYTE,
+	            "First run not capped");
+	ES_NEW_ASRT(descs[1].phys_addr == 0x10002100 && descs[1].n_bytes == PAGE - 0x100,
+	            "Remainder of the first run wrong");
+	ES_NEW_ASRT(descs[2].phys_addr == 0x20000000 && descs[2].n_bytes == PAGE - 0x100,
+	            "Last run wrong");
+	ES_NEW_ASRT(descs[2].channel == 1, "Channel lost");
+	ES_NEW_ASRT(sg_bytes(sg) == 4 * PAGE - 0x200, "Byte count wrong");
+	return 1;
+}
+
+int test_2_out_of_reach(void)
+{
+	SG_CLEANUP sg_list_st *sg = NULL;
+	const uint64_t pages[]    = {0x100000000ull};
+	ES_FWD_INT_NM(sg_alloc(&sg, 0));
+	ES_NEW_ASRT(sg_append_pages(sg, pages, PAGE, 0, PAGE) < 0, "Page above 4 GiB accepted");
+	return 1;
+}
+
+/* Only memory of the pool is accepted, it is one run per buffer */
+int test_3_pool_buffer(void)
+{
+	DEV_CLEANUP dev_st *dev   = NULL;
+	DP_CLEANUP dp_st *pool    = NULL;
+	SG_CLEANUP sg_list_st *sg = NULL;
+	const size_t size         = 3 * MSGDMA_READ_CSR_MAX_BYTE;
+	da_span_t span;
+	dp_buf_t buf;
+	uint8_t *user;
+	ES_FWD_INT_NM(dev_emu_open(&dev, 2 * size, 0));
+	ES_FWD_INT_NM(dp_alloc(&pool));
+	span = da_span_of_dev(dev);
+	ES_FWD_INT_NM(dp_add_dev_span(pool, dev, &span, DP_USE_ANY));
+	ES_FWD_INT_NM(dp_get(pool, &buf, size, DP_USE_ACTIVATIONS));
+	ES_FWD_INT_NM(sg_alloc(&sg, 0));
+	ES_FWD_INT_NM(sg_append_buffer(sg, pool, buf.span.virt, size));
+	ES_NEW_ASRT(sg_count(sg) == 3 && sg_bytes(sg) == size, "%zu descriptors", sg_count(sg));
+	ES_NEW_ASRT(sg_descs(sg)[0].phys_addr == buf.span.phys, "First descriptor wrong");
+	ES_NEW_ASRT(sg_descs(sg)[2].phys_addr == buf.span.phys + 2 * MSGDMA_READ_CSR_MAX_BYTE,
+	            "Last descriptor wrong");
+	ES_NEW_ASRT(sg_append_buffer(sg, pool, buf.span.virt, 3 * size) < 0, "Ran past the region");
+
+	/* Ordinary memory can't be cleaned out of the caches for the DMA */
+	ES_NEW_ASRT_NM(user = aligned_alloc(32, size));
+	ES_NEW_ASRT(sg_append_buffer(sg, pool, user, size) < 0, "User buffer accepted");
+	free(user);
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_runs_and_caps,
+    test_2_out_of_reach,
+    test_3_pool_buffer,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,659 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "errstack.h"
+#include "graph.h"
+#include "nn_ops.h"
+#include "nn_ref.h"
+#include "test_utils.h"
+#include "tflite.h"
+#include "util.h"
+
+/*
+ * Minimal flatbuffer builder. Like the real one it writes back to front, so children come before
+ * the tables that point at them. A reference is the distance of an object from the end.
+ */
+typedef struct _fbb_s
+{
+	uint8_t buf[1 << 16];
+	uint32_t used;
+} _fbb_t;
+
+typedef struct _field_s
+{
+	unsigned id;
+	/* Bytes of a scalar, 0 for a reference */
+	size_t size;
+	uint64_t value;
+} _field_t;
+
+#define _SCALAR(id, size, value) ((_field_t){id, size, value})
+#define _REF(id, ref)            ((_field_t){id, 0, ref})
+
+static void _pad(_fbb_t *b, size_t align, size_t extra)
+{
+	while ((b->used + extra) % align) {
+		b->buf[sizeof(b->buf) - ++b->used] = 0;
+	}
+}
+
+static uint32_t _push(_fbb_t *b, const void *data, size_t size)
+{
+	b->used += size;
+	memcpy(&b->buf[sizeof(b->buf) - b->used], data, size);
+	return b->used;
+}
+
+static uint32_t _push_ref(_fbb_t *b, uint32_t ref)
+{
+	uint32_t offset;
+	_pad(b, 4, 0);
+	offset = b->used + 4 - ref;
+	return _push(b, &offset, 4);
+}
+
+static uint32_t _vector(_fbb_t *b, const void *data, size_t elem_size, size_t n)
+{
+	const uint32_t len = n;
+	_pad(b, MAX(elem_size, (size_t) 4), elem_size * n);
+	_push(b, data, elem_size * n);
+	return _push(b, &len, 4);
+}
+
+static uint32_t _ref_vector(_fbb_t *b, const uint32_t *refs, size_t n)
+{
+	const uint32_t len = n;
+	size_t i;
+	for (i = n; i > 0; i--) {
+		_push_ref(b, refs[i - 1]);
+	}
+	return _push(b, &len, 4);
+}
+
+static uint32_t _string(_fbb_t *b, const char *str)
+{
+	const uint32_t len = strlen(str);
+	_pad(b, 4, len + 1);
+	_push(b, str, len + 1);
+	return _push(b, &len, 4);
+}
+
+static uint32_t _table(_fbb_t *b, const _field_t *fields, size_t n)
+{
+	const uint32_t start = b->used;
+	uint16_t vtable[2 + 16] = {0};
+	uint32_t at[16], table;
+	const int32_t zero = 0;
+	size_t i, n_ids = 0;
+	for (i = 0; i < n; i++) {
+		if (fields[i].size) {
+			_pad(b, fields[i].size, 0);
+			at[i] = _push(b, &fields[i].value, fields[i].size);
+		} else {
+			at[i] = _push_ref(b, fields[i].value);
+		}
+		n_ids = MAX(n_ids, (size_t) fields[i].id + 1);
+	}
+	_pad(b, 4, 0);
+	table = _push(b, &zero, 4);
+	for (i = 0; i < n; i++) {
+		vtable[2 + fields[i].id] = table - at[i];
+	}
+	vtable[0] = 4 + 2 * n_ids;
+	vtable[1] = table - start;
+	/* soffset from the table back to its vtable, which sits right before it */
+	{
+		const int32_t to_vtable = _push(b, vtable, vtable[0]) - table;
+		memcpy(&b->buf[sizeof(b->buf) - table], &to_vtable, 4);
+	}
+	return table;
+}
+
+static const uint8_t *_finish(_fbb_t *b, uint32_t root, size_t *size)
+{
+	_pad(b, 16, 8);
+	_push(b, "TFL3", 4);
+	_push_ref(b, root);
+	*size = b->used;
+	return &b->buf[sizeof(b->buf) - b->used];
+}
+
+static uint64_t _f32_bits(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+/* Model tensor as the test describes it */
+typedef struct _t_s
+{
+	const char *name;
+	int type;
+	int32_t shape[4];
+	size_t rank;
+	uint32_t buffer;
+	/* 0 for no quantization */
+	size_t n_scales;
+	const float *scales;
+	int32_t quantized_dimension;
+	nn_quant_t q;
+} _t_t;
+
+static uint32_t _tensor(_fbb_t *b, const _t_t *t)
+{
+	const uint32_t shape = _vector(b, t->shape, 4, t->rank);
+	const uint32_t name  = _string(b, t->name);
+	_field_t fields[5];
+	size_t n = 0;
+	if (t->n_scales || t->q.scale > 0) {
+		const int64_t zeros[64] = {[0] = t->q.zero_point};
+		const float one[1]      = {t->q.scale};
+		const size_t n_scales   = t->n_scales ? t->n_scales : 1;
+		const uint32_t scales   = _vector(b, t->n_scales ? t->scales : one, 4, n_scales);
+		const uint32_t zps      = _vector(b, zeros, 8, n_scales);
+		const _field_t quant[]  = {
+		    _REF(2, scales),
+		    _REF(3, zps),
+		    _SCALAR(6, 4, t->quantized_dimension),
+		};
+		fields[n++] = _REF(4, _table(b, quant, ARRAY_SIZE(quant)));
+	}
+	fields[n++] = _REF(0, shape);
+	fields[n++] = _REF(3, name);
+	fields[n++] = _SCALAR(1, 1, t->type);
+	fields[n++] = _SCALAR(2, 4, t->buffer);
+	return _table(b, fields, n);
+}
+
+/* One operator: code, option fields and tensor indices, -1 ends the lists */
+typedef struct _o_s
+{
+	int32_t code;
+	uint8_t options_type;
+	_field_t options[8];
+	size_t n_options;
+	int32_t inputs[3];
+	size_t n_inputs;
+	int32_t output;
+} _o_t;
+
+enum
+{
+	_FLOAT32 = 0,
+	_INT32   = 2,
+	_INT8    = 9,
+};
+
+enum
+{
+	IN_H  = 8,
+	IN_W  = 8,
+	IN_C  = 3,
+	CONV  = 8,
+	FLAT  = 2 * 2 * CONV,
+	OUT   = 10,
+	N_BUF = 7,
+};
+
+static int8_t _conv_w[CONV * 3 * 3 * IN_C];
+static int32_t _conv_b[CONV];
+static float _conv_s[CONV];
+static int8_t _dw_w[3 * 3 * CONV];
+static int32_t _dw_b[CONV];
+static float _dw_s[CONV];
+static int8_t _fc_w[OUT * FLAT];
+static int32_t _fc_b[OUT];
+
+static const nn_quant_t _q_in   = {0.02f, -3};
+static const nn_quant_t _q_conv = {0.05f, -128};
+static const nn_quant_t _q_dw   = {0.04f, -128};
+static const nn_quant_t _q_add  = {0.08f, -128};
+static const nn_quant_t _q_fc   = {0.1f, 5};
+static const nn_quant_t _q_sm   = {1.0f / 256, -128};
+static const float _fc_scale    = 0.003f;
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+static void _fill(int8_t *dst, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		dst[i] = (int8_t) (rand() & 0xff);
+	}
+}
+
+static void _init_weights(void)
+{
+	size_t i;
+	srand(17);
+	_fill(_conv_w, ARRAY_SIZE(_conv_w));
+	_fill(_dw_w, ARRAY_SIZE(_dw_w));
+	_fill(_fc_w, ARRAY_SIZE(_fc_w));
+	for (i = 0; i < CONV; i++) {
+		_conv_b[i] = rand() % 2001 - 1000;
+		_conv_s[i] = 0.002f + 0.001f * (i % 4);
+		_dw_b[i]   = rand() % 2001 - 1000;
+		_dw_s[i]   = 0.003f + 0.001f * (i % 3);
+	}
+	for (i = 0; i < OUT; i++) {
+		_fc_b[i] = rand() % 2001 - 1000;
+	}
+}
+
+/*
+ * float in -> QUANTIZE -> CONV_2D (relu) -> DEPTHWISE_CONV_2D (stride 2, relu6) -> MAX_POOL_2D ->
+ * ADD (with itself) -> RESHAPE -> FULLY_CONNECTED -> SOFTMAX -> DEQUANTIZE -> float out
+ */
+static const uint8_t *_build_model(_fbb_t *b, size_t *size, int32_t unsupported_code)
+{
+	const _t_t tensors[] = {
+	    {"input", _FLOAT32, {1, IN_H, IN_W, IN_C}, 4, 0, 0, NULL, 0, {0, 0}},
+	    {"input_q", _INT8, {1, IN_H, IN_W, IN_C}, 4, 0, 0, NULL, 0, _q_in},
+	    {"conv_w", _INT8, {CONV, 3, 3, IN_C}, 4, 1, CONV, _conv_s, 0, {0, 0}},
+	    {"conv_b", _INT32, {CONV}, 1, 2, 0, NULL, 0, {0, 0}},
+	    {"conv", _INT8, {1, IN_H, IN_W, CONV}, 4, 0, 0, NULL, 0, _q_conv},
+	    {"dw_w", _INT8, {1, 3, 3, CONV}, 4, 3, CONV, _dw_s, 3, {0, 0}},
+	    {"dw_b", _INT32, {CONV}, 1, 4, 0, NULL, 0, {0, 0}},
+	    {"dw", _INT8, {1, 4, 4, CONV}, 4, 0, 0, NULL, 0, _q_dw},
+	    {"pool", _INT8, {1, 2, 2, CONV}, 4, 0, 0, NULL, 0, _q_dw},
+	    {"add", _INT8, {1, 2, 2, CONV}, 4, 0, 0, NULL, 0, _q_add},
+	    {"flat", _INT8, {1, FLAT}, 2, 0, 0, NULL, 0, _q_add},
+	    {"fc_w", _INT8, {OUT, FLAT}, 2, 5, 1, &_fc_scale, 0, {0, 0}},
+	    {"fc_b", _INT32, {OUT}, 1, 6, 0, NULL, 0, {0, 0}},
+	    {"fc", _INT8, {1, OUT}, 2, 0, 0, NULL, 0, _q_fc},
+	    {"softmax", _INT8, {1, OUT}, 2, 0, 0, NULL, 0, _q_sm},
+	    {"output", _FLOAT32, {1, OUT}, 2, 0, 0, NULL, 0, {0, 0}},
+	};
+	const _o_t ops[] = {
+	    {114, 0, {{0}}, 0, {0}, 1, 1},
+	    {3,
+	     1,
+	     {_SCALAR(0, 1, 0), _SCALAR(1, 4, 1), _SCALAR(2, 4, 1), _SCALAR(3, 1, 1)},
+	     4,
+	     {1, 2, 3},
+	     3,
+	     4},
+	    {4,
+	     2,
+	     {_SCALAR(0, 1, 0),
+	      _SCALAR(1, 4, 2),
+	      _SCALAR(2, 4, 2),
+	      _SCALAR(3, 4, 1),
+	      _SCALAR(4, 1, 3)},
+	     5,
+	     {4, 5, 6},
+	     3,
+	     7},
+	    {17,
+	     5,
+	     {_SCALAR(0, 1, 1),
+	      _SCALAR(1, 4, 2),
+	      _SCALAR(2, 4, 2),
+	      _SCALAR(3, 4, 2),
+	      _SCALAR(4, 4, 2)},
+	     5,
+	     {7},
+	     1,
+	     8},
+	    {0, 11, {{0}}, 0, {8, 8}, 2, 9},
+	    {22, 0, {{0}}, 0, {9}, 1, 10},
+	    {9, 8, {{0}}, 0, {10, 11, 12}, 3, 13},
+	    {25, 9, {_SCALAR(0, 4, _f32_bits(1.0f))}, 1, {13}, 1, 14},
+	    {6, 0, {{0}}, 0, {14}, 1, 15},
+	};
+	const struct
+	{
+		const void *data;
+		size_t size;
+	} buffers[N_BUF] = {
+	    {NULL, 0},
+	    {_conv_w, sizeof(_conv_w)},
+	    {_conv_b, sizeof(_conv_b)},
+	    {_dw_w, sizeof(_dw_w)},
+	    {_dw_b, sizeof(_dw_b)},
+	    {_fc_w, sizeof(_fc_w)},
+	    {_fc_b, sizeof(_fc_b)},
+	};
+	uint32_t tensor_refs[ARRAY_SIZE(tensors)], op_refs[ARRAY_SIZE(ops)], buffer_refs[N_BUF];
+	uint32_t code_refs[ARRAY_SIZE(ops)], subgraph;
+	const int32_t inputs[] = {0}, outputs[] = {15};
+	size_t i;
+	b->used = 0;
+	for (i = 0; i < ARRAY_SIZE(tensors); i++) {
+		tensor_refs[i] = _tensor(b, &tensors[i]);
+	}
+	/* One operator code per operator keeps opcode_index == operator index */
+	for (i = 0; i < ARRAY_SIZE(ops); i++) {
+		const int32_t code     = i == 4 && unsupported_code >= 0 ? unsupported_code : ops[i].code;
+		const _field_t field[] = {
+		    _SCALAR(0, 1, (uint64_t) MIN(code, 127)),
+		    _SCALAR(3, 4, (uint64_t) code),
+		};
+		code_refs[i] = _table(b, field, ARRAY_SIZE(field));
+	}
+	for (i = 0; i < ARRAY_SIZE(ops); i++) {
+		const uint32_t in  = _vector(b, ops[i].inputs, 4, ops[i].n_inputs);
+		const uint32_t out = _vector(b, &ops[i].output, 4, 1);
+		_field_t fields[5] = {
+		    _SCALAR(0, 4, i),
+		    _REF(1, in),
+		    _REF(2, out),
+		};
+		size_t n = 3;
+		if (ops[i].options_type) {
+			fields[n++] = _SCALAR(3, 1, ops[i].options_type);
+			fields[n++] = _REF(4, _table(b, ops[i].options, ops[i].n_options));
+		}
+		op_refs[i] = _table(b, fields, n);
+	}
+	for (i = 0; i < N_BUF; i++) {
+		_field_t field = {0};
+		if (buffers[i].data) {
+			field = _REF(0, _vector(b, buffers[i].data, 1, buffers[i].size));
+		}
+		buffer_refs[i] = _table(b, &field, buffers[i].data ? 1 : 0);
+	}
+	{
+		const _field_t fields[] = {
+		    _REF(0, _ref_vector(b, tensor_refs, ARRAY_SIZE(tensors))),
+		    _REF(1, _vector(b, inputs, 4, 1)),
+		    _REF(2, _vector(b, outputs, 4, 1)),
+		    _REF(3, _ref_vector(b, op_refs, ARRAY_SIZE(ops))),
+		};
+		subgraph = _table(b, fields, ARRAY_SIZE(fields));
+	}
+	{
+		const _field_t fields[] = {
+		    _SCALAR(0, 4, 3),
+		    _REF(1, _ref_vector(b, code_refs, ARRAY_SIZE(ops))),
+		    _REF(2, _ref_vector(b, &subgraph, 1)),
+		    _REF(4, _ref_vector(b, buffer_refs, N_BUF)),
+		};
+		return _finish(b, _table(b, fields, ARRAY_SIZE(fields)), size);
+	}
+}
+
+/* The same network, op by op */
+static int _reference(float *output, const float *input, dev_st *dev)
+{
+	NN_OP_CLEANUP nn_op_st *conv = NULL;
+	NN_OP_CLEANUP nn_op_st *dw   = NULL;
+	NN_OP_CLEANUP nn_op_st *fc   = NULL;
+	int8_t input_q[IN_H * IN_W * IN_C], conv_out[IN_H * IN_W * CONV], dw_out[4 * 4 * CONV];
+	int8_t pool_out[FLAT], add_out[FLAT], fc_out[OUT], sm_out[OUT];
+	const nn_conv2d_params_t conv_p = {
+	    .in_h     = IN_H,
+	    .in_w     = IN_W,
+	    .in_c     = IN_C,
+	    .out_c    = CONV,
+	    .k_h      = 3,
+	    .k_w      = 3,
+	    .stride_h = 1,
+	    .stride_w = 1,
+	    .padding  = NN_PAD_SAME,
+	    .filter   = _conv_w,
+	    .bias     = _conv_b,
+	    .input    = _q_in,
+	    .filter_q = {.scales = _conv_s, .n = CONV},
+	    .output   = _q_conv,
+	    .act      = NN_ACT_RELU,
+	};
+	const nn_depthwise_conv2d_params_t dw_p = {
+	    .in_h             = IN_H,
+	    .in_w             = IN_W,
+	    .in_c             = CONV,
+	    .depth_multiplier = 1,
+	    .k_h              = 3,
+	    .k_w              = 3,
+	    .stride_h         = 2,
+	    .stride_w         = 2,
+	    .padding          = NN_PAD_SAME,
+	    .filter           = _dw_w,
+	    .bias             = _dw_b,
+	    .input            = _q_conv,
+	    .filter_q         = {.scales = _dw_s, .n = CONV},
+	    .output           = _q_dw,
+	    .act              = NN_ACT_RELU6,
+	};
+	const nn_fc_params_t fc_p = {
+	    .in_features  = FLAT,
+	    .out_features = OUT,
+	    .weights      = _fc_w,
+	    .bias         = _fc_b,
+	    .input        = _q_add,
+	    .weight_q     = {.scales = &_fc_scale, .n = 1},
+	    .output       = _q_fc,
+	};
+	const nn_pool_params_t pool_p = {
+	    .batch    = 1,
+	    .in_h     = 4,
+	    .in_w     = 4,
+	    .c        = CONV,
+	    .k_h      = 2,
+	    .k_w      = 2,
+	    .stride_h = 2,
+	    .stride_w = 2,
+	    .padding  = NN_PAD_VALID,
+	    .quant    = _q_dw,
+	};
+	ES_FWD_INT_NM(nn_conv2d_prepare(&conv, &conv_p));
+	ES_FWD_INT_NM(nn_depthwise_conv2d_prepare(&dw, &dw_p));
+	ES_FWD_INT_NM(nn_fc_prepare(&fc, &fc_p));
+	nn_ref_quantize(input_q, input, &_q_in, ARRAY_SIZE(input_q));
+	ES_FWD_INT_NM(nn_op_run(conv, dev, conv_out, input_q, 1));
+	ES_FWD_INT_NM(nn_op_run(dw, dev, dw_out, conv_out, 1));
+	nn_ref_max_pool(pool_out, dw_out, &pool_p);
+	nn_ref_add(add_out, pool_out, &_q_dw, pool_out, &_q_dw, &_q_add, NN_ACT_NONE, FLAT);
+	ES_FWD_INT_NM(nn_op_run(fc, dev, fc_out, add_out, 1));
+	nn_ref_softmax(sm_out, fc_out, &_q_fc, &_q_sm, 1.0f, 1, OUT);
+	nn_ref_dequantize(output, sm_out, &_q_sm, OUT);
+	return 0;
+}
+
+int test_1_import_and_run(void)
+{
+	static _fbb_t builder;
+	GR_CLEANUP gr_st *graph = NULL;
+	DEV_CLEANUP dev_st *dev = NULL;
+	CLEANUP(_cleanup_free) void *arena = NULL;
+	float input[IN_H * IN_W * IN_C], expected[OUT], actual[OUT], sum = 0;
+	const uint8_t *model;
+	size_t size, i;
+	_init_weights();
+	for (i = 0; i < ARRAY_SIZE(input); i++) {
+		input[i] = (float) (rand() % 501 - 250) / 100;
+	}
+	model = _build_model(&builder, &size, -1);
+	ES_FWD_INT_NM(tfl_import(&graph, model, size));
+	ES_NEW_ASRT(gr_n_nodes(graph) == 9 && gr_n_inputs(graph) == 1 && gr_n_outputs(graph) == 1,
+	            "Graph has %zu nodes",
+	            gr_n_nodes(graph));
+	ES_NEW_ASRT(gr_node(graph, 2)->kind == GR_KIND_GEMM && gr_node(graph, 3)->kind != GR_KIND_GEMM,
+	            "Depthwise should run on the array, pooling on the CPU");
+	ES_NEW_ASRT(gr_arena_size(graph) < gr_unshared_size(graph),
+	            "Activations do not share memory: %zu of %zu bytes",
+	            gr_arena_size(graph),
+	            gr_unshared_size(graph));
+	ES_NEW_ASRT(gr_plan_report(graph)->peak_live <= gr_arena_size(graph),
+	            "Arena below the peak of live activations");
+	ES_NEW_ASRT_NM(arena = aligned_alloc(GR_ALIGN, gr_arena_size(graph)));
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 0));
+	ES_FWD_INT_NM(_reference(expected, input, dev));
+	for (i = 0; i < 2; i++) {
+		memcpy(gr_tensor_data(graph, arena, gr_input(graph, 0)), input, sizeof(input));
+		ES_FWD_INT(gr_run(graph, i ? dev : NULL, arena), "Run %zu", i);
+		memcpy(actual, gr_tensor_data(graph, arena, gr_output(graph, 0)), sizeof(actual));
+		ES_NEW_ASRT(memcmp(expected, actual, sizeof(actual)) == 0,
+		            "Graph output differs from the reference on run %zu",
+		            i);
+	}
+	for (i = 0; i < OUT; i++) {
+		sum += actual[i];
+	}
+	ES_NEW_ASRT(fabsf(sum - 1.0f) < 0.05f, "Softmax sums to %g", sum);
+	return 1;
+}
+
+int test_2_reject(void)
+{
+	static _fbb_t builder;
+	GR_CLEANUP gr_st *graph              = NULL;
+	CLEANUP(_cleanup_free) uint8_t *copy = NULL;
+	const uint8_t *model;
+	size_t size, i;
+	_init_weights();
+	/* MUL in place of the ADD */
+	model = _build_model(&builder, &size, 18);
+	ES_NEW_ASRT(tfl_import(&graph, model, size) < 0, "Imported an unsupported operator");
+	model = _build_model(&builder, &size, -1);
+	/* Every truncation must fail cleanly, never read past the end */
+	ES_NEW_ASRT_NM(copy = malloc(size));
+	for (i = 0; i < size; i += 7) {
+		memcpy(copy, model, i);
+		ES_NEW_ASRT(tfl_import(&graph, copy, i) < 0,
+		            "Imported a model cut at %zu of %zu bytes",
+		            i,
+		            size);
+	}
+	ES_FWD_INT_NM(tfl_import(&graph, model, size));
+	return 1;
+}
+
+static int _add_tensor(gr_st *graph, const char *name, size_t n, nn_quant_t quant, size_t *idx)
+{
+	const gr_tensor_t tensor = {
+	    .name  = (char *) name,
+	    .type  = GR_TYPE_INT8,
+	    .rank  = 2,
+	    .shape = {1, n},
+	    .quant = quant,
+	    .size  = n,
+	};
+	ES_FWD_INT_NM(gr_add_tensor(graph, &tensor, idx));
+	return 0;
+}
+
+/* FC -> RELU6 -> RELU with a new scale: the RELU6 goes into the FC, the RELU runs in place */
+int test_3_fused_epilogue(void)
+{
+	GR_CLEANUP gr_st *graph            = NULL;
+	DEV_CLEANUP dev_st *dev            = NULL;
+	NN_OP_CLEANUP nn_op_st *fc         = NULL;
+	CLEANUP(_cleanup_free) void *arena = NULL;
+	const nn_quant_t q_in     = {0.02f, 3}, q_mid = {0.05f, -10}, q_out = {0.03f, -20};
+	const nn_fc_params_t fc_p = {
+	    .in_features  = FLAT,
+	    .out_features = OUT,
+	    .weights      = _fc_w,
+	    .bias         = _fc_b,
+	    .input        = q_in,
+	    .weight_q     = {.scales = &_fc_scale, .n = 1},
+	    .output       = q_mid,
+	};
+	gr_node_t gemm  = {.kind = GR_KIND_GEMM, .op_name = "FULLY_CONNECTED", .n_inputs = 1};
+	gr_node_t relu6 = {.kind = GR_KIND_REQUANTIZE, .op_name = "RELU6", .n_inputs = 1};
+	gr_node_t relu  = {.kind = GR_KIND_REQUANTIZE, .op_name = "RELU", .n_inputs = 1};
+	int8_t input[FLAT], mid[OUT], expected[OUT];
+	size_t in, fc_out, relu6_out, out, i;
+	_init_weights();
+	_fill(input, FLAT);
+	ES_FWD_INT_NM(gr_alloc(&graph));
+	ES_FWD_INT_NM(_add_tensor(graph, "in", FLAT, q_in, &in));
+	ES_FWD_INT_NM(_add_tensor(graph, "fc", OUT, q_mid, &fc_out));
+	ES_FWD_INT_NM(_add_tensor(graph, "relu6", OUT, q_mid, &relu6_out));
+	ES_FWD_INT_NM(_add_tensor(graph, "out", OUT, q_out, &out));
+	ES_FWD_INT_NM(nn_fc_prepare(&gemm.op, &fc_p));
+	gemm.batch       = 1;
+	gemm.inputs[0]   = in;
+	gemm.n_outputs   = 1;
+	gemm.outputs[0]  = fc_out;
+	relu6.act        = NN_ACT_RELU6;
+	relu6.inputs[0]  = fc_out;
+	relu6.n_outputs  = 1;
+	relu6.outputs[0] = relu6_out;
+	relu.act         = NN_ACT_RELU;
+	relu.inputs[0]   = relu6_out;
+	relu.n_outputs   = 1;
+	relu.outputs[0]  = out;
+	ES_FWD_INT_NM(gr_add_node(graph, &gemm));
+	ES_FWD_INT_NM(gr_add_node(graph, &relu6));
+	ES_FWD_INT_NM(gr_add_node(graph, &relu));
+	ES_FWD_INT_NM(gr_set_io(graph, &in, 1, &out, 1));
+	ES_FWD_INT_NM(gr_finalize(graph));
+	ES_NEW_ASRT(gr_n_nodes(graph) == 2 && gr_node(graph, 0)->outputs[0] == relu6_out,
+	            "RELU6 was not fused, %zu nodes",
+	            gr_n_nodes(graph));
+	ES_NEW_ASRT(gr_tensor(graph, out)->offset == gr_tensor(graph, relu6_out)->offset,
+	            "RELU does not run in place");
+	/* Unfused: requantize, then each activation as a pass of its own */
+	ES_FWD_INT_NM(nn_fc_prepare(&fc, &fc_p));
+	ES_FWD_INT_NM(nn_op_run(fc, NULL, mid, input, 1));
+	nn_ref_requantize(mid, mid, &q_mid, &q_mid, NN_ACT_RELU6, OUT);
+	nn_ref_requantize(expected, mid, &q_mid, &q_out, NN_ACT_RELU, OUT);
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 0));
+	ES_NEW_ASRT_NM(arena = aligned_alloc(GR_ALIGN, gr_arena_size(graph)));
+	for (i = 0; i < 2; i++) {
+		memcpy(gr_tensor_data(graph, arena, in), input, FLAT);
+		ES_FWD_INT(gr_run(graph, i ? dev : NULL, arena), "Run %zu", i);
+		ES_NEW_ASRT(memcmp(gr_tensor_data(graph, arena, out), expected, OUT) == 0,
+		            "Fused output differs on run %zu",
+		            i);
+	}
+	return 1;
+}
+
+/* An activation added before the FC that feeds it is refused, not fused across the FC */
+int test_4_out_of_order(void)
+{
+	GR_CLEANUP gr_st *graph   = NULL;
+	const nn_quant_t q        = {0.05f, -10};
+	const nn_fc_params_t fc_p = {
+	    .in_features  = FLAT,
+	    .out_features = OUT,
+	    .weights      = _fc_w,
+	    .bias         = _fc_b,
+	    .input        = q,
+	    .weight_q     = {.scales = &_fc_scale, .n = 1},
+	    .output       = q,
+	};
+	gr_node_t gemm = {.kind = GR_KIND_GEMM, .op_name = "FULLY_CONNECTED", .n_inputs = 1};
+	gr_node_t relu = {.kind = GR_KIND_REQUANTIZE, .op_name = "RELU", .n_inputs = 1};
+	size_t in, fc_out, out;
+	_init_weights();
+	ES_FWD_INT_NM(gr_alloc(&graph));
+	ES_FWD_INT_NM(_add_tensor(graph, "in", FLAT, q, &in));
+	ES_FWD_INT_NM(_add_tensor(graph, "fc", OUT, q, &fc_out));
+	ES_FWD_INT_NM(_add_tensor(graph, "out", OUT, q, &out));
+	ES_FWD_INT_NM(nn_fc_prepare(&gemm.op, &fc_p));
+	gemm.batch      = 1;
+	gemm.inputs[0]  = in;
+	gemm.n_outputs  = 1;
+	gemm.outputs[0] = fc_out;
+	relu.act        = NN_ACT_RELU;
+	relu.inputs[0]  = fc_out;
+	relu.n_outputs  = 1;
+	relu.outputs[0] = out;
+	ES_FWD_INT_NM(gr_add_node(graph, &relu));
+	ES_FWD_INT_NM(gr_add_node(graph, &gemm));
+	ES_FWD_INT_NM(gr_set_io(graph, &in, 1, &out, 1));
+	ES_NEW_ASRT(gr_finalize(graph) < 0, "Finalized a graph that reads fc before writing it");
+	ES_NEW_ASRT(gr_n_nodes(graph) == 2 && gr_node(graph, 1)->kind == GR_KIND_GEMM,
+	            "Nodes changed by a refused finalize");
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_import_and_run,
+    test_2_reject,
+    test_3_fused_epilogue,
+    test_4_out_of_order,
+};
+
+TESTER_MAIN(tests);
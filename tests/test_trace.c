@@ -0,0 +1,134 @@
+/* The macros are tested whatever the build settings */
+#ifndef TR_ENABLE
+#	define TR_ENABLE
+#endif
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errstack.h"
+#include "test_utils.h"
+#include "trace.h"
+#include "util.h"
+
+#define N_THREADS (4)
+#define N_EVENTS  (3000)
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+/* Dump into memory, returns the JSON */
+static char *_dump(int *n)
+{
+	char *json = NULL;
+	size_t size;
+	FILE *f = open_memstream(&json, &size);
+	if (!f) {
+		return NULL;
+	}
+	*n = tr_dump_chrome(f);
+	fclose(f);
+	return json;
+}
+
+static size_t _count(const char *haystack, const char *needle)
+{
+	size_t n = 0;
+	for (haystack = strstr(haystack, needle); haystack; haystack = strstr(haystack + 1, needle)) {
+		n++;
+	}
+	return n;
+}
+
+int test_1_events(void)
+{
+	CLEANUP(_cleanup_free) char *json = NULL;
+	int n;
+	tr_reset();
+	tr_thread_name("main");
+	TR_BEGIN("sync_for_device");
+	TR_END("sync_for_device");
+	TR_INSTANT("submit", 7);
+	ES_NEW_ASRT_NM(json = _dump(&n));
+	ES_NEW_ASRT(n == 3, "Dumped %d events", n);
+	ES_NEW_ASRT(strncmp(json, "{\"displayTimeUnit\"", 18) == 0, "Not a trace object");
+	ES_NEW_ASRT(_count(json, "\"name\": \"sync_for_device\", \"ph\": \"B\"") == 1, "No begin");
+	ES_NEW_ASRT(_count(json, "\"name\": \"sync_for_device\", \"ph\": \"E\"") == 1, "No end");
+	ES_NEW_ASRT(_count(json, "\"args\": {\"value\": 7}") == 1, "No instant value");
+	ES_NEW_ASRT(_count(json, "\"args\": {\"name\": \"main\"}") == 1, "No thread name");
+	ES_NEW_ASRT(strcmp(json + strlen(json) - 4, "\n]}\n") == 0, "Unterminated");
+	return 1;
+}
+
+/* Only the newest TR_RING_EVENTS - 1 survive a wrap, in order */
+int test_2_overflow(void)
+{
+	CLEANUP(_cleanup_free) char *json = NULL;
+	const char *first;
+	int n, i;
+	tr_reset();
+	for (i = 0; i < TR_RING_EVENTS + 100; i++) {
+		TR_INSTANT("tick", i);
+	}
+	ES_NEW_ASRT_NM(json = _dump(&n));
+	ES_NEW_ASRT(n == TR_RING_EVENTS - 1, "Dumped %d events", n);
+	ES_NEW_ASRT(!strstr(json, "\"value\": 100}"), "Kept the slot the writer fills next");
+	first = strstr(json, "\"value\": ");
+	ES_NEW_ASRT(first && atoi(first + 9) == 101, "Oldest event is not the 101st");
+	return 1;
+}
+
+static void *_writer(void *arg)
+{
+	int i;
+	tr_thread_name(arg);
+	for (i = 0; i < N_EVENTS; i++) {
+		TR_BEGIN("work");
+		TR_END("work");
+	}
+	return NULL;
+}
+
+/* Every thread has its own ring, dumping while they record is safe */
+int test_3_threads(void)
+{
+	static char names[N_THREADS][16];
+	CLEAN_FILE FILE *sink             = fopen("/dev/null", "w");
+	CLEANUP(_cleanup_free) char *json = NULL;
+	pthread_t threads[N_THREADS];
+	int n, i;
+	ES_NEW_ASRT_NM(sink);
+	tr_reset();
+	for (i = 0; i < N_THREADS; i++) {
+		snprintf(names[i], sizeof(names[i]), "writer %d", i);
+		ES_NEW_ASRT_NM(pthread_create(&threads[i], NULL, _writer, names[i]) == 0);
+	}
+	for (i = 0; i < 20; i++) {
+		ES_FWD_INT_NM(tr_dump_chrome(sink));
+	}
+	for (i = 0; i < N_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	ES_NEW_ASRT_NM(json = _dump(&n));
+	ES_NEW_ASRT(n == N_THREADS * MIN(2 * N_EVENTS, TR_RING_EVENTS - 1),
+	            "Dumped %d events of %d threads",
+	            n,
+	            N_THREADS);
+	for (i = 0; i < N_THREADS; i++) {
+		char name[96];
+		snprintf(name, sizeof(name), "{\"name\": \"%s\"}", names[i]);
+		ES_NEW_ASRT(_count(json, name) == 1, "No ring of %s", names[i]);
+	}
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_events,
+    test_2_overflow,
+    test_3_threads,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "errstack.h"
+#include "test_utils.h"
+#include "util.h"
+#include "waiter.h"
+
+typedef struct _delay_s
+{
+	uint64_t until_ns;
+	uint32_t n_blocks;
+} _delay_t;
+
+static uint64_t _now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static bool _expired(void *arg)
+{
+	return _now_ns() >= ((_delay_t *) arg)->until_ns;
+}
+
+static int _block(void *arg, int ms)
+{
+	const struct timespec nap = {.tv_nsec = MIN(ms, 1) * 1000000};
+	((_delay_t *) arg)->n_blocks++;
+	nanosleep(&nap, NULL);
+	return 0;
+}
+
+/* Wait for a condition that becomes true delay_ns from now */
+static int _wait_for(wt_st *wt, uint64_t delay_ns, _delay_t *delay)
+{
+	delay->until_ns = _now_ns() + delay_ns;
+	return wt_wait(wt, _expired, _block, delay);
+}
+
+int test_1_hist_quantiles(void)
+{
+	wt_hist_t hist = {0};
+	uint64_t p50, p99;
+	size_t i;
+	for (i = 1; i <= 1000; i++) {
+		wt_hist_add(&hist, i * 100);
+	}
+	p50 = wt_hist_quantile(&hist, 0.5);
+	p99 = wt_hist_quantile(&hist, 0.99);
+	/* Buckets are a quarter octave wide, so estimates stay within ~20% */
+	ES_NEW_ASRT(p50 >= 40000 && p50 <= 60000, "p50 %llu", (unsigned long long) p50);
+	ES_NEW_ASRT(p99 >= 80000 && p99 <= 100000, "p99 %llu", (unsigned long long) p99);
+	ES_NEW_ASRT(wt_hist_quantile(&hist, 1) == 100000, "max not kept");
+	ES_NEW_ASRT(wt_hist_cdf(&hist, 100000) == 1, "cdf at max");
+	ES_NEW_ASRT(wt_hist_cdf(&hist, 0) == 0, "cdf below min");
+	for (i = 0; i < 4; i++) {
+		wt_hist_add(&hist, 0);
+	}
+	ES_NEW_ASRT(wt_hist_quantile(&hist, 0.001) == 0, "zero samples lost");
+	return 1;
+}
+
+int test_2_learns_spin_window(void)
+{
+	wt_config_t cfg = WT_CONFIG_DEFAULT;
+	_delay_t delay  = {0};
+	wt_stats_t stats;
+	wt_st wt;
+	size_t i;
+	cfg.recalibrate_every = 16;
+	wt_init(&wt, &cfg);
+
+	/* Short waits: the window should settle around them */
+	for (i = 0; i < 32; i++) {
+		ES_FWD_INT_NM(_wait_for(&wt, 5000, &delay));
+	}
+	wt_get_stats(&wt, &stats);
+	ES_NEW_ASRT(stats.spin_ns > 0 && stats.spin_ns <= cfg.max_spin_ns,
+	            "Spin window %llu for short waits",
+	            (unsigned long long) stats.spin_ns);
+	ES_NEW_ASRT(stats.n_phase[WT_PHASE_SPIN] > 16, "Short waits did not end spinning");
+
+	/* Long waits: spinning would only burn the core */
+	wt_init(&wt, &cfg);
+	for (i = 0; i < 16; i++) {
+		ES_FWD_INT_NM(_wait_for(&wt, 400000, &delay));
+	}
+	wt_get_stats(&wt, &stats);
+	ES_NEW_ASRT(stats.spin_ns == 0,
+	            "Spin window %llu for long waits",
+	            (unsigned long long) stats.spin_ns);
+	ES_NEW_ASRT(stats.count == 16, "Counted %llu waits", (unsigned long long) stats.count);
+	return 1;
+}
+
+int test_3_block_fallback(void)
+{
+	wt_config_t cfg = WT_CONFIG_DEFAULT;
+	_delay_t delay  = {0};
+	wt_st wt;
+	cfg.block_after_ns = 1000000;
+	wt_init(&wt, &cfg);
+	ES_NEW_ASRT(_wait_for(&wt, 5000000, &delay) == WT_PHASE_BLOCK, "Wait did not block");
+	ES_NEW_ASRT(delay.n_blocks > 0, "Blocking callback unused");
+	delay.n_blocks = 0;
+	ES_NEW_ASRT(_wait_for(&wt, 0, &delay) == WT_PHASE_SPIN, "Ready condition did not return");
+	ES_NEW_ASRT(delay.n_blocks == 0, "Blocked on a ready condition");
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_hist_quantiles,
+    test_2_learns_spin_window,
+    test_3_block_fallback,
+};
+
+TESTER_MAIN(tests);
@@ -0,0 +1,205 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "device.h"
+#include "dma_arena.h"
+#include "errstack.h"
+#include "gemm.h"
+#include "test_utils.h"
+#include "util.h"
+#include "weight_file.h"
+
+enum
+{
+	K = 45,
+	N = 37,
+	M = 19,
+};
+
+static int8_t _weights[K * N];
+static int32_t _bias[N];
+static float _scales[N];
+static int32_t _zero_points[N];
+
+static void _fill(int8_t *dst, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++) {
+		dst[i] = (int8_t) (rand() & 0xff);
+	}
+}
+
+/* Two tensors, the second one per-tensor and without bias or zero points */
+static int _write(char *path)
+{
+	CLEAN_FD int fd       = -1;
+	const wf_src_t src[2] = {
+	    {
+	        .name        = "fc1",
+	        .rank        = 2,
+	        .shape       = {N, K},
+	        .weights     = _weights,
+	        .k           = K,
+	        .n           = N,
+	        .bias        = _bias,
+	        .scales      = _scales,
+	        .zero_points = _zero_points,
+	        .n_quant     = N,
+	    },
+	    {
+	        .name    = "fc2",
+	        .rank    = 2,
+	        .shape   = {3, 5},
+	        .weights = _weights,
+	        .k       = 5,
+	        .n       = 3,
+	        .scales  = _scales,
+	        .n_quant = 1,
+	    },
+	};
+	size_t i;
+	srand(16);
+	_fill(_weights, ARRAY_SIZE(_weights));
+	for (i = 0; i < N; i++) {
+		_bias[i]        = rand() % 2001 - 1000;
+		_scales[i]      = 0.001f * (i + 1);
+		_zero_points[i] = i % 5;
+	}
+	strcpy(path, "/tmp/test_weight_file_XXXXXX");
+	ES_NEW_INT_ERRNO(fd = mkstemp(path));
+	ES_FWD_INT_NM(wf_write(path, src, ARRAY_SIZE(src)));
+	return 0;
+}
+
+static void _cleanup_free(void *p)
+{
+	free(*(void **) p);
+}
+
+/* Overwrite the file with a corrupted copy, keeping at most size bytes */
+static int _corrupt(const char *path, size_t size, size_t at, uint8_t value)
+{
+	CLEANUP(cleanup_file) FILE *f       = NULL;
+	CLEANUP(_cleanup_free) uint8_t *buf = NULL;
+	struct stat st;
+	size_t n;
+	ES_NEW_ASRT_ERRNO(f = fopen(path, "rb"));
+	ES_NEW_INT_ERRNO(fstat(fileno(f), &st));
+	ES_NEW_ASRT_NM(buf = malloc(MAX((size_t) st.st_size, (size_t) 1)));
+	n = fread(buf, 1, st.st_size, f);
+	ES_NEW_ASRT(n == (size_t) st.st_size, "Read %zu of %zu bytes", n, (size_t) st.st_size);
+	cleanup_file(&f);
+	n = MIN(n, size);
+	if (at < n) {
+		buf[at] = value;
+	}
+	ES_NEW_ASRT_ERRNO(f = fopen(path, "wb"));
+	ES_NEW_ASRT_ERRNO(fwrite(buf, 1, n, f) == n);
+	return 0;
+}
+
+int test_1_metadata(void)
+{
+	WF_CLEANUP wf_st *wf = NULL;
+	const wf_tensor_t *t;
+	char path[64];
+	size_t i, j;
+	ES_FWD_INT_NM(_write(path));
+	ES_FWD_INT_NM(wf_open(&wf, path));
+	unlink(path);
+	ES_NEW_ASRT(wf_count(wf) == 2, "Expected 2 tensors, got %zu", wf_count(wf));
+	ES_NEW_ASRT(wf_find(wf, "fc2") == 1 && wf_find(wf, "fc3") < 0, "Lookup by name");
+	t = wf_tensor(wf, 0);
+	ES_NEW_ASRT(t->k == K && t->n == N && t->n_quant == N && t->shape[0] == N, "fc1 shape");
+	ES_NEW_ASRT(memcmp(wf_bias(wf, t), _bias, sizeof(_bias)) == 0, "fc1 bias");
+	ES_NEW_ASRT(memcmp(wf_scales(wf, t), _scales, sizeof(_scales)) == 0, "fc1 scales");
+	ES_NEW_ASRT(memcmp(wf_zero_points(wf, t), _zero_points, sizeof(_zero_points)) == 0,
+	            "fc1 zero points");
+	ES_NEW_ASRT((uintptr_t) wf_tiles(wf, t) % WF_ALIGN == 0, "fc1 tiles are not aligned");
+	for (j = 0; j < N; j++) {
+		int32_t sum = 0;
+		for (i = 0; i < K; i++) {
+			sum += _weights[i * N + j];
+		}
+		ES_NEW_ASRT(wf_sums(wf, t)[j] == sum, "fc1 sum of channel %zu", j);
+	}
+	t = wf_tensor(wf, 1);
+	ES_NEW_ASRT(!wf_bias(wf, t) && !wf_zero_points(wf, t) && wf_scales(wf, t)[0] == _scales[0],
+	            "fc2 optional blobs");
+	return 1;
+}
+
+int test_2_pretiled_gemm(void)
+{
+	WF_CLEANUP wf_st *wf    = NULL;
+	DEV_CLEANUP dev_st *dev = NULL;
+	int32_t expected[M * N], actual[M * N];
+	int8_t a[M * K];
+	da_span_t whole, weights;
+	size_t staging, load;
+	char path[64];
+	ES_FWD_INT_NM(_write(path));
+	ES_FWD_INT_NM(wf_open(&wf, path));
+	unlink(path);
+	_fill(a, ARRAY_SIZE(a));
+	gemm_s8_ref(expected, a, _weights, M, K, N);
+	ES_FWD_INT_NM(dev_emu_open(&dev, 1 << 16, 0));
+	/* Resident weights go after the staging slots */
+	whole   = da_span_of_dev(dev);
+	staging = gemm_staging_size(dev, GEMM_PIPELINE_DEPTH);
+	weights = (da_span_t){
+	    .virt   = (uint8_t *) whole.virt + staging,
+	    .phys   = whole.phys + staging,
+	    .offset = whole.offset + staging,
+	    .size   = whole.size - staging,
+	};
+	for (load = 0; load < 2; load++) {
+		const wf_tensor_t *t = wf_tensor(wf, 0);
+		memset(weights.virt, 0, wf_data_size(wf));
+		memset(actual, 0, sizeof(actual));
+		if (load == 0) {
+			ES_FWD_INT_NM(wf_load(wf, dev, &weights));
+		} else {
+			ES_FWD_INT_NM(wf_load_read(wf, dev, &weights));
+		}
+		ES_FWD_INT_NM(
+		    gemm_s8_pretiled(dev, actual, a, wf_tiles_phys(t, &weights), M, K, N, NULL, NULL));
+		ES_NEW_ASRT(memcmp(expected, actual, sizeof(actual)) == 0, "Mismatch with load %zu", load);
+	}
+	weights.size = wf_data_size(wf) - 1;
+	ES_NEW_ASRT(wf_load(wf, dev, &weights) < 0, "Loaded into a region that is too small");
+	return 1;
+}
+
+int test_3_reject_corrupt(void)
+{
+	WF_CLEANUP wf_st *wf = NULL;
+	char path[64];
+	ES_FWD_INT_NM(_write(path));
+	ES_FWD_INT_NM(_corrupt(path, SIZE_MAX, 0, 0));
+	ES_NEW_ASRT(wf_open(&wf, path) < 0, "Opened a file with a bad magic");
+	unlink(path);
+	ES_FWD_INT_NM(_write(path));
+	ES_FWD_INT_NM(_corrupt(path, sizeof(wf_header_t) + sizeof(wf_tensor_t), SIZE_MAX, 0));
+	ES_NEW_ASRT(wf_open(&wf, path) < 0, "Opened a truncated file");
+	unlink(path);
+	ES_FWD_INT_NM(_write(path));
+	/* Tiles offset of the first tensor points outside of the data section */
+	ES_FWD_INT_NM(
+	    _corrupt(path, SIZE_MAX, sizeof(wf_header_t) + offsetof(wf_tensor_t, tiles_offset) + 3, 1));
+	ES_NEW_ASRT(wf_open(&wf, path) < 0, "Opened a file with a bad tiles offset");
+	unlink(path);
+	return 1;
+}
+
+static test_function tests[] = {
+    test_1_metadata,
+    test_2_pretiled_gemm,
+    test_3_reject_corrupt,
+};
+
+TESTER_MAIN(tests);